@@ -0,0 +1,816 @@
+#include "../../source/xfile.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+//==============================================================================
+//  XFILE BENCHMARK
+//==============================================================================
+//  Throughput and latency of the streams on every registered device: binary and text
+//  modes, sync and async ('@') files, transfer sizes from 1 byte to 64 MB, sequential
+//  and random access, small typed Write<T>/Read<T> storms, getC/ReadString loops,
+//  ToFile copies between the devices and several threads opening and closing files
+//  (instance pools and handle cache). The results go out as JSON so the runs of two
+//  versions can be compared, the progress goes to stderr.
+//
+//      xfile_benchmark [--out FILE] [--max-size BYTES] [--budget BYTES] [--quick]
+//
+//      --out FILE          Writes the JSON to FILE (an xfile path) instead of stdout
+//      --max-size BYTES    Biggest transfer size, 64 MB by default
+//      --budget BYTES      Bytes moved by each case, 128 MB by default (small sizes stop at max_ops_v)
+//      --quick             Same as --max-size 1048576 --budget 8388608
+//==============================================================================
+namespace xfile::benchmark
+{
+    using clock = std::chrono::steady_clock;
+
+    constexpr static std::size_t max_ops_v          = 1024 * 1024;     // Operations of a case at most
+    constexpr static std::size_t queue_depth_v      = 8;               // Async requests in flight
+    constexpr static std::size_t open_files_v       = 64;              // Files used by the open/close case
+    constexpr static std::size_t open_close_ops_v   = 4096;            // Opens of each thread
+    constexpr static std::size_t line_length_v      = 64;              // Text files get a '\n' every line_length_v characters
+    constexpr static std::size_t min_threads_v      = 4;               // Threads of the multi threaded cases, at least
+
+    //------------------------------------------------------------------------------
+
+    struct options
+    {
+        std::wstring                    m_OutFile       {};
+        std::size_t                     m_MaxSize       { 64 * 1024 * 1024 };
+        std::size_t                     m_Budget        { 128 * 1024 * 1024 };
+    };
+
+    //------------------------------------------------------------------------------
+    // A registered device and where its files go
+    //------------------------------------------------------------------------------
+    struct target
+    {
+        device::registration*           m_pDeviceReg    { nullptr };
+        std::wstring                    m_Path          {};             // Prefix of the file names
+    };
+
+    //------------------------------------------------------------------------------
+
+    struct result
+    {
+        std::string                     m_Suite         {};
+        std::string                     m_Device        {};
+        std::string                     m_Mode          {};
+        std::size_t                     m_Size          { 0 };          // Bytes per operation
+        std::size_t                     m_nThreads      { 1 };
+        std::uint64_t                   m_nOps          { 0 };
+        std::uint64_t                   m_Bytes         { 0 };
+        double                          m_Seconds       { 0 };
+        std::vector<std::uint64_t>      m_LatencyNs     {};             // Per operation, only for the cases that measure it
+        std::string                     m_Error         {};
+    };
+
+    //------------------------------------------------------------------------------
+
+    inline std::size_t getThreadCount( void ) noexcept
+    {
+        return std::max<std::size_t>(min_threads_v, std::thread::hardware_concurrency());
+    }
+
+    //------------------------------------------------------------------------------
+
+    inline double getSeconds( clock::time_point Start ) noexcept
+    {
+        return std::chrono::duration<double>(clock::now() - Start).count();
+    }
+
+    //------------------------------------------------------------------------------
+
+    inline std::uint64_t getNs( clock::time_point Start ) noexcept
+    {
+        return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - Start).count());
+    }
+
+    //------------------------------------------------------------------------------
+    // Async requests report state::INCOMPLETE until they are synchronized
+    //------------------------------------------------------------------------------
+
+    inline xerr SkipIncomplete( xerr Err ) noexcept
+    {
+        if (Err && Err.getState<state>() == state::INCOMPLETE) Err.clear();
+        return Err;
+    }
+
+    //------------------------------------------------------------------------------
+    // Text with a '\n' at the end of each line (the stream adds the '\r' in text modes)
+    //------------------------------------------------------------------------------
+
+    template< typename T_CHAR >
+    std::vector<T_CHAR> MakeText( std::size_t Count ) noexcept
+    {
+        std::vector<T_CHAR> Text( Count );
+        for (std::size_t i = 0; i < Count; ++i)
+            Text[i] = (i % line_length_v) == line_length_v - 1 ? T_CHAR('\n') : static_cast<T_CHAR>('a' + i % 26);
+        return Text;
+    }
+
+    //------------------------------------------------------------------------------
+
+    class runner
+    {
+    public:
+
+        runner( const options& Options ) noexcept
+            : m_Options{ Options }
+        {
+            // The disk device goes to the temp folder, the rest to the root of their first name
+            auto* pTempDevice = getDevice(L"temp:/");
+            for (auto pReg = device::registration::s_pHead; pReg; pReg = pReg->m_pNext)
+            {
+                target Target{ pReg };
+                if (pReg->m_pDevice == pTempDevice)
+                {
+                    Target.m_Path = L"temp:/xfile_bench_";
+                }
+                else
+                {
+                    for (const char* p = pReg->m_pNames; *p && *p != ':'; ++p) Target.m_Path.push_back(static_cast<wchar_t>(*p));
+                    Target.m_Path += L":/xfile_bench_";
+                }
+                m_Targets.push_back(std::move(Target));
+            }
+
+            // Powers of 16 and the biggest size
+            for (std::size_t Size = 1; Size <= m_Options.m_MaxSize; Size *= 16)
+                m_Sizes.push_back(Size);
+            if (m_Sizes.back() != m_Options.m_MaxSize)
+                m_Sizes.push_back(m_Options.m_MaxSize);
+        }
+
+        //------------------------------------------------------------------------------
+
+        void Run( void ) noexcept
+        {
+            for (auto& Target : m_Targets)
+            {
+                std::fprintf(stderr, "%s\n", Target.m_pDeviceReg->m_pTitle);
+
+                for (const char* pMode : { "b", "b@", "t", "T" })
+                {
+                    for (auto Size : m_Sizes)
+                        Sequential(Target, pMode, Size);
+                }
+
+                for (std::size_t Size : { 512, 4096, 64 * 1024 })
+                {
+                    RandomRead(Target, "b", Size);
+                    RandomRead(Target, "b@", Size);
+                    RandomReadAt(Target, Size, 1);
+                    RandomReadAt(Target, Size, getThreadCount());
+                }
+
+                TypedStorm<std::uint8_t>(Target, "u8");
+                TypedStorm<std::uint32_t>(Target, "u32");
+                TypedStorm<double>(Target, "f64");
+                GetCLoop(Target, "b");
+                GetCLoop(Target, "t");
+                ReadStringLoop(Target);
+
+                for (auto& Dest : m_Targets)
+                    ToFileCopy(Target, Dest);
+
+                for (bool bCache : { false, true })
+                {
+                    OpenClose(Target, 1, bCache);
+                    OpenClose(Target, getThreadCount(), bCache);
+                }
+            }
+        }
+
+        //------------------------------------------------------------------------------
+
+        xerr WriteJson( void ) const noexcept
+        {
+            std::string Json = std::format("{{\n\"benchmark\":\"xfile\",\n\"max_size\":{},\n\"budget\":{},\n\"hardware_threads\":{},\n\"xfile_stats\":{},\n\"results\":["
+                                          , m_Options.m_MaxSize, m_Options.m_Budget, std::thread::hardware_concurrency(), XFILE_STATS );
+
+            for (std::size_t i = 0; i < m_Results.size(); ++i)
+            {
+                const auto& Result  = m_Results[i];
+                const auto  Seconds = std::max(Result.m_Seconds, 1e-9);
+
+                Json += std::format("{}\n{{\"suite\":\"{}\",\"device\":\"{}\",\"mode\":\"{}\",\"size\":{},\"threads\":{},\"ops\":{},\"bytes\":{},\"seconds\":{},\"mb_per_s\":{},\"ns_per_op\":{}"
+                                   , i ? "," : ""
+                                   , Result.m_Suite, Result.m_Device, Result.m_Mode, Result.m_Size, Result.m_nThreads
+                                   , Result.m_nOps, Result.m_Bytes, Result.m_Seconds
+                                   , static_cast<double>(Result.m_Bytes) / Seconds / (1024.0 * 1024.0)
+                                   , Result.m_nOps ? Result.m_Seconds * 1e9 / static_cast<double>(Result.m_nOps) : 0.0 );
+
+                if (Result.m_LatencyNs.empty() == false)
+                {
+                    const auto& L = Result.m_LatencyNs;
+                    Json += std::format(",\"p50_ns\":{},\"p99_ns\":{},\"max_ns\":{}", L[L.size() / 2], L[L.size() * 99 / 100], L.back());
+                }
+
+                // Error messages are plain text, the quotes are the only thing that could break the JSON
+                std::string Error = Result.m_Error;
+                std::replace(Error.begin(), Error.end(), '"', '\'');
+                Json += std::format(",\"error\":\"{}\"}}", Error);
+            }
+            Json += "\n]\n}\n";
+
+            if (m_Options.m_OutFile.empty())
+            {
+                std::fwrite(Json.data(), 1, Json.size(), stdout);
+                return {};
+            }
+
+            stream File;
+            if (auto Err = File.open(m_Options.m_OutFile, "w"); Err)
+                return Err;
+
+            return File.WriteSpan(std::span{ Json.data(), Json.size() });
+        }
+
+    protected:
+
+        //------------------------------------------------------------------------------
+
+        result& Begin( const char* pSuite, const target& Target, std::string Mode, std::size_t Size, std::size_t nThreads = 1 ) noexcept
+        {
+            auto& Result        = m_Results.emplace_back();
+            Result.m_Suite      = pSuite;
+            Result.m_Device     = Target.m_pDeviceReg->m_pTitle;
+            Result.m_Mode       = std::move(Mode);
+            Result.m_Size       = Size;
+            Result.m_nThreads   = nThreads;
+            return Result;
+        }
+
+        //------------------------------------------------------------------------------
+        // Keeps the error of the case, the benchmark goes on
+        //------------------------------------------------------------------------------
+
+        static void Fail( result& Result, xerr& Err ) noexcept
+        {
+            Result.m_Error = Err.getMessage();
+            Err.clear();
+            std::fprintf(stderr, "    %s %s %s %zu: %s\n", Result.m_Suite.c_str(), Result.m_Device.c_str(), Result.m_Mode.c_str(), Result.m_Size, Result.m_Error.c_str());
+        }
+
+        //------------------------------------------------------------------------------
+
+        static void Finish( result& Result ) noexcept
+        {
+            std::sort(Result.m_LatencyNs.begin(), Result.m_LatencyNs.end());
+        }
+
+        //------------------------------------------------------------------------------
+
+        std::size_t getOpCount( std::size_t Size ) const noexcept
+        {
+            return std::clamp<std::size_t>(m_Options.m_Budget / Size, 1, max_ops_v);
+        }
+
+        //------------------------------------------------------------------------------
+        // Writes a file of Bytes bytes for the read cases
+        //------------------------------------------------------------------------------
+
+        static xerr MakeFile( const std::wstring& FileName, std::size_t Bytes, const char* pMode = "w" ) noexcept
+        {
+            stream File;
+            if (auto Err = File.open(FileName, pMode); Err)
+                return Err;
+
+            const auto Text = MakeText<char>(std::min<std::size_t>(Bytes, 1024 * 1024));
+            for (std::size_t Done = 0; Done < Bytes; )
+            {
+                const auto Count = std::min(Text.size(), Bytes - Done);
+                if (auto Err = File.WriteSpan(std::span{ Text.data(), Count }); Err)
+                    return Err;
+                Done += Count;
+            }
+            return {};
+        }
+
+        //------------------------------------------------------------------------------
+        // Count records of Size bytes written and then read one after the other
+        //------------------------------------------------------------------------------
+
+        void Sequential( const target& Target, const char* pMode, std::size_t Size ) noexcept
+        {
+            const bool bWide  = pMode[0] == 'T';
+            const bool bAsync = std::strchr(pMode, '@') != nullptr;
+            if (bWide && Size < sizeof(wchar_t)) return;
+
+            const auto Count    = getOpCount(Size);
+            const auto FileName = Target.m_Path + L"sequential.dat";
+
+            auto& Write = Begin("write_seq", Target, pMode, Size);
+            if (auto Err = bWide ? SequentialPass<wchar_t, true>(FileName, pMode, Size, Count, bAsync, Write)
+                                 : SequentialPass<char,    true>(FileName, pMode, Size, Count, bAsync, Write); Err)
+            {
+                Fail(Write, Err);
+                (void)deleteFile(FileName);
+                return;
+            }
+
+            auto& Read = Begin("read_seq", Target, pMode, Size);
+            if (auto Err = bWide ? SequentialPass<wchar_t, false>(FileName, pMode, Size, Count, bAsync, Read)
+                                 : SequentialPass<char,    false>(FileName, pMode, Size, Count, bAsync, Read); Err)
+                Fail(Read, Err);
+
+            if (auto Err = deleteFile(FileName); Err) Err.clear();
+        }
+
+        //------------------------------------------------------------------------------
+        // Async files keep queue_depth_v requests in flight, each one with its own piece of the buffer
+        //------------------------------------------------------------------------------
+
+        template< typename T_CHAR, bool T_WRITE_V >
+        static xerr SequentialPass( const std::wstring& FileName, const char* pMode, std::size_t Size, std::size_t Count, bool bAsync, result& Result ) noexcept
+        {
+            const auto  nChars  = Size / sizeof(T_CHAR);
+            const auto  nSlots  = bAsync ? std::min(queue_depth_v, Count) : 1;
+            auto        Buffer  = MakeText<T_CHAR>(nChars * nSlots);
+
+            stream File;
+            if (auto Err = File.open(FileName, (std::string(T_WRITE_V ? "w" : "r") + pMode).c_str()); Err)
+                return Err;
+
+            const auto Start = clock::now();
+            for (std::size_t i = 0; i < Count; ++i)
+            {
+                const auto Slot = std::span{ Buffer.data() + (i % nSlots) * nChars, nChars };
+                if (auto Err = SkipIncomplete(T_WRITE_V ? File.WriteSpan(Slot) : File.ReadSpan(Slot)); Err)
+                    return Err;
+
+                // Every slot is in use, wait for them before reusing the first one
+                if (bAsync && (i + 1) % nSlots == 0)
+                {
+                    if (auto Err = File.Synchronize(true); Err)
+                        return Err;
+                }
+            }
+
+            if (bAsync)
+            {
+                if (auto Err = File.Synchronize(true); Err)
+                    return Err;
+            }
+
+            if constexpr (T_WRITE_V) File.Flush();
+            File.close();
+
+            Result.m_Seconds = getSeconds(Start);
+            Result.m_nOps    = Count;
+            Result.m_Bytes   = Count * nChars * sizeof(T_CHAR);
+            return {};
+        }
+
+        //------------------------------------------------------------------------------
+        // Seek + read at random offsets (aligned to Size), the sync ones measure each read
+        //------------------------------------------------------------------------------
+
+        void RandomRead( const target& Target, const char* pMode, std::size_t Size ) noexcept
+        {
+            const bool bAsync   = std::strchr(pMode, '@') != nullptr;
+            const auto FileName = Target.m_Path + L"random.dat";
+            const auto nBlocks  = std::max<std::size_t>(1, std::min<std::size_t>(m_Options.m_Budget, 64 * 1024 * 1024) / Size);
+            const auto Count    = std::min<std::size_t>(getOpCount(Size), 16 * 1024);
+
+            auto& Result = Begin("read_random", Target, pMode, Size);
+            auto  Run    = [&]() -> xerr
+            {
+                if (auto Err = MakeFile(FileName, nBlocks * Size); Err)
+                    return Err;
+
+                stream File;
+                if (auto Err = File.open(FileName, (std::string("r") + pMode).c_str()); Err)
+                    return Err;
+
+                std::mt19937_64             Random{ 1234 };
+                std::vector<std::byte>      Buffer(Size * queue_depth_v);
+                std::vector<async_ticket>   Tickets(queue_depth_v);
+
+                const auto Start = clock::now();
+                for (std::size_t i = 0; i < Count; ++i)
+                {
+                    const auto Offset = (Random() % nBlocks) * Size;
+
+                    if (bAsync)
+                    {
+                        // Each ticket is waited before it is used again
+                        auto& Ticket = Tickets[i % queue_depth_v];
+                        if (auto Err = File.Wait(Ticket); Err)
+                            return Err;
+
+                        if (auto Err = File.ReadAsync(Ticket, { Buffer.data() + (i % queue_depth_v) * Size, Size }, Offset); Err)
+                            return Err;
+                        continue;
+                    }
+
+                    const auto OpStart = clock::now();
+                    if (auto Err = File.SeekOrigin(Offset); Err)
+                        return Err;
+
+                    if (auto Err = File.ReadSpan(std::span{ Buffer.data(), Size }); Err)
+                        return Err;
+                    Result.m_LatencyNs.push_back(getNs(OpStart));
+                }
+
+                for (auto& Ticket : Tickets)
+                {
+                    if (auto Err = File.Wait(Ticket); Err)
+                        return Err;
+                }
+
+                Result.m_Seconds = getSeconds(Start);
+                Result.m_nOps    = Count;
+                Result.m_Bytes   = Count * Size;
+                return {};
+            };
+
+            if (auto Err = Run(); Err) Fail(Result, Err);
+            Finish(Result);
+            if (auto Err = deleteFile(FileName); Err) Err.clear();
+        }
+
+        //------------------------------------------------------------------------------
+        // ReadAt at random offsets from several threads on the same stream
+        //------------------------------------------------------------------------------
+
+        void RandomReadAt( const target& Target, std::size_t Size, std::size_t nThreads ) noexcept
+        {
+            const auto FileName = Target.m_Path + L"random_at.dat";
+            const auto nBlocks  = std::max<std::size_t>(1, std::min<std::size_t>(m_Options.m_Budget, 64 * 1024 * 1024) / Size);
+            const auto Count    = std::min<std::size_t>(getOpCount(Size), 16 * 1024);
+
+            auto& Result = Begin("read_random_at", Target, "b", Size, nThreads);
+            auto  Run    = [&]() -> xerr
+            {
+                if (auto Err = MakeFile(FileName, nBlocks * Size); Err)
+                    return Err;
+
+                stream File;
+                if (auto Err = File.open(FileName, "r"); Err)
+                    return Err;
+
+                std::vector<std::vector<std::uint64_t>> Latencies(nThreads);
+                std::vector<std::string>                Errors(nThreads);
+                std::vector<std::thread>                Threads;
+
+                const auto Start = clock::now();
+                for (std::size_t t = 0; t < nThreads; ++t)
+                {
+                    Threads.emplace_back([&, t]
+                    {
+                        std::mt19937_64         Random{ 1234 + t };
+                        std::vector<std::byte>  Buffer(Size);
+                        for (std::size_t i = t; i < Count; i += nThreads)
+                        {
+                            const auto OpStart = clock::now();
+                            if (auto Err = File.ReadAt((Random() % nBlocks) * Size, Buffer); Err)
+                            {
+                                Errors[t] = Err.getMessage();
+                                Err.clear();
+                                return;
+                            }
+                            Latencies[t].push_back(getNs(OpStart));
+                        }
+                    });
+                }
+                for (auto& Thread : Threads) Thread.join();
+                Result.m_Seconds = getSeconds(Start);
+
+                for (std::size_t t = 0; t < nThreads; ++t)
+                {
+                    if (Errors[t].empty() == false && Result.m_Error.empty()) Result.m_Error = Errors[t];
+                    Result.m_LatencyNs.insert(Result.m_LatencyNs.end(), Latencies[t].begin(), Latencies[t].end());
+                }
+
+                Result.m_nOps  = Result.m_LatencyNs.size();
+                Result.m_Bytes = Result.m_nOps * Size;
+                return {};
+            };
+
+            if (auto Err = Run(); Err) Fail(Result, Err);
+            Finish(Result);
+            if (auto Err = deleteFile(FileName); Err) Err.clear();
+        }
+
+        //------------------------------------------------------------------------------
+        // Lots of tiny Write<T> and then Read<T>, what the stream buffer is for
+        //------------------------------------------------------------------------------
+
+        template< typename T >
+        void TypedStorm( const target& Target, const char* pType ) noexcept
+        {
+            const auto FileName = Target.m_Path + L"typed.dat";
+            const auto Count    = std::min<std::size_t>(m_Options.m_Budget / sizeof(T), 4 * max_ops_v);
+
+            auto& Write = Begin("write_typed", Target, pType, sizeof(T));
+            auto  Run   = [&]( result& Result, bool bWrite ) -> xerr
+            {
+                stream File;
+                if (auto Err = File.open(FileName, bWrite ? "w" : "r"); Err)
+                    return Err;
+
+                const auto Start = clock::now();
+                T Value{};
+                for (std::size_t i = 0; i < Count; ++i)
+                {
+                    if (bWrite)
+                    {
+                        Value = static_cast<T>(i);
+                        if (auto Err = File.Write(Value); Err)
+                            return Err;
+                    }
+                    else if (auto Err = File.Read(Value); Err)
+                        return Err;
+                }
+                File.close();
+
+                Result.m_Seconds = getSeconds(Start);
+                Result.m_nOps    = Count;
+                Result.m_Bytes   = Count * sizeof(T);
+                return {};
+            };
+
+            if (auto Err = Run(Write, true); Err)
+            {
+                Fail(Write, Err);
+            }
+            else
+            {
+                auto& Read = Begin("read_typed", Target, pType, sizeof(T));
+                if (auto Err = Run(Read, false); Err) Fail(Read, Err);
+            }
+
+            if (auto Err = deleteFile(FileName); Err) Err.clear();
+        }
+
+        //------------------------------------------------------------------------------
+        // getC until the end of the file
+        //------------------------------------------------------------------------------
+
+        void GetCLoop( const target& Target, const char* pMode ) noexcept
+        {
+            const auto FileName = Target.m_Path + L"getc.txt";
+            const auto Bytes    = std::min<std::size_t>(m_Options.m_Budget, 16 * 1024 * 1024);
+
+            auto& Result = Begin("getc", Target, pMode, 1);
+            auto  Run    = [&]() -> xerr
+            {
+                if (auto Err = MakeFile(FileName, Bytes, (std::string("w") + pMode).c_str()); Err)
+                    return Err;
+
+                stream File;
+                if (auto Err = File.open(FileName, (std::string("r") + pMode).c_str()); Err)
+                    return Err;
+
+                const auto  Start = clock::now();
+                std::size_t Count = 0;
+                for (int C; ; ++Count)
+                {
+                    if (auto Err = File.getC(C); Err)
+                    {
+                        if (Err.getState<state>() != state::UNEXPECTED_EOF) return Err;
+                        Err.clear();
+                        break;
+                    }
+                }
+
+                Result.m_Seconds = getSeconds(Start);
+                Result.m_nOps    = Count;
+                Result.m_Bytes   = Count;
+                return {};
+            };
+
+            if (auto Err = Run(); Err) Fail(Result, Err);
+            if (auto Err = deleteFile(FileName); Err) Err.clear();
+        }
+
+        //------------------------------------------------------------------------------
+        // Binary strings (null terminated) read back one by one
+        //------------------------------------------------------------------------------
+
+        void ReadStringLoop( const target& Target ) noexcept
+        {
+            constexpr std::string_view string_v = "xfile benchmark string of 40 characters";
+
+            const auto FileName = Target.m_Path + L"strings.dat";
+            const auto Count    = std::min<std::size_t>(m_Options.m_Budget / (string_v.size() + 1), max_ops_v);
+
+            auto& Result = Begin("read_string", Target, "b", string_v.size() + 1);
+            auto  Run    = [&]() -> xerr
+            {
+                {
+                    stream File;
+                    if (auto Err = File.open(FileName, "w"); Err)
+                        return Err;
+
+                    for (std::size_t i = 0; i < Count; ++i)
+                    {
+                        if (auto Err = File.WriteString(string_v); Err)
+                            return Err;
+                    }
+                }
+
+                stream File;
+                if (auto Err = File.open(FileName, "r"); Err)
+                    return Err;
+
+                std::string String;
+                const auto  Start = clock::now();
+                for (std::size_t i = 0; i < Count; ++i)
+                {
+                    String.clear();
+                    if (auto Err = File.ReadString(String); Err)
+                        return Err;
+                }
+
+                Result.m_Seconds = getSeconds(Start);
+                Result.m_nOps    = Count;
+                Result.m_Bytes   = Count * (string_v.size() + 1);
+                return {};
+            };
+
+            if (auto Err = Run(); Err) Fail(Result, Err);
+            if (auto Err = deleteFile(FileName); Err) Err.clear();
+        }
+
+        //------------------------------------------------------------------------------
+
+        void ToFileCopy( const target& Source, const target& Dest ) noexcept
+        {
+            const auto SourceName = Source.m_Path + L"copy_src.dat";
+            const auto DestName   = Dest.m_Path   + L"copy_dst.dat";
+            const auto Bytes      = std::min<std::size_t>(m_Options.m_Budget, 64 * 1024 * 1024);
+
+            auto& Result = Begin("to_file", Source, std::string("to ") + Dest.m_pDeviceReg->m_pTitle, Bytes);
+            auto  Run    = [&]() -> xerr
+            {
+                if (auto Err = MakeFile(SourceName, Bytes); Err)
+                    return Err;
+
+                stream From, To;
+                if (auto Err = From.open(SourceName, "r"); Err)
+                    return Err;
+
+                if (auto Err = To.open(DestName, "w"); Err)
+                    return Err;
+
+                const auto Start = clock::now();
+                if (auto Err = From.ToFile(To); Err)
+                    return Err;
+                To.close();
+
+                Result.m_Seconds = getSeconds(Start);
+                Result.m_nOps    = 1;
+                Result.m_Bytes   = Bytes;
+                return {};
+            };
+
+            if (auto Err = Run(); Err) Fail(Result, Err);
+            if (auto Err = deleteFile(SourceName); Err) Err.clear();
+            if (auto Err = deleteFile(DestName);   Err) Err.clear();
+        }
+
+        //------------------------------------------------------------------------------
+        // Each thread opens one of open_files_v files, reads 4 bytes and closes it
+        //------------------------------------------------------------------------------
+
+        void OpenClose( const target& Target, std::size_t nThreads, bool bHandleCache ) noexcept
+        {
+            auto& Device = *Target.m_pDeviceReg->m_pDevice;
+            if (bHandleCache)
+            {
+                // Devices without OS handles do not have the cache
+                if (auto Err = Device.setHandleCache(2 * open_files_v); Err)
+                {
+                    Err.clear();
+                    return;
+                }
+            }
+
+            auto& Result = Begin("open_close", Target, bHandleCache ? "cache" : "no_cache", 4, nThreads);
+            auto  Run    = [&]() -> xerr
+            {
+                for (std::size_t i = 0; i < open_files_v; ++i)
+                {
+                    if (auto Err = MakeFile(Target.m_Path + L"open" + std::to_wstring(i) + L".dat", 4); Err)
+                        return Err;
+                }
+
+                std::vector<std::vector<std::uint64_t>> Latencies(nThreads);
+                std::vector<std::string>                Errors(nThreads);
+                std::vector<std::thread>                Threads;
+
+                const auto Start = clock::now();
+                for (std::size_t t = 0; t < nThreads; ++t)
+                {
+                    Threads.emplace_back([&, t]
+                    {
+                        std::mt19937_64 Random{ 1234 + t };
+                        std::wstring    FileName;
+                        for (std::size_t i = 0; i < open_close_ops_v; ++i)
+                        {
+                            FileName = Target.m_Path + L"open" + std::to_wstring(Random() % open_files_v) + L".dat";
+
+                            const auto      OpStart = clock::now();
+                            stream          File;
+                            std::uint32_t   Value;
+                            auto            Err     = File.open(FileName, "r");
+                            if (!Err) Err = File.Read(Value);
+                            if (Err)
+                            {
+                                Errors[t] = Err.getMessage();
+                                Err.clear();
+                                return;
+                            }
+                            File.close();
+                            Latencies[t].push_back(getNs(OpStart));
+                        }
+                    });
+                }
+                for (auto& Thread : Threads) Thread.join();
+                Result.m_Seconds = getSeconds(Start);
+
+                for (std::size_t t = 0; t < nThreads; ++t)
+                {
+                    if (Errors[t].empty() == false && Result.m_Error.empty()) Result.m_Error = Errors[t];
+                    Result.m_LatencyNs.insert(Result.m_LatencyNs.end(), Latencies[t].begin(), Latencies[t].end());
+                }
+
+                Result.m_nOps  = Result.m_LatencyNs.size();
+                Result.m_Bytes = Result.m_nOps * 4;
+                return {};
+            };
+
+            if (auto Err = Run(); Err) Fail(Result, Err);
+            Finish(Result);
+
+            if (bHandleCache)
+            {
+                if (auto Err = Device.setHandleCache(0); Err) Err.clear();
+            }
+
+            for (std::size_t i = 0; i < open_files_v; ++i)
+            {
+                if (auto Err = deleteFile(Target.m_Path + L"open" + std::to_wstring(i) + L".dat"); Err) Err.clear();
+            }
+        }
+
+    protected:
+
+        options                         m_Options       {};
+        std::vector<target>             m_Targets       {};
+        std::vector<std::size_t>        m_Sizes         {};
+        std::vector<result>             m_Results       {};
+    };
+}
+
+//------------------------------------------------------------------------------
+
+int main( int argc, char* argv[] )
+{
+    xfile::benchmark::options Options;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string_view Arg = argv[i];
+        const bool             bValue = i + 1 < argc;
+
+        if      (Arg == "--quick")                  { Options.m_MaxSize = 1024 * 1024; Options.m_Budget = 8 * 1024 * 1024; }
+        else if (Arg == "--max-size" && bValue)     Options.m_MaxSize = std::strtoull(argv[++i], nullptr, 10);
+        else if (Arg == "--budget"   && bValue)     Options.m_Budget  = std::strtoull(argv[++i], nullptr, 10);
+        else if (Arg == "--out"      && bValue)     for (const char* p = argv[++i]; *p; ++p) Options.m_OutFile.push_back(static_cast<wchar_t>(static_cast<unsigned char>(*p)));
+        else
+        {
+            std::fprintf(stderr, "usage: xfile_benchmark [--out FILE] [--max-size BYTES] [--budget BYTES] [--quick]\n");
+            return 1;
+        }
+    }
+
+    if (Options.m_MaxSize == 0 || Options.m_Budget == 0)
+    {
+        std::fprintf(stderr, "--max-size and --budget must be bigger than zero\n");
+        return 1;
+    }
+
+    xfile::benchmark::runner Runner{ Options };
+    Runner.Run();
+
+    if (auto Err = Runner.WriteJson(); Err)
+    {
+        std::fprintf(stderr, "Failed to write the results: %s\n", Err.getMessage());
+        Err.clear();
+        return 1;
+    }
+
+    return 0;
+}
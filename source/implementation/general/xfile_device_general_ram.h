@@ -1,122 +1,538 @@
+#include <shared_mutex>
+#include <unordered_map>
+#include <mutex>
+#include <bit>
+#include <new>
+#include <cstring>
+
+#ifndef XFILE_RAM_HUGE_PAGES
+    #define XFILE_RAM_HUGE_PAGES 0
+#endif
+
+#if XFILE_RAM_HUGE_PAGES && !defined(_WIN32)
+    #include <sys/mman.h>
+#endif
+
 namespace xfile::driver::ram
 {
+    //==============================================================================
+    //  EXTENT SLAB
+    //==============================================================================
+    //  slab
+    //      Process wide recycler of the memory used by the ram files. Extents only come
+    //      in a few sizes (powers of two) so each size has its own free list. Freed extents
+    //      stay in the free lists (up to a budget) so other ram files can reuse them
+    //      without going back to the heap.
+    //      Define XFILE_RAM_HUGE_PAGES to 1 to back the big extents with huge pages (linux).
+    //==============================================================================
+    struct slab
+    {
+        constexpr static std::size_t    first_extent_v  = 64 * 1024;            // Size of the first extent of every file
+        constexpr static std::size_t    max_extent_v    = 16 * 1024 * 1024;     // Extents stop growing at this size
+        constexpr static std::size_t    class_count_v   = std::countr_zero(max_extent_v / first_extent_v) + 1;
+        constexpr static std::size_t    budget_v        = 256 * 1024 * 1024;    // Max bytes kept in the free lists
+        constexpr static std::size_t    huge_page_v     = 2 * 1024 * 1024;
+
+        //------------------------------------------------------------------------------
+
+        constexpr static std::size_t getClass( std::size_t Size ) noexcept
+        {
+            return static_cast<std::size_t>(std::countr_zero(Size / first_extent_v));
+        }
+
+        constexpr static std::align_val_t getAlignment( std::size_t Size ) noexcept
+        {
+            return std::align_val_t{ (XFILE_RAM_HUGE_PAGES && Size >= huge_page_v) ? huge_page_v : 64 };
+        }
+
+        //------------------------------------------------------------------------------
+
+        ~slab( void ) noexcept
+        {
+            for (std::size_t i = 0; i < class_count_v; ++i)
+            {
+                for (auto* p : m_FreeList[i]) ::operator delete(p, getAlignment(first_extent_v << i));
+            }
+        }
+
+        //------------------------------------------------------------------------------
+
+        std::byte* Alloc( std::size_t Size ) noexcept
+        {
+            const auto iClass = getClass(Size);
+            {
+                std::lock_guard Lk(m_Lock[iClass]);
+                if (m_FreeList[iClass].empty() == false)
+                {
+                    auto* p = m_FreeList[iClass].back();
+                    m_FreeList[iClass].pop_back();
+                    m_CachedBytes.fetch_sub(Size, std::memory_order_relaxed);
+                    return p;
+                }
+            }
+
+            auto* p = static_cast<std::byte*>(::operator new(Size, getAlignment(Size), std::nothrow));
+
+#if XFILE_RAM_HUGE_PAGES && defined(MADV_HUGEPAGE)
+            if (p && Size >= huge_page_v) ::madvise(p, Size, MADV_HUGEPAGE);
+#endif
+            return p;
+        }
+
+        //------------------------------------------------------------------------------
+
+        void Free( std::byte* p, std::size_t Size ) noexcept
+        {
+            if (p == nullptr) return;
+
+            if (m_CachedBytes.load(std::memory_order_relaxed) + Size <= budget_v)
+            {
+                const auto iClass = getClass(Size);
+                std::lock_guard Lk(m_Lock[iClass]);
+                m_FreeList[iClass].push_back(p);
+                m_CachedBytes.fetch_add(Size, std::memory_order_relaxed);
+                return;
+            }
+
+            ::operator delete(p, getAlignment(Size));
+        }
+
+        std::array<std::mutex, class_count_v>                   m_Lock          {};
+        std::array<std::vector<std::byte*>, class_count_v>      m_FreeList      {};
+        std::atomic<std::size_t>                                m_CachedBytes   { 0 };
+    };
+
+    // Must be defined before the device so that it is destroyed after all the files
+    static slab s_Slab;
+
+    //==============================================================================
+    //  MEMORY FILE DATA
+    //==============================================================================
+    //  file_data
+    //      The actual content of a ram file. It lives in the file system index so it
+    //      survives close(), and it is shared by all the instances that have the file open.
+    //      The data is kept in extents that grow geometrically (64KB, 128KB, ... 16MB, 16MB...)
+    //      so big files need few allocations and the extent of any offset can be computed directly.
+    //      A null extent has never been written and reads as zeros.
+    //==============================================================================
+    struct file_data
+    {
+        constexpr static std::size_t    first_extent_v  = slab::first_extent_v;
+        constexpr static std::size_t    max_extent_v    = slab::max_extent_v;
+        constexpr static std::size_t    growing_count_v = slab::class_count_v - 1;                      // Extents before reaching the max size
+        constexpr static std::uint64_t  growing_size_v  = first_extent_v * ((1ull << growing_count_v) - 1);  // Bytes covered by those extents
+
+        //------------------------------------------------------------------------------
+
+        ~file_data( void ) noexcept
+        {
+            for (std::size_t i = 0; i < m_lExtent.size(); ++i) s_Slab.Free(m_lExtent[i], getExtentSize(i));
+        }
+
+        //------------------------------------------------------------------------------
+
+        constexpr static std::size_t getExtentSize( std::size_t iExtent ) noexcept
+        {
+            return iExtent < growing_count_v ? first_extent_v << iExtent : max_extent_v;
+        }
+
+        //------------------------------------------------------------------------------
+        // Finds which extent holds a file offset, and where in that extent it is
+        //------------------------------------------------------------------------------
+        constexpr static std::pair<std::size_t, std::size_t> Locate( std::uint64_t Offset ) noexcept
+        {
+            if (Offset < growing_size_v)
+            {
+                const auto iExtent = static_cast<std::size_t>(std::bit_width(Offset / first_extent_v + 1) - 1);
+                return { iExtent, static_cast<std::size_t>(Offset - first_extent_v * ((1ull << iExtent) - 1)) };
+            }
+
+            const auto Rest = Offset - growing_size_v;
+            return { growing_count_v + static_cast<std::size_t>(Rest / max_extent_v), static_cast<std::size_t>(Rest % max_extent_v) };
+        }
+
+        //------------------------------------------------------------------------------
+        // Copies out of the file, the caller must hold the lock and make sure the range is inside the file
+        //------------------------------------------------------------------------------
+        void CopyOut( std::uint64_t Offset, std::span<std::byte> View ) const noexcept
+        {
+            auto [iExtent, ExtentOffset] = Locate(Offset);
+            for (std::size_t Done = 0; Done < View.size(); ++iExtent, ExtentOffset = 0)
+            {
+                const auto Count = std::min(View.size() - Done, getExtentSize(iExtent) - ExtentOffset);
+
+                if (iExtent < m_lExtent.size() && m_lExtent[iExtent]) std::memcpy(&View[Done], m_lExtent[iExtent] + ExtentOffset, Count);
+                else                                                  std::memset(&View[Done], 0, Count);
+
+                Done += Count;
+            }
+        }
+
+        //------------------------------------------------------------------------------
+        // Copies into the file allocating extents as needed. The caller must hold the lock exclusively.
+        //------------------------------------------------------------------------------
+        xerr CopyIn( std::uint64_t Offset, std::span<const std::byte> View ) noexcept
+        {
+            auto [iExtent, ExtentOffset] = Locate(Offset);
+            for (std::size_t Done = 0; Done < View.size(); ++iExtent, ExtentOffset = 0)
+            {
+                const auto ExtentSize = getExtentSize(iExtent);
+                const auto Count      = std::min(View.size() - Done, ExtentSize - ExtentOffset);
+
+                if (iExtent >= m_lExtent.size()) m_lExtent.resize(iExtent + 1, nullptr);
+                if (m_lExtent[iExtent] == nullptr)
+                {
+                    m_lExtent[iExtent] = s_Slab.Alloc(ExtentSize);
+                    if (m_lExtent[iExtent] == nullptr)
+                        return xerr::create_f<state, "Out of memory while writing into the ram drive">();
+
+                    // Whatever is not covered by this write must read as zeros (recycled extents are dirty)
+                    std::memset(m_lExtent[iExtent], 0, ExtentOffset);
+                    std::memset(m_lExtent[iExtent] + ExtentOffset + Count, 0, ExtentSize - ExtentOffset - Count);
+                }
+
+                std::memcpy(m_lExtent[iExtent] + ExtentOffset, &View[Done], Count);
+                Done += Count;
+            }
+
+            return {};
+        }
+
+        //------------------------------------------------------------------------------
+        // Zeros a range of the file. Extents fully inside of the range go back to the slab
+        // since a null extent already reads as zeros. The caller must hold the lock exclusively.
+        //------------------------------------------------------------------------------
+        void ZeroRange( std::uint64_t Offset, std::uint64_t Count ) noexcept
+        {
+            auto [iExtent, ExtentOffset] = Locate(Offset);
+            for (std::uint64_t Done = 0; Done < Count && iExtent < m_lExtent.size(); ++iExtent, ExtentOffset = 0)
+            {
+                const auto ExtentSize = getExtentSize(iExtent);
+                const auto n          = static_cast<std::size_t>(std::min<std::uint64_t>(Count - Done, ExtentSize - ExtentOffset));
+
+                if (m_lExtent[iExtent])
+                {
+                    if (n == ExtentSize)
+                    {
+                        s_Slab.Free(m_lExtent[iExtent], ExtentSize);
+                        m_lExtent[iExtent] = nullptr;
+                    }
+                    else
+                    {
+                        std::memset(m_lExtent[iExtent] + ExtentOffset, 0, n);
+                    }
+                }
+
+                Done += n;
+            }
+        }
+
+        std::shared_mutex                       m_Lock          {};     // Readers share it, writers own it
+        std::vector<std::byte*>                 m_lExtent       {};
+        std::int64_t                            m_EOF           { 0 };
+    };
+
+    //==============================================================================
+    //  FILE SYSTEM
+    //==============================================================================
+    //  file_system
+    //      Index of all the ram files keyed by their path. The index is split in shards
+    //      each one with its own lock, so opens from different threads rarely wait on each other.
+    //      Lookups only take the shard lock in shared mode.
+    //==============================================================================
+    struct file_system
+    {
+        constexpr static std::size_t shard_count_v = 32;
+
+        struct hash
+        {
+            using is_transparent = void;
+            std::size_t operator()(std::wstring_view Path) const noexcept { return std::hash<std::wstring_view>{}(Path); }
+        };
+
+        struct shard
+        {
+            std::shared_mutex                                                                       m_Lock  {};
+            std::unordered_map<std::wstring, std::shared_ptr<file_data>, hash, std::equal_to<>>     m_Files {};
+        };
+
+        //------------------------------------------------------------------------------
+        // Removes the device name and makes all the separators the same.
+        // ram:\\Foo\bar and ram:/Foo/bar are the same file.
+        //------------------------------------------------------------------------------
+        static std::wstring_view MakeKey( std::span<wchar_t> Buffer, std::wstring_view Path ) noexcept
+        {
+            if (auto i = Path.find(L':'); i != std::wstring_view::npos) Path.remove_prefix(i + 1);
+            while (Path.empty() == false && (Path.front() == L'/' || Path.front() == L'\\')) Path.remove_prefix(1);
+
+            const auto Length = std::min(Path.size(), Buffer.size());
+            for (std::size_t i = 0; i < Length; ++i)
+            {
+                Buffer[i] = (Path[i] == L'\\') ? L'/' : Path[i];
+            }
+
+            return { Buffer.data(), Length };
+        }
+
+        //------------------------------------------------------------------------------
+
+        shard& getShard( std::wstring_view Key ) noexcept
+        {
+            return m_Shards[hash{}(Key) % shard_count_v];
+        }
+
+        //------------------------------------------------------------------------------
+        // Finds an existing file, returns nullptr if it does not exist
+        //------------------------------------------------------------------------------
+        std::shared_ptr<file_data> Find( std::wstring_view Key ) noexcept
+        {
+            auto&               Shard = getShard(Key);
+            std::shared_lock    Lk(Shard.m_Lock);
+
+            if (auto It = Shard.m_Files.find(Key); It != Shard.m_Files.end())
+                return It->second;
+
+            return {};
+        }
+
+        //------------------------------------------------------------------------------
+        // Creates a new empty file. If one already existed it is replaced, any instance
+        // that still has the old one open keeps reading the old data.
+        //------------------------------------------------------------------------------
+        std::shared_ptr<file_data> Create( std::wstring_view Key ) noexcept
+        {
+            auto                pData = std::make_shared<file_data>();
+            auto&               Shard = getShard(Key);
+            std::unique_lock    Lk(Shard.m_Lock);
+
+            if (auto It = Shard.m_Files.find(Key); It != Shard.m_Files.end()) It->second = pData;
+            else                                                              Shard.m_Files.emplace(Key, pData);
+
+            return pData;
+        }
+
+        //------------------------------------------------------------------------------
+
+        bool Delete( std::wstring_view Key ) noexcept
+        {
+            auto&               Shard = getShard(Key);
+            std::unique_lock    Lk(Shard.m_Lock);
+
+            if (auto It = Shard.m_Files.find(Key); It != Shard.m_Files.end())
+            {
+                Shard.m_Files.erase(It);
+                return true;
+            }
+
+            return false;
+        }
+
+        std::array<shard, shard_count_v>    m_Shards {};
+    };
+
     //==============================================================================
     //  MEMORY FILE CLASS
     //==============================================================================
     //  memfile 
     //      memfile is a class that contains the interface to access the memory files.
-    //      currently, it is implemented as an array of memblock's of the size
-    //      block_size_v
+    //      It keeps its own cursor and a reference to the file data.
     //==============================================================================
     struct memfile : xfile::device::instance
     {
         //------------------------------------------------------------------------------
 
-        xerr open (std::wstring_view FileName, xfile::device::access_types AccessTypes)   noexcept override
+        xerr open (std::wstring_view FileName, xfile::device::access_types AccessTypes)   noexcept override;
+
+        //------------------------------------------------------------------------------
+
+        void close (void) noexcept override
+        {
+            m_pData.reset();
+        }
+
+        //------------------------------------------------------------------------------
+
+        xerr Read (std::span<std::byte> View) noexcept override
+        {
+            std::shared_lock Lk(m_pData->m_Lock);
+
+            if (m_SeekPosition >= m_pData->m_EOF)
+                return xerr::create<state::UNEXPECTED_EOF, "Unexpected End of File">();
+
+            // Copy what we can
+            const auto Count = std::min<std::size_t>(View.size(), static_cast<std::size_t>(m_pData->m_EOF - m_SeekPosition));
+            m_pData->CopyOut(m_SeekPosition, View.subspan(0, Count));
+            m_SeekPosition += Count;
+
+            if (Count != View.size())
+                return xerr::create<state::UNEXPECTED_EOF, "Unexpected End of File">();
+
+            return {};
+        }
+
+        //------------------------------------------------------------------------------
+
+        xerr ReadView (std::span<const std::byte>& View, std::size_t Count) noexcept override
         {
-            // File already open
-            assert(m_EOF == 0);
+            std::shared_lock Lk(m_pData->m_Lock);
+
+            View = {};
+            if (m_SeekPosition + static_cast<std::int64_t>(Count) > m_pData->m_EOF)
+                return xerr::create<state::UNEXPECTED_EOF, "Unexpected End of File">();
+
+            const auto [iExtent, ExtentOffset] = file_data::Locate(m_SeekPosition);
+
+            // We can only lend memory that lives in a single extent
+            if (ExtentOffset + Count > file_data::getExtentSize(iExtent) || iExtent >= m_pData->m_lExtent.size() || m_pData->m_lExtent[iExtent] == nullptr)
+                return xerr::create<state::NOT_SUPPORTED, "The view crosses an extent boundary">();
+
+            View            = { m_pData->m_lExtent[iExtent] + ExtentOffset, Count };
+            m_SeekPosition += Count;
             return {};
         }
 
         //------------------------------------------------------------------------------
 
-        void close (void) noexcept override
+        xerr Write (const std::span<const std::byte> View) noexcept override
         {
-            
+            std::unique_lock Lk(m_pData->m_Lock);
+
+            if (auto Err = m_pData->CopyIn(m_SeekPosition, View); Err)
+                return Err;
+
+            m_SeekPosition += View.size();
+            if (m_pData->m_EOF < m_SeekPosition) m_pData->m_EOF = m_SeekPosition;
+
+            return {};
         }
 
+        //------------------------------------------------------------------------------
+        // The lock of the file data is all it takes, the cursor is not used
         //------------------------------------------------------------------------------
 
-        xerr Read (std::span<std::byte> View) noexcept override
+        xerr ReadAt (std::size_t Offset, std::span<std::byte> View) noexcept override
         {
-            if (m_SeekPosition >= m_EOF)
+            std::shared_lock Lk(m_pData->m_Lock);
+
+            if (static_cast<std::int64_t>(Offset) >= m_pData->m_EOF)
                 return xerr::create<state::UNEXPECTED_EOF, "Unexpected End of File">();
 
-            auto currentBlockIndex  = m_SeekPosition / block_size_v;
-            auto currentBlockOffset = m_SeekPosition % block_size_v;
-            std::uint64_t bufferOffset = 0;
+            const auto Count = std::min<std::size_t>(View.size(), static_cast<std::size_t>(m_pData->m_EOF - static_cast<std::int64_t>(Offset)));
+            m_pData->CopyOut(Offset, View.subspan(0, Count));
+
+            if (Count != View.size())
+                return xerr::create<state::UNEXPECTED_EOF, "Unexpected End of File">();
+
+            return {};
+        }
+
+        //------------------------------------------------------------------------------
+
+        xerr WriteAt (std::size_t Offset, std::span<const std::byte> View) noexcept override
+        {
+            std::unique_lock Lk(m_pData->m_Lock);
+
+            if (auto Err = m_pData->CopyIn(Offset, View); Err)
+                return Err;
+
+            const auto End = static_cast<std::int64_t>(Offset + View.size());
+            if (m_pData->m_EOF < End) m_pData->m_EOF = End;
+
+            return {};
+        }
 
-            assert(currentBlockIndex >= 0 && currentBlockIndex < m_lBlock.size());
+        //------------------------------------------------------------------------------
+        // Memory is never busy so the requests are done right away, at their own offset
+        //------------------------------------------------------------------------------
 
-            while (bufferOffset < View.size())
+        xerr ReadAsync (async_ticket& Ticket, std::span<std::byte> View, std::size_t Offset) noexcept override
+        {
+            Ticket.Begin(*this, View.size());
+
+            std::size_t Count = 0;
             {
-                // Copy data from blocks.
-                View[bufferOffset] = (*m_lBlock[currentBlockIndex])[currentBlockOffset];
-                currentBlockOffset++;
-                bufferOffset++;
-                m_SeekPosition++;
-                if (currentBlockOffset >= block_size_v)
+                std::shared_lock Lk(m_pData->m_Lock);
+                if (static_cast<std::int64_t>(Offset) < m_pData->m_EOF)
                 {
-                    // Since we've completed the current block, increment to next block.
-                    currentBlockIndex++;
-                    currentBlockOffset = 0;
-
-                    if (currentBlockIndex >= m_lBlock.size())
-                        return xerr::create_f<state,"Fail to read all the bytes from the ram drive">();
+                    Count = std::min<std::size_t>(View.size(), static_cast<std::size_t>(m_pData->m_EOF - static_cast<std::int64_t>(Offset)));
+                    m_pData->CopyOut(Offset, View.subspan(0, Count));
                 }
             }
 
+            if (Ticket.Complete(Count == View.size() ? async_ticket::result::OK : async_ticket::result::UNEXPECTED_EOF, Count)) Ticket.RunCallback();
             return {};
         }
 
         //------------------------------------------------------------------------------
 
-        xerr Write (const std::span<const std::byte> View) noexcept override
+        xerr WriteAsync (async_ticket& Ticket, std::span<const std::byte> View, std::size_t Offset) noexcept override
         {
-            // Check current position and size of data being added.
-            const auto NewDataPosition = m_SeekPosition + View.size();
-            if (m_EOF < static_cast<std::int64_t>(NewDataPosition)) m_EOF = NewDataPosition;
+            Ticket.Begin(*this, View.size());
 
-            // If we need to allocate more memory for the blocks, then do so.
-            if (m_EOF >= static_cast<std::int64_t>(m_lBlock.size() * block_size_v))
+            auto Result = async_ticket::result::OK;
             {
-                auto NumBlocksRequired = m_EOF / block_size_v + 1;
-                NumBlocksRequired -= m_lBlock.size();
-
-                // Allocate list of blocks
-                for (int i = 0; i < NumBlocksRequired; i++)
+                std::unique_lock Lk(m_pData->m_Lock);
+                if (auto Err = m_pData->CopyIn(Offset, View); Err)
                 {
-                    m_lBlock.push_back(std::unique_ptr<block>{ new block });
+                    Err.clear();
+                    Result = async_ticket::result::FAILURE;
+                }
+                else
+                {
+                    const auto End = static_cast<std::int64_t>(Offset + View.size());
+                    if (m_pData->m_EOF < End) m_pData->m_EOF = End;
                 }
             }
 
-            auto currentBlockIndex = m_SeekPosition / block_size_v;
-            auto currentBlockOffset = m_SeekPosition % block_size_v;
-            std::uint64_t bufferOffset = 0;
+            if (Ticket.Complete(Result, Result == async_ticket::result::OK ? View.size() : 0)) Ticket.RunCallback();
+            return {};
+        }
 
-            assert(currentBlockIndex >= 0 && currentBlockIndex < m_lBlock.size());
+        //------------------------------------------------------------------------------
+        // Lends the memory from the cursor to the end of its extent. Holes lend a block of zeros.
+        //------------------------------------------------------------------------------
 
-            while (bufferOffset < View.size())
-            {
-                // Copy data into blocks.
-                (*m_lBlock[currentBlockIndex])[currentBlockOffset] = View[bufferOffset];
+        xerr MapView (std::span<const std::byte>& View) noexcept override
+        {
+            static constexpr std::array<std::byte, file_data::first_extent_v> Zeros{};
+            std::shared_lock Lk(m_pData->m_Lock);
 
-                bufferOffset++;
-                currentBlockOffset++;
-                m_SeekPosition++;
+            View = {};
+            if (m_SeekPosition >= m_pData->m_EOF) return {};
 
-                if (currentBlockOffset >= block_size_v)
-                {
-                    // Since we've completed the current block, increment to next block.
-                    currentBlockIndex++;
-                    currentBlockOffset = 0;
-                    assert(currentBlockIndex < m_lBlock.size());
-                }
-            }
+            const auto [iExtent, ExtentOffset] = file_data::Locate(m_SeekPosition);
+            const auto Count = std::min<std::size_t>(file_data::getExtentSize(iExtent) - ExtentOffset, static_cast<std::size_t>(m_pData->m_EOF - m_SeekPosition));
 
+            if (iExtent < m_pData->m_lExtent.size() && m_pData->m_lExtent[iExtent]) View = { m_pData->m_lExtent[iExtent] + ExtentOffset, Count };
+            else                                                                      View = { Zeros.data(), std::min(Count, Zeros.size()) };
             return {};
         }
 
         //------------------------------------------------------------------------------
-        void        SeekOrigin      (std::size_t Offset)    noexcept { m_SeekPosition  = Offset;         assert(m_SeekPosition<=m_EOF && m_SeekPosition >= 0); }
-        void        SeekCurrent     (std::size_t Offset)    noexcept { m_SeekPosition += Offset;         assert(m_SeekPosition<=m_EOF && m_SeekPosition >= 0); }
-        void        SeekEnd         (std::size_t Offset)    noexcept { m_SeekPosition  = m_EOF - Offset; assert(m_SeekPosition<=m_EOF && m_SeekPosition >= 0); }
+
+        xerr WriteZero (std::size_t Count) noexcept override
+        {
+            std::unique_lock Lk(m_pData->m_Lock);
+
+            // Only what is inside of the file needs clearing, beyond it there is nothing
+            m_pData->ZeroRange(m_SeekPosition, Count);
+
+            m_SeekPosition += Count;
+            if (m_pData->m_EOF < m_SeekPosition) m_pData->m_EOF = m_SeekPosition;
+
+            return {};
+        }
+
+        //------------------------------------------------------------------------------
+        void        SeekOrigin      (std::size_t Offset)    noexcept { m_SeekPosition  = Offset;                    assert(m_SeekPosition<=m_pData->m_EOF && m_SeekPosition >= 0); }
+        void        SeekCurrent     (std::size_t Offset)    noexcept { m_SeekPosition += Offset;                    assert(m_SeekPosition<=m_pData->m_EOF && m_SeekPosition >= 0); }
+        void        SeekEnd         (std::size_t Offset)    noexcept { m_SeekPosition  = m_pData->m_EOF - Offset;   assert(m_SeekPosition<=m_pData->m_EOF && m_SeekPosition >= 0); }
 
         //------------------------------------------------------------------------------
 
         xerr Seek(xfile::device::seek_mode Mode, std::size_t Pos) noexcept override
         {
+            std::shared_lock Lk(m_pData->m_Lock);
             assert(Pos >= 0);
             switch (Mode)
             {
@@ -149,7 +565,8 @@ namespace xfile::driver::ram
 
         xerr Length(std::size_t& L) noexcept override
         {
-            L = m_EOF;
+            std::shared_lock Lk(m_pData->m_Lock);
+            L = m_pData->m_EOF;
             return {};
         }
 
@@ -157,7 +574,8 @@ namespace xfile::driver::ram
 
         bool isEOF ( void ) noexcept override
         {
-            return m_SeekPosition > m_EOF;
+            std::shared_lock Lk(m_pData->m_Lock);
+            return m_SeekPosition > m_pData->m_EOF;
         }
 
         //------------------------------------------------------------------------------
@@ -178,126 +596,69 @@ namespace xfile::driver::ram
 
         void clear() noexcept
         {
-            m_lBlock.clear();
+            m_pData.reset();
             m_SeekPosition  = 0;
-            m_EOF           = 0;
-            m_iNext         = {};
         }
 
         //------------------------------------------------------------------------------
 
-        constexpr static std::size_t block_size_v = 1024 * 10;
-        using block = std::array< std::byte, block_size_v >;
-
-        std::vector<std::unique_ptr<block>>     m_lBlock        {};
+        std::shared_ptr<file_data>              m_pData         {};
         std::int64_t                            m_SeekPosition  { 0 };
-        std::int64_t                            m_EOF           { 0 };
-        std::int16_t                            m_iNext         {};
-    };
-
-    //------------------------------------------------------------------------------
-
-    struct next
-    {
-        std::int16_t    m_iNext;
-        std::uint16_t   m_Counter;
     };
 
     //------------------------------------------------------------------------------
 
     struct device final : xfile::device
     {
-        std::array<memfile, 128>    m_FileHPool;
-        std::atomic<next>           m_iEmptyHead = { {0,0} };
+        instance_pool<memfile>      m_FileHPool;
+        file_system                 m_FileSystem;
 
         //------------------------------------------------------------------------------
 
-        inline device(void) noexcept
+        virtual void Init(const void*) noexcept
         {
-            // Initialize the pool of handles
-            for (std::size_t i = 0; i < m_FileHPool.size(); ++i)
-            {
-                m_FileHPool[i].m_iNext = static_cast<std::int16_t>(i + 1);
-            }
-            m_FileHPool[m_FileHPool.size() - 1].m_iNext = static_cast<std::int16_t>(-1);
         }
 
         //------------------------------------------------------------------------------
 
-        virtual void Init(const void*) noexcept
+        virtual xerr deleteFile(std::wstring_view FileName) noexcept
         {
+            std::array<wchar_t, max_length::path_v> Buffer;
+            if (m_FileSystem.Delete(file_system::MakeKey(Buffer, FileName)) == false)
+                return xerr::create<state::OPENING_FILE, "The system cannot find the file specified.">();
+
+            return {};
         }
 
         //------------------------------------------------------------------------------
 
         virtual void Kill(void) noexcept
         {
-            for (auto& E : m_FileHPool)
+            m_FileHPool.ForEachInUse([](auto&)
             {
-                if (E.m_iNext == -2)
-                {
-                    // This should have been freed
-                    assert(false);
-                }
-            }
+                // This should have been freed
+                assert(false);
+            });
         }
 
         //------------------------------------------------------------------------------
 
         virtual instance* createInstance(void) noexcept
         {
-            auto Local = m_iEmptyHead.load(std::memory_order_relaxed);
-            do
-            {
-                assert(Local.m_iNext >= 0);
-
-                auto NewValue = Local;
-
-                NewValue.m_iNext = m_FileHPool[Local.m_iNext].m_iNext;
-                NewValue.m_Counter++;
-
-                if (m_iEmptyHead.compare_exchange_weak(Local, NewValue, std::memory_order_release))
-                {
-                    // Let us mark this entry as is now ours!
-                    m_FileHPool[Local.m_iNext].m_iNext = -2;
-                    break;
-                }
-
-            } while (true);
-
-            // Return the instance
-            return &m_FileHPool[Local.m_iNext];
+            // Returns nullptr when we run out of handles
+            return m_FileHPool.Alloc();
         }
 
         //------------------------------------------------------------------------------
 
         virtual void destroyInstance(instance& Instance) noexcept
         {
-            auto&               SmallFile   = *reinterpret_cast<memfile*>(&Instance);
-            const std::size_t   Index       = static_cast<std::size_t>(&SmallFile - m_FileHPool.data());
-            assert(Index < m_FileHPool.size());
-            assert(SmallFile.m_iNext == -2);
+            auto& SmallFile = static_cast<memfile&>(Instance);
 
             // OK we can officially free everything from our entry
             SmallFile.clear();
 
-            //
-            // Now we must insert it into the free list
-            //
-            auto Local = m_iEmptyHead.load(std::memory_order_relaxed);
-            do
-            {
-                // Add the structure into the chain
-                SmallFile.m_iNext = Local.m_iNext;
-
-                auto NewValue = Local;
-                NewValue.m_iNext = static_cast<std::int16_t>(Index);
-                NewValue.m_Counter++;
-
-                if (m_iEmptyHead.compare_exchange_weak(Local, NewValue, std::memory_order_release))
-                    break;
-
-            } while (true);
+            m_FileHPool.Free(SmallFile);
         }
     };
 
@@ -306,4 +667,30 @@ namespace xfile::driver::ram
     //
     static xfile::driver::ram::device   s_RamDevice;
     static device::registration         s_RamDeviceRegistration("RamDevice", s_RamDevice, "ram:");
+
+    //------------------------------------------------------------------------------
+
+    inline
+    xerr memfile::open(std::wstring_view FileName, xfile::device::access_types AccessTypes) noexcept
+    {
+        // File already open
+        assert(m_pData == nullptr);
+
+        std::array<wchar_t, max_length::path_v> Buffer;
+        const auto                              Key = file_system::MakeKey(Buffer, FileName);
+
+        if (AccessTypes.m_bCreate)
+        {
+            m_pData = s_RamDevice.m_FileSystem.Create(Key);
+        }
+        else
+        {
+            m_pData = s_RamDevice.m_FileSystem.Find(Key);
+            if (m_pData == nullptr)
+                return xerr::create<state::OPENING_FILE, "The system cannot find the file specified.">();
+        }
+
+        m_SeekPosition = 0;
+        return {};
+    }
 }
\ No newline at end of file
@@ -0,0 +1,352 @@
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+namespace xfile::driver::async
+{
+    //==============================================================================
+    //  ASYNC LAYER
+    //==============================================================================
+    //  Gives real async files ('@' mode) to the devices that can only do one blocking
+    //  operation at a time (the ram device, posix files without io_uring, compressed
+    //  files, etc). The stream adds it when the instance below says it is not async.
+    //
+    //  Read/Write queue the request at the cursor and return state::INCOMPLETE right
+    //  away, the same goes for the tickets of ReadAsync/WriteAsync. The IO thread pool
+    //  runs them on the instance below, with their own offset so the cursor of the
+    //  instance below is never used. A file has at most one job in the pool which takes
+    //  its requests in order until there are none left: different files run in parallel
+    //  and the requests of a file never overlap. Synchronize, AsyncAbort and isEOF
+    //  behave like they do for the devices that overlap their requests by themselves.
+    //==============================================================================
+    struct layer : xfile::device::instance
+    {
+        struct request
+        {
+            std::span<std::byte>        m_View;
+            std::size_t                 m_Offset;
+            async_ticket*               m_pTicket;      // nullptr for the requests made by Read/Write
+            bool                        m_bWrite;
+        };
+
+        //------------------------------------------------------------------------------
+
+        xerr Create( xfile::device::instance& Base ) noexcept
+        {
+            m_pBase = &Base;
+            return Base.Tell(m_Position);
+        }
+
+        //------------------------------------------------------------------------------
+
+        xfile::device::instance& getBase( void ) noexcept
+        {
+            assert(m_pBase);
+            return *m_pBase;
+        }
+
+        //------------------------------------------------------------------------------
+
+        void clear( void ) noexcept
+        {
+            assert(m_bScheduled == false && m_Requests.empty());
+            m_pBase     = nullptr;
+            m_Position  = 0;
+            m_nPending  = 0;
+            m_bEOF      = false;
+            m_Error.clear();
+        }
+
+        //------------------------------------------------------------------------------
+
+        xerr open( std::wstring_view, xfile::device::access_types ) noexcept override
+        {
+            return xerr::create<state::NOT_SUPPORTED, "Layers are created on top of an open file">();
+        }
+
+        //------------------------------------------------------------------------------
+        // The buffers of the requests belong to the user, nothing can be left running
+        //------------------------------------------------------------------------------
+
+        void close( void ) noexcept override
+        {
+            WaitIdle();
+        }
+
+        //------------------------------------------------------------------------------
+
+        xerr Read( std::span<std::byte> View ) noexcept override
+        {
+            Queue({ View, m_Position, nullptr, false });
+            m_Position += View.size();
+            return xerr::create<state::INCOMPLETE, "Still reading">();
+        }
+
+        //------------------------------------------------------------------------------
+
+        xerr Write( const std::span<const std::byte> View ) noexcept override
+        {
+            Queue({ { const_cast<std::byte*>(View.data()), View.size() }, m_Position, nullptr, true });
+            m_Position += View.size();
+            return xerr::create<state::INCOMPLETE, "Still writing">();
+        }
+
+        //------------------------------------------------------------------------------
+
+        xerr Seek( xfile::device::seek_mode Mode, std::size_t Pos ) noexcept override
+        {
+            switch (Mode)
+            {
+            case xfile::device::SKM_ORIGIN: m_Position  = Pos; break;
+            case xfile::device::SKM_CURENT: m_Position += Pos; break;
+            case xfile::device::SKM_END:
+            {
+                std::size_t L;
+                if (auto Err = Length(L); Err)
+                    return Err;
+                m_Position = L + Pos;
+                break;
+            }
+            default: assert(false); break;
+            }
+
+            std::lock_guard Lk(m_Lock);
+            m_bEOF = false;
+            return {};
+        }
+
+        //------------------------------------------------------------------------------
+
+        xerr Tell( std::size_t& Pos ) noexcept override
+        {
+            Pos = m_Position;
+            return {};
+        }
+
+        //------------------------------------------------------------------------------
+
+        void Flush( void ) noexcept override
+        {
+            WaitIdle();
+            m_pBase->Flush();
+        }
+
+        //------------------------------------------------------------------------------
+        // Pending writes may change the size of the file
+        //------------------------------------------------------------------------------
+
+        xerr Length( std::size_t& L ) noexcept override
+        {
+            WaitIdle();
+            return m_pBase->Length(L);
+        }
+
+        //------------------------------------------------------------------------------
+
+        bool isEOF( void ) noexcept override
+        {
+            if (auto Err = Synchronize(true); Err) Err.clear();
+
+            std::lock_guard Lk(m_Lock);
+            return m_bEOF;
+        }
+
+        //------------------------------------------------------------------------------
+        // Reports the first failure since the last call, once everything is done
+        //------------------------------------------------------------------------------
+
+        xerr Synchronize( bool bBlock ) noexcept override
+        {
+            std::unique_lock Lk(m_Lock);
+            if (bBlock) m_Idle.wait(Lk, [&] { return m_nPending == 0; });
+
+            if (m_nPending) return xerr::create<state::INCOMPLETE, "Incomplete">();
+
+            auto Err = std::move(m_Error);
+            m_Error.clear();
+            return Err;
+        }
+
+        //------------------------------------------------------------------------------
+        // Drops the requests of Read/Write that did not start, the one running finishes
+        //------------------------------------------------------------------------------
+
+        void AsyncAbort( void ) noexcept override
+        {
+            std::lock_guard Lk(m_Lock);
+
+            const auto Before = m_Requests.size();
+            std::erase_if(m_Requests, [](const request& R) { return R.m_pTicket == nullptr; });
+            if (Before == m_Requests.size()) return;
+
+            m_nPending -= Before - m_Requests.size();
+            if (!m_Error) m_Error = xerr::create_f<state, "Operation Aborted">();
+            if (m_nPending == 0) m_Idle.notify_all();
+        }
+
+        //------------------------------------------------------------------------------
+
+        bool isAsync( void ) noexcept override
+        {
+            return true;
+        }
+
+        //------------------------------------------------------------------------------
+
+        xerr ReadAsync( async_ticket& Ticket, std::span<std::byte> View, std::size_t Offset ) noexcept override
+        {
+            Ticket.Begin(*this, View.size());
+            Queue({ View, Offset, &Ticket, false });
+            return {};
+        }
+
+        //------------------------------------------------------------------------------
+
+        xerr WriteAsync( async_ticket& Ticket, std::span<const std::byte> View, std::size_t Offset ) noexcept override
+        {
+            Ticket.Begin(*this, View.size());
+            Queue({ { const_cast<std::byte*>(View.data()), View.size() }, Offset, &Ticket, true });
+            return {};
+        }
+
+        //------------------------------------------------------------------------------
+
+        xerr Wait( async_ticket& Ticket, bool bBlock ) noexcept override
+        {
+            if (bBlock) details::done_signal::Wait([&]{ return Ticket.m_Status.load(std::memory_order_acquire) == async_ticket::status::DONE; });
+
+            return Ticket.getError();
+        }
+
+        //------------------------------------------------------------------------------
+        // Only requests that did not start can be canceled
+        //------------------------------------------------------------------------------
+
+        void Cancel( async_ticket& Ticket ) noexcept override
+        {
+            {
+                std::lock_guard Lk(m_Lock);
+                auto It = std::find_if(m_Requests.begin(), m_Requests.end(), [&](const request& R) { return R.m_pTicket == &Ticket; });
+                if (It == m_Requests.end()) return;
+
+                m_Requests.erase(It);
+                if (--m_nPending == 0) m_Idle.notify_all();
+            }
+
+            if (Ticket.Complete(async_ticket::result::CANCELED, 0)) Ticket.RunCallback();
+        }
+
+        //------------------------------------------------------------------------------
+        // Done right away by the instance below, they do not wait for the queued requests
+        //------------------------------------------------------------------------------
+
+        xerr ReadAt( std::size_t Offset, std::span<std::byte> View ) noexcept override
+        {
+            return m_pBase->ReadAt(Offset, View);
+        }
+
+        //------------------------------------------------------------------------------
+
+        xerr WriteAt( std::size_t Offset, std::span<const std::byte> View ) noexcept override
+        {
+            return m_pBase->WriteAt(Offset, View);
+        }
+
+    protected:
+
+        //------------------------------------------------------------------------------
+        // Adds the request and gives the file a job in the pool if it does not have one
+        //------------------------------------------------------------------------------
+
+        void Queue( request&& Request ) noexcept
+        {
+            {
+                std::lock_guard Lk(m_Lock);
+                m_Requests.push_back(std::move(Request));
+                ++m_nPending;
+
+                if (m_bScheduled) return;
+                m_bScheduled = true;
+            }
+
+            details::thread_pool::getIOInstance().Submit([this] { Run(); });
+        }
+
+        //------------------------------------------------------------------------------
+        // The job of the file in the IO pool
+        //------------------------------------------------------------------------------
+
+        void Run( void ) noexcept
+        {
+            std::unique_lock Lk(m_Lock);
+            while (m_Requests.empty() == false)
+            {
+                const auto Request = m_Requests.front();
+                m_Requests.pop_front();
+                Lk.unlock();
+
+                // The instance below does the work right away, with the offset of the request
+                async_ticket Inner;
+                auto Err = Request.m_bWrite ? m_pBase->WriteAsync(Inner, Request.m_View, Request.m_Offset)
+                                            : m_pBase->ReadAsync(Inner, Request.m_View, Request.m_Offset);
+                if (!Err) Err = m_pBase->Wait(Inner, true);
+
+                if (Request.m_pTicket)
+                {
+                    const auto Result = Inner.m_Status.load(std::memory_order_acquire) == async_ticket::status::DONE ? Inner.m_Result : async_ticket::result::FAILURE;
+                    Err.clear();
+
+                    Lk.lock();
+                    if (--m_nPending == 0) m_Idle.notify_all();
+                    Lk.unlock();
+
+                    // The callback may make new requests on this file. Without one the user can get
+                    // rid of the ticket as soon as it is done, so it is not touched after Complete
+                    if (Request.m_pTicket->Complete(Result, Inner.m_Transferred)) Request.m_pTicket->RunCallback();
+                    Lk.lock();
+                    continue;
+                }
+
+                Lk.lock();
+                if (Err)
+                {
+                    if (Err.getState<state>() == state::UNEXPECTED_EOF) m_bEOF = true;
+                    if (!m_Error) m_Error = std::move(Err);
+                    else          Err.clear();
+                }
+                if (--m_nPending == 0) m_Idle.notify_all();
+            }
+
+            // Once this is seen the file may be closed, the layer is not touched after it
+            m_bScheduled = false;
+            m_Idle.notify_all();
+        }
+
+        //------------------------------------------------------------------------------
+        // Waits until the file does not have a job in the pool
+        //------------------------------------------------------------------------------
+
+        void WaitIdle( void ) noexcept
+        {
+            std::unique_lock Lk(m_Lock);
+            m_Idle.wait(Lk, [&] { return m_bScheduled == false; });
+        }
+
+    protected:
+
+        xfile::device::instance*        m_pBase         { nullptr };
+        std::size_t                     m_Position      { 0 };              // Cursor of the stream, the requests are queued at it
+        std::mutex                      m_Lock          {};
+        std::condition_variable         m_Idle          {};
+        std::deque<request>             m_Requests      {};                 // Requests that did not start, in order
+        std::size_t                     m_nPending      { 0 };              // Requests that did not finish
+        bool                            m_bScheduled    { false };          // The file has a job in the pool
+        bool                            m_bEOF          { false };
+        xerr                            m_Error         {};                 // First failure of Read/Write, for Synchronize
+    };
+
+    //------------------------------------------------------------------------------
+    // Layers are shared by all the devices
+    //------------------------------------------------------------------------------
+    static instance_pool<layer>         s_LayerPool;
+}
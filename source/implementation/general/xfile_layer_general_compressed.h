@@ -0,0 +1,667 @@
+#include <vector>
+#include <array>
+#include <atomic>
+#include <cstring>
+
+#include "xfile_lz_codec.h"
+
+namespace xfile::driver::compressed
+{
+    //==============================================================================
+    //  COMPRESSED FILE LAYER
+    //==============================================================================
+    //  Files written with the "c" mode are split in blocks of block_size_v bytes which
+    //  are compressed on their own, so reading any part of the file only decompresses
+    //  the blocks it touches. On disk (little endian):
+    //
+    //      header      magic, version and block size
+    //      blocks      the compressed blocks one after the other, blocks that do not
+    //                  shrink are stored as they are
+    //      index       one uint32 per block with its stored size (stored_flag_v when not compressed)
+    //      footer      uncompressed length, number of blocks and the magic again
+    //
+    //  The layer sits on top of the instance of the real device. The stream adds it for
+    //  "c" files and when it finds the magic at the start of a read only file.
+    //  Compressed files are written sequentially and can not be modified after.
+    //
+    //  The blocks go through a ring of slots so the thread pool (de)compresses several
+    //  of them at once. Writing queues every full block and writes them to the device in
+    //  order as they come back. Reading along the file decompresses the blocks ahead of
+    //  the cursor. The ring is bounded by pipeline_depth_v and pipeline_budget_v.
+    //==============================================================================
+    constexpr static std::uint32_t  magic_v             = 0x5A4C4658;           // "XFLZ"
+    constexpr static std::uint32_t  version_v           = 1;
+    constexpr static std::size_t    block_size_v        = 64 * 1024;            // Block size of the files we write
+    constexpr static std::size_t    max_block_size_v    = 16 * 1024 * 1024;     // Biggest block size we accept from a file
+    constexpr static std::uint32_t  stored_flag_v       = 0x80000000u;
+    constexpr static std::size_t    pipeline_depth_v    = 16;                   // Max blocks in flight per file
+    constexpr static std::size_t    pipeline_budget_v   = 4 * 1024 * 1024;      // Max memory used by the slots of a file
+
+    struct header
+    {
+        std::uint32_t   m_Magic;
+        std::uint32_t   m_Version;
+        std::uint32_t   m_BlockSize;
+        std::uint32_t   m_Reserved;
+    };
+
+    struct footer
+    {
+        std::uint64_t   m_Length;
+        std::uint32_t   m_nBlocks;
+        std::uint32_t   m_Magic;
+    };
+
+    //------------------------------------------------------------------------------
+    // A block on its way through the workers. The thread that needs the result runs
+    // the job itself when no worker picked it up yet, so it never waits on the pool.
+    //------------------------------------------------------------------------------
+    struct slot
+    {
+        enum : std::uint8_t
+        { IDLE
+        , QUEUED
+        , RUNNING
+        , READY
+        };
+
+        //------------------------------------------------------------------------------
+
+        void Run( void ) noexcept
+        {
+            // Blocks that do not shrink get a packed size of zero
+            if (m_bCompress) m_PackedSize = details::lz::Compress({ m_Raw.data(), m_RawSize }, { m_Packed.data(), m_RawSize - 1 });
+            else             m_bOk        = details::lz::Decompress({ m_Packed.data(), m_PackedSize }, { m_Raw.data(), m_RawSize });
+
+            m_State.store(READY, std::memory_order_release);
+            m_State.notify_all();
+        }
+
+        //------------------------------------------------------------------------------
+
+        bool TryRun( void ) noexcept
+        {
+            std::uint8_t Expected = QUEUED;
+            if (m_State.compare_exchange_strong(Expected, RUNNING, std::memory_order_acquire) == false) return false;
+            Run();
+            return true;
+        }
+
+        //------------------------------------------------------------------------------
+
+        void Queue( bool bBackground ) noexcept
+        {
+            m_State.store(QUEUED, std::memory_order_release);
+
+            // Jobs stay valid after the slot moves on, they only run it if it is QUEUED
+            if (bBackground) details::thread_pool::getInstance().Submit([this] { (void)TryRun(); });
+        }
+
+        //------------------------------------------------------------------------------
+
+        void Wait( void ) noexcept
+        {
+            if (TryRun()) return;
+            for (auto State = m_State.load(std::memory_order_acquire); State == RUNNING; State = m_State.load(std::memory_order_acquire))
+                m_State.wait(State, std::memory_order_acquire);
+        }
+
+        //------------------------------------------------------------------------------
+        // Leaves the slot IDLE, a job that nobody started is dropped
+        //------------------------------------------------------------------------------
+
+        void Cancel( void ) noexcept
+        {
+            std::uint8_t Expected = QUEUED;
+            if (m_State.compare_exchange_strong(Expected, IDLE, std::memory_order_acquire) == false) Wait();
+            m_State.store(IDLE, std::memory_order_relaxed);
+        }
+
+        std::atomic<std::uint8_t>       m_State         { IDLE };
+        bool                            m_bCompress     { false };
+        bool                            m_bOk           { false };
+        std::size_t                     m_iBlock        { ~std::size_t{0} };
+        std::size_t                     m_RawSize       { 0 };
+        std::size_t                     m_PackedSize    { 0 };
+        std::vector<std::byte>          m_Raw           {};
+        std::vector<std::byte>          m_Packed        {};
+    };
+
+    //==============================================================================
+    //  LAYER CLASS
+    //==============================================================================
+    struct layer : xfile::device::instance
+    {
+        //------------------------------------------------------------------------------
+        // Checks the header and the footer of the file and leaves the cursor back at the start.
+        // Plain files that just happen to start with the magic are not taken as compressed.
+        //------------------------------------------------------------------------------
+
+        static bool isCompressed( xfile::device::instance& Base, xfile::device::access_types AccessTypes ) noexcept
+        {
+            const bool bCompressed = hasValidHeaders(Base, AccessTypes);
+
+            if (auto Err = Base.Seek(xfile::device::SKM_ORIGIN, 0); Err)
+            {
+                Err.clear();
+                return false;
+            }
+
+            return bCompressed;
+        }
+
+        //------------------------------------------------------------------------------
+        // Starts a new compressed file on top of a freshly created one
+        //------------------------------------------------------------------------------
+
+        xerr Create( xfile::device::instance& Base, xfile::device::access_types AccessTypes ) noexcept
+        {
+            m_pBase       = &Base;
+            m_AccessTypes = AccessTypes;
+            m_bWrite      = true;
+            m_BlockSize   = block_size_v;
+            SetupSlots();
+
+            const header Header{ magic_v, version_v, static_cast<std::uint32_t>(m_BlockSize), 0 };
+            return BaseWrite({ reinterpret_cast<const std::byte*>(&Header), sizeof(Header) });
+        }
+
+        //------------------------------------------------------------------------------
+        // Magic, version and block size of the header, then the magic and block count of the footer
+        //------------------------------------------------------------------------------
+
+        static bool hasValidHeaders( xfile::device::instance& Base, xfile::device::access_types AccessTypes ) noexcept
+        {
+            header Header;
+            if (auto Err = BaseRead(Base, AccessTypes, { reinterpret_cast<std::byte*>(&Header), sizeof(Header) }); Err)
+            {
+                Err.clear();
+                return false;
+            }
+
+            if (Header.m_Magic != magic_v || Header.m_Version != version_v || Header.m_BlockSize == 0 || Header.m_BlockSize > max_block_size_v)
+                return false;
+
+            std::size_t BaseLength;
+            if (auto Err = Base.Length(BaseLength); Err)
+            {
+                Err.clear();
+                return false;
+            }
+
+            if (BaseLength < sizeof(header) + sizeof(footer))
+                return false;
+
+            footer Footer;
+            if (auto Err = Base.Seek(xfile::device::SKM_ORIGIN, BaseLength - sizeof(footer)); Err)
+            {
+                Err.clear();
+                return false;
+            }
+
+            if (auto Err = BaseRead(Base, AccessTypes, { reinterpret_cast<std::byte*>(&Footer), sizeof(Footer) }); Err)
+            {
+                Err.clear();
+                return false;
+            }
+
+            return Footer.m_Magic == magic_v && Footer.m_nBlocks == (Footer.m_Length + Header.m_BlockSize - 1) / Header.m_BlockSize;
+        }
+
+        //------------------------------------------------------------------------------
+        // Reads the header, footer and index of an existing compressed file
+        //------------------------------------------------------------------------------
+
+        xerr Load( xfile::device::instance& Base, xfile::device::access_types AccessTypes ) noexcept
+        {
+            m_pBase       = &Base;
+            m_AccessTypes = AccessTypes;
+            m_bWrite      = false;
+
+            header Header;
+            if (auto Err = BaseRead(Base, AccessTypes, { reinterpret_cast<std::byte*>(&Header), sizeof(Header) }); Err || Header.m_Magic != magic_v)
+                return xerr::create<state::CORRUPTED, "The file is not a compressed file">();
+
+            if (Header.m_Version != version_v || Header.m_BlockSize == 0 || Header.m_BlockSize > max_block_size_v)
+                return xerr::create<state::NOT_SUPPORTED, "Unknown version of compressed file">();
+
+            std::size_t BaseLength;
+            if (auto Err = Base.Length(BaseLength); Err)
+                return Err;
+
+            if (BaseLength < sizeof(header) + sizeof(footer))
+                return xerr::create<state::CORRUPTED, "The compressed file is truncated">();
+
+            footer Footer;
+            if (auto Err = Base.Seek(xfile::device::SKM_ORIGIN, BaseLength - sizeof(footer)); Err)
+                return Err;
+
+            if (auto Err = BaseRead(Base, AccessTypes, { reinterpret_cast<std::byte*>(&Footer), sizeof(Footer) }); Err)
+                return Err;
+
+            m_BlockSize = Header.m_BlockSize;
+            m_Length    = static_cast<std::size_t>(Footer.m_Length);
+
+            const auto IndexBytes = std::size_t{ Footer.m_nBlocks } * sizeof(std::uint32_t);
+            if (Footer.m_Magic != magic_v || Footer.m_nBlocks != (m_Length + m_BlockSize - 1) / m_BlockSize || BaseLength - sizeof(footer) - sizeof(header) < IndexBytes)
+                return xerr::create<state::CORRUPTED, "The compressed file has an invalid footer">();
+
+            const auto IndexOffset = BaseLength - sizeof(footer) - IndexBytes;
+            m_Index.resize(Footer.m_nBlocks);
+            if (auto Err = Base.Seek(xfile::device::SKM_ORIGIN, IndexOffset); Err)
+                return Err;
+
+            if (auto Err = BaseRead(Base, AccessTypes, std::as_writable_bytes(std::span{ m_Index })); Err)
+                return Err;
+
+            // Where each block starts, the last one must end where the index starts
+            m_Offsets.resize(m_Index.size() + 1);
+            m_Offsets[0] = sizeof(header);
+            for (std::size_t i = 0; i < m_Index.size(); ++i)
+            {
+                const auto Size = m_Index[i] & ~stored_flag_v;
+                if (Size > m_BlockSize)
+                    return xerr::create<state::CORRUPTED, "The compressed file has an invalid index">();
+                m_Offsets[i + 1] = m_Offsets[i] + Size;
+            }
+
+            if (m_Offsets.back() != IndexOffset)
+                return xerr::create<state::CORRUPTED, "The compressed file has an invalid index">();
+
+            SetupSlots();
+            return {};
+        }
+
+        //------------------------------------------------------------------------------
+
+        xerr open( std::wstring_view, xfile::device::access_types ) noexcept override
+        {
+            return xerr::create<state::NOT_SUPPORTED, "Layers are created on top of an open file">();
+        }
+
+        //------------------------------------------------------------------------------
+        // Writes the last block and the index, the base instance is closed by the stream
+        //------------------------------------------------------------------------------
+
+        void close( void ) noexcept override
+        {
+            if (m_bWrite == false || m_pBase == nullptr) return;
+
+            if (m_BlockFill) QueueBlock();
+            while (m_nRetired < m_nQueued) (void)RetireBlock();
+
+            const footer Footer{ m_Length, static_cast<std::uint32_t>(m_Index.size()), magic_v };
+            (void)BaseWrite(std::as_bytes(std::span{ m_Index }));
+            (void)BaseWrite({ reinterpret_cast<const std::byte*>(&Footer), sizeof(Footer) });
+        }
+
+        //------------------------------------------------------------------------------
+
+        xerr Read( std::span<std::byte> View ) noexcept override
+        {
+            if (m_bWrite)
+                return xerr::create<state::NOT_SUPPORTED, "Compressed files can not be read while writing them">();
+
+            for (std::size_t Done = 0; Done < View.size(); )
+            {
+                if (m_Position >= m_Length)
+                {
+                    m_bEOF = true;
+                    return xerr::create<state::UNEXPECTED_EOF, "Unexpected End of File">();
+                }
+
+                const auto iBlock   = m_Position / m_BlockSize;
+                const auto Offset   = m_Position % m_BlockSize;
+                const auto BlockLen = std::min(m_BlockSize, m_Length - iBlock * m_BlockSize);
+                const auto Count    = std::min(BlockLen - Offset, View.size() - Done);
+                auto&      Slot     = m_Slots[iBlock % m_Depth];
+
+                if (isScheduled(iBlock) == false)
+                {
+                    if (auto Err = ScheduleBlock(iBlock, false); Err)
+                        return Err;
+                }
+
+                // Reading along the file, get the blocks that follow going
+                if (iBlock != m_iLastBlock)
+                {
+                    if (iBlock == m_iLastBlock + 1)
+                    {
+                        for (auto i = iBlock + 1, End = std::min(iBlock + m_Depth, m_Index.size()); i < End; ++i)
+                        {
+                            if (isScheduled(i)) continue;
+                            if (auto Err = ScheduleBlock(i, true); Err)
+                                return Err;
+                        }
+                    }
+                    m_iLastBlock = iBlock;
+                }
+
+                Slot.Wait();
+                if (Slot.m_bOk == false)
+                    return xerr::create<state::CORRUPTED, "A block of the compressed file is corrupted">();
+
+                std::memcpy(&View[Done], &Slot.m_Raw[Offset], Count);
+
+                Done       += Count;
+                m_Position += Count;
+            }
+
+            return {};
+        }
+
+        //------------------------------------------------------------------------------
+        // Leaves the slots alone, each block it touches is read with ReadAt of the instance
+        // below and decompressed by the caller. The index does not change after Load so
+        // several threads can do it at once.
+        //------------------------------------------------------------------------------
+
+        xerr ReadAt( std::size_t Offset, std::span<std::byte> View ) noexcept override
+        {
+            if (m_bWrite)
+                return xerr::create<state::NOT_SUPPORTED, "Compressed files can not be read while writing them">();
+
+            std::vector<std::byte> Packed;
+            std::vector<std::byte> Raw;
+            for (std::size_t Done = 0; Done < View.size(); )
+            {
+                const auto Position = Offset + Done;
+                if (Position >= m_Length)
+                    return xerr::create<state::UNEXPECTED_EOF, "Unexpected End of File">();
+
+                const auto iBlock      = Position / m_BlockSize;
+                const auto InBlock     = Position % m_BlockSize;
+                const auto BlockLen    = std::min(m_BlockSize, m_Length - iBlock * m_BlockSize);
+                const auto Count       = std::min(BlockLen - InBlock, View.size() - Done);
+                const auto BlockOffset = static_cast<std::size_t>(m_Offsets[iBlock]);
+                const auto Dest        = View.subspan(Done, Count);
+
+                if (m_Index[iBlock] & stored_flag_v)
+                {
+                    if (auto Err = m_pBase->ReadAt(BlockOffset + InBlock, Dest); Err)
+                        return Err;
+                }
+                else
+                {
+                    Packed.resize(m_Index[iBlock]);
+                    if (auto Err = m_pBase->ReadAt(BlockOffset, Packed); Err)
+                        return Err;
+
+                    // Whole blocks go straight into the view
+                    const bool bWhole = Count == BlockLen;
+                    if (bWhole == false) Raw.resize(BlockLen);
+
+                    if (details::lz::Decompress(Packed, bWhole ? Dest : std::span{ Raw }) == false)
+                        return xerr::create<state::CORRUPTED, "A block of the compressed file is corrupted">();
+
+                    if (bWhole == false) std::memcpy(Dest.data(), &Raw[InBlock], Count);
+                }
+
+                Done += Count;
+            }
+
+            return {};
+        }
+
+        //------------------------------------------------------------------------------
+
+        xerr WriteAt( std::size_t, std::span<const std::byte> ) noexcept override
+        {
+            return xerr::create<state::NOT_SUPPORTED, "Compressed files can only be written sequentially">();
+        }
+
+        //------------------------------------------------------------------------------
+
+        xerr Write( const std::span<const std::byte> View ) noexcept override
+        {
+            if (m_bWrite == false)
+                return xerr::create<state::NOT_SUPPORTED, "The compressed file was opened for reading">();
+
+            for (std::size_t Done = 0; Done < View.size(); )
+            {
+                // Starting a new block, its slot must be done with the block it had
+                if (m_BlockFill == 0 && m_nQueued - m_nRetired == m_Depth)
+                {
+                    if (auto Err = RetireBlock(); Err)
+                        return Err;
+                }
+
+                auto&      Slot  = m_Slots[m_nQueued % m_Depth];
+                const auto Count = std::min(m_BlockSize - m_BlockFill, View.size() - Done);
+                std::memcpy(&Slot.m_Raw[m_BlockFill], &View[Done], Count);
+                m_BlockFill += Count;
+                Done        += Count;
+
+                if (m_BlockFill == m_BlockSize) QueueBlock();
+            }
+
+            m_Position = m_Length += View.size();
+            return {};
+        }
+
+        //------------------------------------------------------------------------------
+
+        xerr Seek( xfile::device::seek_mode Mode, std::size_t Pos ) noexcept override
+        {
+            std::size_t NewPosition = 0;
+            switch (Mode)
+            {
+            case xfile::device::SKM_ORIGIN: NewPosition = Pos;              break;
+            case xfile::device::SKM_CURENT: NewPosition = m_Position + Pos; break;
+            case xfile::device::SKM_END:    NewPosition = m_Length + Pos;   break;
+            default: assert(false); break;
+            }
+
+            if (m_bWrite && NewPosition != m_Position)
+                return xerr::create<state::NOT_SUPPORTED, "Compressed files can only be written sequentially">();
+
+            m_Position = NewPosition;
+            m_bEOF     = false;
+            return {};
+        }
+
+        //------------------------------------------------------------------------------
+
+        xerr Tell( std::size_t& Pos ) noexcept override
+        {
+            Pos = m_Position;
+            return {};
+        }
+
+        //------------------------------------------------------------------------------
+
+        void Flush( void ) noexcept override
+        {
+            // A partial block can not be written until it is complete (or the file is closed)
+            m_pBase->Flush();
+        }
+
+        //------------------------------------------------------------------------------
+
+        xerr Length( std::size_t& L ) noexcept override
+        {
+            L = m_Length;
+            return {};
+        }
+
+        //------------------------------------------------------------------------------
+
+        bool isEOF( void ) noexcept override
+        {
+            return m_bEOF;
+        }
+
+        //------------------------------------------------------------------------------
+
+        xerr Synchronize( bool ) noexcept override
+        {
+            // Every operation completes before returning
+            return {};
+        }
+
+        //------------------------------------------------------------------------------
+
+        void AsyncAbort( void ) noexcept override
+        {
+        }
+
+        //------------------------------------------------------------------------------
+
+        void clear( void ) noexcept
+        {
+            for (auto& Slot : m_Slots)
+            {
+                Slot.Cancel();
+                Slot.m_iBlock = ~std::size_t{0};
+            }
+
+            m_pBase      = nullptr;
+            m_bWrite     = m_bEOF = false;
+            m_Position   = m_Length = m_BlockFill = 0;
+            m_nQueued    = m_nRetired = 0;
+            m_iLastBlock = ~std::size_t{0};
+            m_Index.clear();
+            m_Offsets.clear();
+        }
+
+    protected:
+
+        //------------------------------------------------------------------------------
+        // The layer works synchronously, async files wait for each of their operations
+        //------------------------------------------------------------------------------
+
+        static xerr BaseRead( xfile::device::instance& Base, xfile::device::access_types AccessTypes, std::span<std::byte> View ) noexcept
+        {
+            auto Err = Base.Read(View);
+            if (Err && AccessTypes.m_bASync && Err.getState<state>() == state::INCOMPLETE) Err = Base.Synchronize(true);
+            return Err;
+        }
+
+        //------------------------------------------------------------------------------
+
+        xerr BaseWrite( std::span<const std::byte> View ) noexcept
+        {
+            auto Err = m_pBase->Write(View);
+            if (Err && m_AccessTypes.m_bASync && Err.getState<state>() == state::INCOMPLETE) Err = m_pBase->Synchronize(true);
+            return Err;
+        }
+
+        //------------------------------------------------------------------------------
+        // Slots buffers stay allocated while the layer goes back and forth to the pool
+        //------------------------------------------------------------------------------
+
+        void SetupSlots( void ) noexcept
+        {
+            const auto Workers = details::thread_pool::getInstance().getWorkerCount();
+            m_Depth = std::min({ pipeline_depth_v, 2 * (Workers + 1), std::max<std::size_t>(1, pipeline_budget_v / (2 * m_BlockSize)) });
+
+            for (std::size_t i = 0; i < m_Depth; ++i)
+            {
+                m_Slots[i].m_Raw.resize(m_BlockSize);
+                m_Slots[i].m_Packed.resize(m_BlockSize);
+            }
+        }
+
+        //------------------------------------------------------------------------------
+        // Hands the block being filled to the workers
+        //------------------------------------------------------------------------------
+
+        void QueueBlock( void ) noexcept
+        {
+            auto& Slot = m_Slots[m_nQueued++ % m_Depth];
+            Slot.m_bCompress = true;
+            Slot.m_RawSize   = m_BlockFill;
+            m_BlockFill      = 0;
+            Slot.Queue(true);
+        }
+
+        //------------------------------------------------------------------------------
+        // Writes the oldest block in flight, so they reach the file in order
+        //------------------------------------------------------------------------------
+
+        xerr RetireBlock( void ) noexcept
+        {
+            auto& Slot = m_Slots[m_nRetired++ % m_Depth];
+            Slot.Wait();
+            Slot.m_State.store(slot::IDLE, std::memory_order_relaxed);
+
+            if (Slot.m_PackedSize)
+            {
+                m_Index.push_back(static_cast<std::uint32_t>(Slot.m_PackedSize));
+                return BaseWrite({ Slot.m_Packed.data(), Slot.m_PackedSize });
+            }
+
+            m_Index.push_back(static_cast<std::uint32_t>(Slot.m_RawSize) | stored_flag_v);
+            return BaseWrite({ Slot.m_Raw.data(), Slot.m_RawSize });
+        }
+
+        //------------------------------------------------------------------------------
+
+        bool isScheduled( std::size_t iBlock ) const noexcept
+        {
+            const auto& Slot = m_Slots[iBlock % m_Depth];
+            return Slot.m_iBlock == iBlock && Slot.m_State.load(std::memory_order_relaxed) != slot::IDLE;
+        }
+
+        //------------------------------------------------------------------------------
+        // Reads the block from the device and queues it to be decompressed. Background
+        // blocks go to the workers, the others are decompressed by the first Wait.
+        //------------------------------------------------------------------------------
+
+        xerr ScheduleBlock( std::size_t iBlock, bool bBackground ) noexcept
+        {
+            auto& Slot = m_Slots[iBlock % m_Depth];
+            Slot.Cancel();
+            Slot.m_iBlock     = iBlock;
+            Slot.m_bCompress  = false;
+            Slot.m_RawSize    = std::min(m_BlockSize, m_Length - iBlock * m_BlockSize);
+            Slot.m_PackedSize = m_Index[iBlock] & ~stored_flag_v;
+
+            if (auto Err = m_pBase->Seek(xfile::device::SKM_ORIGIN, static_cast<std::size_t>(m_Offsets[iBlock])); Err)
+                return Err;
+
+            // Blocks stored as they are do not need the workers
+            if (m_Index[iBlock] & stored_flag_v)
+            {
+                if (Slot.m_PackedSize != Slot.m_RawSize)
+                    return xerr::create<state::CORRUPTED, "The compressed file has an invalid index">();
+
+                if (auto Err = BaseRead(*m_pBase, m_AccessTypes, { Slot.m_Raw.data(), Slot.m_RawSize }); Err)
+                    return Err;
+
+                Slot.m_bOk = true;
+                Slot.m_State.store(slot::READY, std::memory_order_relaxed);
+                return {};
+            }
+
+            if (auto Err = BaseRead(*m_pBase, m_AccessTypes, { Slot.m_Packed.data(), Slot.m_PackedSize }); Err)
+                return Err;
+
+            Slot.Queue(bBackground);
+            return {};
+        }
+
+    protected:
+
+        xfile::device::instance*        m_pBase         { nullptr };
+        xfile::device::access_types     m_AccessTypes   {};
+        bool                            m_bWrite        { false };
+        bool                            m_bEOF          { false };
+        std::size_t                     m_BlockSize     { block_size_v };
+        std::size_t                     m_Position      { 0 };
+        std::size_t                     m_Length        { 0 };              // Uncompressed length of the file
+        std::size_t                     m_BlockFill     { 0 };              // Bytes of the block being filled (writing)
+        std::size_t                     m_Depth         { 1 };              // Slots in use
+        std::size_t                     m_nQueued       { 0 };              // Blocks handed to the slots (writing)
+        std::size_t                     m_nRetired      { 0 };              // Blocks already in the device (writing)
+        std::size_t                     m_iLastBlock    { ~std::size_t{0} };// Last block read, to detect reading along the file
+        std::vector<std::uint32_t>      m_Index         {};
+        std::vector<std::uint64_t>      m_Offsets       {};
+        std::array<slot, pipeline_depth_v> m_Slots      {};
+    };
+
+    //------------------------------------------------------------------------------
+    // Layers are shared by all the devices
+    //------------------------------------------------------------------------------
+    static instance_pool<layer>         s_LayerPool;
+}
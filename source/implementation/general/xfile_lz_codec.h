@@ -0,0 +1,225 @@
+#include <array>
+#include <bit>
+#include <cstring>
+#include <cstdint>
+#include <span>
+
+//==============================================================================
+//  LZ CODEC
+//==============================================================================
+//  Small LZ77 byte codec used by the compressed files ('c' mode). The encoded
+//  stream is a list of sequences, same layout as the LZ4 block format:
+//
+//      token       1 byte, high nibble literal count, low nibble match length - 4
+//      literals    (15 or more adds 255 bytes until one is smaller)
+//      offset      2 bytes little endian, distance back to the match
+//      match       (15 or more adds 255 bytes until one is smaller)
+//
+//  The last sequence only has literals. Matches are found with a single hash
+//  table probe per position so it compresses fast rather than tight.
+//==============================================================================
+namespace xfile::details::lz
+{
+    constexpr static std::size_t    min_match_v     = 4;
+    constexpr static std::size_t    max_distance_v  = 0xffff;
+    constexpr static int            hash_bits_v     = 12;
+
+    //------------------------------------------------------------------------------
+    // Worst case size of the compressed data (everything ends up as literals)
+    //------------------------------------------------------------------------------
+    constexpr std::size_t getBound( std::size_t Size ) noexcept
+    {
+        return Size + Size / 255 + 16;
+    }
+
+    //------------------------------------------------------------------------------
+
+    inline std::uint32_t Read32( const std::byte* p ) noexcept
+    {
+        std::uint32_t V;
+        std::memcpy(&V, p, sizeof(V));
+        return V;
+    }
+
+    inline std::uint64_t Read64( const std::byte* p ) noexcept
+    {
+        std::uint64_t V;
+        std::memcpy(&V, p, sizeof(V));
+        return V;
+    }
+
+    constexpr std::uint32_t Hash( std::uint32_t V ) noexcept
+    {
+        return (V * 2654435761u) >> (32 - hash_bits_v);
+    }
+
+    //------------------------------------------------------------------------------
+    // Writes a length that did not fit in its nibble, returns false if it runs out of room
+    //------------------------------------------------------------------------------
+    inline bool WriteLength( std::byte*& pOut, const std::byte* pOutEnd, std::size_t Length ) noexcept
+    {
+        for (; Length >= 255; Length -= 255)
+        {
+            if (pOut == pOutEnd) return false;
+            *pOut++ = std::byte{ 255 };
+        }
+
+        if (pOut == pOutEnd) return false;
+        *pOut++ = static_cast<std::byte>(Length);
+        return true;
+    }
+
+    //------------------------------------------------------------------------------
+    // Writes the literals from pLiterals and (when Distance is not zero) a match after them
+    //------------------------------------------------------------------------------
+    inline bool WriteSequence( std::byte*& pOut, const std::byte* pOutEnd, const std::byte* pLiterals, std::size_t nLiterals, std::size_t Distance, std::size_t MatchLength ) noexcept
+    {
+        if (pOut == pOutEnd) return false;
+
+        const auto ExtraMatch = MatchLength - min_match_v;
+        auto&      Token      = *pOut++;
+        Token = static_cast<std::byte>((std::min<std::size_t>(nLiterals, 15) << 4) | (Distance ? std::min<std::size_t>(ExtraMatch, 15) : 0));
+
+        if (nLiterals >= 15 && WriteLength(pOut, pOutEnd, nLiterals - 15) == false) return false;
+        if (static_cast<std::size_t>(pOutEnd - pOut) < nLiterals)                   return false;
+
+        if (nLiterals) std::memcpy(pOut, pLiterals, nLiterals);
+        pOut += nLiterals;
+
+        if (Distance == 0) return true;
+
+        if (pOutEnd - pOut < 2) return false;
+        *pOut++ = static_cast<std::byte>(Distance & 0xff);
+        *pOut++ = static_cast<std::byte>(Distance >> 8);
+
+        return ExtraMatch < 15 || WriteLength(pOut, pOutEnd, ExtraMatch - 15);
+    }
+
+    //------------------------------------------------------------------------------
+    // Returns the size of the compressed data or zero if it did not fit in Dst.
+    // Src must be smaller than 4GB.
+    //------------------------------------------------------------------------------
+    inline std::size_t Compress( std::span<const std::byte> Src, std::span<std::byte> Dst ) noexcept
+    {
+        std::array<std::uint32_t, 1 << hash_bits_v> Table{};
+
+        const std::byte* const  pBase    = Src.data();
+        const std::byte* const  pEnd     = pBase + Src.size();
+        std::byte*              pOut     = Dst.data();
+        const std::byte* const  pOutEnd  = pOut + Dst.size();
+        const std::byte*        pAnchor  = pBase;
+
+        if (Src.size() > min_match_v + 8)
+        {
+            const std::byte* const pLimit = pEnd - min_match_v;
+
+            for (const std::byte* p = pBase + 1; p < pLimit; )
+            {
+                const auto          V    = Read32(p);
+                auto&               Slot = Table[Hash(V)];
+                const std::byte*    pRef = pBase + Slot;
+                Slot = static_cast<std::uint32_t>(p - pBase);
+
+                if (pRef >= p || static_cast<std::size_t>(p - pRef) > max_distance_v || Read32(pRef) != V)
+                {
+                    // The longer we go without a match the faster we skip ahead
+                    p += 1 + ((p - pAnchor) >> 6);
+                    continue;
+                }
+
+                // Extend the match backwards over the literals and then forward
+                while (p > pAnchor && pRef > pBase && p[-1] == pRef[-1]) { --p; --pRef; }
+
+                const std::byte* q     = p    + min_match_v;
+                const std::byte* r     = pRef + min_match_v;
+                bool             bDone = false;
+                if constexpr (std::endian::native == std::endian::little)
+                {
+                    for (; q + 8 <= pEnd; q += 8, r += 8)
+                    {
+                        if (const auto Diff = Read64(q) ^ Read64(r); Diff)
+                        {
+                            q    += std::countr_zero(Diff) / 8;
+                            bDone = true;
+                            break;
+                        }
+                    }
+                }
+                if (bDone == false) while (q < pEnd && *q == *r) { ++q; ++r; }
+
+                if (WriteSequence(pOut, pOutEnd, pAnchor, static_cast<std::size_t>(p - pAnchor), static_cast<std::size_t>(p - pRef), static_cast<std::size_t>(q - p)) == false)
+                    return 0;
+
+                pAnchor = p = q;
+                if (p < pLimit) Table[Hash(Read32(p - 2))] = static_cast<std::uint32_t>(p - 2 - pBase);
+            }
+        }
+
+        if (WriteSequence(pOut, pOutEnd, pAnchor, static_cast<std::size_t>(pEnd - pAnchor), 0, min_match_v) == false)
+            return 0;
+
+        return static_cast<std::size_t>(pOut - Dst.data());
+    }
+
+    //------------------------------------------------------------------------------
+    // Decompresses Src which must produce exactly Dst.size() bytes.
+    // Returns false if the data is corrupted.
+    //------------------------------------------------------------------------------
+    inline bool Decompress( std::span<const std::byte> Src, std::span<std::byte> Dst ) noexcept
+    {
+        const std::byte*        pIn     = Src.data();
+        const std::byte* const  pInEnd  = pIn + Src.size();
+        std::byte*              pOut    = Dst.data();
+        std::byte* const        pOutEnd = pOut + Dst.size();
+
+        auto ReadLength = [&]( std::size_t& Length ) noexcept
+        {
+            for (std::byte B{ 255 }; B == std::byte{ 255 }; Length += static_cast<std::size_t>(B))
+            {
+                if (pIn == pInEnd) return false;
+                B = *pIn++;
+            }
+            return true;
+        };
+
+        while (pIn < pInEnd)
+        {
+            const auto  Token     = static_cast<std::size_t>(*pIn++);
+            std::size_t nLiterals = Token >> 4;
+            if (nLiterals == 15 && ReadLength(nLiterals) == false)                                  return false;
+            if (static_cast<std::size_t>(pInEnd - pIn) < nLiterals || static_cast<std::size_t>(pOutEnd - pOut) < nLiterals) return false;
+
+            if (nLiterals) std::memcpy(pOut, pIn, nLiterals);
+            pOut += nLiterals;
+            pIn  += nLiterals;
+
+            // The last sequence does not have a match
+            if (pIn == pInEnd) break;
+
+            if (pInEnd - pIn < 2) return false;
+            const auto Distance = static_cast<std::size_t>(pIn[0]) | (static_cast<std::size_t>(pIn[1]) << 8);
+            pIn += 2;
+
+            std::size_t MatchLength = Token & 15;
+            if (MatchLength == 15 && ReadLength(MatchLength) == false) return false;
+            MatchLength += min_match_v;
+
+            if (Distance == 0 || Distance > static_cast<std::size_t>(pOut - Dst.data()) || static_cast<std::size_t>(pOutEnd - pOut) < MatchLength)
+                return false;
+
+            const std::byte* pRef = pOut - Distance;
+            if (Distance >= MatchLength)
+            {
+                std::memcpy(pOut, pRef, MatchLength);
+                pOut += MatchLength;
+            }
+            else
+            {
+                // Overlapping match, repeats the last Distance bytes
+                for (std::size_t i = 0; i < MatchLength; ++i) *pOut++ = pRef[i];
+            }
+        }
+
+        return pOut == pOutEnd;
+    }
+}
@@ -0,0 +1,1149 @@
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#if defined(__linux__)
+    #include <sys/sendfile.h>
+#endif
+#include <cerrno>
+#include <climits>
+#include <cstring>
+
+#include "xfile_io_uring.h"
+
+namespace xfile::driver::posix
+{
+    //------------------------------------------------------------------------------
+    // Converts a wide path (UTF-32 on posix) into a null terminated UTF-8 string
+    // without touching the heap. Returns false if the buffer is too small.
+    //------------------------------------------------------------------------------
+    inline
+    bool ToUTF8( std::span<char> Buffer, std::wstring_view Path ) noexcept
+    {
+        std::size_t i = 0;
+        for( const wchar_t wC : Path )
+        {
+            const auto C = static_cast<std::uint32_t>(wC);
+            if( C < 0x80 )
+            {
+                if (i + 1 >= Buffer.size()) return false;
+                Buffer[i++] = static_cast<char>(C);
+            }
+            else if( C < 0x800 )
+            {
+                if (i + 2 >= Buffer.size()) return false;
+                Buffer[i++] = static_cast<char>(0xC0 | (C >> 6));
+                Buffer[i++] = static_cast<char>(0x80 | (C & 0x3F));
+            }
+            else if( C < 0x10000 )
+            {
+                if (i + 3 >= Buffer.size()) return false;
+                Buffer[i++] = static_cast<char>(0xE0 | (C >> 12));
+                Buffer[i++] = static_cast<char>(0x80 | ((C >> 6) & 0x3F));
+                Buffer[i++] = static_cast<char>(0x80 | (C & 0x3F));
+            }
+            else
+            {
+                if (i + 4 >= Buffer.size()) return false;
+                Buffer[i++] = static_cast<char>(0xF0 | (C >> 18));
+                Buffer[i++] = static_cast<char>(0x80 | ((C >> 12) & 0x3F));
+                Buffer[i++] = static_cast<char>(0x80 | ((C >> 6) & 0x3F));
+                Buffer[i++] = static_cast<char>(0x80 | (C & 0x3F));
+            }
+        }
+
+        Buffer[i] = 0;
+        return true;
+    }
+
+    //------------------------------------------------------------------------------
+
+    inline
+    void CloseFileHandle( int Handle ) noexcept
+    {
+        (void)::close(Handle);
+    }
+
+    //------------------------------------------------------------------------------
+
+    struct device final : public xfile::device
+    {
+        // How much of a memory mapped file we map at once. Bigger files slide the window around.
+        constexpr static std::size_t map_window_v = sizeof(void*) >= 8 ? std::size_t{ 1 } << 30 : std::size_t{ 64 } << 20;
+
+        using handle_cache = driver::handle_cache<int, &CloseFileHandle>;
+
+        struct alignas(std::atomic<void*>) small_file : device::instance, uring::completion
+        {
+            int                         m_Handle            { -1 };
+            std::size_t                 m_Position          { 0 };      // We keep our own cursor since we use pread/pwrite
+            access_types                m_AccessTypes       {};
+            bool                        m_bEOF              { false };
+            int                         m_LastError         { 0 };      // errno of the last failure
+            std::shared_ptr<uring::ring> m_pRing            {};         // Ring used for the async operations (nullptr when sync)
+            std::atomic<std::uint32_t>  m_nPending          { 0 };      // Number of async operations in flight
+            int                         m_AsyncError        { 0 };      // First failure (-errno) of the async operations, EOF for short reads
+            const std::byte*            m_pMap              { nullptr };// Current mapping window (memory mapped files only)
+            std::size_t                 m_MapOffset         { 0 };      // File offset where the window starts
+            std::size_t                 m_MapSize           { 0 };      // Size of the window
+            std::size_t                 m_MapFileSize       { 0 };      // Size of the file (it is read only so it does not change)
+            bool                        m_bMapped           { false };  // Is this file served from memory
+            handle_cache*               m_pHandleCache      { nullptr };// Cache of the device, set when the instance is created
+            handle_cache::node          m_CacheNode         {};         // Entry of m_Handle in the cache
+            bool                        m_bCachedHandle     { false };  // m_Handle goes back to the cache on close
+
+            void clear()
+            {
+                m_CacheNode     = {};
+                m_bCachedHandle = false;
+                m_Handle        = -1;
+                m_Position      = 0;
+                m_AccessTypes   = {};
+                m_bEOF          = false;
+                m_LastError     = 0;
+                m_pRing.reset();
+                m_nPending      = 0;
+                m_AsyncError    = 0;
+                m_pMap          = nullptr;
+                m_MapOffset     = 0;
+                m_MapSize       = 0;
+                m_MapFileSize   = 0;
+                m_bMapped       = false;
+            }
+
+            //----------------------------------------------------------------------------------------
+            // Makes sure that the mapping window contains the given range
+            //----------------------------------------------------------------------------------------
+
+            xerr MapWindow( std::size_t Position, std::size_t Count = 1 ) noexcept
+            {
+                if (m_pMap && Position >= m_MapOffset && Position + Count <= m_MapOffset + m_MapSize)
+                    return {};
+
+                if (m_pMap)
+                {
+                    ::munmap(const_cast<std::byte*>(m_pMap), m_MapSize);
+                    m_pMap = nullptr;
+                }
+
+                static const std::size_t PageSize = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+                m_MapOffset = Position & ~(PageSize - 1);
+                m_MapSize   = std::min(map_window_v, m_MapFileSize - m_MapOffset);
+
+                void* pMap = ::mmap(nullptr, m_MapSize, PROT_READ, MAP_SHARED, m_Handle, static_cast<off_t>(m_MapOffset));
+                if (pMap == MAP_FAILED)
+                {
+                    m_LastError = errno;
+                    m_MapSize   = 0;
+                    return xerr::create_f<state, "Fail to map the file in memory">();
+                }
+
+                // Most of the time files are parsed front to back
+                ::madvise(pMap, m_MapSize, MADV_SEQUENTIAL);
+                ::madvise(pMap, m_MapSize, MADV_WILLNEED);
+
+                m_pMap = static_cast<const std::byte*>(pMap);
+                return {};
+            }
+
+            //----------------------------------------------------------------------------------------
+            // Called by the ring (with its lock taken) when one of our operations is done
+            //----------------------------------------------------------------------------------------
+
+            void onComplete( std::int32_t Result, std::uint32_t Expected ) noexcept override
+            {
+                if (m_AsyncError == 0)
+                {
+                    if      (Result < 0)                                     m_AsyncError = Result;
+                    else if (static_cast<std::uint32_t>(Result) < Expected) m_AsyncError = EOF;
+                }
+
+                m_nPending.fetch_sub(1, std::memory_order_release);
+            }
+
+            //----------------------------------------------------------------------------------------
+            // Queues the operation in the ring and lets the kernel know right away
+            //----------------------------------------------------------------------------------------
+
+#if XFILE_IO_URING
+            template< typename T_BYTE >
+            void QueueAsync( std::uint8_t OpCode, std::span<T_BYTE> View ) noexcept
+            {
+                std::vector<uring::completion*> Deferred;
+                {
+                    std::lock_guard Lk(m_pRing->m_Lock);
+
+                    for (std::size_t Done = 0; Done < View.size(); )
+                    {
+                        const auto Size = static_cast<std::uint32_t>(std::min<std::size_t>(View.size() - Done, uring::ring::max_op_bytes_v));
+                        m_nPending.fetch_add(1, std::memory_order_relaxed);
+                        m_pRing->Queue(OpCode, m_Handle, &View[Done], Size, m_Position + Done, this);
+                        Done += Size;
+                    }
+                    m_pRing->Submit();
+                    m_pRing->TakeDeferred(Deferred);
+                }
+                uring::ring::RunDeferred(Deferred);
+
+                // The cursor moves right away so that the next operation goes after this one
+                m_Position += View.size();
+            }
+
+            //----------------------------------------------------------------------------------------
+            // Lives inside of the async_ticket while its request is in the ring
+            //----------------------------------------------------------------------------------------
+
+            struct ticket_request final : uring::completion
+            {
+                async_ticket*               m_pTicket       { nullptr };
+                small_file*                 m_pFile         { nullptr };
+                std::size_t                 m_Transferred   { 0 };
+                std::uint32_t               m_nPieces       { 0 };      // Entries still in the ring, big requests are split
+                std::int32_t                m_Error         { 0 };      // First failure (-errno), EOF for short transfers
+
+                void onComplete( std::int32_t Result, std::uint32_t Expected ) noexcept override
+                {
+                    if (Result > 0) m_Transferred += static_cast<std::size_t>(Result);
+                    if (m_Error == 0)
+                    {
+                        if      (Result < 0)                                     m_Error = Result;
+                        else if (static_cast<std::uint32_t>(Result) < Expected) m_Error = EOF;
+                    }
+
+                    if (--m_nPieces) return;
+
+                    // The user can get rid of the ticket as soon as it is done so it goes last
+                    auto& Ticket = *m_pTicket;
+                    m_pFile->m_nPending.fetch_sub(1, std::memory_order_release);
+                    if (Ticket.m_Callback) m_pFile->m_pRing->Defer(*this);
+
+                    Ticket.Complete( m_Error == 0           ? async_ticket::result::OK
+                                   : m_Error == EOF         ? async_ticket::result::UNEXPECTED_EOF
+                                   : m_Error == -ECANCELED  ? async_ticket::result::CANCELED
+                                   :                          async_ticket::result::FAILURE
+                                   , m_Transferred );
+                }
+
+                void onDeferred( void ) noexcept override
+                {
+                    m_pTicket->RunCallback();
+                }
+            };
+
+            static_assert(sizeof(ticket_request) <= sizeof(async_ticket::m_DeviceData));
+
+            //----------------------------------------------------------------------------------------
+
+            template< typename T_BYTE >
+            void QueueTicket( std::uint8_t OpCode, async_ticket& Ticket, std::span<T_BYTE> View, std::size_t Offset ) noexcept
+            {
+                constexpr auto  MaxSize  = std::size_t{ uring::ring::max_op_bytes_v };
+                auto&           Request  = *new(Ticket.m_DeviceData.data()) ticket_request{};
+                Request.m_pTicket = &Ticket;
+                Request.m_pFile   = this;
+                Request.m_nPieces = static_cast<std::uint32_t>(std::max<std::size_t>(1, (View.size() + MaxSize - 1) / MaxSize));
+
+                Ticket.Begin(*this, View.size());
+
+                // Callbacks must happen even if nobody polls
+                if (Ticket.m_Callback) m_pRing->Watch();
+
+                std::vector<uring::completion*> Deferred;
+                {
+                    std::lock_guard Lk(m_pRing->m_Lock);
+
+                    m_nPending.fetch_add(1, std::memory_order_relaxed);
+                    std::size_t Done = 0;
+                    do
+                    {
+                        const auto Size = static_cast<std::uint32_t>(std::min(View.size() - Done, MaxSize));
+                        m_pRing->Queue(OpCode, m_Handle, View.data() + Done, Size, Offset + Done, &Request);
+                        Done += Size;
+                    } while (Done < View.size());
+
+                    m_pRing->Submit();
+                    m_pRing->TakeDeferred(Deferred);
+                }
+                uring::ring::RunDeferred(Deferred);
+            }
+
+            static ticket_request& getRequest( async_ticket& Ticket ) noexcept
+            {
+                return *std::launder(reinterpret_cast<ticket_request*>(Ticket.m_DeviceData.data()));
+            }
+#endif
+
+            //----------------------------------------------------------------------------------------
+
+            xerr open(std::wstring_view FileName, access_types AccessTypes) noexcept override
+            {
+                assert(FileName.empty() == false);
+
+                std::array<char, PATH_MAX> Path;
+                if ( ToUTF8(Path, FileName) == false )
+                    return xerr::create<state::OPENING_FILE, "The file name is too long.">();
+
+                int Flags = O_CLOEXEC;
+                if (AccessTypes.m_bCreate)
+                {
+                    Flags |= O_RDWR | O_CREAT | O_TRUNC;
+                }
+                else
+                {
+                    Flags |= AccessTypes.m_bWrite ? O_RDWR : O_RDONLY;
+                }
+
+                // Read only files may get a handle that was left by a file that closed,
+                // files that are going to change make the cached handles go away
+                const bool bReadOnly = (Flags & O_ACCMODE) == O_RDONLY;
+                if (bReadOnly == false) m_pHandleCache->Invalidate(FileName);
+
+                // open the file (or create a new one)
+                int Handle = -1;
+                if (bReadOnly && m_pHandleCache->Acquire(FileName, m_CacheNode))
+                {
+                    Handle          = m_CacheNode->m_Handle;
+                    m_bCachedHandle = true;
+                }
+                else
+                {
+                    do
+                    {
+                        Handle = ::open(Path.data(), Flags, 0666);
+                    } while( Handle == -1 && errno == EINTR );
+
+                    if (Handle != -1 && bReadOnly) m_bCachedHandle = m_pHandleCache->Add(FileName, Handle, m_CacheNode);
+                }
+
+                if (Handle == -1)
+                {
+                    m_LastError = errno;
+                    switch (m_LastError)
+                    {
+                    case ENOENT:  return xerr::create<state::OPENING_FILE, "The system cannot find the file specified.">();
+                    case EPERM:
+                    case EACCES:  return xerr::create<state::OPENING_FILE, "Access is denied.">();
+                    case ENOTDIR: return xerr::create<state::OPENING_FILE, "The system cannot find the path specified.">();
+                    case EMFILE:
+                    case ENFILE:  return xerr::create<state::OPENING_FILE, "Too many open files.">();
+                    default:      return xerr::create<state::OPENING_FILE, "Unknown error.">();
+                    }
+                }
+
+                //
+                // Okay we are in business
+                //
+                m_Handle      = Handle;
+                m_AccessTypes = AccessTypes;
+                m_Position    = 0;
+                m_bEOF        = false;
+
+                // Async files use (and keep alive) the ring of the thread that opened them,
+                // if the kernel does not have io_uring the operations will simply be synchronous
+                m_pRing       = AccessTypes.m_bASync ? uring::getThreadRing() : nullptr;
+
+                // Memory mapped files (read only). If we can not map it we just fall back to regular reads
+                if (AccessTypes.m_bMemoryMap && AccessTypes.m_bWrite == false && m_pRing == nullptr)
+                {
+                    struct stat Stat;
+                    if (::fstat(m_Handle, &Stat) == 0 && S_ISREG(Stat.st_mode))
+                    {
+                        m_MapFileSize = static_cast<std::size_t>(Stat.st_size);
+                        m_bMapped     = (m_MapFileSize == 0) || !MapWindow(0);
+                    }
+                }
+
+                // done
+                return {};
+            }
+
+            //----------------------------------------------------------------------------------------
+
+            void close(void) noexcept override
+            {
+                // The kernel may still be using our buffers
+                if (m_pRing)
+                {
+                    (void)Synchronize(true);
+                    m_pRing.reset();
+                }
+
+                if (m_pMap) ::munmap(const_cast<std::byte*>(m_pMap), m_MapSize);
+
+                if (m_bCachedHandle)
+                {
+                    m_pHandleCache->Release(m_CacheNode);
+                }
+                else if (::close(m_Handle) == -1)
+                {
+                    m_LastError = errno;
+                }
+            }
+
+            //----------------------------------------------------------------------------------------
+
+            xerr Read(std::span<std::byte> View) noexcept override
+            {
+#if XFILE_IO_URING
+                if (m_pRing)
+                {
+                    QueueAsync(IORING_OP_READ, View);
+                    return xerr::create<state::INCOMPLETE, "Still reading">();
+                }
+#endif
+
+                if (m_bMapped) return ReadMapped(View);
+
+                std::size_t Done = 0;
+                while( Done < View.size() )
+                {
+                    const auto n = ::pread( m_Handle, &View[Done], View.size() - Done, static_cast<off_t>(m_Position + Done) );
+                    if (n > 0)
+                    {
+                        Done += static_cast<std::size_t>(n);
+                    }
+                    else if (n == 0)
+                    {
+                        // we have reached the end of the file
+                        m_Position += Done;
+                        m_bEOF      = true;
+                        return xerr::create<state::UNEXPECTED_EOF, "Unexpected End Of File while reading">();
+                    }
+                    else if (errno != EINTR)
+                    {
+                        m_LastError = errno;
+                        m_Position += Done;
+                        return xerr::create_f<state, "Error while reading">();
+                    }
+                }
+
+                m_Position += Done;
+                return {};
+            }
+
+            //----------------------------------------------------------------------------------------
+
+            xerr ReadMapped(std::span<std::byte> View) noexcept
+            {
+                std::size_t Done = 0;
+                while (Done < View.size())
+                {
+                    if (m_Position >= m_MapFileSize)
+                    {
+                        m_bEOF = true;
+                        return xerr::create<state::UNEXPECTED_EOF, "Unexpected End Of File while reading">();
+                    }
+
+                    if (auto Err = MapWindow(m_Position); Err)
+                        return Err;
+
+                    const auto Offset = m_Position - m_MapOffset;
+                    const auto Count  = std::min(View.size() - Done, m_MapSize - Offset);
+                    std::memcpy(&View[Done], m_pMap + Offset, Count);
+                    Done       += Count;
+                    m_Position += Count;
+                }
+
+                return {};
+            }
+
+            //----------------------------------------------------------------------------------------
+
+            xerr MapView(std::span<const std::byte>& View) noexcept override
+            {
+                View = {};
+                if (m_bMapped == false)
+                    return xerr::create<state::NOT_SUPPORTED, "The file is not memory mapped, open it with the 'm' mode">();
+
+                if (m_Position >= m_MapFileSize)
+                    return {};
+
+                if (auto Err = MapWindow(m_Position); Err)
+                    return Err;
+
+                const auto Offset = m_Position - m_MapOffset;
+                View = { m_pMap + Offset, m_MapSize - Offset };
+                return {};
+            }
+
+            //----------------------------------------------------------------------------------------
+
+            xerr ReadView(std::span<const std::byte>& View, std::size_t Count) noexcept override
+            {
+                View = {};
+                if (m_bMapped == false)
+                    return xerr::create<state::NOT_SUPPORTED, "The file is not memory mapped">();
+
+                if (m_Position + Count > m_MapFileSize)
+                {
+                    m_bEOF = true;
+                    return xerr::create<state::UNEXPECTED_EOF, "Unexpected End Of File while reading">();
+                }
+
+                if (auto Err = MapWindow(m_Position, Count); Err)
+                    return Err;
+
+                // Too big for a single window
+                if (m_Position + Count > m_MapOffset + m_MapSize)
+                    return xerr::create<state::NOT_SUPPORTED, "The view does not fit in the mapping window">();
+
+                View        = { m_pMap + (m_Position - m_MapOffset), Count };
+                m_Position += Count;
+                return {};
+            }
+
+            //----------------------------------------------------------------------------------------
+
+            xerr Write(const std::span<const std::byte> View) noexcept override
+            {
+#if XFILE_IO_URING
+                if (m_pRing)
+                {
+                    QueueAsync(IORING_OP_WRITE, View);
+                    return xerr::create<state::INCOMPLETE, "Still writing">();
+                }
+#endif
+
+                std::size_t Done = 0;
+                while (Done < View.size())
+                {
+                    const auto n = ::pwrite( m_Handle, &View[Done], View.size() - Done, static_cast<off_t>(m_Position + Done) );
+                    if (n >= 0)
+                    {
+                        Done += static_cast<std::size_t>(n);
+                    }
+                    else if (errno != EINTR)
+                    {
+                        m_LastError = errno;
+                        m_Position += Done;
+                        if (m_LastError == ENOSPC) return xerr::create_f<state, "No space left on the device while writing">();
+                        return xerr::create_f<state, "Error while writing">();
+                    }
+                }
+
+                m_Position += Done;
+                return {};
+            }
+
+            //----------------------------------------------------------------------------------------
+
+            xerr ReadV(std::span<const std::span<std::byte>> Views) noexcept override
+            {
+                if (m_pRing || m_bMapped) return device::instance::ReadV(Views);
+                return TransferV<false>(Views);
+            }
+
+            //----------------------------------------------------------------------------------------
+
+            xerr WriteV(std::span<const std::span<const std::byte>> Views) noexcept override
+            {
+                if (m_pRing) return device::instance::WriteV(Views);
+                return TransferV<true>(Views);
+            }
+
+            //----------------------------------------------------------------------------------------
+            // pread/pwrite at their own offset, the kernel keeps them apart so there is nothing to lock.
+            // Mapped and ring files go the same way (the mapping window and the ring belong to the cursor).
+            // m_LastError is not touched since several threads may be here.
+            //----------------------------------------------------------------------------------------
+
+            xerr ReadAt(std::size_t Offset, std::span<std::byte> View) noexcept override
+            {
+                std::size_t Done = 0;
+                while (Done < View.size())
+                {
+                    const auto n = ::pread( m_Handle, &View[Done], View.size() - Done, static_cast<off_t>(Offset + Done) );
+                    if (n > 0)
+                    {
+                        Done += static_cast<std::size_t>(n);
+                    }
+                    else if (n == 0)
+                    {
+                        return xerr::create<state::UNEXPECTED_EOF, "Unexpected End Of File while reading">();
+                    }
+                    else if (errno != EINTR)
+                    {
+                        return xerr::create_f<state, "Error while reading">();
+                    }
+                }
+
+                return {};
+            }
+
+            //----------------------------------------------------------------------------------------
+
+            xerr WriteAt(std::size_t Offset, std::span<const std::byte> View) noexcept override
+            {
+                std::size_t Done = 0;
+                while (Done < View.size())
+                {
+                    const auto n = ::pwrite( m_Handle, &View[Done], View.size() - Done, static_cast<off_t>(Offset + Done) );
+                    if (n >= 0)
+                    {
+                        Done += static_cast<std::size_t>(n);
+                    }
+                    else if (errno != EINTR)
+                    {
+                        if (errno == ENOSPC) return xerr::create_f<state, "No space left on the device while writing">();
+                        return xerr::create_f<state, "Error while writing">();
+                    }
+                }
+
+                return {};
+            }
+
+            //----------------------------------------------------------------------------------------
+            // preadv/pwritev with up to iov_batch_v views per call, short transfers continue
+            // from the middle of the view where they stopped
+            //----------------------------------------------------------------------------------------
+
+            template< bool T_WRITE_V, typename T_BYTE >
+            xerr TransferV(std::span<const std::span<T_BYTE>> Views) noexcept
+            {
+                constexpr std::size_t               iov_batch_v = 64;
+                std::array<iovec, iov_batch_v>      IOV;
+                std::size_t                         iView = 0;
+                std::size_t                         Skip  = 0;      // Bytes of Views[iView] already done
+
+                while (true)
+                {
+                    int nIOV = 0;
+                    for (std::size_t i = iView, s = Skip; i < Views.size() && nIOV < static_cast<int>(IOV.size()); ++i, s = 0)
+                    {
+                        if (Views[i].size() == s) continue;
+                        IOV[nIOV++] = { const_cast<std::byte*>(Views[i].data()) + s, Views[i].size() - s };
+                    }
+                    if (nIOV == 0) return {};
+
+                    const auto n = T_WRITE_V ? ::pwritev(m_Handle, IOV.data(), nIOV, static_cast<off_t>(m_Position))
+                                             : ::preadv (m_Handle, IOV.data(), nIOV, static_cast<off_t>(m_Position));
+                    if (n < 0)
+                    {
+                        if (errno == EINTR) continue;
+
+                        m_LastError = errno;
+                        if constexpr (T_WRITE_V)
+                        {
+                            if (m_LastError == ENOSPC) return xerr::create_f<state, "No space left on the device while writing">();
+                            return xerr::create_f<state, "Error while writing">();
+                        }
+                        else return xerr::create_f<state, "Error while reading">();
+                    }
+
+                    if (n == 0)
+                    {
+                        if constexpr (T_WRITE_V) return xerr::create_f<state, "Error while writing">();
+
+                        // we have reached the end of the file
+                        m_bEOF = true;
+                        return xerr::create<state::UNEXPECTED_EOF, "Unexpected End Of File while reading">();
+                    }
+
+                    m_Position += static_cast<std::size_t>(n);
+                    for (auto Left = static_cast<std::size_t>(n); Left; )
+                    {
+                        const auto Rest = Views[iView].size() - Skip;
+                        if (Left < Rest) { Skip += Left; Left = 0; }
+                        else             { Left -= Rest; Skip = 0; ++iView; }
+                    }
+                }
+            }
+
+            //----------------------------------------------------------------------------------------
+            // Copies between two files of this device without the data going through user space
+            //----------------------------------------------------------------------------------------
+
+            xerr CopyTo(device::instance& Dest, std::size_t Count) noexcept override
+            {
+#if defined(__linux__)
+                auto* pDest = dynamic_cast<small_file*>(&Dest);
+                if (pDest == nullptr || m_pRing || pDest->m_pRing)
+                    return device::instance::CopyTo(Dest, Count);
+
+                bool bUseSendFile = false;
+                for (std::size_t Done = 0; Done < Count; )
+                {
+                    auto In  = static_cast<off_t>(m_Position);
+                    auto Out = static_cast<off_t>(pDest->m_Position);
+
+                    ssize_t n;
+                    if (bUseSendFile)
+                    {
+                        // sendfile writes at the file offset of the destination
+                        n = ::lseek(pDest->m_Handle, Out, SEEK_SET) == -1 ? -1 : ::sendfile(pDest->m_Handle, m_Handle, &In, Count - Done);
+                    }
+                    else
+                    {
+                        n = ::copy_file_range(m_Handle, &In, pDest->m_Handle, &Out, Count - Done, 0);
+                    }
+
+                    if (n > 0)
+                    {
+                        Done               += static_cast<std::size_t>(n);
+                        m_Position         += static_cast<std::size_t>(n);
+                        pDest->m_Position  += static_cast<std::size_t>(n);
+                        continue;
+                    }
+
+                    if (n == 0)
+                    {
+                        m_bEOF = true;
+                        return xerr::create<state::UNEXPECTED_EOF, "Unexpected End Of File while reading">();
+                    }
+
+                    if (errno == EINTR) continue;
+
+                    // Older kernels (or file systems) can not do copy_file_range between these two files
+                    if (bUseSendFile == false && (errno == EXDEV || errno == ENOSYS || errno == EINVAL || errno == EOPNOTSUPP))
+                    {
+                        bUseSendFile = true;
+                        continue;
+                    }
+
+                    m_LastError = errno;
+                    if (Done == 0 && (errno == ENOSYS || errno == EINVAL)) 
+                        return device::instance::CopyTo(Dest, Count);
+
+                    return xerr::create_f<state, "Error while copying">();
+                }
+
+                return {};
+#else
+                return device::instance::CopyTo(Dest, Count);
+#endif
+            }
+
+            //----------------------------------------------------------------------------------------
+            // Async files put the request in the ring, sync files do it right away (still at its own offset)
+            //----------------------------------------------------------------------------------------
+
+            xerr ReadAsync(async_ticket& Ticket, std::span<std::byte> View, std::size_t Offset) noexcept override
+            {
+#if XFILE_IO_URING
+                if (m_pRing)
+                {
+                    QueueTicket(IORING_OP_READ, Ticket, View, Offset);
+                    return {};
+                }
+#endif
+                Ticket.Begin(*this, View.size());
+
+                auto        Result = async_ticket::result::OK;
+                std::size_t Done   = 0;
+                while (Done < View.size())
+                {
+                    const auto n = ::pread( m_Handle, &View[Done], View.size() - Done, static_cast<off_t>(Offset + Done) );
+                    if (n > 0)
+                    {
+                        Done += static_cast<std::size_t>(n);
+                    }
+                    else if (n == 0)
+                    {
+                        Result = async_ticket::result::UNEXPECTED_EOF;
+                        break;
+                    }
+                    else if (errno != EINTR)
+                    {
+                        m_LastError = errno;
+                        Result      = async_ticket::result::FAILURE;
+                        break;
+                    }
+                }
+
+                if (Ticket.Complete(Result, Done)) Ticket.RunCallback();
+                return {};
+            }
+
+            //----------------------------------------------------------------------------------------
+
+            xerr WriteAsync(async_ticket& Ticket, std::span<const std::byte> View, std::size_t Offset) noexcept override
+            {
+#if XFILE_IO_URING
+                if (m_pRing)
+                {
+                    QueueTicket(IORING_OP_WRITE, Ticket, View, Offset);
+                    return {};
+                }
+#endif
+                Ticket.Begin(*this, View.size());
+
+                auto        Result = async_ticket::result::OK;
+                std::size_t Done   = 0;
+                while (Done < View.size())
+                {
+                    const auto n = ::pwrite( m_Handle, &View[Done], View.size() - Done, static_cast<off_t>(Offset + Done) );
+                    if (n >= 0)
+                    {
+                        Done += static_cast<std::size_t>(n);
+                    }
+                    else if (errno != EINTR)
+                    {
+                        m_LastError = errno;
+                        Result      = async_ticket::result::FAILURE;
+                        break;
+                    }
+                }
+
+                if (Ticket.Complete(Result, Done)) Ticket.RunCallback();
+                return {};
+            }
+
+            //----------------------------------------------------------------------------------------
+
+            xerr Wait(async_ticket& Ticket, bool bBlock) noexcept override
+            {
+#if XFILE_IO_URING
+                if (m_pRing)
+                {
+                    std::vector<uring::completion*> Deferred;
+                    while (true)
+                    {
+                        {
+                            std::lock_guard Lk(m_pRing->m_Lock);
+                            m_pRing->Submit();
+                            m_pRing->Reap(bBlock && Ticket.m_Status.load(std::memory_order_acquire) == async_ticket::status::PENDING);
+                            m_pRing->TakeDeferred(Deferred);
+                        }
+                        uring::ring::RunDeferred(Deferred);
+
+                        const auto Status = Ticket.m_Status.load(std::memory_order_acquire);
+                        if (Status == async_ticket::status::DONE || bBlock == false) break;
+
+                        // Some other thread found it done and it is running its callback
+                        if (Status == async_ticket::status::COMPLETING) details::done_signal::Wait([&]{ return Ticket.m_Status.load(std::memory_order_acquire) != Status; });
+                    }
+                }
+#endif
+                return Ticket.getError();
+            }
+
+            //----------------------------------------------------------------------------------------
+
+            void Cancel(async_ticket& Ticket) noexcept override
+            {
+#if XFILE_IO_URING
+                if (m_pRing == nullptr) return;
+
+                std::vector<uring::completion*> Deferred;
+                {
+                    std::lock_guard Lk(m_pRing->m_Lock);
+                    if (Ticket.m_Status.load(std::memory_order_acquire) == async_ticket::status::PENDING) m_pRing->Cancel(&getRequest(Ticket));
+                    m_pRing->TakeDeferred(Deferred);
+                }
+                uring::ring::RunDeferred(Deferred);
+#endif
+            }
+
+            //----------------------------------------------------------------------------------------
+            // Zeros are not written, the part inside of the file becomes a hole and the part 
+            // past the end just extends the file (which reads as zeros)
+            //----------------------------------------------------------------------------------------
+
+            xerr WriteZero(std::size_t Count) noexcept override
+            {
+                if (m_pRing || m_bMapped) 
+                    return device::instance::WriteZero(Count);
+
+                struct stat Stat;
+                if (::fstat(m_Handle, &Stat) == -1)
+                {
+                    m_LastError = errno;
+                    return xerr::create_f<state, "Fail to get the length of the file">();
+                }
+
+                const auto FileSize = static_cast<std::size_t>(Stat.st_size);
+                const auto End      = m_Position + Count;
+
+                if (m_Position < FileSize)
+                {
+                    const auto Overlap = std::min(End, FileSize) - m_Position;
+#if defined(FALLOC_FL_PUNCH_HOLE)
+                    if (::fallocate(m_Handle, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, static_cast<off_t>(m_Position), static_cast<off_t>(Overlap)) == 0)
+                    {
+                        m_Position += Overlap;
+                    }
+                    else
+#endif
+                    {
+                        // The file system can not punch holes, write them
+                        if (auto Err = device::instance::WriteZero(Overlap); Err)
+                            return Err;
+                    }
+                }
+
+                if (End > FileSize && ::ftruncate(m_Handle, static_cast<off_t>(End)) == -1)
+                {
+                    m_LastError = errno;
+                    if (m_LastError == ENOSPC || m_LastError == EFBIG) return xerr::create_f<state, "No space left on the device while writing">();
+                    return xerr::create_f<state, "Error while writing">();
+                }
+
+                m_Position = End;
+                return {};
+            }
+
+            //----------------------------------------------------------------------------------------
+
+            xerr Seek(seek_mode Mode, std::size_t Pos) noexcept override
+            {
+                // Note that offsets are allowed to wrap around so that negative numbers work as expected
+                switch (Mode)
+                {
+                case SKM_ORIGIN: m_Position  = Pos; break;
+                case SKM_CURENT: m_Position += Pos; break;
+                case SKM_END:
+                {
+                    std::size_t L;
+                    if (auto Err = Length(L); Err)
+                        return Err;
+                    m_Position = L + Pos;
+                    break;
+                }
+                default: assert(false); break;
+                }
+
+                m_bEOF = false;
+                return {};
+            }
+
+            //----------------------------------------------------------------------------------------
+
+            xerr Tell(std::size_t& Pos) noexcept override
+            {
+                Pos = m_Position;
+                return {};
+            }
+
+            //----------------------------------------------------------------------------------------
+
+            void Flush ( void ) noexcept override
+            {
+                // There is not user space buffering in this device, the data is already in the kernel after each pwrite.
+                // For async files we make sure all the operations are done.
+                if (m_pRing) (void)Synchronize(true);
+            }
+
+            //----------------------------------------------------------------------------------------
+
+            xerr Length(std::size_t& Length) noexcept override
+            {
+                // Pending writes may change the size of the file
+                if (m_nPending.load(std::memory_order_acquire))
+                {
+                    if (auto Err = Synchronize(true); Err && Err.getState<state>() != state::UNEXPECTED_EOF)
+                        return Err;
+                }
+
+                if (m_bMapped)
+                {
+                    Length = m_MapFileSize;
+                    return {};
+                }
+
+                struct stat Stat;
+                if (::fstat(m_Handle, &Stat) == -1)
+                {
+                    m_LastError = errno;
+                    return xerr::create_f<state, "Fail to get the length of the file">();
+                }
+
+                Length = static_cast<std::size_t>(Stat.st_size);
+                return {};
+            }
+
+            //----------------------------------------------------------------------------------------
+
+            bool isEOF(void) noexcept override
+            {
+                if (m_nPending.load(std::memory_order_acquire))
+                {
+                    if (auto Err = Synchronize(true); Err)
+                    {
+                        if (Err.getState<state>() == state::INCOMPLETE) return false;
+                        Err.clear();
+                    }
+                }
+
+                return m_bEOF;
+            }
+
+            //----------------------------------------------------------------------------------------
+
+            xerr Synchronize(bool bBlock) noexcept override
+            {
+                // Sync files have all their operations completed by the time Read/Write returns
+                if (m_pRing == nullptr) return {};
+
+#if XFILE_IO_URING
+                std::vector<uring::completion*> Deferred;
+                int                             Error = 0;
+                do
+                {
+                    {
+                        std::lock_guard Lk(m_pRing->m_Lock);
+
+                        m_pRing->Reap(false);
+                        while (bBlock && m_nPending.load(std::memory_order_acquire))
+                        {
+                            m_pRing->Submit();
+                            m_pRing->Reap(true);
+                        }
+                        m_pRing->TakeDeferred(Deferred);
+
+                        // Report the first failure (only once)
+                        if (m_nPending.load(std::memory_order_acquire) == 0)
+                        {
+                            if (Error == 0) Error = m_AsyncError;
+                            m_AsyncError = 0;
+                        }
+                    }
+
+                    // The callbacks of the tickets may make new requests
+                    uring::ring::RunDeferred(Deferred);
+
+                } while (bBlock && m_nPending.load(std::memory_order_acquire));
+
+                if (m_nPending.load(std::memory_order_acquire))
+                    return xerr::create<state::INCOMPLETE, "Incomplete">();
+
+                if (Error == EOF)
+                {
+                    m_bEOF = true;
+                    return xerr::create<state::UNEXPECTED_EOF, "Unexpected end of file">();
+                }
+
+                if (Error == -ECANCELED)
+                {
+                    return xerr::create_f<state, "Operation Aborted">();
+                }
+
+                if (Error < 0)
+                {
+                    m_LastError = -Error;
+                    return xerr::create_f<state, "Unknown Error">();
+                }
+#endif
+                return {};
+            }
+
+            //----------------------------------------------------------------------------------------
+            // Without io_uring the stream runs our operations in its IO threads
+            //----------------------------------------------------------------------------------------
+
+            bool isAsync(void) noexcept override
+            {
+                return m_pRing != nullptr;
+            }
+
+            //----------------------------------------------------------------------------------------
+
+            void AsyncAbort(void) noexcept override
+            {
+#if XFILE_IO_URING
+                if (m_pRing == nullptr || m_nPending.load(std::memory_order_acquire) == 0) return;
+
+                std::vector<uring::completion*> Deferred;
+                {
+                    std::lock_guard Lk(m_pRing->m_Lock);
+                    m_pRing->Cancel(this);
+                    m_pRing->TakeDeferred(Deferred);
+                }
+                uring::ring::RunDeferred(Deferred);
+#endif
+            }
+        };
+
+        instance_pool<small_file>       m_FileHPool;
+        handle_cache                    m_HandleCache;
+
+        //----------------------------------------------------------------------------------------
+
+        void Init(const void*) noexcept override
+        {
+            // Nothing to do...
+        }
+
+        //----------------------------------------------------------------------------------------
+
+        xerr setHandleCache(std::size_t MaxHandles) noexcept override
+        {
+            m_HandleCache.setMaxIdle(MaxHandles);
+            return {};
+        }
+
+        //----------------------------------------------------------------------------------------
+
+        std::uint64_t getHandleCacheHits(void) noexcept override
+        {
+            return m_HandleCache.getHits();
+        }
+
+        //----------------------------------------------------------------------------------------
+
+        xerr deleteFile(std::wstring_view FileName) noexcept override
+        {
+            std::array<char, PATH_MAX> Path;
+            if (ToUTF8(Path, FileName) == false)
+                return xerr::create<state::OPENING_FILE, "The file name is too long.">();
+
+            m_HandleCache.Invalidate(FileName);
+
+            if (::unlink(Path.data()) == -1)
+            {
+                switch (errno)
+                {
+                case ENOENT:  return xerr::create<state::OPENING_FILE, "The system cannot find the file specified.">();
+                case EPERM:
+                case EACCES:  return xerr::create<state::OPENING_FILE, "Access is denied.">();
+                default:      return xerr::create_f<state, "Fail to delete the file">();
+                }
+            }
+
+            return {};
+        }
+
+        //----------------------------------------------------------------------------------------
+
+        void Kill(void) noexcept override
+        {
+            m_FileHPool.ForEachInUse([](auto&)
+            {
+                // This should have been freed
+                assert(false);
+            });
+
+            m_HandleCache.Clear();
+        }
+
+        //----------------------------------------------------------------------------------------
+
+        instance* createInstance(void) noexcept override
+        {
+            // Returns nullptr when we run out of handles
+            auto pFile = m_FileHPool.Alloc();
+            if (pFile) pFile->m_pHandleCache = &m_HandleCache;
+            return pFile;
+        }
+
+        //----------------------------------------------------------------------------------------
+
+        void destroyInstance(instance& Instance) noexcept override
+        {
+            auto& SmallFile = static_cast<small_file&>(Instance);
+
+            // OK we can officially free everything from our entry
+            SmallFile.clear();
+
+            m_FileHPool.Free(SmallFile);
+        }
+    };
+
+    //
+    // Registration functions... here we create the device as well as we register with the file system
+    // Note that drive-less paths and temp: are resolved into '/' rooted paths before they reach the device list.
+    //
+    static xfile::driver::posix::device     s_PosixDevice;
+    static device::registration             s_PosixDeviceRegistration("PosixDevice", s_PosixDevice, "/:");
+}
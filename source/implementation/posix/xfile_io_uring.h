@@ -0,0 +1,521 @@
+
+#if __has_include(<linux/io_uring.h>)
+    #include <linux/io_uring.h>
+    #include <sys/mman.h>
+    #include <sys/syscall.h>
+    #include <sys/uio.h>
+    #include <sys/epoll.h>
+    #include <sys/eventfd.h>
+    #include <cstring>
+    #include <algorithm>
+    #include <memory>
+    #include <mutex>
+    #include <thread>
+    #include <vector>
+    #define XFILE_IO_URING 1
+#else
+    #define XFILE_IO_URING 0
+#endif
+
+//------------------------------------------------------------------------------
+// Description:
+//      Minimal io_uring engine (no liburing needed) used by the posix device for
+//      the '@' mode. Each thread gets its own ring which is shared by all the files
+//      that were opened in that thread. Those files keep a reference to the ring, so it
+//      outlives the thread if they are still open when it ends. Any number of operations (up to the ring size)
+//      can be in flight at their own offsets, and all the entries that are queued
+//      before an io_uring_enter go to the kernel as a single batch.
+//      Note that files opened in one thread can still be used in another thread since
+//      each ring is protected by a (mostly uncontended) lock.
+//      Rings that have requests with callbacks (coroutines included) are also watched by
+//      the reaper thread, which gets woken by the kernel (eventfd) when something completes
+//      so nobody has to poll for them.
+//------------------------------------------------------------------------------
+namespace xfile::driver::posix::uring
+{
+    // Anything that wants to know when an operation has finished
+    struct completion
+    {
+        // Result is the number of bytes transferred or -errno
+        virtual void onComplete( std::int32_t Result, std::uint32_t Expected ) noexcept = 0;
+
+        // Work that onComplete left for after the lock is released (see ring::Defer)
+        virtual void onDeferred( void ) noexcept {}
+    };
+
+#if XFILE_IO_URING
+
+    struct ring
+    {
+        constexpr static std::uint32_t  entries_v       = 256;
+        constexpr static std::uint32_t  max_op_bytes_v  = 1u << 30;     // Bigger transfers are split in several entries
+
+        struct op
+        {
+            completion*     m_pTarget   { nullptr };
+            std::uint32_t   m_Expected  { 0 };
+        };
+
+        //------------------------------------------------------------------------------
+
+        inline ~ring( void ) noexcept;
+        inline void Watch( void ) noexcept;
+
+        //------------------------------------------------------------------------------
+        // Called by the reaper thread when the kernel lets it know that there are completions
+        //------------------------------------------------------------------------------
+        void onNotify( std::vector<completion*>& Deferred ) noexcept
+        {
+            eventfd_t Count;
+            (void)::eventfd_read(m_EventFd, &Count);
+
+            std::lock_guard Lk(m_Lock);
+            Reap(false);
+            TakeDeferred(Deferred);
+        }
+
+        //------------------------------------------------------------------------------
+
+        void Release( void ) noexcept
+        {
+            if (m_Fd == -1) return;
+
+            // We can not leave the kernel writing into memory that may be freed
+            {
+                std::unique_lock Lk(m_Lock);
+                Drain(Lk);
+            }
+
+            if (m_pSQEs)                                ::munmap(m_pSQEs, m_SQEsSize);
+            if (m_pCQRing && m_pCQRing != m_pSQRing)    ::munmap(m_pCQRing, m_CQRingSize);
+            if (m_pSQRing)                              ::munmap(m_pSQRing, m_SQRingSize);
+            if (m_EventFd != -1)                        ::close(m_EventFd);
+            ::close(m_Fd);
+        }
+
+        //------------------------------------------------------------------------------
+
+        bool Init( void ) noexcept
+        {
+            io_uring_params Params{};
+            m_Fd = static_cast<int>(::syscall(__NR_io_uring_setup, entries_v, &Params));
+            if (m_Fd < 0)
+            {
+                m_Fd = -1;
+                return false;
+            }
+
+            m_SQRingSize = Params.sq_off.array + Params.sq_entries * sizeof(std::uint32_t);
+            m_CQRingSize = Params.cq_off.cqes  + Params.cq_entries * sizeof(io_uring_cqe);
+            if (Params.features & IORING_FEAT_SINGLE_MMAP) m_SQRingSize = m_CQRingSize = std::max(m_SQRingSize, m_CQRingSize);
+
+            m_pSQRing = ::mmap(nullptr, m_SQRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_Fd, IORING_OFF_SQ_RING);
+            if (m_pSQRing == MAP_FAILED) { m_pSQRing = nullptr; return false; }
+
+            if (Params.features & IORING_FEAT_SINGLE_MMAP)
+            {
+                m_pCQRing = m_pSQRing;
+            }
+            else
+            {
+                m_pCQRing = ::mmap(nullptr, m_CQRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_Fd, IORING_OFF_CQ_RING);
+                if (m_pCQRing == MAP_FAILED) { m_pCQRing = nullptr; return false; }
+            }
+
+            m_SQEsSize = Params.sq_entries * sizeof(io_uring_sqe);
+            m_pSQEs    = static_cast<io_uring_sqe*>(::mmap(nullptr, m_SQEsSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_Fd, IORING_OFF_SQES));
+            if (m_pSQEs == MAP_FAILED) { m_pSQEs = nullptr; return false; }
+
+            auto* pSQ = static_cast<std::byte*>(m_pSQRing);
+            auto* pCQ = static_cast<std::byte*>(m_pCQRing);
+            m_pSQHead   = reinterpret_cast<std::uint32_t*>(pSQ + Params.sq_off.head);
+            m_pSQTail   = reinterpret_cast<std::uint32_t*>(pSQ + Params.sq_off.tail);
+            m_SQMask    = *reinterpret_cast<std::uint32_t*>(pSQ + Params.sq_off.ring_mask);
+            m_pSQArray  = reinterpret_cast<std::uint32_t*>(pSQ + Params.sq_off.array);
+            m_pCQHead   = reinterpret_cast<std::uint32_t*>(pCQ + Params.cq_off.head);
+            m_pCQTail   = reinterpret_cast<std::uint32_t*>(pCQ + Params.cq_off.tail);
+            m_CQMask    = *reinterpret_cast<std::uint32_t*>(pCQ + Params.cq_off.ring_mask);
+            m_pCQEs     = reinterpret_cast<io_uring_cqe*>(pCQ + Params.cq_off.cqes);
+            m_nSQEntries = Params.sq_entries;
+
+            // The operation table is never bigger than what the completion queue can hold
+            m_Ops.resize(Params.sq_entries);
+            m_FreeOps.reserve(Params.sq_entries);
+            for (std::uint32_t i = Params.sq_entries; i--; ) m_FreeOps.push_back(i);
+
+            return true;
+        }
+
+        //------------------------------------------------------------------------------
+        // Adds an operation to the submission queue. Must be called with the lock taken.
+        // If the ring is full it waits for some operations to finish.
+        //------------------------------------------------------------------------------
+        void Queue( std::uint8_t OpCode, int Fd, const void* pData, std::uint32_t Size, std::uint64_t Offset, completion* pTarget ) noexcept
+        {
+            while (m_FreeOps.empty() || (m_SQTail - std::atomic_ref(*m_pSQHead).load(std::memory_order_acquire)) == m_nSQEntries)
+            {
+                Submit();
+                Reap(true);
+            }
+
+            const auto iOp = m_FreeOps.back();
+            m_FreeOps.pop_back();
+            m_Ops[iOp] = { pTarget, Size };
+
+            const auto  Index = m_SQTail & m_SQMask;
+            auto&       SQE   = m_pSQEs[Index];
+            std::memset(&SQE, 0, sizeof(SQE));
+            SQE.opcode      = OpCode;
+            SQE.fd          = Fd;
+            SQE.addr        = reinterpret_cast<std::uint64_t>(pData);
+            SQE.len         = Size;
+            SQE.off         = Offset;
+            SQE.user_data   = iOp;
+
+            // Use the registered buffers when we can, saves the kernel from pinning the pages every time
+            if (OpCode == IORING_OP_READ || OpCode == IORING_OP_WRITE)
+            {
+                const auto* pBegin = static_cast<const std::byte*>(pData);
+                for (std::size_t i = 0; i < m_Buffers.size(); ++i)
+                {
+                    const auto* pBuffer = static_cast<const std::byte*>(m_Buffers[i].iov_base);
+                    if (pBegin >= pBuffer && pBegin + Size <= pBuffer + m_Buffers[i].iov_len)
+                    {
+                        SQE.opcode    = (OpCode == IORING_OP_READ) ? IORING_OP_READ_FIXED : IORING_OP_WRITE_FIXED;
+                        SQE.buf_index = static_cast<std::uint16_t>(i);
+                        break;
+                    }
+                }
+            }
+
+            m_pSQArray[Index] = Index;
+            ++m_SQTail;
+            ++m_nToSubmit;
+        }
+
+        //------------------------------------------------------------------------------
+        // Asks the kernel to cancel all the operations that belong to a target
+        //------------------------------------------------------------------------------
+        void Cancel( completion* pTarget ) noexcept
+        {
+            for (std::size_t i = 0; i < m_Ops.size(); ++i)
+            {
+                if (m_Ops[i].m_pTarget != pTarget) continue;
+
+                // Make sure this operation is still in flight
+                if (std::find(m_FreeOps.begin(), m_FreeOps.end(), static_cast<std::uint32_t>(i)) != m_FreeOps.end()) continue;
+
+                Queue(IORING_OP_ASYNC_CANCEL, -1, reinterpret_cast<const void*>(static_cast<std::uintptr_t>(i)), 0, 0, nullptr);
+            }
+            Submit();
+        }
+
+        //------------------------------------------------------------------------------
+        // Sends all the queued entries to the kernel in one call. Must be called with the lock taken.
+        //------------------------------------------------------------------------------
+        int Submit( void ) noexcept
+        {
+            if (m_nToSubmit == 0) return 0;
+
+            std::atomic_ref(*m_pSQTail).store(m_SQTail, std::memory_order_release);
+
+            int n;
+            do
+            {
+                n = static_cast<int>(::syscall(__NR_io_uring_enter, m_Fd, m_nToSubmit, 0, 0, nullptr, 0));
+            } while (n < 0 && errno == EINTR);
+
+            if (n > 0) m_nToSubmit -= static_cast<std::uint32_t>(n);
+            return n;
+        }
+
+        //------------------------------------------------------------------------------
+        // Dispatches all the completions. If bBlock it waits for at least one of them.
+        // Must be called with the lock taken.
+        //------------------------------------------------------------------------------
+        void Reap( bool bBlock ) noexcept
+        {
+            auto Head = *m_pCQHead;
+            auto Tail = std::atomic_ref(*m_pCQTail).load(std::memory_order_acquire);
+
+            if (Head == Tail && bBlock && m_FreeOps.size() != m_Ops.size())
+            {
+                int n;
+                do
+                {
+                    n = static_cast<int>(::syscall(__NR_io_uring_enter, m_Fd, m_nToSubmit, 1, IORING_ENTER_GETEVENTS, nullptr, 0));
+                } while (n < 0 && errno == EINTR);
+
+                if (n > 0) m_nToSubmit -= std::min<std::uint32_t>(m_nToSubmit, static_cast<std::uint32_t>(n));
+                Tail = std::atomic_ref(*m_pCQTail).load(std::memory_order_acquire);
+            }
+
+            for ( ; Head != Tail; ++Head )
+            {
+                const auto& CQE = m_pCQEs[Head & m_CQMask];
+                const auto  iOp = static_cast<std::uint32_t>(CQE.user_data);
+                const auto  Op  = m_Ops[iOp];
+
+                m_Ops[iOp] = {};
+                m_FreeOps.push_back(iOp);
+
+                if (Op.m_pTarget) Op.m_pTarget->onComplete(CQE.res, Op.m_Expected);
+            }
+
+            std::atomic_ref(*m_pCQHead).store(Head, std::memory_order_release);
+        }
+
+        //------------------------------------------------------------------------------
+        // Completions call it from onComplete when they have work to do without the lock
+        // (like user callbacks that may queue more operations). Must be called with the lock taken.
+        //------------------------------------------------------------------------------
+        void Defer( completion& Target ) noexcept
+        {
+            m_Deferred.push_back(&Target);
+        }
+
+        //------------------------------------------------------------------------------
+        // Hands over the deferred completions, the caller calls RunDeferred with them once
+        // it releases the lock. Must be called with the lock taken.
+        //------------------------------------------------------------------------------
+        void TakeDeferred( std::vector<completion*>& List ) noexcept
+        {
+            if (m_Deferred.empty()) return;
+            List.insert(List.end(), m_Deferred.begin(), m_Deferred.end());
+            m_Deferred.clear();
+        }
+
+        //------------------------------------------------------------------------------
+
+        static void RunDeferred( std::vector<completion*>& List ) noexcept
+        {
+            for (auto* p : List) p->onDeferred();
+            List.clear();
+        }
+
+        //------------------------------------------------------------------------------
+        // Waits for all the operations, including the ones that the deferred work queues.
+        // Lk must hold the lock, it is released while the deferred work runs.
+        //------------------------------------------------------------------------------
+        void Drain( std::unique_lock<std::mutex>& Lk ) noexcept
+        {
+            std::vector<completion*> Deferred;
+            while (true)
+            {
+                Submit();
+                while (m_FreeOps.size() != m_Ops.size()) Reap(true);
+                if (m_Deferred.empty()) return;
+
+                TakeDeferred(Deferred);
+                Lk.unlock();
+                RunDeferred(Deferred);
+                Lk.lock();
+            }
+        }
+
+        //------------------------------------------------------------------------------
+        // Registers (or unregisters when empty) the fixed buffers. Waits for all operations first.
+        //------------------------------------------------------------------------------
+        xerr RegisterBuffers( std::span<const std::span<std::byte>> Buffers ) noexcept
+        {
+            std::unique_lock Lk(m_Lock);
+            Drain(Lk);
+
+            if (m_Buffers.empty() == false)
+            {
+                ::syscall(__NR_io_uring_register, m_Fd, IORING_UNREGISTER_BUFFERS, nullptr, 0);
+                m_Buffers.clear();
+            }
+
+            if (Buffers.empty()) return {};
+
+            for (auto& B : Buffers) m_Buffers.push_back({ B.data(), B.size() });
+            if (::syscall(__NR_io_uring_register, m_Fd, IORING_REGISTER_BUFFERS, m_Buffers.data(), static_cast<unsigned>(m_Buffers.size())) < 0)
+            {
+                m_Buffers.clear();
+                return xerr::create_f<state, "Fail to register the buffers with io_uring">();
+            }
+
+            return {};
+        }
+
+        //------------------------------------------------------------------------------
+
+        std::mutex                  m_Lock          {};
+        int                         m_Fd            { -1 };
+        void*                       m_pSQRing       { nullptr };
+        void*                       m_pCQRing       { nullptr };
+        io_uring_sqe*               m_pSQEs         { nullptr };
+        std::size_t                 m_SQRingSize    { 0 };
+        std::size_t                 m_CQRingSize    { 0 };
+        std::size_t                 m_SQEsSize      { 0 };
+        std::uint32_t*              m_pSQHead       { nullptr };
+        std::uint32_t*              m_pSQTail       { nullptr };
+        std::uint32_t*              m_pSQArray      { nullptr };
+        std::uint32_t               m_SQMask        { 0 };
+        std::uint32_t               m_SQTail        { 0 };      // Local copy of the tail, published at Submit
+        std::uint32_t               m_nSQEntries    { 0 };
+        std::uint32_t               m_nToSubmit     { 0 };
+        std::uint32_t*              m_pCQHead       { nullptr };
+        std::uint32_t*              m_pCQTail       { nullptr };
+        std::uint32_t               m_CQMask        { 0 };
+        io_uring_cqe*               m_pCQEs         { nullptr };
+        std::vector<op>             m_Ops           {};
+        std::vector<std::uint32_t>  m_FreeOps       {};
+        std::vector<iovec>          m_Buffers       {};
+        std::vector<completion*>    m_Deferred      {};
+        int                         m_EventFd       { -1 };     // Signaled by the kernel on completions once the ring is watched
+        std::once_flag              m_WatchOnce     {};
+    };
+
+    //------------------------------------------------------------------------------
+    // Thread that collects the completions of the watched rings as soon as the kernel
+    // posts them, and runs the deferred work (callbacks) of those completions.
+    //------------------------------------------------------------------------------
+    struct reaper
+    {
+        // Never destroyed, rings of threads that end late may still need it
+        static reaper& getInstance( void ) noexcept
+        {
+            static reaper* s_pReaper = new reaper;
+            return *s_pReaper;
+        }
+
+        //------------------------------------------------------------------------------
+
+        reaper( void ) noexcept
+        {
+            m_EpollFd = ::epoll_create1(EPOLL_CLOEXEC);
+            if (m_EpollFd != -1) std::thread([this] { Loop(); }).detach();
+        }
+
+        //------------------------------------------------------------------------------
+
+        bool Watch( ring& Ring ) noexcept
+        {
+            std::lock_guard Lk(m_Lock);
+
+            epoll_event Event{};
+            Event.events   = EPOLLIN;
+            Event.data.ptr = &Ring;
+            if (m_EpollFd == -1 || ::epoll_ctl(m_EpollFd, EPOLL_CTL_ADD, Ring.m_EventFd, &Event) == -1)
+                return false;
+
+            m_Rings.push_back(&Ring);
+            return true;
+        }
+
+        //------------------------------------------------------------------------------
+        // Once it returns the reaper will not touch the ring again
+        //------------------------------------------------------------------------------
+        void Unwatch( ring& Ring ) noexcept
+        {
+            std::lock_guard Lk(m_Lock);
+            if (std::erase(m_Rings, &Ring)) ::epoll_ctl(m_EpollFd, EPOLL_CTL_DEL, Ring.m_EventFd, nullptr);
+        }
+
+        //------------------------------------------------------------------------------
+
+        void Loop( void ) noexcept
+        {
+            std::array<epoll_event, 16>     Events;
+            std::vector<completion*>        Deferred;
+            while (true)
+            {
+                const int n = ::epoll_wait(m_EpollFd, Events.data(), static_cast<int>(Events.size()), -1);
+                if (n < 0)
+                {
+                    if (errno == EINTR) continue;
+                    return;
+                }
+
+                {
+                    std::lock_guard Lk(m_Lock);
+                    for (int i = 0; i < n; ++i)
+                    {
+                        // The ring may be gone by now
+                        auto* pRing = static_cast<ring*>(Events[i].data.ptr);
+                        if (std::find(m_Rings.begin(), m_Rings.end(), pRing) != m_Rings.end()) pRing->onNotify(Deferred);
+                    }
+                }
+
+                ring::RunDeferred(Deferred);
+            }
+        }
+
+        //------------------------------------------------------------------------------
+
+        std::mutex                  m_Lock      {};
+        int                         m_EpollFd   { -1 };
+        std::vector<ring*>          m_Rings     {};
+    };
+
+    //------------------------------------------------------------------------------
+
+    inline
+    ring::~ring( void ) noexcept
+    {
+        if (m_EventFd != -1) reaper::getInstance().Unwatch(*this);
+        Release();
+    }
+
+    //------------------------------------------------------------------------------
+    // Lets the reaper collect the completions of this ring. Call it without the lock.
+    //------------------------------------------------------------------------------
+    inline
+    void ring::Watch( void ) noexcept
+    {
+        std::call_once(m_WatchOnce, [this]
+        {
+            const int EventFd = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+            if (EventFd == -1) return;
+
+            if (::syscall(__NR_io_uring_register, m_Fd, IORING_REGISTER_EVENTFD, &EventFd, 1) < 0)
+            {
+                ::close(EventFd);
+                return;
+            }
+
+            m_EventFd = EventFd;
+            if (reaper::getInstance().Watch(*this) == false)
+            {
+                ::syscall(__NR_io_uring_register, m_Fd, IORING_UNREGISTER_EVENTFD, nullptr, 0);
+                ::close(EventFd);
+                m_EventFd = -1;
+            }
+        });
+    }
+
+    //------------------------------------------------------------------------------
+    // Returns the ring of the calling thread or nullptr if the kernel does not support io_uring.
+    // The thread holds one reference, the files that use the ring hold the others.
+    //------------------------------------------------------------------------------
+    inline
+    std::shared_ptr<ring> getThreadRing( void ) noexcept
+    {
+        struct thread_ring
+        {
+            thread_ring() noexcept
+            {
+                m_pRing = std::make_shared<ring>();
+                if (m_pRing->Init() == false) m_pRing.reset();
+            }
+
+            std::shared_ptr<ring>   m_pRing {};
+        };
+
+        thread_local thread_ring ThreadRing;
+        return ThreadRing.m_pRing;
+    }
+
+#else
+
+    struct ring
+    {
+        xerr RegisterBuffers( std::span<const std::span<std::byte>> ) noexcept { return {}; }
+    };
+
+    inline std::shared_ptr<ring> getThreadRing( void ) noexcept { return {}; }
+
+#endif
+}
@@ -4,30 +4,59 @@
 
 namespace xfile::driver::windows
 {
+    //------------------------------------------------------------------------------
+
+    inline
+    void CloseFileHandle( HANDLE Handle ) noexcept
+    {
+        (void)::CloseHandle(Handle);
+    }
+
+    //------------------------------------------------------------------------------
+
     struct device final : public xfile::device
     {
-        struct next
-        {
-            std::int16_t    m_iNext;
-            std::uint16_t   m_Counter;
-        };
+        using handle_cache = driver::handle_cache<HANDLE, &CloseFileHandle>;
 
         struct alignas(std::atomic<void*>) small_file : device::instance
         {
             HANDLE                      m_Handle            {};
-            OVERLAPPED                  m_Overlapped        {};
+            OVERLAPPED                  m_Overlapped        {};         // Its offset is the cursor, the pointer of the OS is never used
             access_types                m_AccessTypes       {};
-            std::int16_t                m_iNext             {};
             bool                        m_bIOPending        { false };
             std::wstring                m_LastError         {};
+            std::vector<async_ticket*>  m_Tickets           {};         // Requests in flight that are collected by Wait/Synchronize
+            std::atomic<std::uint32_t>  m_nWaitTickets      { 0 };      // Requests in flight that are collected by the thread pool (callbacks)
+            handle_cache*               m_pHandleCache      { nullptr };// Cache of the device, set when the instance is created
+            handle_cache::node          m_CacheNode         {};         // Entry of m_Handle in the cache
+            bool                        m_bCachedHandle     { false };  // m_Handle goes back to the cache on close
 
             void clear()
             {
+                m_CacheNode     = {};
+                m_bCachedHandle = false;
                 m_Handle        = {};
                 m_Overlapped    = {};
                 m_AccessTypes   = {};
                 m_bIOPending    = false;
                 m_LastError     = {};
+                m_Tickets.clear();
+                m_nWaitTickets  = 0;
+            }
+
+            // Lives inside of the async_ticket while its request is in flight
+            struct ticket_request
+            {
+                OVERLAPPED                  m_Overlapped        {};
+                HANDLE                      m_hWait             { nullptr };    // Wait on the event registered with the thread pool
+                small_file*                 m_pFile             { nullptr };
+            };
+
+            static_assert(sizeof(ticket_request) <= sizeof(async_ticket::m_DeviceData));
+
+            static ticket_request& getRequest( async_ticket& Ticket ) noexcept
+            {
+                return *std::launder(reinterpret_cast<ticket_request*>(Ticket.m_DeviceData.data()));
             }
 
             //----------------------------------------------------------------------------------------
@@ -84,8 +113,24 @@ namespace xfile::driver::windows
                     AttrFlags = FILE_ATTRIBUTE_NORMAL;
                 }
 
+                // Read only (sync) files may get a handle that was left by a file that closed,
+                // files that are going to change make the cached handles go away
+                const bool bCacheable = (FileMode & GENERIC_WRITE) == 0 && AccessTypes.m_bASync == false;
+                if (FileMode & GENERIC_WRITE) m_pHandleCache->Invalidate(FileName);
+
                 // open the file (or create a new one)
-                HANDLE Handle = CreateFile(FileName.data(), FileMode, ShareType, nullptr, Disposition, AttrFlags, nullptr);
+                HANDLE Handle = INVALID_HANDLE_VALUE;
+                if (bCacheable && m_pHandleCache->Acquire(FileName, m_CacheNode))
+                {
+                    Handle          = m_CacheNode->m_Handle;
+                    m_bCachedHandle = true;
+                }
+                else
+                {
+                    Handle = CreateFile(FileName.data(), FileMode, ShareType, nullptr, Disposition, AttrFlags, nullptr);
+                    if (Handle != INVALID_HANDLE_VALUE && bCacheable) m_bCachedHandle = m_pHandleCache->Add(FileName, Handle, m_CacheNode);
+                }
+
                 if (Handle == INVALID_HANDLE_VALUE)
                 {
                     DWORD errorCode = GetLastError();
@@ -124,9 +169,18 @@ namespace xfile::driver::windows
 
             void close(void) noexcept override
             {
+                // The kernel may still be using the buffers of the tickets
+                (void)CollectTickets(true);
+
                 //
-                // Close the handle
+                // Close the handle (or give it back to the cache)
                 //
+                if (m_bCachedHandle)
+                {
+                    m_pHandleCache->Release(m_CacheNode);
+                    return;
+                }
+
                 if (!CloseHandle(m_Handle))
                 {
                     DWORD errorCode = GetLastError();
@@ -135,6 +189,24 @@ namespace xfile::driver::windows
                 }
             }
 
+            //----------------------------------------------------------------------------------------
+            // Every ReadFile/WriteFile goes with an offset, so even sync handles move the pointer of
+            // the OS as a side effect (ReadAt/WriteAt included). The cursor lives in m_Overlapped instead.
+            //----------------------------------------------------------------------------------------
+
+            std::size_t getCursor( void ) const noexcept
+            {
+                return static_cast<std::size_t>((static_cast<std::uint64_t>(m_Overlapped.OffsetHigh) << 32) | m_Overlapped.Offset);
+            }
+
+            //----------------------------------------------------------------------------------------
+
+            void setCursor( std::size_t Cursor ) noexcept
+            {
+                m_Overlapped.Offset     = static_cast<DWORD>(Cursor);
+                m_Overlapped.OffsetHigh = static_cast<DWORD>(static_cast<std::uint64_t>(Cursor) >> 32);
+            }
+
             //----------------------------------------------------------------------------------------
 
             xerr Read(std::span<std::byte> View) noexcept override
@@ -150,10 +222,7 @@ namespace xfile::driver::windows
                                                     , &m_Overlapped);
 
                 // Set the file pointer (We assume we didn't make any errors)
-                //if( File.m_Flags&xfile_device_i::ACC_ASYNC) 
-                {
-                    m_Overlapped.Offset += Count;
-                }
+                setCursor(getCursor() + Count);
 
                 if (!bResult)
                 {
@@ -206,10 +275,7 @@ namespace xfile::driver::windows
                                             , &m_Overlapped);
 
                 // Set the file pointer (We assume we didnt make any errors)
-                //if( File.m_Flags&xfile_device_i::ACC_ASYNC) 
-                {
-                    m_Overlapped.Offset += Count;
-                }
+                setCursor(getCursor() + Count);
 
                 if (!bResult)
                 {
@@ -245,71 +311,296 @@ namespace xfile::driver::windows
                 return {};
             }
 
+            //----------------------------------------------------------------------------------------
+            // Each call has its own OVERLAPPED with the offset so m_Overlapped (the cursor) is not used.
+            // Async handles need an event to wait on since other requests may be in flight on the handle.
+            // m_LastError is not touched since several threads may be here.
             //----------------------------------------------------------------------------------------
 
-            xerr Seek(seek_mode Mode, std::size_t Pos) noexcept override
+            xerr TransferAt(const std::byte* pData, std::size_t Size, std::size_t Offset, bool bWrite) noexcept
             {
-                auto HardwareMode = [](seek_mode Mode)
-                    {
-                        switch (Mode) //-V719
-                        {
-                        case SKM_CURENT: return FILE_CURRENT;
-                        case SKM_END:    return FILE_END;
-                        }
-                        assert(Mode == SKM_ORIGIN);
-                        return FILE_BEGIN;
-                    }(Mode);
+                assert(Size < std::numeric_limits<DWORD>::max());
 
-                // We will make sure we are sync here
-                // WARNING: Potential time wasted here
+                OVERLAPPED Overlapped{};
+                Overlapped.Offset     = static_cast<DWORD>(Offset);
+                Overlapped.OffsetHigh = static_cast<DWORD>(static_cast<std::uint64_t>(Offset) >> 32);
                 if (m_AccessTypes.m_bASync)
                 {
-                    if ( auto Err = Synchronize(true); Err ) 
-                        return Err;
+                    Overlapped.hEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+                    if (Overlapped.hEvent == nullptr)
+                        return xerr::create_f<state, "Fail to create the event for the request">();
                 }
 
-                // Seek!
-                LARGE_INTEGER Position;
-                LARGE_INTEGER NewFilePointer;
+                const DWORD Count           = static_cast<DWORD>(Size);
+                DWORD       nBytesTransfer  = 0;
+                BOOL        bResult         = bWrite ? WriteFile(m_Handle, pData, Count, nullptr, &Overlapped)
+                                                     : ReadFile(m_Handle, const_cast<std::byte*>(pData), Count, nullptr, &Overlapped);
+
+                if (bResult || GetLastError() == ERROR_IO_PENDING)
+                    bResult = GetOverlappedResult(m_Handle, &Overlapped, &nBytesTransfer, TRUE);
+
+                const DWORD dwError = bResult ? ERROR_SUCCESS : GetLastError();
+                if (Overlapped.hEvent) CloseHandle(Overlapped.hEvent);
+
+                if (dwError == ERROR_HANDLE_EOF || (dwError == ERROR_SUCCESS && nBytesTransfer < Count))
+                    return xerr::create<state::UNEXPECTED_EOF, "Unexpected End Of File">();
+
+                if (dwError != ERROR_SUCCESS)
+                    return bWrite ? xerr::create_f<state, "Error while writing">() : xerr::create_f<state, "Error while reading">();
+
+                return {};
+            }
+
+            //----------------------------------------------------------------------------------------
 
-                Position.QuadPart = Pos;
-                const DWORD Result = SetFilePointerEx(m_Handle, Position, &NewFilePointer, HardwareMode);
-                if (!Result)
+            xerr ReadAt(std::size_t Offset, std::span<std::byte> View) noexcept override
+            {
+                return TransferAt(View.data(), View.size(), Offset, false);
+            }
+
+            //----------------------------------------------------------------------------------------
+
+            xerr WriteAt(std::size_t Offset, std::span<const std::byte> View) noexcept override
+            {
+                return TransferAt(View.data(), View.size(), Offset, true);
+            }
+
+            //----------------------------------------------------------------------------------------
+            // Each ticket has its own OVERLAPPED (with its own event) so any number of them can be
+            // in flight. Files that were not opened with "@" can not do that and do the work right away.
+            // Tickets with a callback have their event watched by the thread pool, which collects them
+            // as soon as they are done, otherwise they are collected by Wait/Synchronize.
+            //----------------------------------------------------------------------------------------
+
+            xerr IssueTicket(async_ticket& Ticket, const std::byte* pData, std::size_t Size, std::size_t Offset, bool bWrite) noexcept
+            {
+                assert(Size < std::numeric_limits<DWORD>::max());
+
+                auto& Request = *new(Ticket.m_DeviceData.data()) ticket_request{};
+                Request.m_pFile                 = this;
+                Request.m_Overlapped.Offset     = static_cast<DWORD>(Offset);
+                Request.m_Overlapped.OffsetHigh = static_cast<DWORD>(static_cast<std::uint64_t>(Offset) >> 32);
+                Request.m_Overlapped.hEvent     = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+                if (Request.m_Overlapped.hEvent == nullptr)
+                {
+                    CollectErrorAsString();
+                    return xerr::create_f<state, "Fail to create the event for the async request">();
+                }
+
+                Ticket.Begin(*this, Size);
+
+                // The event is not signaled until the request is done so we can watch it before making the request
+                if (Ticket.m_Callback)
+                {
+                    if (RegisterWaitForSingleObject(&Request.m_hWait, Request.m_Overlapped.hEvent, &onTicketSignaled, &Ticket, INFINITE, WT_EXECUTEONLYONCE))
+                    {
+                        m_nWaitTickets.fetch_add(1, std::memory_order_relaxed);
+                    }
+                    else
+                    {
+                        CollectErrorAsString();
+                        Request.m_hWait = nullptr;
+                    }
+                }
+
+                const DWORD Count   = static_cast<DWORD>(Size);
+                const BOOL  bResult = bWrite ? WriteFile(m_Handle, pData, Count, nullptr, &Request.m_Overlapped)
+                                             : ReadFile(m_Handle, const_cast<std::byte*>(pData), Count, nullptr, &Request.m_Overlapped);
+
+                if (!bResult && GetLastError() != ERROR_IO_PENDING)
                 {
+                    // It failed before getting in flight, the event will never be signaled
+                    const DWORD dwError = GetLastError();
                     CollectErrorAsString();
-                    if (Result == INVALID_SET_FILE_POINTER) //-V547
+
+                    if (Request.m_hWait)
                     {
-                        // Failed to seek.
-                        return xerr::create_f<state,"Fail to seek, INVALID_SET_FILE_POINTER">();
+                        UnregisterWaitEx(Request.m_hWait, INVALID_HANDLE_VALUE);
+                        m_nWaitTickets.fetch_sub(1, std::memory_order_relaxed);
                     }
+                    CloseHandle(Request.m_Overlapped.hEvent);
 
-                    return xerr::create_f<state,"Fail to seek">();
+                    if (Ticket.Complete(dwError == ERROR_HANDLE_EOF ? async_ticket::result::UNEXPECTED_EOF : async_ticket::result::FAILURE, 0)) Ticket.RunCallback();
+                    return {};
                 }
 
-                // Set the position for async files
-                m_Overlapped.Offset     = NewFilePointer.LowPart;
-                m_Overlapped.OffsetHigh = NewFilePointer.HighPart;
-
+                // Even if it finished right away the event is signaled
+                if (Request.m_hWait == nullptr) m_Tickets.push_back(&Ticket);
                 return {};
             }
 
+            //----------------------------------------------------------------------------------------
+            // Completes the ticket (without calling the callback), returns false if it is still in flight.
+            // bCallback is set when RunCallback must follow, without a callback the ticket may be gone already.
             //----------------------------------------------------------------------------------------
 
-            xerr Tell(std::size_t& Pos) noexcept override
+            bool CollectTicket(async_ticket& Ticket, bool bBlock, bool& bCallback) noexcept
             {
-                LARGE_INTEGER   Position;
-                LARGE_INTEGER   NewFilePointer;
+                auto&       Request         = getRequest(Ticket);
+                DWORD       nBytesTransfer  = 0;
+                auto        Result          = async_ticket::result::OK;
 
-                Position.LowPart = 0;
-                Position.HighPart = 0;
+                if (GetOverlappedResult(m_Handle, &Request.m_Overlapped, &nBytesTransfer, bBlock) == FALSE)
+                {
+                    const DWORD dwError = GetLastError();
+                    if (dwError == ERROR_IO_INCOMPLETE) return false;
 
-                if (FALSE == SetFilePointerEx(m_Handle, Position, &NewFilePointer, FILE_CURRENT))
+                    if      (dwError == ERROR_HANDLE_EOF)           Result = async_ticket::result::UNEXPECTED_EOF;
+                    else if (dwError == ERROR_OPERATION_ABORTED)    Result = async_ticket::result::CANCELED;
+                    else
+                    {
+                        CollectErrorAsString();
+                        Result = async_ticket::result::FAILURE;
+                    }
+                }
+                else if (nBytesTransfer < Ticket.m_Requested)
                 {
-                    CollectErrorAsString();
-                    return xerr::create_f<state,"Error while Telling">();
+                    Result = async_ticket::result::UNEXPECTED_EOF;
+                }
+
+                // Called from the wait callback itself so it does not block
+                if (Request.m_hWait) UnregisterWait(Request.m_hWait);
+                CloseHandle(Request.m_Overlapped.hEvent);
+
+                bCallback = Ticket.Complete(Result, nBytesTransfer);
+                return true;
+            }
+
+            //----------------------------------------------------------------------------------------
+            // Thread pool callback for the tickets that have a callback
+            //----------------------------------------------------------------------------------------
+
+            static void CALLBACK onTicketSignaled(PVOID pContext, BOOLEAN) noexcept
+            {
+                auto&       Ticket  = *static_cast<async_ticket*>(pContext);
+                small_file& File    = *getRequest(Ticket).m_pFile;
+
+                bool        bCallback = false;
+                (void)File.CollectTicket(Ticket, true, bCallback);
+
+                // After this the file may be closed, and after the callback the ticket may be gone
+                if (File.m_nWaitTickets.fetch_sub(1, std::memory_order_release) == 1) File.m_nWaitTickets.notify_all();
+                if (bCallback) Ticket.RunCallback();
+            }
+
+            //----------------------------------------------------------------------------------------
+            // Returns false while there are requests in flight
+            //----------------------------------------------------------------------------------------
+
+            bool CollectTickets(bool bBlock) noexcept
+            {
+                // The callbacks may add more
+                for (std::size_t i = 0; i < m_Tickets.size(); )
+                {
+                    auto& Ticket    = *m_Tickets[i];
+                    bool  bCallback = false;
+                    if (CollectTicket(Ticket, bBlock, bCallback) == false)
+                    {
+                        ++i;
+                        continue;
+                    }
+
+                    m_Tickets.erase(m_Tickets.begin() + i);
+                    if (bCallback) Ticket.RunCallback();
+                }
+
+                if (bBlock)
+                {
+                    for (auto n = m_nWaitTickets.load(std::memory_order_acquire); n; n = m_nWaitTickets.load(std::memory_order_acquire))
+                        m_nWaitTickets.wait(n, std::memory_order_acquire);
+                }
+
+                return m_Tickets.empty() && m_nWaitTickets.load(std::memory_order_acquire) == 0;
+            }
+
+            //----------------------------------------------------------------------------------------
+
+            xerr ReadAsync(async_ticket& Ticket, std::span<std::byte> View, std::size_t Offset) noexcept override
+            {
+                if (m_AccessTypes.m_bASync == false) return device::instance::ReadAsync(Ticket, View, Offset);
+                return IssueTicket(Ticket, View.data(), View.size(), Offset, false);
+            }
+
+            //----------------------------------------------------------------------------------------
+
+            xerr WriteAsync(async_ticket& Ticket, std::span<const std::byte> View, std::size_t Offset) noexcept override
+            {
+                if (m_AccessTypes.m_bASync == false) return device::instance::WriteAsync(Ticket, View, Offset);
+                return IssueTicket(Ticket, View.data(), View.size(), Offset, true);
+            }
+
+            //----------------------------------------------------------------------------------------
+
+            xerr Wait(async_ticket& Ticket, bool bBlock) noexcept override
+            {
+                for (auto Status = Ticket.m_Status.load(std::memory_order_acquire); Status == async_ticket::status::PENDING || Status == async_ticket::status::COMPLETING; Status = Ticket.m_Status.load(std::memory_order_acquire))
+                {
+                    if (Status == async_ticket::status::PENDING && std::find(m_Tickets.begin(), m_Tickets.end(), &Ticket) != m_Tickets.end())
+                    {
+                        bool bCallback = false;
+                        if (CollectTicket(Ticket, bBlock, bCallback) == false) break;
+
+                        // The callback may make a new request with the same ticket
+                        std::erase(m_Tickets, &Ticket);
+                        if (bCallback) Ticket.RunCallback();
+                        continue;
+                    }
+
+                    // The thread pool is collecting it
+                    if (bBlock == false) break;
+                    details::done_signal::Wait([&]{ return Ticket.m_Status.load(std::memory_order_acquire) != Status; });
+                }
+
+                return Ticket.getError();
+            }
+
+            //----------------------------------------------------------------------------------------
+
+            void Cancel(async_ticket& Ticket) noexcept override
+            {
+                if (Ticket.m_Status.load(std::memory_order_acquire) != async_ticket::status::PENDING) return;
+                if (!CancelIoEx(m_Handle, &getRequest(Ticket).m_Overlapped) && GetLastError() != ERROR_NOT_FOUND) CollectErrorAsString();
+            }
+
+            //----------------------------------------------------------------------------------------
+
+            xerr Seek(seek_mode Mode, std::size_t Pos) noexcept override
+            {
+                // We will make sure we are sync here
+                // WARNING: Potential time wasted here
+                if (m_AccessTypes.m_bASync)
+                {
+                    if ( auto Err = Synchronize(true); Err ) 
+                        return Err;
+                }
+
+                // Note that offsets are allowed to wrap around so that negative numbers work as expected
+                switch (Mode)
+                {
+                case SKM_ORIGIN: setCursor(Pos); break;
+                case SKM_CURENT: setCursor(getCursor() + Pos); break;
+                case SKM_END:
+                {
+                    LARGE_INTEGER Size;
+                    if (FALSE == GetFileSizeEx(m_Handle, &Size))
+                    {
+                        CollectErrorAsString();
+                        return xerr::create_f<state,"Fail to seek">();
+                    }
+                    setCursor(static_cast<std::size_t>(Size.QuadPart) + Pos);
+                    break;
+                }
+                default: assert(false); break;
                 }
 
-                Pos = NewFilePointer.QuadPart;
+                return {};
+            }
+
+            //----------------------------------------------------------------------------------------
+
+            xerr Tell(std::size_t& Pos) noexcept override
+            {
+                Pos = getCursor();
                 return {};
             }
 
@@ -327,22 +618,22 @@ namespace xfile::driver::windows
 
             xerr Length(std::size_t& Length) noexcept override
             {
-                std::size_t Cursor;
-
-                if (auto Err = Tell(Cursor); Err ) 
-                    return Err;
-
-                if (auto Err = Seek(SKM_END, 0 ); Err ) 
-                    return Err;
-
-                if ( auto Err = Tell(Length); Err ) 
-                    return Err;
+                // Pending writes may change the size of the file
+                if (m_AccessTypes.m_bASync)
+                {
+                    if ( auto Err = Synchronize(true); Err ) 
+                        return Err;
+                }
 
-                if ( auto Err = Seek(SKM_ORIGIN, Cursor); Err ) 
-                    return Err;
+                LARGE_INTEGER Size;
+                if (FALSE == GetFileSizeEx(m_Handle, &Size))
+                {
+                    CollectErrorAsString();
+                    return xerr::create_f<state,"Fail to get the length of the file">();
+                }
 
+                Length = static_cast<std::size_t>(Size.QuadPart);
                 return {};
-
             }
 
             //----------------------------------------------------------------------------------------
@@ -394,6 +685,9 @@ namespace xfile::driver::windows
 
             xerr Synchronize(bool bBlock) noexcept override
             {
+                if (CollectTickets(bBlock) == false && m_bIOPending == false)
+                    return xerr::create<state::INCOMPLETE, "Incomplete">();
+
                 if (m_bIOPending)
                 {
                     if (HasOverlappedIoCompleted(&m_Overlapped))
@@ -447,6 +741,15 @@ namespace xfile::driver::windows
                 return xerr::create_f<state,"Unknown Error">();
             }
 
+            //----------------------------------------------------------------------------------------
+            // Async files are opened with FILE_FLAG_OVERLAPPED, the system does the work
+            //----------------------------------------------------------------------------------------
+
+            bool isAsync(void) noexcept override
+            {
+                return m_AccessTypes.m_bASync;
+            }
+
             //----------------------------------------------------------------------------------------
 
             void AsyncAbort(void) noexcept override
@@ -456,96 +759,86 @@ namespace xfile::driver::windows
             }
         };
 
-        std::array<small_file, 128>     m_FileHPool;
-        std::atomic<next>               m_iEmptyHead = {{0,0}};
+        instance_pool<small_file>       m_FileHPool;
+        handle_cache                    m_HandleCache;
 
-        device()
+        //----------------------------------------------------------------------------------------
+
+        void Init(const void*) noexcept override
         {
-            // Initialize the pool of handles
-            for( std::size_t i=0; i< m_FileHPool.size(); ++i )
-            {
-                m_FileHPool[i].m_iNext = static_cast<std::int16_t>(i + 1);
-            }
-            m_FileHPool[m_FileHPool.size()-1].m_iNext = static_cast<std::int16_t>(-1);
+            // Nothing to do...
         }
 
         //----------------------------------------------------------------------------------------
 
-        void Init(const void*) noexcept override
+        xerr setHandleCache(std::size_t MaxHandles) noexcept override
         {
-            // Nothing to do...
+            m_HandleCache.setMaxIdle(MaxHandles);
+            return {};
         }
 
         //----------------------------------------------------------------------------------------
 
-        void Kill(void) noexcept override
+        std::uint64_t getHandleCacheHits(void) noexcept override
+        {
+            return m_HandleCache.getHits();
+        }
+
+        //----------------------------------------------------------------------------------------
+
+        xerr deleteFile(std::wstring_view FileName) noexcept override
         {
-            for ( auto& E : m_FileHPool )
+            assert(FileName.data()[FileName.size()] == 0);
+
+            // The cached handles would keep the file around
+            m_HandleCache.Invalidate(FileName);
+            if (!DeleteFileW(FileName.data()))
             {
-                if (E.m_iNext == -2)
+                switch (GetLastError())
                 {
-                    // This should have been freed
-                    assert(false);
+                case ERROR_FILE_NOT_FOUND: return xerr::create<state::OPENING_FILE, "The system cannot find the file specified.">();
+                case ERROR_ACCESS_DENIED:  return xerr::create<state::OPENING_FILE, "Access is denied.">();
+                case ERROR_PATH_NOT_FOUND: return xerr::create<state::OPENING_FILE, "The system cannot find the path specified.">();
+                default:                   return xerr::create_f<state, "Fail to delete the file">();
                 }
             }
+
+            return {};
         }
 
         //----------------------------------------------------------------------------------------
 
-        instance* createInstance(void) noexcept override
+        void Kill(void) noexcept override
         {
-            auto Local = m_iEmptyHead.load(std::memory_order_relaxed);
-            do
+            m_FileHPool.ForEachInUse([](auto&)
             {
-                assert(Local.m_iNext >= 0);
+                // This should have been freed
+                assert(false);
+            });
 
-                auto NewValue = Local;
-
-                NewValue.m_iNext = m_FileHPool[Local.m_iNext].m_iNext;
-                NewValue.m_Counter++;
-
-                if (m_iEmptyHead.compare_exchange_weak(Local, NewValue, std::memory_order_release))
-                {
-                    // Let us mark this entry as is now ours!
-                    m_FileHPool[Local.m_iNext].m_iNext = -2;
-                    break;
-                }
+            m_HandleCache.Clear();
+        }
 
-            } while (true);
+        //----------------------------------------------------------------------------------------
 
-            // Return the instance
-            return &m_FileHPool[Local.m_iNext];
+        instance* createInstance(void) noexcept override
+        {
+            // Returns nullptr when we run out of handles
+            auto pFile = m_FileHPool.Alloc();
+            if (pFile) pFile->m_pHandleCache = &m_HandleCache;
+            return pFile;
         }
 
         //----------------------------------------------------------------------------------------
 
         void destroyInstance(instance& Instance) noexcept override
         {
-            auto&               SmallFile = *reinterpret_cast<small_file*>(&Instance);
-            const std::size_t   Index     = static_cast<std::size_t>( &SmallFile - m_FileHPool.data());
-            assert(Index < m_FileHPool.size());
-            assert(SmallFile.m_iNext == -2);
+            auto& SmallFile = static_cast<small_file&>(Instance);
 
             // OK we can officially free everything from our entry
             SmallFile.clear();
 
-            //
-            // Now we must insert it into the free list
-            //
-            auto Local = m_iEmptyHead.load(std::memory_order_relaxed);
-            do
-            {
-                // Add the structure into the chain
-                SmallFile.m_iNext = Local.m_iNext;
-
-                auto NewValue = Local;
-                NewValue.m_iNext = static_cast<std::int16_t>(Index);
-                NewValue.m_Counter++;
-
-                if (m_iEmptyHead.compare_exchange_weak(Local, NewValue, std::memory_order_release))
-                    break;
-
-            } while (true);
+            m_FileHPool.Free(SmallFile);
         }
     };
 
@@ -0,0 +1,243 @@
+#include <array>
+#include <bit>
+#include <cwchar>
+#include <cwctype>
+#include <filesystem>
+#include <shared_mutex>
+#include <utility>
+#include <vector>
+
+namespace xfile::details
+{
+    //==============================================================================
+    //  DEVICE TABLE
+    //==============================================================================
+    //  device_table
+    //      Finds the registration of a device name ("c:", "ram:", ...) without walking
+    //      the list of registrations. The first lookup compiles every name of every
+    //      registration into an open addressing hash table keyed by the lower case name,
+    //      it is compiled again when a new registration shows up or after Invalidate.
+    //      It also keeps the working and temp paths so resolving a relative or "temp:"
+    //      path does not go to the system. Lookups take the lock shared and never allocate.
+    //==============================================================================
+    class device_table
+    {
+    public:
+
+        constexpr static std::size_t max_name_v = 16;          // Longest device name (without the ':')
+
+        //------------------------------------------------------------------------------
+
+        static device_table& getInstance( void ) noexcept
+        {
+            static device_table s_Table;
+            return s_Table;
+        }
+
+        //------------------------------------------------------------------------------
+        // DeviceName is what comes before the path, with its ':'
+        //------------------------------------------------------------------------------
+
+        device::registration* Find( std::wstring_view DeviceName ) noexcept
+        {
+            key Key;
+            if (Key.Set(DeviceName) == false) return nullptr;
+
+            for (;;)
+            {
+                {
+                    std::shared_lock Lk(m_Lock);
+                    if (isStale() == false) return Lookup(Key);
+                }
+                Build();
+            }
+        }
+
+        //------------------------------------------------------------------------------
+        // Replaces the content of Path with the cached working/temp path
+        //------------------------------------------------------------------------------
+
+        void AssignWorkingPath( std::wstring& Path ) noexcept
+        {
+            ReadPaths([&]( const paths& Paths ) { Path.assign(Paths.m_WorkingPath); });
+        }
+
+        void AssignTempPath( std::wstring& Path ) noexcept
+        {
+            ReadPaths([&]( const paths& Paths ) { Path.assign(Paths.m_TempPath); });
+        }
+
+        //------------------------------------------------------------------------------
+        // Paths and registrations are collected again by the next lookup
+        //------------------------------------------------------------------------------
+
+        void Invalidate( void ) noexcept
+        {
+            std::unique_lock Lk(m_Lock);
+            m_bValid = false;
+        }
+
+        //------------------------------------------------------------------------------
+
+        static bool isSameName( std::wstring_view A, std::wstring_view B ) noexcept
+        {
+            if (A.size() != B.size()) return false;
+            for (std::size_t i = 0; i < A.size(); ++i)
+                if (Fold(A[i]) != Fold(B[i])) return false;
+            return true;
+        }
+
+    protected:
+
+        struct paths
+        {
+            std::wstring                m_WorkingPath   {};
+            std::wstring                m_TempPath      {};     // Always ends with a separator
+        };
+
+        // Lower case name with its hash
+        struct key
+        {
+            bool Set( std::wstring_view DeviceName ) noexcept
+            {
+                if (DeviceName.empty() == false && DeviceName.back() == L':') DeviceName.remove_suffix(1);
+                if (DeviceName.empty() || DeviceName.size() > max_name_v) return false;
+
+                // FNV-1a
+                m_Hash   = 2166136261u;
+                m_Length = static_cast<std::uint8_t>(DeviceName.size());
+                for (std::size_t i = 0; i < DeviceName.size(); ++i)
+                {
+                    m_Name[i] = Fold(DeviceName[i]);
+                    m_Hash    = (m_Hash ^ static_cast<std::uint32_t>(m_Name[i])) * 16777619u;
+                }
+                return true;
+            }
+
+            bool operator == ( const key& Other ) const noexcept
+            {
+                return m_Hash == Other.m_Hash && m_Length == Other.m_Length && std::wmemcmp(m_Name.data(), Other.m_Name.data(), m_Length) == 0;
+            }
+
+            std::array<wchar_t, max_name_v> m_Name      {};
+            std::uint32_t                   m_Hash      { 0 };
+            std::uint8_t                    m_Length    { 0 };
+        };
+
+        struct entry
+        {
+            key                         m_Key           {};
+            device::registration*       m_pRegistration { nullptr };    // nullptr for empty entries
+        };
+
+        //------------------------------------------------------------------------------
+
+        static wchar_t Fold( wchar_t C ) noexcept
+        {
+            if (C < 0x80) return (C >= L'A' && C <= L'Z') ? static_cast<wchar_t>(C + (L'a' - L'A')) : C;
+            return static_cast<wchar_t>(std::towlower(static_cast<std::wint_t>(C)));
+        }
+
+        //------------------------------------------------------------------------------
+        // New registrations go to the head of the list
+        //------------------------------------------------------------------------------
+
+        bool isStale( void ) const noexcept
+        {
+            return m_bValid == false || m_pBuiltFrom != device::registration::s_pHead;
+        }
+
+        //------------------------------------------------------------------------------
+
+        device::registration* Lookup( const key& Key ) const noexcept
+        {
+            for (auto i = Key.m_Hash & m_Mask; ; i = (i + 1) & m_Mask)
+            {
+                const auto& Entry = m_Entries[i];
+                if (Entry.m_pRegistration == nullptr) return nullptr;
+                if (Entry.m_Key == Key)               return Entry.m_pRegistration;
+            }
+        }
+
+        //------------------------------------------------------------------------------
+        // Calls Function with the paths while the shared lock is taken, a Build that comes
+        // after an Invalidate replaces them as soon as the lock is released
+        //------------------------------------------------------------------------------
+
+        template< typename T_FUNCTION >
+        void ReadPaths( T_FUNCTION&& Function ) noexcept
+        {
+            for (;;)
+            {
+                {
+                    std::shared_lock Lk(m_Lock);
+                    if (isStale() == false)
+                    {
+                        Function(std::as_const(m_Paths));
+                        return;
+                    }
+                }
+                Build();
+            }
+        }
+
+        //------------------------------------------------------------------------------
+        // Compiles the registrations and collects the paths
+        //------------------------------------------------------------------------------
+
+        void Build( void ) noexcept
+        {
+            std::unique_lock Lk(m_Lock);
+            if (isStale() == false) return;
+
+            std::size_t Count = 0;
+            for (auto pReg = device::registration::s_pHead; pReg; pReg = pReg->m_pNext)
+                for (const char* p = pReg->m_pNames; *p; ++p) Count += *p == ':';
+
+            // At most half full so the probes stay short
+            const auto Size = std::max<std::size_t>(16, std::bit_ceil(2 * Count));
+            m_Entries.assign(Size, entry{});
+            m_Mask = static_cast<std::uint32_t>(Size - 1);
+
+            for (auto pReg = device::registration::s_pHead; pReg; pReg = pReg->m_pNext)
+            {
+                for (const char* pName = pReg->m_pNames; *pName; )
+                {
+                    std::array<wchar_t, max_name_v + 1> Name;
+                    std::size_t                         Length = 0;
+                    for (; *pName && *pName != ':'; ++pName)
+                        if (Length < Name.size()) Name[Length++] = static_cast<wchar_t>(static_cast<unsigned char>(*pName));
+                    if (*pName == ':') ++pName;
+
+                    key Key;
+                    if (Key.Set({ Name.data(), Length }) == false) continue;
+
+                    // Like the list, the first registration with the name wins
+                    auto i = Key.m_Hash & m_Mask;
+                    for (; m_Entries[i].m_pRegistration && !(m_Entries[i].m_Key == Key); i = (i + 1) & m_Mask) {}
+                    if (m_Entries[i].m_pRegistration == nullptr) m_Entries[i] = { Key, pReg };
+                }
+            }
+
+            std::error_code Ec;
+            m_Paths.m_WorkingPath = std::filesystem::current_path(Ec).wstring();
+            m_Paths.m_TempPath    = std::filesystem::temp_directory_path(Ec).wstring();
+
+            // Make sure that the path always ends with a separator ( posix does not add it )
+            if (m_Paths.m_TempPath.empty() == false && m_Paths.m_TempPath.back() != L'/' && m_Paths.m_TempPath.back() != L'\\')
+                m_Paths.m_TempPath.push_back(static_cast<wchar_t>(std::filesystem::path::preferred_separator));
+
+            m_pBuiltFrom = device::registration::s_pHead;
+            m_bValid     = true;
+        }
+
+    protected:
+
+        std::shared_mutex               m_Lock          {};
+        std::vector<entry>              m_Entries       {};
+        std::uint32_t                   m_Mask          { 0 };
+        device::registration*           m_pBuiltFrom    { nullptr };    // Head of the registrations when it was compiled
+        bool                            m_bValid        { false };
+        paths                           m_Paths         {};
+    };
+}
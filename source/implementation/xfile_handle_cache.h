@@ -0,0 +1,187 @@
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+namespace xfile::driver
+{
+    //==============================================================================
+    //  HANDLE CACHE
+    //==============================================================================
+    //  handle_cache
+    //      Keeps the OS handles of read only files after they are closed so opening the
+    //      same path again does not go to the system. A handle belongs to one open file
+    //      at a time: Acquire takes an idle handle of the path (the file starts with its
+    //      own fresh cursor), Add gives a handle that was just opened to the cache and
+    //      Release puts it back in the idle list when the file closes. At most m_MaxIdle
+    //      handles stay idle, the least recently used one is closed to make room.
+    //      Invalidate closes the idle handles of a path and marks the busy ones so they
+    //      are closed on Release (the devices call it before writing or deleting a file).
+    //      It is off until setMaxIdle is called with something other than zero.
+    //==============================================================================
+    template< typename T_HANDLE, void(*T_CLOSE_V)(T_HANDLE) noexcept >
+    class handle_cache
+    {
+    public:
+
+        struct entry
+        {
+            std::wstring                m_Path      {};
+            T_HANDLE                    m_Handle    {};
+            bool                        m_bStale    { false };      // The file changed while it was busy
+        };
+
+        // What an open file keeps to give its handle back
+        using node = typename std::list<entry>::iterator;
+
+        //------------------------------------------------------------------------------
+
+        ~handle_cache( void ) noexcept
+        {
+            Clear();
+        }
+
+        //------------------------------------------------------------------------------
+        // Takes an idle handle of the path, returns false if there is none
+        //------------------------------------------------------------------------------
+
+        bool Acquire( std::wstring_view Path, node& Node ) noexcept
+        {
+            if (m_MaxIdle.load(std::memory_order_relaxed) == 0) return false;
+
+            std::lock_guard Lk(m_Lock);
+            if (m_MaxIdle == 0) return false;
+
+            auto It = m_Index.find(Path);
+            if (It == m_Index.end()) return false;
+
+            Node = It->second;
+            m_Index.erase(It);
+            m_Busy.splice(m_Busy.begin(), m_Idle, Node);
+
+            m_nHits.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+
+        //------------------------------------------------------------------------------
+        // Takes a handle that was just opened, returns false when the cache is off
+        //------------------------------------------------------------------------------
+
+        bool Add( std::wstring_view Path, T_HANDLE Handle, node& Node ) noexcept
+        {
+            if (m_MaxIdle.load(std::memory_order_relaxed) == 0) return false;
+
+            std::lock_guard Lk(m_Lock);
+            if (m_MaxIdle == 0) return false;
+
+            m_Busy.push_front({ std::wstring(Path), Handle, false });
+            Node = m_Busy.begin();
+            return true;
+        }
+
+        //------------------------------------------------------------------------------
+        // The file closed, its handle may be kept for the next open
+        //------------------------------------------------------------------------------
+
+        void Release( node Node ) noexcept
+        {
+            std::optional<T_HANDLE> Close;
+            {
+                std::lock_guard Lk(m_Lock);
+
+                if (Node->m_bStale || m_MaxIdle == 0)
+                {
+                    Close = Node->m_Handle;
+                    m_Busy.erase(Node);
+                }
+                else
+                {
+                    m_Idle.splice(m_Idle.begin(), m_Busy, Node);
+                    m_Index.emplace(std::wstring_view{ Node->m_Path }, Node);
+
+                    if (m_Idle.size() > m_MaxIdle.load(std::memory_order_relaxed))
+                    {
+                        Close = m_Idle.back().m_Handle;
+                        EraseIdle(std::prev(m_Idle.end()));
+                    }
+                }
+            }
+
+            if (Close) T_CLOSE_V(*Close);
+        }
+
+        //------------------------------------------------------------------------------
+
+        void Invalidate( std::wstring_view Path ) noexcept
+        {
+            // Busy handles of a cache that was turned off are closed on Release anyway
+            if (m_MaxIdle.load(std::memory_order_relaxed) == 0) return;
+
+            std::lock_guard Lk(m_Lock);
+
+            for (auto& Entry : m_Busy)
+                if (Entry.m_Path == Path) Entry.m_bStale = true;
+
+            for (auto It = m_Index.find(Path); It != m_Index.end(); It = m_Index.find(Path))
+            {
+                T_CLOSE_V(It->second->m_Handle);
+                EraseIdle(It->second);
+            }
+        }
+
+        //------------------------------------------------------------------------------
+        // Also closes every idle handle, so it can be used to forget the files changed by others
+        //------------------------------------------------------------------------------
+
+        void setMaxIdle( std::size_t MaxIdle ) noexcept
+        {
+            Clear();
+
+            std::lock_guard Lk(m_Lock);
+            m_MaxIdle = MaxIdle;
+        }
+
+        //------------------------------------------------------------------------------
+
+        void Clear( void ) noexcept
+        {
+            std::lock_guard Lk(m_Lock);
+            for (auto& Entry : m_Idle) T_CLOSE_V(Entry.m_Handle);
+            m_Idle.clear();
+            m_Index.clear();
+        }
+
+        //------------------------------------------------------------------------------
+
+        std::uint64_t getHits( void ) const noexcept
+        {
+            return m_nHits.load(std::memory_order_relaxed);
+        }
+
+    protected:
+
+        void EraseIdle( node Node ) noexcept
+        {
+            for (auto [It, End] = m_Index.equal_range(Node->m_Path); It != End; ++It)
+            {
+                if (It->second != Node) continue;
+                m_Index.erase(It);
+                break;
+            }
+            m_Idle.erase(Node);
+        }
+
+    protected:
+
+        std::mutex                                              m_Lock      {};
+        std::list<entry>                                        m_Idle      {};     // Most recently used first
+        std::list<entry>                                        m_Busy      {};     // Handles of the files that are open
+        std::unordered_multimap<std::wstring_view, node>        m_Index     {};     // Idle handles by path (the views point at the entries)
+        std::atomic<std::size_t>                                m_MaxIdle   { 0 };      // Changed under the lock, read without it to skip the lock when off
+        std::atomic<std::uint64_t>                              m_nHits     { 0 };
+    };
+}
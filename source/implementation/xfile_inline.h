@@ -1,4 +1,14 @@
 #include <cassert>
+#include <cstdio>
+#include <cwchar>
+#include <cstring>
+#include <algorithm>
+#include <new>
+#include <iterator>
+#include <bit>
+#if XFILE_STATS
+    #include <chrono>
+#endif
 
 namespace xfile 
 {
@@ -9,6 +19,579 @@ namespace xfile
         {
             return (Address + (static_cast<std::size_t>(AlignTo) - 1)) & static_cast<std::size_t>(-AlignTo);
         }
+
+        //------------------------------------------------------------------------------
+        // Container for std::back_inserter used by Printf. The formatted characters are
+        // collected in a chunk on the stack which goes to the stream every time it fills up.
+        //------------------------------------------------------------------------------
+        template< typename T_CHAR >
+        struct format_sink
+        {
+            using value_type = T_CHAR;
+
+            constexpr static std::size_t chunk_size_v = 512 / sizeof(T_CHAR);
+
+            // The chunk is not cleared, only its first m_Count characters are ever read
+            explicit format_sink( stream& Stream ) noexcept : m_Stream{ Stream } {}
+
+            void push_back( T_CHAR C ) noexcept
+            {
+                if (m_Count == chunk_size_v) (void)Flush();
+                m_Chunk[m_Count++] = C;
+            }
+
+            // After a failure the rest of the text is dropped, the first error is kept
+            xerr Flush( void ) noexcept
+            {
+                if (m_Count && !m_Error) m_Error = m_Stream.WriteRaw({ reinterpret_cast<const std::byte*>(m_Chunk.data()), m_Count * sizeof(T_CHAR) });
+                m_Count = 0;
+                return m_Error;
+            }
+
+            stream&                             m_Stream;
+            xerr                                m_Error     {};
+            std::size_t                         m_Count     { 0 };
+            std::array<T_CHAR, chunk_size_v>    m_Chunk;
+        };
+
+#if XFILE_STATS
+        // Set by stats::BeginTrace/EndTrace, the events go to TraceEvent (xfile.cpp)
+        inline std::atomic<bool> s_bTracing { false };
+
+        void TraceEvent( const device::registration* pDeviceReg, stats::op Op, std::chrono::steady_clock::time_point Start, std::uint64_t Ns, std::size_t Bytes ) noexcept;
+#endif
+
+        //------------------------------------------------------------------------------
+        // Times what the stream does on its device until it goes out of scope and records
+        // it in the stats of the device, of the stream and in the trace. Compiled out
+        // without XFILE_STATS.
+        //------------------------------------------------------------------------------
+        struct stats_probe
+        {
+#if XFILE_STATS
+            stats_probe( const stream& Stream, stats::op Op, std::size_t Bytes = 0 ) noexcept
+                : m_pDeviceReg  { Stream.m_pDeviceReg }
+                , m_pStats      { Stream.m_pStats }
+                , m_Start       { std::chrono::steady_clock::now() }
+                , m_Bytes       { Bytes }
+                , m_Op          { Op }
+                {}
+
+            ~stats_probe( void ) noexcept
+            {
+                const auto Ns = static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_Start).count());
+                if (m_pDeviceReg) m_pDeviceReg->m_Stats.Record(m_Op, m_Bytes, Ns);
+                if (m_pStats)     m_pStats->Record(m_Op, m_Bytes, Ns);
+                if (s_bTracing.load(std::memory_order_relaxed)) TraceEvent(m_pDeviceReg, m_Op, m_Start, Ns, m_Bytes);
+            }
+
+            device::registration*                   m_pDeviceReg;
+            stats::counters*                        m_pStats;
+            std::chrono::steady_clock::time_point   m_Start;
+            std::size_t                             m_Bytes;
+            stats::op                               m_Op;
+#else
+            constexpr stats_probe( const stream&, stats::op, std::size_t = 0 ) noexcept {}
+#endif
+        };
+    }
+
+    //------------------------------------------------------------------------------
+    // stats
+    //------------------------------------------------------------------------------
+    inline
+    std::uint64_t stats::op_snapshot::getPercentileNs( double Percent ) const noexcept
+    {
+        std::uint64_t Total = 0;
+        for (auto Count : m_Histogram) Total += Count;
+        if (Total == 0) return 0;
+
+        const auto Target = std::max(1.0, Percent * static_cast<double>(Total) / 100.0);
+        std::uint64_t Sum = 0;
+        for (std::size_t i = 0; i < histogram_size_v - 1; ++i)
+        {
+            Sum += m_Histogram[i];
+            if (static_cast<double>(Sum) >= Target) return std::min(std::uint64_t{ 1 } << i, m_MaxNs);
+        }
+        return m_MaxNs;
+    }
+
+    //------------------------------------------------------------------------------
+    inline
+    stats::snapshot& stats::snapshot::operator += ( const snapshot& Other ) noexcept
+    {
+        for (std::size_t i = 0; i < m_Ops.size(); ++i)
+        {
+            auto&       Op    = m_Ops[i];
+            const auto& Add   = Other.m_Ops[i];
+            Op.m_nOps    += Add.m_nOps;
+            Op.m_Bytes   += Add.m_Bytes;
+            Op.m_TotalNs += Add.m_TotalNs;
+            Op.m_MaxNs    = std::max(Op.m_MaxNs, Add.m_MaxNs);
+            for (std::size_t j = 0; j < histogram_size_v; ++j) Op.m_Histogram[j] += Add.m_Histogram[j];
+        }
+        return *this;
+    }
+
+    //------------------------------------------------------------------------------
+    // Bucket of a latency is the number of bits it needs (0 ns goes in the first one)
+    //------------------------------------------------------------------------------
+    inline
+    void stats::counters::Record( op Op, std::size_t Bytes, std::uint64_t Ns ) noexcept
+    {
+        auto& Counters = m_Ops[static_cast<std::size_t>(Op)];
+        Counters.m_nOps.fetch_add(1, std::memory_order_relaxed);
+        if (Bytes) Counters.m_Bytes.fetch_add(Bytes, std::memory_order_relaxed);
+        Counters.m_TotalNs.fetch_add(Ns, std::memory_order_relaxed);
+        Counters.m_Histogram[std::min<std::size_t>(std::bit_width(Ns), histogram_size_v - 1)].fetch_add(1, std::memory_order_relaxed);
+
+        for (auto Max = Counters.m_MaxNs.load(std::memory_order_relaxed); Ns > Max && !Counters.m_MaxNs.compare_exchange_weak(Max, Ns, std::memory_order_relaxed); ) {}
+    }
+
+    //------------------------------------------------------------------------------
+    inline
+    void stats::counters::getSnapshot( snapshot& Snapshot ) const noexcept
+    {
+        for (std::size_t i = 0; i < m_Ops.size(); ++i)
+        {
+            auto&       Op       = Snapshot.m_Ops[i];
+            const auto& Counters = m_Ops[i];
+            Op.m_nOps    = Counters.m_nOps.load(std::memory_order_relaxed);
+            Op.m_Bytes   = Counters.m_Bytes.load(std::memory_order_relaxed);
+            Op.m_TotalNs = Counters.m_TotalNs.load(std::memory_order_relaxed);
+            Op.m_MaxNs   = Counters.m_MaxNs.load(std::memory_order_relaxed);
+            for (std::size_t j = 0; j < histogram_size_v; ++j) Op.m_Histogram[j] = Counters.m_Histogram[j].load(std::memory_order_relaxed);
+        }
+    }
+
+    //------------------------------------------------------------------------------
+    inline
+    void stats::counters::Reset( void ) noexcept
+    {
+        for (auto& Counters : m_Ops)
+        {
+            Counters.m_nOps.store(0, std::memory_order_relaxed);
+            Counters.m_Bytes.store(0, std::memory_order_relaxed);
+            Counters.m_TotalNs.store(0, std::memory_order_relaxed);
+            Counters.m_MaxNs.store(0, std::memory_order_relaxed);
+            for (auto& Count : Counters.m_Histogram) Count.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    //------------------------------------------------------------------------------
+    // buffer
+    //------------------------------------------------------------------------------
+    inline
+    buffer::buffer( buffer&& Other ) noexcept
+        : m_pData   { Other.m_pData }
+        , m_Size    { Other.m_Size }
+    {
+        Other.m_pData = nullptr;
+        Other.m_Size  = 0;
+    }
+
+    //------------------------------------------------------------------------------
+    inline
+    buffer::~buffer( void ) noexcept
+    {
+        clear();
+    }
+
+    //------------------------------------------------------------------------------
+    inline
+    buffer& buffer::operator = ( buffer&& Other ) noexcept
+    {
+        if (this != &Other)
+        {
+            clear();
+            m_pData       = Other.m_pData;
+            m_Size        = Other.m_Size;
+            Other.m_pData = nullptr;
+            Other.m_Size  = 0;
+        }
+        return *this;
+    }
+
+    //------------------------------------------------------------------------------
+    // The old content is lost
+    //------------------------------------------------------------------------------
+    inline
+    xerr buffer::Resize( std::size_t Size ) noexcept
+    {
+        if (Size == m_Size) return {};
+        clear();
+        if (Size == 0) return {};
+
+        m_pData = static_cast<std::byte*>(::operator new(Size, std::align_val_t{ alignment_v }, std::nothrow));
+        if (m_pData == nullptr)
+            return xerr::create_f<state, "Out of memory allocating the buffer">();
+
+        m_Size = Size;
+        return {};
+    }
+
+    //------------------------------------------------------------------------------
+    inline
+    void buffer::clear( void ) noexcept
+    {
+        if (m_pData) ::operator delete(m_pData, std::align_val_t{ alignment_v });
+        m_pData = nullptr;
+        m_Size  = 0;
+    }
+
+    //------------------------------------------------------------------------------
+    // Default implementations of the optional device features
+    //------------------------------------------------------------------------------
+    inline
+    xerr device::instance::MapView( std::span<const std::byte>& View ) noexcept
+    {
+        View = {};
+        return xerr::create<state::NOT_SUPPORTED, "The device does not support memory mapping">();
+    }
+
+    //------------------------------------------------------------------------------
+    inline
+    xerr device::instance::ReadView( std::span<const std::byte>& View, std::size_t ) noexcept
+    {
+        View = {};
+        return xerr::create<state::NOT_SUPPORTED, "The device can not lend its memory">();
+    }
+
+    //------------------------------------------------------------------------------
+    // Writes zeros, devices that can do better (sparse files, holes, etc) override it
+    //------------------------------------------------------------------------------
+    inline
+    xerr device::instance::WriteZero( std::size_t Count ) noexcept
+    {
+        static constexpr std::array<std::byte, 4096> Zeros{};
+        while (Count)
+        {
+            const auto n = std::min(Count, Zeros.size());
+            if (auto Err = Write({ Zeros.data(), n }); Err)
+                return Err;
+            Count -= n;
+        }
+        return {};
+    }
+
+    //------------------------------------------------------------------------------
+    inline
+    xerr device::instance::CopyTo( instance&, std::size_t ) noexcept
+    {
+        return xerr::create<state::NOT_SUPPORTED, "The device can not copy to the other device by itself">();
+    }
+
+    //------------------------------------------------------------------------------
+    // Async devices queue every view, the caller synchronizes once for all of them
+    //------------------------------------------------------------------------------
+    inline
+    xerr device::instance::ReadV( std::span<const std::span<std::byte>> Views ) noexcept
+    {
+        bool bIncomplete = false;
+        for (auto View : Views)
+        {
+            if (View.empty()) continue;
+            if (auto Err = Read(View); Err)
+            {
+                if (Err.getState<state>() != state::INCOMPLETE) return Err;
+                Err.clear();
+                bIncomplete = true;
+            }
+        }
+
+        if (bIncomplete) return xerr::create<state::INCOMPLETE, "Still reading">();
+        return {};
+    }
+
+    //------------------------------------------------------------------------------
+    inline
+    xerr device::instance::WriteV( std::span<const std::span<const std::byte>> Views ) noexcept
+    {
+        bool bIncomplete = false;
+        for (auto View : Views)
+        {
+            if (View.empty()) continue;
+            if (auto Err = Write(View); Err)
+            {
+                if (Err.getState<state>() != state::INCOMPLETE) return Err;
+                Err.clear();
+                bIncomplete = true;
+            }
+        }
+
+        if (bIncomplete) return xerr::create<state::INCOMPLETE, "Still writing">();
+        return {};
+    }
+
+    //------------------------------------------------------------------------------
+    // Only the device knows how to reach an offset without the cursor (the default tickets
+    // borrow it, see ReadAsync) so the devices that can do it override these.
+    //------------------------------------------------------------------------------
+    inline
+    xerr device::instance::ReadAt( std::size_t, std::span<std::byte> ) noexcept
+    {
+        return xerr::create<state::NOT_SUPPORTED, "The device can not read at an offset without the cursor">();
+    }
+
+    //------------------------------------------------------------------------------
+    inline
+    xerr device::instance::WriteAt( std::size_t, std::span<const std::byte> ) noexcept
+    {
+        return xerr::create<state::NOT_SUPPORTED, "The device can not write at an offset without the cursor">();
+    }
+
+    //------------------------------------------------------------------------------
+    // The stream puts the async files of the devices that say no behind the async layer
+    //------------------------------------------------------------------------------
+    inline
+    bool device::instance::isAsync( void ) noexcept
+    {
+        return false;
+    }
+
+    //------------------------------------------------------------------------------
+    // Devices without async requests do the work right away with the cursor (which is restored)
+    //------------------------------------------------------------------------------
+    inline
+    xerr device::instance::ReadAsync( async_ticket& Ticket, std::span<std::byte> View, std::size_t Offset ) noexcept
+    {
+        std::size_t Cursor;
+        if (auto Err = Tell(Cursor); Err)                   return Err;
+        if (auto Err = Seek(SKM_ORIGIN, Offset); Err)       return Err;
+
+        Ticket.Begin(*this, View.size());
+
+        auto Err = Read(View);
+        if (Err && Err.getState<state>() == state::INCOMPLETE) Err = Synchronize(true);
+
+        std::size_t End = Offset + View.size();
+        if (Err) (void)Tell(End);
+
+        const auto Result = !Err ? async_ticket::result::OK : Err.getState<state>() == state::UNEXPECTED_EOF ? async_ticket::result::UNEXPECTED_EOF : async_ticket::result::FAILURE;
+        Err.clear();
+
+        if (auto E = Seek(SKM_ORIGIN, Cursor); E) E.clear();
+
+        if (Ticket.Complete(Result, std::min(View.size(), End - Offset))) Ticket.RunCallback();
+        return {};
+    }
+
+    //------------------------------------------------------------------------------
+    inline
+    xerr device::instance::WriteAsync( async_ticket& Ticket, std::span<const std::byte> View, std::size_t Offset ) noexcept
+    {
+        std::size_t Cursor;
+        if (auto Err = Tell(Cursor); Err)                   return Err;
+        if (auto Err = Seek(SKM_ORIGIN, Offset); Err)       return Err;
+
+        Ticket.Begin(*this, View.size());
+
+        auto Err = Write(View);
+        if (Err && Err.getState<state>() == state::INCOMPLETE) Err = Synchronize(true);
+
+        const auto Result = Err ? async_ticket::result::FAILURE : async_ticket::result::OK;
+        Err.clear();
+
+        if (auto E = Seek(SKM_ORIGIN, Cursor); E) E.clear();
+
+        if (Ticket.Complete(Result, Result == async_ticket::result::OK ? View.size() : 0)) Ticket.RunCallback();
+        return {};
+    }
+
+    //------------------------------------------------------------------------------
+    inline
+    xerr device::instance::Wait( async_ticket& Ticket, bool ) noexcept
+    {
+        return Ticket.getError();
+    }
+
+    //------------------------------------------------------------------------------
+    inline
+    void device::instance::Cancel( async_ticket& ) noexcept
+    {
+        // Nothing is ever in flight
+    }
+
+    //------------------------------------------------------------------------------
+    inline
+    xerr device::deleteFile( std::wstring_view ) noexcept
+    {
+        return xerr::create<state::NOT_SUPPORTED, "The device does not support deleting files">();
+    }
+
+    //------------------------------------------------------------------------------
+    inline
+    xerr device::setHandleCache( std::size_t ) noexcept
+    {
+        return xerr::create<state::NOT_SUPPORTED, "The device does not have OS handles to cache">();
+    }
+
+    //------------------------------------------------------------------------------
+    inline
+    std::uint64_t device::getHandleCacheHits( void ) noexcept
+    {
+        return 0;
+    }
+
+    //------------------------------------------------------------------------------
+    // open_request
+    //------------------------------------------------------------------------------
+    inline
+    xerr open_request::Wait( void ) noexcept
+    {
+        details::done_signal::Wait([this]{ return isDone(); });
+        return m_Error;
+    }
+
+    //------------------------------------------------------------------------------
+    // done_signal
+    //------------------------------------------------------------------------------
+    inline
+    void details::done_signal::Notify( void ) noexcept
+    {
+        s_nDone.fetch_add(1, std::memory_order_release);
+        s_nDone.notify_all();
+    }
+
+    //------------------------------------------------------------------------------
+    template< typename T_IS_DONE >
+    void details::done_signal::Wait( T_IS_DONE&& isDone ) noexcept
+    {
+        // The counter is read first, a request done after that moves it and wait returns
+        for (auto nDone = s_nDone.load(std::memory_order_acquire); isDone() == false; nDone = s_nDone.load(std::memory_order_acquire))
+            s_nDone.wait(nDone, std::memory_order_acquire);
+    }
+
+    //------------------------------------------------------------------------------
+    // async_ticket
+    //------------------------------------------------------------------------------
+    inline
+    xerr async_ticket::getError( void ) const noexcept
+    {
+        switch (m_Status.load(std::memory_order_acquire))
+        {
+        case status::IDLE:          return {};
+        case status::PENDING:
+        case status::COMPLETING:    return xerr::create<state::INCOMPLETE, "Incomplete">();
+        case status::DONE:          break;
+        }
+
+        switch (m_Result)
+        {
+        case result::OK:                return {};
+        case result::UNEXPECTED_EOF:    return xerr::create<state::UNEXPECTED_EOF, "Unexpected end of file">();
+        case result::CANCELED:          return xerr::create_f<state, "Operation Aborted">();
+        case result::FAILURE:           break;
+        }
+        return xerr::create_f<state, "Error in the async request">();
+    }
+
+    //------------------------------------------------------------------------------
+    inline
+    void async_ticket::Begin( device::instance& Instance, std::size_t Requested ) noexcept
+    {
+        assert(m_Status.load(std::memory_order_relaxed) != status::PENDING);
+
+        m_pInstance     = &Instance;
+        m_Requested     = Requested;
+        m_Transferred   = 0;
+        m_Result        = result::OK;
+        m_Status.store(status::PENDING, std::memory_order_relaxed);
+    }
+
+    //------------------------------------------------------------------------------
+    // Tickets with a callback stay in COMPLETING until the device calls RunCallback (when
+    // this returns true). The rest are done, and may be gone, as soon as the status is stored.
+    //------------------------------------------------------------------------------
+    inline
+    bool async_ticket::Complete( result Result, std::size_t Transferred ) noexcept
+    {
+        m_Result      = Result;
+        m_Transferred = Transferred;
+
+        if (m_Callback)
+        {
+            m_Status.store(status::COMPLETING, std::memory_order_release);
+            return true;
+        }
+
+        m_Status.store(status::DONE, std::memory_order_release);
+        details::done_signal::Notify();
+        return false;
+    }
+
+    //------------------------------------------------------------------------------
+    // The ticket is done before the callback is called so the callback can make a new
+    // request with it, or let it go. That is why we call a copy of the callback, once
+    // the status is stored the ticket is not touched again.
+    //------------------------------------------------------------------------------
+    inline
+    void async_ticket::RunCallback( void ) noexcept
+    {
+        if (m_Status.load(std::memory_order_acquire) != status::COMPLETING) return;
+
+        auto Callback = m_Callback;
+        m_Status.store(status::DONE, std::memory_order_release);
+        details::done_signal::Notify();
+        Callback(*this);
+    }
+
+    //------------------------------------------------------------------------------
+    // awaiters
+    //------------------------------------------------------------------------------
+    inline
+    void details::awaiter::Arrive( void ) noexcept
+    {
+        if (m_bArrived.exchange(true, std::memory_order_acq_rel) == false) return;
+
+        if (m_pExecutor) m_pExecutor->Post(m_Handle);
+        else             m_Handle.resume();
+    }
+
+    //------------------------------------------------------------------------------
+    inline
+    bool details::request_awaiter::await_suspend( std::coroutine_handle<> Handle ) noexcept
+    {
+        m_Handle    = Handle;
+        m_pExecutor = m_Stream.m_pExecutor;
+
+        if (m_Offset == cursor_v)
+        {
+            m_bCursor = true;
+            if (auto Err = m_Stream.Tell(m_Offset); Err)
+            {
+                m_Error = std::move(Err);
+                return false;
+            }
+        }
+
+        m_Ticket.m_Callback = [this](async_ticket&) { Arrive(); };
+
+        auto Err = m_bWrite ? m_Stream.WriteAsync(m_Ticket, m_View, m_Offset) : m_Stream.ReadAsync(m_Ticket, m_View, m_Offset);
+        if (Err)
+        {
+            m_Error = std::move(Err);
+            return false;
+        }
+
+        // If the request got here first it is done, keep going
+        return m_bArrived.exchange(true, std::memory_order_acq_rel) == false;
+    }
+
+    //------------------------------------------------------------------------------
+    inline
+    xerr details::request_awaiter::await_resume( void ) noexcept
+    {
+        if (m_Error) return std::move(m_Error);
+
+        // Back in the coroutine, the cursor moves like it would for Read/Write
+        if (m_bCursor && m_Ticket.m_Transferred)
+        {
+            if (auto Err = m_Stream.SeekOrigin(m_Offset + m_Ticket.m_Transferred); Err)
+                return Err;
+        }
+
+        return m_Ticket.getError();
     }
 
     //------------------------------------------------------------------------------
@@ -16,12 +599,28 @@ namespace xfile
     constexpr
     stream::stream(stream&& Entry) noexcept
     {
-        m_pInstance    = Entry.m_pInstance;
-        m_pDeviceReg   = Entry.m_pDeviceReg;
-        m_AccessType   = Entry.m_AccessType;
-        m_FilePath     = std::move(Entry.m_FilePath);
-
-        Entry.m_pInstance = nullptr;
+        m_pInstance     = Entry.m_pInstance;
+        m_pBaseInstance = Entry.m_pBaseInstance;
+        m_pDeviceReg    = Entry.m_pDeviceReg;
+        m_AccessType    = Entry.m_AccessType;
+        m_FilePath      = std::move(Entry.m_FilePath);
+        m_Staging       = std::move(Entry.m_Staging);
+        m_Buffer        = std::move(Entry.m_Buffer);
+        m_BufferSize    = Entry.m_BufferSize;
+        m_BufferOffset  = Entry.m_BufferOffset;
+        m_BufferPos     = Entry.m_BufferPos;
+        m_BufferEnd     = Entry.m_BufferEnd;
+        m_CachedLength  = Entry.m_CachedLength;
+        m_BufferMode    = Entry.m_BufferMode;
+        m_bAsyncLayer   = Entry.m_bAsyncLayer;
+        m_pExecutor     = Entry.m_pExecutor;
+        m_pStats        = Entry.m_pStats;
+
+        Entry.m_pInstance     = nullptr;
+        Entry.m_pBaseInstance = nullptr;
+        Entry.m_BufferMode    = buffer_mode::NONE;
+        Entry.m_bAsyncLayer   = false;
+        Entry.m_pStats        = nullptr;
     }
 
     //------------------------------------------------------------------------------
@@ -37,6 +636,15 @@ namespace xfile
     xerr stream::Write(const T& Val) noexcept
     {
         assert(m_pInstance);
+
+        // Fast path, binary data that fits in the buffer
+        if (m_BufferMode == buffer_mode::WRITE && m_AccessType.m_Text == 0 && m_AccessType.m_bForceFlush == 0 && m_BufferSize - m_BufferPos >= sizeof(T))
+        {
+            std::memcpy(&m_Buffer[m_BufferPos], &Val, sizeof(T));
+            m_BufferPos += sizeof(T);
+            return {};
+        }
+
         return WriteRaw({ reinterpret_cast<const std::byte*>(&Val), sizeof(T)});
     }
 
@@ -64,6 +672,15 @@ namespace xfile
     xerr stream::Read( T& Val ) noexcept
     {
         assert(m_pInstance);
+
+        // Fast path, binary data already in the buffer
+        if (m_BufferMode == buffer_mode::READ && m_AccessType.m_Text == 0 && m_BufferEnd - m_BufferPos >= sizeof(T))
+        {
+            std::memcpy(&Val, &m_Buffer[m_BufferPos], sizeof(T));
+            m_BufferPos += sizeof(T);
+            return {};
+        }
+
         return ReadRaw({ reinterpret_cast<std::byte*>(&Val), sizeof(T) });
     }
 
@@ -138,7 +755,106 @@ namespace xfile
             return {};
         }
 
-        return m_pInstance->Synchronize(bBlock);
+        if (bBlock == false) return m_pInstance->Synchronize(false);
+
+        details::stats_probe Probe(*this, stats::op::STALL);
+        return m_pInstance->Synchronize(true);
+    }
+
+    //------------------------------------------------------------------------------
+    // The returned error is about making the request, the result of it is in the ticket
+    //------------------------------------------------------------------------------
+    inline
+    xerr stream::ReadAsync( async_ticket& Ticket, std::span<std::byte> View, std::size_t Offset ) noexcept
+    {
+        assert(m_pInstance);
+        if (auto Err = FlushBuffer(); Err) return Err;
+
+        details::stats_probe Probe(*this, stats::op::READ, View.size());
+        return m_pInstance->ReadAsync(Ticket, View, Offset);
+    }
+
+    //------------------------------------------------------------------------------
+    inline
+    xerr stream::WriteAsync( async_ticket& Ticket, std::span<const std::byte> View, std::size_t Offset ) noexcept
+    {
+        assert(m_pInstance);
+        if (auto Err = FlushBuffer(); Err) return Err;
+        m_CachedLength = ~std::size_t{0};
+
+        details::stats_probe Probe(*this, stats::op::WRITE, View.size());
+        return m_pInstance->WriteAsync(Ticket, View, Offset);
+    }
+
+    //------------------------------------------------------------------------------
+    // Nothing of the stream is touched (buffer, cursor, cached length) so threads can share it
+    //------------------------------------------------------------------------------
+    inline
+    xerr stream::ReadAt( std::size_t Offset, std::span<std::byte> View ) noexcept
+    {
+        assert(m_pInstance);
+        details::stats_probe Probe(*this, stats::op::READ, View.size());
+        return m_pInstance->ReadAt(Offset, View);
+    }
+
+    //------------------------------------------------------------------------------
+    inline
+    xerr stream::WriteAt( std::size_t Offset, std::span<const std::byte> View ) noexcept
+    {
+        assert(m_pInstance);
+        details::stats_probe Probe(*this, stats::op::WRITE, View.size());
+        return m_pInstance->WriteAt(Offset, View);
+    }
+
+    //------------------------------------------------------------------------------
+    inline
+    xerr stream::Wait( async_ticket& Ticket ) noexcept
+    {
+        assert(m_pInstance);
+        if (Ticket.m_Status.load(std::memory_order_acquire) == async_ticket::status::IDLE) return {};
+        assert(Ticket.m_pInstance == m_pInstance);
+
+        details::stats_probe Probe(*this, stats::op::STALL);
+        return m_pInstance->Wait(Ticket, true);
+    }
+
+    //------------------------------------------------------------------------------
+    // Returns state::INCOMPLETE while the request is in flight
+    //------------------------------------------------------------------------------
+    inline
+    xerr stream::Poll( async_ticket& Ticket ) noexcept
+    {
+        assert(m_pInstance);
+        if (Ticket.m_Status.load(std::memory_order_acquire) == async_ticket::status::IDLE) return {};
+        assert(Ticket.m_pInstance == m_pInstance);
+        return m_pInstance->Wait(Ticket, false);
+    }
+
+    //------------------------------------------------------------------------------
+    // The ticket still completes (as canceled unless it was too late), wait for it
+    //------------------------------------------------------------------------------
+    inline
+    void stream::Cancel( async_ticket& Ticket ) noexcept
+    {
+        assert(m_pInstance);
+        if (Ticket.m_Status.load(std::memory_order_acquire) != async_ticket::status::PENDING) return;
+        m_pInstance->Cancel(Ticket);
+    }
+
+    //------------------------------------------------------------------------------
+    inline
+    details::request_awaiter stream::ReadAsync( std::span<std::byte> View, std::size_t Offset ) noexcept
+    {
+        assert(m_pInstance);
+        return { *this, View, Offset, false };
+    }
+
+    //------------------------------------------------------------------------------
+    inline
+    details::request_awaiter stream::WriteAsync( std::span<const std::byte> View, std::size_t Offset ) noexcept
+    {
+        assert(m_pInstance);
+        return { *this, { const_cast<std::byte*>(View.data()), View.size() }, Offset, true };
     }
 
     //------------------------------------------------------------------------------
@@ -146,7 +862,13 @@ namespace xfile
     void stream::Flush(void) noexcept
     {
         assert(m_pInstance);
+        (void)FlushBuffer();
+
+        details::stats_probe Probe(*this, stats::op::FLUSH);
         m_pInstance->Flush();
+
+        // WriteAt may have grown the file behind our back
+        m_CachedLength = ~std::size_t{0};
     }
 
     //------------------------------------------------------------------------------
@@ -154,7 +876,7 @@ namespace xfile
     xerr stream::SeekOrigin( std::size_t Offset ) noexcept
     {
         assert(m_pInstance);
-        return m_pInstance->Seek( device::SKM_ORIGIN, Offset );
+        return BufferedSeek( device::SKM_ORIGIN, Offset );
     }
 
     //------------------------------------------------------------------------------
@@ -162,7 +884,7 @@ namespace xfile
     xerr stream::SeekEnd(std::size_t  Offset ) noexcept
     {
         assert(m_pInstance);
-        return m_pInstance->Seek( device::SKM_END, Offset );
+        return BufferedSeek( device::SKM_END, Offset );
     }
 
     //------------------------------------------------------------------------------
@@ -170,7 +892,7 @@ namespace xfile
     xerr stream::SeekCurrent(std::size_t Offset ) noexcept
     {
         assert(m_pInstance);
-        return m_pInstance->Seek( device::SKM_CURENT, Offset );
+        return BufferedSeek( device::SKM_CURENT, Offset );
     }
 
     //------------------------------------------------------------------------------
@@ -178,7 +900,7 @@ namespace xfile
     xerr stream::Tell(std::size_t& Pos ) noexcept
     {
         assert(m_pInstance);
-        return m_pInstance->Tell(Pos);
+        return BufferedTell(Pos);
     }
 
     //------------------------------------------------------------------------------
@@ -186,6 +908,10 @@ namespace xfile
     bool stream::isEOF(void) noexcept
     {
         assert(m_pInstance);
+
+        // Let the device answer from the stream cursor
+        if (m_BufferMode == buffer_mode::READ && m_BufferPos < m_BufferEnd) return false;
+        if (auto Err = FlushBuffer(); Err) return false;
         return m_pInstance->isEOF();
     }
 
@@ -194,6 +920,19 @@ namespace xfile
     xerr stream::getC( int& C ) noexcept
     {
         assert(m_pInstance);
+
+        // Fast path, the character is in the buffer and does not need any translation
+        if (m_BufferMode == buffer_mode::READ && m_BufferPos < m_BufferEnd && m_AccessType.m_Text != 2)
+        {
+            const auto x = static_cast<std::uint8_t>(m_Buffer[m_BufferPos]);
+            if (m_AccessType.m_Text == 0 || x != '\r')
+            {
+                ++m_BufferPos;
+                C = x;
+                return {};
+            }
+        }
+
         std::uint8_t x;
         if ( auto Err = ReadRaw(std::span<std::byte>{ reinterpret_cast<std::byte*>(&x), sizeof(x)}); Err ) 
             return Err;
@@ -210,7 +949,6 @@ namespace xfile
         assert(m_pInstance);
 
         std::size_t     iPos{ 0 };
-        std::uint8_t    C   = static_cast<std::uint8_t>(aC);
 
         if (Count == 0) return {};
         if (bUpdatePos == false) 
@@ -219,11 +957,8 @@ namespace xfile
                 return Err;
         }
 
-        for( int i = 0; i < Count; i++ )
-        {
-            if ( auto Err = WriteRaw({ reinterpret_cast<const std::byte*>(&C), sizeof(C) }); Err )
-                return Err;
-        }
+        if ( auto Err = Fill(aC, static_cast<std::size_t>(Count)); Err )
+            return Err;
 
         if (bUpdatePos == false)
         {
@@ -258,52 +993,33 @@ namespace xfile
     xerr stream::getFileLength( std::size_t& Length ) noexcept
     {
         assert(m_pInstance);
-        return m_pInstance->Length(Length);
-    }
+        if (m_BufferSize == 0) return m_pInstance->Length(Length);
 
-    //------------------------------------------------------------------------------
-    inline
-    xerr stream::ToFile( stream& File ) noexcept
-    {
-        // Seek at the begging of the file
-        if( auto Err = SeekOrigin( 0 ); Err ) 
-            return Err;
-
-        std::size_t                       i;
-        std::array<std::byte, 2 * 256>    Buffer;
-        std::size_t                       Length;
-        
-        if( auto Err = getFileLength(Length); Err ) 
-            return Err;
-
-        if (Length > Buffer.size() )
-        {
-            Length -= Buffer.size();
-            for (i = 0; i < Length; i += 256 )
-            {
-                if( auto Err = ReadRaw(Buffer); Err ) 
-                    return Err;
-
-                if( auto Err = File.WriteRaw(Buffer) ) 
-                    return Err;
-            }
-            Length += Buffer.size();
-        }
-
-        // Write trailing bytes
-        auto S = Length - i;
-        if (S)
+        if (m_CachedLength == ~std::size_t{0})
         {
-            auto FinalView = std::span{ Buffer.data(), Length - i };
-            if( auto Err = ReadRaw(FinalView); Err) 
+            if (auto Err = m_pInstance->Length(m_CachedLength); Err)
                 return Err;
-
-            return File.WriteRaw(FinalView);
         }
 
+        // Count the writes that have not reached the device yet
+        Length = m_BufferMode == buffer_mode::WRITE ? std::max(m_CachedLength, m_BufferOffset + m_BufferPos) : m_CachedLength;
         return {};
     }
 
+    //------------------------------------------------------------------------------
+    // Gives direct access to the bytes of a memory mapped file ("m" mode) or a ram file, starting at the cursor.
+    // The view ends where the device's current mapping window (or ram extent) ends.
+    // The view is valid until the next operation in the file.
+    //------------------------------------------------------------------------------
+    inline
+    xerr stream::MapView( std::span<const std::byte>& View ) noexcept
+    {
+        assert(m_pInstance);
+        if (auto Err = FlushBuffer(); Err) 
+            return Err;
+        return m_pInstance->MapView(View);
+    }
+
     //------------------------------------------------------------------------------
     inline
     xerr stream::ToMemory( std::span<std::byte> View ) noexcept
@@ -318,7 +1034,7 @@ namespace xfile
         if ( auto Err = getFileLength(Length); Err )
             return Err;
 
-        if ( Length < View.size()) 
+        if ( View.size() < Length ) 
             return xerr::create_f<state, "Buffer is too small">();
 
         return ReadRaw({ View.data(), Length });
@@ -333,6 +1049,23 @@ namespace xfile
 
         while (true) 
         {
+            // Binary strings can be scanned straight from the buffer
+            if (m_BufferMode == buffer_mode::READ && m_BufferPos < m_BufferEnd && m_AccessType.m_Text == 0)
+            {
+                const auto  Available = m_BufferEnd - m_BufferPos;
+                const auto* pStart    = reinterpret_cast<const char*>(&m_Buffer[m_BufferPos]);
+
+                if (auto* pEnd = static_cast<const char*>(std::memchr(pStart, 0, Available)); pEnd)
+                {
+                    Buffer.append(pStart, pEnd);
+                    m_BufferPos += static_cast<std::size_t>(pEnd - pStart) + 1;
+                    return {};
+                }
+
+                Buffer.append(pStart, Available);
+                m_BufferPos = m_BufferEnd;
+            }
+
             if (auto err = getC(c); err)
                 return err;
 
@@ -349,7 +1082,7 @@ namespace xfile
 
     xerr stream::WriteString( const std::string_view String ) noexcept
     {
-        if ( auto Err = m_pInstance->Write( { reinterpret_cast<const std::byte*>(String.data()), String.length() } ); Err )
+        if ( auto Err = BufferedWrite( { reinterpret_cast<const std::byte*>(String.data()), String.length() } ); Err )
             return Err;
 
         // if we are doing binary we better know where the string end...
@@ -366,7 +1099,7 @@ namespace xfile
 
     xerr stream::WriteString(const std::wstring_view String) noexcept
     {
-        if (auto Err = m_pInstance->Write({ reinterpret_cast<const std::byte*>(String.data()), String.length()*2 }); Err)
+        if (auto Err = BufferedWrite({ reinterpret_cast<const std::byte*>(String.data()), String.length() * sizeof(wchar_t) }); Err)
             return Err;
 
         // if we are doing binary we better know where the string end...
@@ -383,22 +1116,20 @@ namespace xfile
     //------------------------------------------------------------------------------
 
     template<typename... T_ARGS> inline
-    xerr stream::Printf( const char* pFormatStr, const T_ARGS& ... Args ) noexcept
+    xerr stream::Printf( std::format_string<T_ARGS...> FormatStr, T_ARGS&& ... Args ) noexcept
     {
-        constexpr auto size = 512;
-        auto Scratch = std::make_unique<char[]>(size);
-        std::size_t c = _sprintf(Scratch.get(), size, pFormatStr, Args...);
-        return WriteSpan( {reinterpret_cast<const std::byte*>(Scratch.get()), c});
+        details::format_sink<char> Sink{ *this };
+        std::format_to(std::back_inserter(Sink), FormatStr, std::forward<T_ARGS>(Args)...);
+        return Sink.Flush();
     }
 
     //------------------------------------------------------------------------------
 
     template<typename... T_ARGS> inline
-    xerr stream::wPrintf(const wchar_t* pFormatStr, const T_ARGS& ... Args) noexcept
+    xerr stream::wPrintf( std::wformat_string<T_ARGS...> FormatStr, T_ARGS&& ... Args ) noexcept
     {
-        constexpr auto size = 512;
-        auto Scratch = std::make_unique<wchar_t[]>(size);
-        std::size_t c = _wsprintf(Scratch.get(), size, pFormatStr, Args...);
-        return WriteSpan({ reinterpret_cast<const std::byte*>(Scratch.get()), c*2 });
+        details::format_sink<wchar_t> Sink{ *this };
+        std::format_to(std::back_inserter(Sink), FormatStr, std::forward<T_ARGS>(Args)...);
+        return Sink.Flush();
     }
 }
@@ -0,0 +1,228 @@
+#include <atomic>
+#include <array>
+#include <mutex>
+#include <new>
+#include <cassert>
+#include <span>
+
+namespace xfile::driver
+{
+    //==============================================================================
+    //  INSTANCE POOL
+    //==============================================================================
+    //  instance_pool
+    //      Pool of device instances shared by all the devices. It grows in segments
+    //      (so pointers handed out are never invalidated) up to T_MAX_SEGMENTS_V segments.
+    //      The free list is a lock-free stack with a 32 bit ABA tag, and every thread keeps
+    //      a small cache of free entries so that open/close in a loop does not touch the
+    //      shared head at all.
+    //      Alloc returns nullptr when the pool is exhausted.
+    //==============================================================================
+    template< typename T, std::size_t T_SEGMENT_SIZE_V = 128, std::size_t T_MAX_SEGMENTS_V = 1024 >
+    class instance_pool
+    {
+    public:
+
+        constexpr static std::size_t    segment_size_v  = T_SEGMENT_SIZE_V;
+        constexpr static std::size_t    max_segments_v  = T_MAX_SEGMENTS_V;
+        constexpr static std::size_t    cache_size_v    = 16;
+
+        static_assert( segment_size_v * max_segments_v < 0x7fffffff );
+
+        //------------------------------------------------------------------------------
+
+        instance_pool( void ) noexcept = default;
+        instance_pool( const instance_pool& ) = delete;
+
+        ~instance_pool( void ) noexcept
+        {
+            for (auto& S : m_Segments)
+                delete S.load(std::memory_order_relaxed);
+        }
+
+        //------------------------------------------------------------------------------
+
+        T* Alloc( void ) noexcept
+        {
+            // Try the thread cache first
+            if (auto& Cache = s_Cache; Cache.m_pPool == this && Cache.m_Count)
+            {
+                auto& Entry = getEntry(Cache.m_lIndex[--Cache.m_Count]);
+                Entry.m_bInUse = true;
+                return &Entry;
+            }
+
+            auto Local = m_Head.load(std::memory_order_acquire);
+            do
+            {
+                if (Local.m_iNext < 0)
+                {
+                    if (Grow() == false) return nullptr;
+                    Local = m_Head.load(std::memory_order_acquire);
+                    continue;
+                }
+
+                auto NewValue = Local;
+                NewValue.m_iNext = getEntry(Local.m_iNext).m_iNext.load(std::memory_order_relaxed);
+                NewValue.m_Tag++;
+
+                if (m_Head.compare_exchange_weak(Local, NewValue, std::memory_order_acquire, std::memory_order_acquire))
+                    break;
+
+            } while (true);
+
+            auto& Entry = getEntry(Local.m_iNext);
+            Entry.m_bInUse = true;
+            return &Entry;
+        }
+
+        //------------------------------------------------------------------------------
+
+        void Free( T& Instance ) noexcept
+        {
+            auto& Entry = static_cast<entry&>(Instance);
+            assert(Entry.m_bInUse);
+            Entry.m_bInUse = false;
+
+            auto& Cache = s_Cache;
+            if (Cache.m_pPool != this)
+            {
+                // The cache only serves one pool at a time, take it over if it is empty
+                if (Cache.m_Count) return Push(Entry.m_Index, Entry);
+                Cache.m_pPool   = this;
+                Cache.m_pFlush  = [](void* pPool, std::span<const std::int32_t> List) noexcept
+                {
+                    static_cast<instance_pool*>(pPool)->PushList(List);
+                };
+            }
+
+            if (Cache.m_Count == cache_size_v)
+            {
+                // Give back half of the cache to the other threads
+                PushList({ &Cache.m_lIndex[cache_size_v / 2], cache_size_v / 2 });
+                Cache.m_Count = cache_size_v / 2;
+            }
+
+            Cache.m_lIndex[Cache.m_Count++] = Entry.m_Index;
+        }
+
+        //------------------------------------------------------------------------------
+        // Visits all the entries that are currently handed out
+        //------------------------------------------------------------------------------
+        template< typename T_CALLBACK >
+        void ForEachInUse( T_CALLBACK&& Callback ) noexcept
+        {
+            const auto nSegments = m_nSegments.load(std::memory_order_acquire);
+            for (std::size_t i = 0; i < nSegments; ++i)
+            {
+                for (auto& E : *m_Segments[i].load(std::memory_order_acquire))
+                    if (E.m_bInUse) Callback(static_cast<T&>(E));
+            }
+        }
+
+    protected:
+
+        struct entry : T
+        {
+            std::atomic<std::int32_t>   m_iNext     { -1 };     // Atomic since a popping thread may read it after it lost the race
+            std::int32_t                m_Index     { -1 };
+            bool                        m_bInUse    { false };
+        };
+
+        using segment = std::array<entry, segment_size_v>;
+
+        struct head
+        {
+            std::int32_t    m_iNext;
+            std::uint32_t   m_Tag;
+        };
+
+        struct thread_cache
+        {
+            ~thread_cache( void ) noexcept
+            {
+                if (m_pPool && m_Count) m_pFlush(m_pPool, { m_lIndex.data(), m_Count });
+            }
+
+            void*                                       m_pPool     { nullptr };
+            void                                      (*m_pFlush)(void*, std::span<const std::int32_t>) noexcept {};
+            std::size_t                                 m_Count     { 0 };
+            std::array<std::int32_t, cache_size_v>      m_lIndex    {};
+        };
+
+        //------------------------------------------------------------------------------
+
+        entry& getEntry( std::int32_t Index ) noexcept
+        {
+            return (*m_Segments[Index / segment_size_v].load(std::memory_order_acquire))[Index % segment_size_v];
+        }
+
+        //------------------------------------------------------------------------------
+        // Pushes a chain of entries already linked from First to Last
+        //------------------------------------------------------------------------------
+        void Push( std::int32_t First, entry& Last ) noexcept
+        {
+            auto Local = m_Head.load(std::memory_order_relaxed);
+            do
+            {
+                Last.m_iNext.store(Local.m_iNext, std::memory_order_relaxed);
+
+                auto NewValue = Local;
+                NewValue.m_iNext = First;
+                NewValue.m_Tag++;
+
+                if (m_Head.compare_exchange_weak(Local, NewValue, std::memory_order_release, std::memory_order_relaxed))
+                    break;
+
+            } while (true);
+        }
+
+        //------------------------------------------------------------------------------
+
+        void PushList( std::span<const std::int32_t> List ) noexcept
+        {
+            if (List.empty()) return;
+            for (std::size_t i = 1; i < List.size(); ++i) getEntry(List[i - 1]).m_iNext.store(List[i], std::memory_order_relaxed);
+            Push(List.front(), getEntry(List.back()));
+        }
+
+        //------------------------------------------------------------------------------
+
+        bool Grow( void ) noexcept
+        {
+            std::lock_guard Lk(m_GrowLock);
+
+            // Someone else may have grown the pool (or freed entries) while we waited
+            if (m_Head.load(std::memory_order_acquire).m_iNext >= 0) return true;
+
+            const auto iSegment = m_nSegments.load(std::memory_order_relaxed);
+            if (iSegment == max_segments_v) return false;
+
+            auto* pSegment = new(std::nothrow) segment;
+            if (pSegment == nullptr) return false;
+
+            const auto Base = static_cast<std::int32_t>(iSegment * segment_size_v);
+            for (std::size_t i = 0; i < segment_size_v; ++i)
+            {
+                auto& E = (*pSegment)[i];
+                E.m_Index = Base + static_cast<std::int32_t>(i);
+                E.m_iNext.store(E.m_Index + 1, std::memory_order_relaxed);
+            }
+
+            m_Segments[iSegment].store(pSegment, std::memory_order_release);
+            m_nSegments.store(iSegment + 1, std::memory_order_release);
+
+            Push(Base, pSegment->back());
+            return true;
+        }
+
+    protected:
+
+        inline static thread_local thread_cache                 s_Cache     {};
+
+        std::atomic<head>                                       m_Head      { head{ -1, 0 } };
+        std::atomic<std::size_t>                                m_nSegments { 0 };
+        std::array<std::atomic<segment*>, max_segments_v>       m_Segments  {};
+        std::mutex                                              m_GrowLock  {};
+    };
+}
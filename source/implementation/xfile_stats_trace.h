@@ -0,0 +1,127 @@
+#include <chrono>
+#include <mutex>
+#include <vector>
+
+namespace xfile::details
+{
+    //==============================================================================
+    //  STATS TRACE
+    //==============================================================================
+    //  stats_trace
+    //      Timeline of the operations done between stats::BeginTrace and EndTrace. The
+    //      probes only come here while s_bTracing is set, so the lock is not touched by
+    //      anyone otherwise. The events grow the list up to the limit given to Begin,
+    //      the ones after that are counted as dropped. Export writes them in the Chrome
+    //      trace event format ("X" events, one track per thread, the device as category).
+    //==============================================================================
+    class stats_trace
+    {
+    public:
+
+        struct event
+        {
+            const device::registration* m_pDeviceReg    { nullptr };
+            std::uint64_t               m_StartNs       { 0 };          // Since Begin
+            std::uint64_t               m_Ns            { 0 };
+            std::size_t                 m_Bytes         { 0 };
+            std::uint32_t               m_ThreadID      { 0 };
+            stats::op                   m_Op            { stats::op::OPEN };
+        };
+
+        //------------------------------------------------------------------------------
+
+        static stats_trace& getInstance( void ) noexcept
+        {
+            static stats_trace s_Trace;
+            return s_Trace;
+        }
+
+        //------------------------------------------------------------------------------
+
+        void Begin( std::size_t MaxEvents ) noexcept
+        {
+            std::lock_guard Lk(m_Lock);
+            m_Events.clear();
+            m_MaxEvents = MaxEvents;
+            m_nDropped  = 0;
+            m_Start     = std::chrono::steady_clock::now();
+            s_bTracing.store(true, std::memory_order_relaxed);
+        }
+
+        //------------------------------------------------------------------------------
+
+        void End( void ) noexcept
+        {
+            s_bTracing.store(false, std::memory_order_relaxed);
+        }
+
+        //------------------------------------------------------------------------------
+        // Operations that started before Begin are not part of the trace
+        //------------------------------------------------------------------------------
+
+        void Add( const device::registration* pDeviceReg, stats::op Op, std::chrono::steady_clock::time_point Start, std::uint64_t Ns, std::size_t Bytes ) noexcept
+        {
+            static std::atomic<std::uint32_t>   s_nThreads  { 0 };
+            thread_local const std::uint32_t   s_ThreadID  = ++s_nThreads;
+
+            std::lock_guard Lk(m_Lock);
+            if (s_bTracing.load(std::memory_order_relaxed) == false || Start < m_Start) return;
+
+            if (m_Events.size() == m_MaxEvents)
+            {
+                ++m_nDropped;
+                return;
+            }
+
+            const auto StartNs = static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(Start - m_Start).count());
+            m_Events.push_back({ pDeviceReg, StartNs, Ns, Bytes, s_ThreadID, Op });
+        }
+
+        //------------------------------------------------------------------------------
+
+        xerr Export( std::wstring_view Path ) noexcept
+        {
+            End();
+
+            // Writing the file does not add events, the trace is off
+            std::lock_guard Lk(m_Lock);
+
+            stream File;
+            if (auto Err = File.open(Path, "w"); Err)
+                return Err;
+
+            if (auto Err = File.Printf("{{\"displayTimeUnit\":\"ns\",\"otherData\":{{\"dropped\":{}}},\"traceEvents\":[", m_nDropped); Err)
+                return Err;
+
+            for (std::size_t i = 0; i < m_Events.size(); ++i)
+            {
+                const auto& Event = m_Events[i];
+
+                // Device titles are plain identifiers, they do not need escaping
+                if (auto Err = File.Printf("{}\n{{\"name\":\"{}\",\"cat\":\"{}\",\"ph\":\"X\",\"pid\":1,\"tid\":{},\"ts\":{},\"dur\":{},\"args\":{{\"bytes\":{}}}}}"
+                                          , i ? "," : ""
+                                          , stats::getName(Event.m_Op)
+                                          , Event.m_pDeviceReg ? Event.m_pDeviceReg->m_pTitle : "None"
+                                          , Event.m_ThreadID
+                                          , static_cast<double>(Event.m_StartNs) / 1000.0
+                                          , static_cast<double>(Event.m_Ns) / 1000.0
+                                          , Event.m_Bytes ); Err)
+                    return Err;
+            }
+
+            if (auto Err = File.Printf("\n]}}\n"); Err)
+                return Err;
+
+            File.Flush();
+            return {};
+        }
+
+    protected:
+
+        std::mutex                              m_Lock          {};
+        std::vector<event>                      m_Events        {};
+        std::size_t                             m_MaxEvents     { 0 };
+        std::uint64_t                           m_nDropped      { 0 };
+        std::chrono::steady_clock::time_point   m_Start         {};
+    };
+}
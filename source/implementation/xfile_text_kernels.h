@@ -0,0 +1,141 @@
+#include <bit>
+#include <cstring>
+#include <cstdint>
+
+#if defined(__AVX2__)
+    #include <immintrin.h>
+    #define XFILE_TEXT_SIMD 32
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #include <emmintrin.h>
+    #define XFILE_TEXT_SIMD 16
+#else
+    #define XFILE_TEXT_SIMD 0
+#endif
+
+//==============================================================================
+//  TEXT KERNELS
+//==============================================================================
+//  Newline translation used by the text modes ("t" and "T") of the stream.
+//  Writing turns every '\n' into "\r\n", reading turns every "\r\n" back into '\n'.
+//  Both scan the text a vector at a time (AVX2 or SSE2 depending on the build) and
+//  only look at the individual characters of the vectors that have something to do.
+//  They are templated on the character type (char for "t", wchar_t for "T").
+//==============================================================================
+namespace xfile::details::text
+{
+#if XFILE_TEXT_SIMD
+    constexpr static std::size_t vector_bytes_v = XFILE_TEXT_SIMD;
+
+    //------------------------------------------------------------------------------
+    // Returns a mask with sizeof(T_CHAR) bits set for each character of the vector equal to C
+    //------------------------------------------------------------------------------
+    template< typename T_CHAR >
+    inline std::uint32_t MatchMask( const T_CHAR* p, T_CHAR C ) noexcept
+    {
+    #if XFILE_TEXT_SIMD == 32
+        const auto V = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        if constexpr (sizeof(T_CHAR) == 1) return static_cast<std::uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8 (V, _mm256_set1_epi8 (static_cast<char>(C)))));
+        if constexpr (sizeof(T_CHAR) == 2) return static_cast<std::uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi16(V, _mm256_set1_epi16(static_cast<short>(C)))));
+        if constexpr (sizeof(T_CHAR) == 4) return static_cast<std::uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi32(V, _mm256_set1_epi32(static_cast<int>(C)))));
+    #else
+        const auto V = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        if constexpr (sizeof(T_CHAR) == 1) return static_cast<std::uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8 (V, _mm_set1_epi8 (static_cast<char>(C)))));
+        if constexpr (sizeof(T_CHAR) == 2) return static_cast<std::uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi16(V, _mm_set1_epi16(static_cast<short>(C)))));
+        if constexpr (sizeof(T_CHAR) == 4) return static_cast<std::uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi32(V, _mm_set1_epi32(static_cast<int>(C)))));
+    #endif
+    }
+
+    //------------------------------------------------------------------------------
+    // Removes the lowest character from the mask, returns its index in the vector
+    //------------------------------------------------------------------------------
+    template< typename T_CHAR >
+    inline std::size_t PopLane( std::uint32_t& Mask ) noexcept
+    {
+        constexpr std::uint32_t lane_bits_v = (1u << sizeof(T_CHAR)) - 1;
+        const auto Bit = static_cast<std::uint32_t>(std::countr_zero(Mask));
+        Mask &= ~(lane_bits_v << Bit);
+        return Bit / sizeof(T_CHAR);
+    }
+#endif
+
+    //------------------------------------------------------------------------------
+    // Copies Count characters from pSrc into pDst turning '\n' into "\r\n".
+    // pDst must have room for 2 * Count characters. Returns the characters written.
+    //------------------------------------------------------------------------------
+    template< typename T_CHAR >
+    std::size_t ExpandNewLines( const T_CHAR* pSrc, std::size_t Count, T_CHAR* pDst ) noexcept
+    {
+        T_CHAR*     p = pDst;
+        std::size_t i = 0;
+
+#if XFILE_TEXT_SIMD
+        constexpr std::size_t lanes_v = vector_bytes_v / sizeof(T_CHAR);
+        for (; i + lanes_v <= Count; i += lanes_v)
+        {
+            auto        Mask   = MatchMask(pSrc + i, T_CHAR('\n'));
+            std::size_t Copied = 0;
+            while (Mask)
+            {
+                const auto Lane = PopLane<T_CHAR>(Mask);
+                std::memcpy(p, pSrc + i + Copied, (Lane - Copied) * sizeof(T_CHAR));
+                p     += Lane - Copied;
+                *p++   = T_CHAR('\r');
+                *p++   = T_CHAR('\n');
+                Copied = Lane + 1;
+            }
+
+            std::memcpy(p, pSrc + i + Copied, (lanes_v - Copied) * sizeof(T_CHAR));
+            p += lanes_v - Copied;
+        }
+#endif
+
+        for (; i < Count; ++i)
+        {
+            if (pSrc[i] == T_CHAR('\n')) *p++ = T_CHAR('\r');
+            *p++ = pSrc[i];
+        }
+
+        return static_cast<std::size_t>(p - pDst);
+    }
+
+    //------------------------------------------------------------------------------
+    // Turns every "\r\n" into '\n' in place. A '\r' in the last character is kept since
+    // we can not know what follows it. Returns the new number of characters.
+    //------------------------------------------------------------------------------
+    template< typename T_CHAR >
+    std::size_t CompactNewLines( T_CHAR* pData, std::size_t Count ) noexcept
+    {
+        std::size_t i = 0;
+        std::size_t o = 0;
+
+#if XFILE_TEXT_SIMD
+        // Note the strict < so that we can always look at the character after the vector
+        constexpr std::size_t lanes_v = vector_bytes_v / sizeof(T_CHAR);
+        for (; i + lanes_v < Count; i += lanes_v)
+        {
+            auto        Mask   = MatchMask(pData + i, T_CHAR('\r'));
+            std::size_t Copied = 0;
+            while (Mask)
+            {
+                const auto Lane = PopLane<T_CHAR>(Mask);
+                if (pData[i + Lane + 1] != T_CHAR('\n')) continue;
+
+                std::memmove(pData + o, pData + i + Copied, (Lane - Copied) * sizeof(T_CHAR));
+                o     += Lane - Copied;
+                Copied = Lane + 1;
+            }
+
+            std::memmove(pData + o, pData + i + Copied, (lanes_v - Copied) * sizeof(T_CHAR));
+            o += lanes_v - Copied;
+        }
+#endif
+
+        for (; i < Count; ++i)
+        {
+            if (pData[i] == T_CHAR('\r') && i + 1 < Count && pData[i + 1] == T_CHAR('\n')) continue;
+            pData[o++] = pData[i];
+        }
+
+        return o;
+    }
+}
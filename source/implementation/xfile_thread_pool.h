@@ -0,0 +1,216 @@
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <vector>
+#include <atomic>
+#include <algorithm>
+
+namespace xfile::details
+{
+    //==============================================================================
+    //  THREAD POOL
+    //==============================================================================
+    //  thread_pool
+    //      Workers used by the file system for the jobs it splits in pieces (loading
+    //      big files, compressing, etc). Jobs must not block waiting for other jobs,
+    //      except through ForEach which always makes progress on the calling thread.
+    //      Every worker has its own queue: jobs submitted by a worker go to its queue
+    //      (and it takes the newest one first), the rest are spread across the queues.
+    //      A worker with an empty queue steals the oldest job of the others.
+    //      getIOInstance is a second, small pool for jobs that block on a device.
+    //==============================================================================
+    class thread_pool
+    {
+    public:
+
+        using job = std::function<void()>;
+
+        constexpr static std::size_t io_workers_v = 4;
+
+        //------------------------------------------------------------------------------
+
+        static thread_pool& getInstance( void ) noexcept
+        {
+            static thread_pool s_Pool;
+            return s_Pool;
+        }
+
+        //------------------------------------------------------------------------------
+
+        static thread_pool& getIOInstance( void ) noexcept
+        {
+            static thread_pool s_Pool{ io_workers_v };
+            return s_Pool;
+        }
+
+        //------------------------------------------------------------------------------
+
+        explicit thread_pool( std::size_t nWorkers = std::max(1u, std::thread::hardware_concurrency()) - 1 ) noexcept
+            : m_Queues( std::max<std::size_t>(nWorkers, 1) )
+        {
+            for (std::size_t i = 0; i < m_Queues.size(); ++i)
+                m_Workers.emplace_back([this, i] { WorkerLoop(i); });
+        }
+
+        //------------------------------------------------------------------------------
+
+        ~thread_pool( void ) noexcept
+        {
+            {
+                std::lock_guard Lk(m_Lock);
+                m_bStop = true;
+            }
+            m_Ready.notify_all();
+            for (auto& W : m_Workers) W.join();
+        }
+
+        //------------------------------------------------------------------------------
+
+        std::size_t getWorkerCount( void ) const noexcept
+        {
+            return m_Workers.size();
+        }
+
+        //------------------------------------------------------------------------------
+
+        void Submit( job&& Job ) noexcept
+        {
+            const auto iQueue = s_pWorkerPool == this ? s_iWorker : m_iNextQueue.fetch_add(1, std::memory_order_relaxed) % m_Queues.size();
+            {
+                // Counted under the lock so a worker going to sleep can not miss it
+                std::lock_guard Lk(m_Lock);
+                m_nJobs.fetch_add(1, std::memory_order_relaxed);
+            }
+            {
+                auto& Queue = m_Queues[iQueue];
+                std::lock_guard Lk(Queue.m_Lock);
+                Queue.m_Jobs.push_back(std::move(Job));
+            }
+            m_Ready.notify_one();
+        }
+
+        //------------------------------------------------------------------------------
+        // Calls Function(i) for every i in [0, Count) using the workers and the calling
+        // thread, and returns when all the calls are done.
+        //------------------------------------------------------------------------------
+        template< typename T_FUNCTION >
+        void ForEach( std::size_t Count, T_FUNCTION&& Function ) noexcept
+        {
+            if (Count == 0) return;
+
+            struct state
+            {
+                std::atomic<std::size_t>    m_iNext     { 0 };
+                std::atomic<std::size_t>    m_nDone     { 0 };
+                std::size_t                 m_Count     { 0 };
+                T_FUNCTION*                 m_pFunction { nullptr };
+                std::mutex                  m_Lock      {};
+                std::condition_variable     m_Done      {};
+
+                void Run( void ) noexcept
+                {
+                    for (auto i = m_iNext++; i < m_Count; i = m_iNext++)
+                    {
+                        (*m_pFunction)(i);
+                        if (++m_nDone == m_Count)
+                        {
+                            std::lock_guard Lk(m_Lock);
+                            m_Done.notify_all();
+                        }
+                    }
+                }
+            };
+
+            auto State = std::make_shared<state>();
+            State->m_Count     = Count;
+            State->m_pFunction = &Function;
+
+            // Helpers that start late find nothing to do, they only keep the state alive
+            for (std::size_t i = 0, end = std::min(Count - 1, m_Workers.size()); i < end; ++i)
+                Submit([State] { State->Run(); });
+
+            State->Run();
+
+            std::unique_lock Lk(State->m_Lock);
+            State->m_Done.wait(Lk, [&] { return State->m_nDone.load() == Count; });
+        }
+
+    protected:
+
+        struct queue
+        {
+            std::mutex                  m_Lock      {};
+            std::deque<job>             m_Jobs      {};
+        };
+
+        //------------------------------------------------------------------------------
+        // Newest job of our queue first, then the oldest job of the others
+        //------------------------------------------------------------------------------
+        bool Pop( std::size_t iWorker, job& Job ) noexcept
+        {
+            {
+                auto& Queue = m_Queues[iWorker];
+                std::lock_guard Lk(Queue.m_Lock);
+                if (Queue.m_Jobs.empty() == false)
+                {
+                    Job = std::move(Queue.m_Jobs.back());
+                    Queue.m_Jobs.pop_back();
+                    return true;
+                }
+            }
+
+            for (std::size_t i = 1; i < m_Queues.size(); ++i)
+            {
+                auto& Queue = m_Queues[(iWorker + i) % m_Queues.size()];
+                std::lock_guard Lk(Queue.m_Lock);
+                if (Queue.m_Jobs.empty() == false)
+                {
+                    Job = std::move(Queue.m_Jobs.front());
+                    Queue.m_Jobs.pop_front();
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        //------------------------------------------------------------------------------
+
+        void WorkerLoop( std::size_t iWorker ) noexcept
+        {
+            s_pWorkerPool = this;
+            s_iWorker     = iWorker;
+
+            while (true)
+            {
+                if (job Job; Pop(iWorker, Job))
+                {
+                    m_nJobs.fetch_sub(1, std::memory_order_relaxed);
+                    Job();
+                    continue;
+                }
+
+                // A job may be counted before it lands in a queue, in that case we only look again
+                std::unique_lock Lk(m_Lock);
+                m_Ready.wait(Lk, [&] { return m_bStop || m_nJobs.load(std::memory_order_relaxed); });
+                if (m_nJobs.load(std::memory_order_relaxed) == 0) return;
+            }
+        }
+
+    protected:
+
+        inline static thread_local thread_pool*     s_pWorkerPool   { nullptr };
+        inline static thread_local std::size_t      s_iWorker       { 0 };
+
+        std::mutex                  m_Lock          {};
+        std::condition_variable     m_Ready         {};
+        std::vector<queue>          m_Queues;
+        std::atomic<std::size_t>    m_nJobs         { 0 };      // Jobs in the queues
+        std::atomic<std::size_t>    m_iNextQueue    { 0 };
+        std::vector<std::thread>    m_Workers       {};
+        bool                        m_bStop         { false };
+    };
+}
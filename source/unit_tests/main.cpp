@@ -3,7 +3,6 @@
 
 int main()
 {
-    xfile::unit_test::Tests();
-
-    return 0;
-}
\ No newline at end of file
+    // Any test that fails makes ctest report the run as failed
+    return xfile::unit_test::Tests() ? 1 : 0;
+}
@@ -1,4 +1,11 @@
 #include <string>
+#include <filesystem>
+#include <cstring>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cstdio>
 
 namespace xfile::unit_test
 {
@@ -200,6 +207,9 @@ namespace xfile::unit_test
                     else return Err;
                 }
 
+                if( auto Err = File.Synchronize(true); Err ) 
+                    return Err;
+
                 // Start reading 
                 for (int i = 1; i < Steps; i++)
                 {
@@ -235,17 +245,1646 @@ namespace xfile::unit_test
 
     //-----------------------------------------------------------------------------------------
 
-    void Tests(void)
+    xerr asyncQueueDepthTest( std::wstring_view FileName )
+    {
+        constexpr static int    Chunks    = 32;
+        constexpr static int    ChunkSize = 1024;
+        auto                    Buffer    = std::make_unique<std::int32_t[]>(Chunks * ChunkSize);
+        xfile::stream           File;
+
+        for (int i = 0; i < Chunks * ChunkSize; ++i) Buffer[i] = i;
+
+        if (auto Err = File.open(FileName, "w"); Err)
+            return Err;
+
+        if (auto Err = File.WriteSpan(std::span(Buffer.get(), Chunks * ChunkSize)); Err)
+            return Err;
+
+        File.close();
+        std::fill_n(Buffer.get(), Chunks * ChunkSize, 0);
+
+        //
+        // Queue all the chunks in reverse order so each request has its own offset
+        //
+        if (auto Err = File.open(FileName, "r@"); Err)
+            return Err;
+
+        for (int i = Chunks - 1; i >= 0; --i)
+        {
+            if (auto Err = File.SeekOrigin(i * ChunkSize * sizeof(std::int32_t)); Err)
+                return Err;
+
+            if (auto Err = File.ReadSpan(std::span(&Buffer[i * ChunkSize], ChunkSize)); Err)
+            {
+                if (Err.getState<xfile::state>() == xfile::state::INCOMPLETE) Err.clear();
+                else return Err;
+            }
+        }
+
+        if (auto Err = File.Synchronize(true); Err)
+            return Err;
+
+        for (int i = 0; i < Chunks * ChunkSize; ++i)
+        {
+            assert(Buffer[i] == i);
+        }
+
+        File.close();
+        return {};
+    }
+
+    //-----------------------------------------------------------------------------------------
+
+    xerr crossThreadAsyncTest( std::wstring_view FileName )
+    {
+        std::array<std::uint32_t, 4096> Buffer{};
+        xfile::stream                   File;
+
+        for (std::uint32_t i = 0; i < Buffer.size(); i++) Buffer[i] = i;
+
+        if (auto Err = File.open(FileName, "w"); Err)
+            return Err;
+
+        if (auto Err = File.WriteSpan(std::span(Buffer)); Err)
+            return Err;
+
+        File.close();
+        Buffer.fill(0);
+
+        //
+        // Open the file in a thread that is gone by the time we read from it
+        //
+        xerr OpenErr;
+        std::thread([&]{ OpenErr = File.open(FileName, "r@"); }).join();
+        if (OpenErr)
+            return OpenErr;
+
+        if (auto Err = File.ReadSpan(std::span(Buffer)); Err)
+        {
+            if (Err.getState<xfile::state>() == xfile::state::INCOMPLETE) Err.clear();
+            else return Err;
+        }
+
+        if (auto Err = File.Synchronize(true); Err)
+            return Err;
+
+        for (std::uint32_t i = 0; i < Buffer.size(); i++)
+        {
+            assert(Buffer[i] == i);
+        }
+
+        File.close();
+        return {};
+    }
+
+    //-----------------------------------------------------------------------------------------
+
+    xerr memoryMapTest( std::wstring_view FileName )
+    {
+        std::array< std::uint32_t, 4096> Buffer{};
+        for (std::uint32_t i = 0; i < Buffer.size(); i++) Buffer[i] = i;
+
+        xfile::stream File;
+        if (auto Err = File.open(FileName, "w"); Err)
+            return Err;
+
+        if (auto Err = File.WriteSpan(std::span{ Buffer }); Err)
+            return Err;
+
+        File.close();
+
+        if (auto Err = File.open(FileName, "rm"); Err)
+            return Err;
+
+        // Parse in place when the device can map it
+        if (auto Err = File.SeekOrigin(sizeof(std::uint32_t)); Err)
+            return Err;
+
+        std::span<const std::byte> View;
+        if (auto Err = File.MapView(View); Err)
+        {
+            if (Err.getState<xfile::state>() != xfile::state::NOT_SUPPORTED) return Err;
+            Err.clear();
+        }
+        else
+        {
+            assert(View.size() == (Buffer.size() - 1) * sizeof(std::uint32_t));
+            assert(reinterpret_cast<const std::uint32_t*>(View.data())[0] == 1);
+        }
+
+        // Regular reads still work
+        std::uint32_t Value;
+        if (auto Err = File.SeekEnd(0); Err)
+            return Err;
+
+        if (auto Err = File.SeekCurrent(-static_cast<std::ptrdiff_t>(sizeof(Value))); Err)
+            return Err;
+
+        if (auto Err = File.Read(Value); Err)
+            return Err;
+        assert(Value == Buffer.size() - 1);
+
+        File.close();
+        return {};
+    }
+
+    //-----------------------------------------------------------------------------------------
+
+    xerr readViewTest( std::wstring_view FileName )
+    {
+        std::array< std::uint32_t, 8000> Buffer{};
+        for (std::uint32_t i = 0; i < Buffer.size(); i++) Buffer[i] = i;
+
+        xfile::stream File;
+        if (auto Err = File.open(FileName, "w"); Err)
+            return Err;
+
+        if (auto Err = File.WriteSpan(std::span{ Buffer }); Err)
+            return Err;
+
+        if (auto Err = File.SeekOrigin(0); Err)
+            return Err;
+
+        // Read in odd sizes so some of the views cross the device blocks
+        std::uint32_t Expected = 0;
+        for (std::size_t Total = 0; Total < sizeof(Buffer); )
+        {
+            const auto Count = std::min<std::size_t>(sizeof(Buffer) - Total, 1000 * sizeof(std::uint32_t));
+
+            std::span<const std::byte> View;
+            if (auto Err = File.ReadView(View, Count); Err)
+                return Err;
+
+            assert(View.size() == Count);
+            for (std::size_t i = 0; i < Count; i += sizeof(std::uint32_t))
+            {
+                std::uint32_t Value;
+                std::memcpy(&Value, &View[i], sizeof(Value));
+                assert(Value == Expected++);
+            }
+
+            Total += Count;
+        }
+
+        File.close();
+        return {};
+    }
+
+    //-----------------------------------------------------------------------------------------
+
+    xerr ramFileSystemTest( void )
+    {
+        {
+            xfile::stream File;
+            if (auto Err = File.open(L"ram:\\stage\\data.bin", "w"); Err)
+                return Err;
+
+            if (auto Err = File.WriteString(std::string_view{ "Survives close" }); Err)
+                return Err;
+        }
+
+        // Many readers of the same file, the path separators do not matter
+        {
+            std::array<xfile::stream, 4> Readers;
+            for (auto& R : Readers)
+            {
+                if (auto Err = R.open(L"ram:/stage/data.bin", "r"); Err)
+                    return Err;
+            }
+
+            for (auto& R : Readers)
+            {
+                std::string Str;
+                if (auto Err = R.ReadString(Str); Err)
+                    return Err;
+                assert(Str == "Survives close");
+            }
+        }
+
+        if (auto Err = xfile::deleteFile(L"ram:/stage/data.bin"); Err)
+            return Err;
+
+        xfile::stream File;
+        if (auto Err = File.open(L"ram:/stage/data.bin", "r"); !Err)
+            return xerr::create_f<xfile::state, "The ram file should have been deleted">();
+
+        return {};
+    }
+
+    //-----------------------------------------------------------------------------------------
+
+    xerr ramExtentTest( void )
+    {
+        // Big enough to span several extents, with an odd size so copies straddle the boundaries
+        std::vector<std::uint32_t> Data( 300 * 1024 + 7 );
+        for (std::size_t i = 0; i < Data.size(); ++i) Data[i] = static_cast<std::uint32_t>(i * 2654435761u);
+
+        xfile::stream File;
+        if (auto Err = File.open(L"ram:/extents.bin", "w+"); Err)
+            return Err;
+
+        if (auto Err = File.WriteSpan(std::span<const std::uint32_t>{ Data }); Err)
+            return Err;
+
+        std::vector<std::uint32_t> Copy( Data.size() );
+        if (auto Err = File.SeekOrigin(0); Err)
+            return Err;
+
+        if (auto Err = File.ReadSpan(std::span{ Copy }); Err)
+            return Err;
+
+        assert(Copy == Data);
+
+        // Reading past the end gives what there is and then reports the end of the file
+        std::array<std::uint32_t, 4> Tail{};
+        if (auto Err = File.SeekOrigin((Data.size() - 2) * sizeof(std::uint32_t)); Err)
+            return Err;
+
+        if (auto Err = File.ReadSpan(std::span{ Tail }); Err.getState<xfile::state>() != xfile::state::UNEXPECTED_EOF)
+            return xerr::create_f<xfile::state, "Expected to hit the end of the ram file">();
+
+        assert(Tail[0] == Data[Data.size() - 2] && Tail[1] == Data[Data.size() - 1]);
+
+        File.close();
+        return xfile::deleteFile(L"ram:/extents.bin");
+    }
+
+    //-----------------------------------------------------------------------------------------
+
+    xerr bufferedStreamTest( std::wstring_view FileName )
+    {
+        constexpr std::uint32_t count_v = 100000;
+
+        xfile::stream File;
+        if (auto Err = File.open(FileName, "w"); Err)
+            return Err;
+
+        // Lots of tiny writes, more than what the buffer holds
+        for (std::uint32_t i = 0; i < count_v; ++i)
+        {
+            if (auto Err = File.Write(i); Err)
+                return Err;
+        }
+
+        // The length must include what is still in the buffer
+        std::size_t Length;
+        if (auto Err = File.getFileLength(Length); Err)
+            return Err;
+        assert(Length == count_v * sizeof(std::uint32_t));
+
+        // Patch a value in the middle and go back to the end
+        if (auto Err = File.SeekOrigin(1000 * sizeof(std::uint32_t)); Err)
+            return Err;
+
+        if (auto Err = File.Write(std::uint32_t{ 0xdeadbeef }); Err)
+            return Err;
+
+        if (auto Err = File.SeekEnd(0); Err)
+            return Err;
+
+        if (auto Err = File.WriteString(std::string_view{ "End" }); Err)
+            return Err;
+
+        // Read it back with small reads, jumping around
+        if (auto Err = File.SeekOrigin(0); Err)
+            return Err;
+
+        for (std::uint32_t i = 0; i < count_v; ++i)
+        {
+            std::uint32_t Value;
+            if (auto Err = File.Read(Value); Err)
+                return Err;
+            assert(Value == (i == 1000 ? 0xdeadbeef : i));
+
+            if (i == 50000)
+            {
+                // Seeking backwards inside of what is buffered
+                std::size_t Pos;
+                if (auto Err = File.Tell(Pos); Err)
+                    return Err;
+                assert(Pos == (i + 1) * sizeof(std::uint32_t));
+
+                if (auto Err = File.SeekCurrent(static_cast<std::size_t>(-4)); Err)
+                    return Err;
+
+                if (auto Err = File.Read(Value); Err)
+                    return Err;
+                assert(Value == i);
+            }
+        }
+
+        std::string End;
+        if (auto Err = File.ReadString(End); Err)
+            return Err;
+        assert(End == "End");
+
+        std::uint32_t Value;
+        if (auto Err = File.Read(Value); Err.getState<xfile::state>() != xfile::state::UNEXPECTED_EOF)
+            return xerr::create_f<xfile::state, "Expected to hit the end of the file">();
+
+        // An unbuffered stream must see the same thing
+        File.close();
+        if (auto Err = File.open(FileName, "r"); Err)
+            return Err;
+
+        if (auto Err = File.setBufferSize(0); Err)
+            return Err;
+
+        if (auto Err = File.SeekOrigin(1000 * sizeof(std::uint32_t)); Err)
+            return Err;
+
+        if (auto Err = File.Read(Value); Err)
+            return Err;
+        assert(Value == 0xdeadbeef);
+
+        return {};
+    }
+
+    //-----------------------------------------------------------------------------------------
+
+    template< typename T_CHAR >
+    xerr textModeTest( std::wstring_view FileName )
+    {
+        // Lots of newlines, and some '\r' in odd places to stress the translation
+        std::basic_string<T_CHAR> Text;
+        std::size_t               nNewLines = 0;
+        std::uint32_t             Seed      = 1234;
+        for (int i = 0; i < 200000; ++i)
+        {
+            Seed = Seed * 1664525u + 1013904223u;
+            const auto R = (Seed >> 24) % 16;
+            const auto C = R == 0 ? T_CHAR('\n') : R == 1 ? T_CHAR('\r') : static_cast<T_CHAR>('a' + R);
+            nNewLines += C == T_CHAR('\n');
+            Text.push_back(C);
+        }
+
+        const char* pWrite = sizeof(T_CHAR) == 1 ? "wt" : "wT";
+        const char* pRead  = sizeof(T_CHAR) == 1 ? "rt" : "rT";
+
+        xfile::stream File;
+        if (auto Err = File.open(FileName, pWrite); Err)
+            return Err;
+
+        if (auto Err = File.WriteRaw(std::as_bytes(std::span{ Text })); Err)
+            return Err;
+
+        File.close();
+
+        // Every '\n' must have turned into "\r\n"
+        if (auto Err = File.open(FileName, "r"); Err)
+            return Err;
+
+        std::size_t Length;
+        if (auto Err = File.getFileLength(Length); Err)
+            return Err;
+        assert(Length == (Text.size() + nNewLines) * sizeof(T_CHAR));
+        File.close();
+
+        // Read it back in odd sized pieces
+        if (auto Err = File.open(FileName, pRead); Err)
+            return Err;
+
+        std::basic_string<T_CHAR> Copy(Text.size(), T_CHAR(0));
+        for (std::size_t i = 0, Step = 1; i < Copy.size(); i += Step, Step = Step * 3 % 4099 + 1)
+        {
+            Step = std::min(Step, Copy.size() - i);
+            if (auto Err = File.ReadRaw(std::as_writable_bytes(std::span{ &Copy[i], Step })); Err)
+                return Err;
+        }
+
+        assert(Copy == Text);
+        return {};
+    }
+
+    //-----------------------------------------------------------------------------------------
+
+    xerr printfTest( std::wstring_view FileName )
     {
+        // Longer than the formatting chunk so that it goes out in pieces
+        const std::string Long( 3000, 'x' );
+
+        xfile::stream File;
+        if (auto Err = File.open(FileName, "wt"); Err)
+            return Err;
+
+        if (auto Err = File.Printf("{} {} {}\n", 42, "abc", Long); Err)
+            return Err;
+
+        if (auto Err = File.Printf("{}|{}|\n", -7, 'z'); Err)
+            return Err;
+
+        File.close();
+
+        const std::string Expected = "42 abc " + Long + "\r\n-7|z|\r\n";
+
+        xfile::buffer Buffer;
+        if (auto Err = xfile::LoadAll(FileName, Buffer); Err)
+            return Err;
+
+        assert(std::string_view(reinterpret_cast<const char*>(Buffer.data()), Buffer.size()) == Expected);
+
+        // Wide text goes out as wchar_t
+        if (auto Err = File.open(FileName, "w"); Err)
+            return Err;
+
+        if (auto Err = File.wPrintf(L"{}-{}", L"abc", 7); Err)
+            return Err;
+
+        File.close();
+
+        if (auto Err = xfile::LoadAll(FileName, Buffer); Err)
+            return Err;
+
+        assert(std::wstring_view(reinterpret_cast<const wchar_t*>(Buffer.data()), Buffer.size() / sizeof(wchar_t)) == L"abc-7");
+        return {};
+    }
+
+    //-----------------------------------------------------------------------------------------
+
+    xerr fillTest( std::wstring_view FileName )
+    {
+        constexpr std::size_t zeros_v = 3 * 1024 * 1024 + 17;
+
+        xfile::stream File;
+        if (auto Err = File.open(FileName, "w"); Err)
+            return Err;
+
+        if (auto Err = File.Write(std::uint32_t{ 0x11223344 }); Err)
+            return Err;
+
+        // Pad to a page and then reserve a big zero region
+        if (auto Err = File.AlignPutC(0, 0, 4096); Err)
+            return Err;
+
+        if (auto Err = File.Skip(zeros_v); Err)
+            return Err;
+
+        if (auto Err = File.Write(std::uint32_t{ 0x55667788 }); Err)
+            return Err;
+
+        if (auto Err = File.Fill('x', 10); Err)
+            return Err;
+
+        std::size_t Length;
+        if (auto Err = File.getFileLength(Length); Err)
+            return Err;
+        assert(Length == 4096 + zeros_v + sizeof(std::uint32_t) + 10);
+
+        // Clear a region that has data already (holes on devices that support them)
+        std::vector<std::byte> Data( 256 * 1024, std::byte{ 0xAB } );
+        if (auto Err = File.WriteSpan(std::span{ Data }); Err)
+            return Err;
+
+        if (auto Err = File.SeekOrigin(Length); Err)
+            return Err;
+
+        if (auto Err = File.Fill(0, Data.size() - 1); Err)
+            return Err;
+
+        // Check everything
+        if (auto Err = File.SeekOrigin(0); Err)
+            return Err;
+
+        std::vector<std::byte> Copy( Length + Data.size() );
+        if (auto Err = File.ReadSpan(std::span{ Copy }); Err)
+            return Err;
+
+        std::uint32_t Value;
+        std::memcpy(&Value, &Copy[0], sizeof(Value));
+        assert(Value == 0x11223344);
+        std::memcpy(&Value, &Copy[4096 + zeros_v], sizeof(Value));
+        assert(Value == 0x55667788);
+
+        for (std::size_t i = sizeof(Value); i < 4096 + zeros_v; ++i) assert(Copy[i] == std::byte{ 0 });
+        for (std::size_t i = 0; i < 10; ++i)                          assert(Copy[4096 + zeros_v + sizeof(Value) + i] == std::byte{ 'x' });
+        for (std::size_t i = Length; i < Copy.size() - 1; ++i)        assert(Copy[i] == std::byte{ 0 });
+        assert(Copy.back() == std::byte{ 0xAB });
+
+        return {};
+    }
+
+    //-----------------------------------------------------------------------------------------
+
+    xerr toFileTest( std::wstring_view SrcName, const char* pSrcMode, std::wstring_view DstName, const char* pDstMode )
+    {
+        // Not a multiple of any of the chunk sizes
+        std::vector<std::uint32_t> Data( 3 * 1024 * 1024 + 11 );
+        for (std::size_t i = 0; i < Data.size(); ++i) Data[i] = static_cast<std::uint32_t>(i * 2654435761u);
+
+        xfile::stream Src;
+        if (auto Err = Src.open(SrcName, "w"); Err)
+            return Err;
+
+        if (auto Err = Src.WriteSpan(std::span{ Data }); Err)
+            return Err;
+
+        Src.close();
+        if (auto Err = Src.open(SrcName, pSrcMode); Err)
+            return Err;
+
+        xfile::stream Dst;
+        if (auto Err = Dst.open(DstName, pDstMode); Err)
+            return Err;
+
+        std::uint64_t LastDone = 0;
+        if (auto Err = Src.ToFile(Dst, [&](std::uint64_t Done, std::uint64_t Total)
+            {
+                assert(Done > LastDone && Done <= Total);
+                assert(Total == Data.size() * sizeof(std::uint32_t));
+                LastDone = Done;
+            }); Err)
+            return Err;
+
+        assert(LastDone == Data.size() * sizeof(std::uint32_t));
+
+        // Read it back the plain way
+        Dst.close();
+        if (auto Err = Dst.open(DstName, "r"); Err)
+            return Err;
+
+        std::size_t Length;
+        if (auto Err = Dst.getFileLength(Length); Err)
+            return Err;
+        assert(Length == LastDone);
+
+        std::vector<std::uint32_t> Copy( Data.size() );
+        if (auto Err = Dst.ReadSpan(std::span{ Copy }); Err)
+            return Err;
+
+        assert(Copy == Data);
+        return {};
+    }
+
+    //-----------------------------------------------------------------------------------------
+
+    xerr loadAllTest( std::wstring_view FileName )
+    {
+        // Big enough to be split between threads, and an odd size so the last piece is short
+        std::vector<std::uint32_t> Data( 5 * 1024 * 1024 + 3 );
+        for (std::size_t i = 0; i < Data.size(); ++i) Data[i] = static_cast<std::uint32_t>(i * 2654435761u);
+
+        {
+            xfile::stream File;
+            if (auto Err = File.open(FileName, "w"); Err)
+                return Err;
+
+            if (auto Err = File.WriteSpan(std::span{ Data }); Err)
+                return Err;
+        }
+
+        xfile::buffer Buffer;
+        if (auto Err = xfile::LoadAll(FileName, Buffer); Err)
+            return Err;
+
+        assert(Buffer.size() == Data.size() * sizeof(std::uint32_t));
+        assert(reinterpret_cast<std::uintptr_t>(Buffer.data()) % xfile::buffer::alignment_v == 0);
+        assert(std::memcmp(Buffer.data(), Data.data(), Buffer.size()) == 0);
+
+        // Mapped files get copied straight from the view
+        xfile::stream File;
+        if (auto Err = File.open(FileName, "rm"); Err)
+            return Err;
+
+        xfile::buffer Mapped;
+        if (auto Err = File.LoadAll(Mapped); Err)
+            return Err;
+
+        assert(Mapped.size() == Buffer.size());
+        assert(std::memcmp(Mapped.data(), Data.data(), Mapped.size()) == 0);
+
+        std::size_t Pos;
+        if (auto Err = File.Tell(Pos); Err)
+            return Err;
+        assert(Pos == Mapped.size());
+
+        // Async files have to wait for their read before returning
+        File.close();
+        if (auto Err = File.open(FileName, "r@"); Err)
+            return Err;
+
+        xfile::buffer Async;
+        if (auto Err = File.LoadAll(Async); Err)
+            return Err;
+
+        assert(Async.size() == Buffer.size());
+        assert(std::memcmp(Async.data(), Data.data(), Async.size()) == 0);
+
+        return {};
+    }
+
+    //-----------------------------------------------------------------------------------------
+
+    xerr compressedFileTest( std::wstring_view FileName )
+    {
+        // Text like data that compresses well followed by noise that does not
+        std::vector<std::byte> Data;
+        for (int i = 0; Data.size() < 700 * 1024; ++i)
+        {
+            const auto Line = std::format("Entity {} position {} {} {}\n", i, i % 17, i % 5, i * 3);
+            for (auto C : Line) Data.push_back(static_cast<std::byte>(C));
+        }
+
+        std::uint32_t Seed = 77;
+        for (int i = 0; i < 150 * 1024 + 13; ++i)
+        {
+            Seed = Seed * 1664525u + 1013904223u;
+            Data.push_back(static_cast<std::byte>(Seed >> 24));
+        }
+
+        xfile::stream File;
+        if (auto Err = File.open(FileName, "wc"); Err)
+            return Err;
+
+        // Odd sized writes so the blocks get filled in pieces
+        for (std::size_t i = 0, Step = 1; i < Data.size(); i += Step, Step = Step * 7 % 100003 + 1)
+        {
+            Step = std::min(Step, Data.size() - i);
+            if (auto Err = File.WriteRaw({ &Data[i], Step }); Err)
+                return Err;
+        }
+
+        File.close();
+
+        // Opening it for writing does not go through the layer, so we see the real size
+        if (auto Err = File.open(FileName, "r+"); Err)
+            return Err;
+
+        std::size_t Length;
+        if (auto Err = File.getFileLength(Length); Err)
+            return Err;
+        assert(Length < Data.size() / 2);
+        File.close();
+
+        // Detected automatically
+        if (auto Err = File.open(FileName, "r"); Err)
+            return Err;
+
+        if (auto Err = File.getFileLength(Length); Err)
+            return Err;
+        assert(Length == Data.size());
+
+        // Jump around the file
+        std::vector<std::byte> Copy( 100 * 1024 );
+        for (std::size_t Offset : { std::size_t{ 700 * 1024 }, std::size_t{ 0 }, std::size_t{ 65536 - 7 }, Data.size() - Copy.size(), std::size_t{ 300 * 1024 + 1 } })
+        {
+            if (auto Err = File.SeekOrigin(Offset); Err)
+                return Err;
+
+            if (auto Err = File.ReadSpan(std::span{ Copy }); Err)
+                return Err;
+
+            assert(std::memcmp(Copy.data(), &Data[Offset], Copy.size()) == 0);
+        }
+
+        // Offsets from the end wrap around like they do on the devices
+        if (auto Err = File.SeekEnd(0 - Copy.size()); Err)
+            return Err;
+
+        if (auto Err = File.ReadSpan(std::span{ Copy }); Err)
+            return Err;
+
+        assert(std::memcmp(Copy.data(), &Data[Data.size() - Copy.size()], Copy.size()) == 0);
+        File.close();
+
+        xfile::buffer Buffer;
+        if (auto Err = xfile::LoadAll(FileName, Buffer); Err)
+            return Err;
+
+        assert(Buffer.size() == Data.size() && std::memcmp(Buffer.data(), Data.data(), Data.size()) == 0);
+
+        // Asking for a compressed file when it is not one
+        {
+            xfile::stream Plain;
+            if (auto Err = Plain.open(std::wstring(FileName) + L".plain", "w"); Err)
+                return Err;
+
+            if (auto Err = Plain.WriteSpan(std::span{ Data }); Err)
+                return Err;
+        }
+
+        auto Err = File.open(std::wstring(FileName) + L".plain", "rc");
+        assert(Err && Err.getState<xfile::state>() == xfile::state::CORRUPTED);
+        Err.clear();
+
+        // Plain files that start like a compressed one are still read as they are
+        const std::array<std::uint32_t, 4> Header{ 0x5A4C4658, 1, 64 * 1024, 0 };
+        std::memcpy(Data.data(), Header.data(), sizeof(Header));
+        {
+            xfile::stream Plain;
+            if (auto Err = Plain.open(std::wstring(FileName) + L".plain", "w"); Err)
+                return Err;
+
+            if (auto Err = Plain.WriteSpan(std::span{ Data }); Err)
+                return Err;
+        }
+
+        xfile::buffer Raw;
+        if (auto Err = xfile::LoadAll(std::wstring(FileName) + L".plain", Raw); Err)
+            return Err;
+
+        assert(Raw.size() == Data.size() && std::memcmp(Raw.data(), Data.data(), Data.size()) == 0);
+
+        Err = File.open(std::wstring(FileName) + L".plain", "rc");
+        assert(Err);
+        Err.clear();
+
+        return {};
+    }
+
+    //-----------------------------------------------------------------------------------------
+
+    xerr asyncTicketTest( std::wstring_view FileName, const char* pAsyncMode )
+    {
+        constexpr static std::size_t            Chunks    = 64;
+        constexpr static std::size_t            ChunkSize = 16 * 1024;
+        std::vector<std::uint32_t>              Data( Chunks * ChunkSize / sizeof(std::uint32_t) );
+        std::array<xfile::async_ticket, Chunks> Tickets;
+
+        for (std::size_t i = 0; i < Data.size(); ++i) Data[i] = static_cast<std::uint32_t>(i);
+        const auto Bytes = std::as_bytes(std::span{ Data });
+
+        //
+        // All the chunks in flight at once, back to front
+        //
+        xfile::stream File;
+        if (auto Err = File.open(FileName, (std::string("w") + pAsyncMode).c_str()); Err)
+            return Err;
+
+        for (std::size_t i = Chunks; i--; )
+        {
+            if (auto Err = File.WriteAsync(Tickets[i], Bytes.subspan(i * ChunkSize, ChunkSize), i * ChunkSize); Err)
+                return Err;
+        }
+
+        for (auto& T : Tickets)
+        {
+            if (auto Err = File.Wait(T); Err)
+                return Err;
+            assert(T.m_Transferred == ChunkSize);
+        }
+
+        File.close();
+
+        //
+        // Read them back, half of them with a callback and one that makes a second request from its callback
+        //
+        std::vector<std::uint32_t> Copy( Data.size() );
+        const auto                 CopyBytes  = std::as_writable_bytes(std::span{ Copy });
+        std::atomic<int>           nCallbacks = 0;
+
+        if (auto Err = File.open(FileName, (std::string("r") + pAsyncMode).c_str()); Err)
+            return Err;
+
+        // Ticket 0 goes last and chains the read of the last chunk from its callback
+        Tickets[0].m_Callback = [&](xfile::async_ticket& T)
+        {
+            auto& Stream = File;
+            auto& Count  = nCallbacks;
+            auto  Last   = CopyBytes.subspan((Chunks - 1) * ChunkSize);
+            T.m_Callback = {};                  // destroys this lambda, only locals from here
+            (void)Stream.ReadAsync(T, Last, (Chunks - 1) * ChunkSize);
+            ++Count;
+        };
+
+        for (std::size_t j = 1; j <= Chunks - 1; ++j)
+        {
+            const auto i = j % (Chunks - 1);
+            if (i & 1) Tickets[i].m_Callback = [&](xfile::async_ticket& T) { assert(T.m_Transferred == ChunkSize); ++nCallbacks; };
+            if (auto Err = File.ReadAsync(Tickets[i], CopyBytes.subspan(i * ChunkSize, ChunkSize), i * ChunkSize); Err)
+                return Err;
+        }
+
+        // Callbacks may be called by the device on its own thread, nobody has to wait for them
+        while (nCallbacks.load() != Chunks / 2) std::this_thread::yield();
+
+        for (auto& T : Tickets)
+        {
+            if (auto Err = File.Wait(T); Err)
+                return Err;
+        }
+
+        assert(Copy == Data);
+        for (auto& T : Tickets) T.m_Callback = {};
+
+        // Reading past the end only transfers what is there
+        std::array<std::byte, 256> Tail;
+        if (auto Err = File.ReadAsync(Tickets[0], Tail, Bytes.size() - 100); Err)
+            return Err;
+
+        if (auto Err = File.Wait(Tickets[0]); !Err || Err.getState<xfile::state>() != xfile::state::UNEXPECTED_EOF)
+            return xerr::create_f<xfile::state, "Reading past the end must fail">();
+        assert(Tickets[0].m_Transferred == 100);
+
+        // A canceled request still completes, it may have been too late to cancel it
+        if (auto Err = File.ReadAsync(Tickets[1], CopyBytes.subspan(0, ChunkSize), 0); Err)
+            return Err;
+        File.Cancel(Tickets[1]);
+        if (auto Err = File.Wait(Tickets[1]); Err)
+        {
+            assert(Tickets[1].m_Result == xfile::async_ticket::result::CANCELED);
+            Err.clear();
+        }
+
+        return {};
+    }
+
+    //-----------------------------------------------------------------------------------------
+    // Async files of devices that block (and of compressed files) go through the async layer
+    //-----------------------------------------------------------------------------------------
+
+    xerr asyncLayerTest( std::wstring_view FileName, const char* pMode )
+    {
+        constexpr static std::size_t Chunks    = 32;
+        constexpr static std::size_t ChunkSize = 8 * 1024;
+        std::vector<std::uint32_t>   Data( Chunks * ChunkSize / sizeof(std::uint32_t) );
+        for (std::size_t i = 0; i < Data.size(); ++i) Data[i] = static_cast<std::uint32_t>(i * 3);
+        const auto Bytes = std::as_bytes(std::span{ Data });
+
+        auto Ignore = [](xerr& Err) { if (Err.getState<xfile::state>() == xfile::state::INCOMPLETE) Err.clear(); return !Err; };
+
+        xfile::stream File;
+        if (auto Err = File.open(FileName, (std::string("w") + pMode).c_str()); Err)
+            return Err;
+
+        // Every chunk queued at once, they land in order
+        for (std::size_t i = 0; i < Chunks; ++i)
+        {
+            if (auto Err = File.WriteSpan(Bytes.subspan(i * ChunkSize, ChunkSize)); Err && !Ignore(Err))
+                return Err;
+        }
+
+        if (auto Err = File.Synchronize(true); Err)
+            return Err;
+        File.close();
+
+        std::vector<std::uint32_t> Copy( Data.size() );
+        const auto CopyBytes = std::as_writable_bytes(std::span{ Copy });
+
+        if (auto Err = File.open(FileName, "r@"); Err)
+            return Err;
+
+        for (std::size_t i = 0; i < Chunks; ++i)
+        {
+            if (auto Err = File.ReadSpan(CopyBytes.subspan(i * ChunkSize, ChunkSize)); Err && !Ignore(Err))
+                return Err;
+        }
+
+        if (auto Err = File.Synchronize(true); Err)
+            return Err;
+        assert(Copy == Data);
+
+        // Reading past the end fails in Synchronize, like it does for the devices with real async
+        assert(File.isEOF() == false);
+        if (auto Err = File.ReadSpan(CopyBytes.subspan(0, ChunkSize)); Err && !Ignore(Err))
+            return Err;
+
+        if (auto Err = File.Synchronize(true); !Err || Err.getState<xfile::state>() != xfile::state::UNEXPECTED_EOF)
+            return xerr::create_f<xfile::state, "Reading past the end must fail">();
+        assert(File.isEOF());
+
+        // Aborting drops what did not start, the file is still good after
+        if (auto Err = File.SeekOrigin(0); Err)
+            return Err;
+
+        for (std::size_t i = 0; i < Chunks; ++i)
+        {
+            if (auto Err = File.ReadSpan(CopyBytes.subspan(i * ChunkSize, ChunkSize)); Err && !Ignore(Err))
+                return Err;
+        }
+        File.AsyncAbort();
+        if (auto Err = File.Synchronize(true); Err) Err.clear();
+
+        std::ranges::fill(Copy, 0);
+        if (auto Err = File.SeekOrigin(0); Err)
+            return Err;
+
+        if (auto Err = File.ReadSpan(CopyBytes); Err && !Ignore(Err))
+            return Err;
+
+        if (auto Err = File.Synchronize(true); Err)
+            return Err;
+        assert(Copy == Data);
+
+        File.close();
+        return {};
+    }
+
+    //-----------------------------------------------------------------------------------------
+    // Records made of several pieces, small ones (buffered) and big ones (straight to the device)
+    //-----------------------------------------------------------------------------------------
+
+    xerr vectorIOTest( std::wstring_view FileName, const char* pMode )
+    {
+        struct header { std::uint32_t m_Magic, m_nEntries; };
+
+        const header                Header  { 0xC0FFEE, 100 };
+        std::vector<std::uint64_t>  Table   ( Header.m_nEntries );
+        std::vector<std::uint8_t>   Payload ( 300 * 1024 );
+        for (std::size_t i = 0; i < Table.size();   ++i) Table[i]   = i * 1000003;
+        for (std::size_t i = 0; i < Payload.size(); ++i) Payload[i] = static_cast<std::uint8_t>(i * 7 + i / 251);
+
+        // More pieces than a single preadv/pwritev takes
+        std::vector<std::span<const std::byte>> Pieces{ std::as_bytes(std::span{ &Header, 1 }), std::as_bytes(std::span{ Table }) };
+        for (std::size_t i = 0; i < Payload.size(); i += 3000)
+            Pieces.push_back(std::as_bytes(std::span{ Payload }.subspan(i, std::min<std::size_t>(3000, Payload.size() - i))));
+
+        auto Ignore = [](xerr& Err) { if (Err.getState<xfile::state>() == xfile::state::INCOMPLETE) Err.clear(); return !Err; };
+
+        xfile::stream File;
+        if (auto Err = File.open(FileName, (std::string("w") + pMode).c_str()); Err)
+            return Err;
+
+        if (auto Err = File.WriteV(std::span{ Pieces }.subspan(0, 2)); Err && !Ignore(Err))
+            return Err;
+
+        if (auto Err = File.WriteV(std::span{ Pieces }.subspan(2)); Err && !Ignore(Err))
+            return Err;
+
+        if (auto Err = File.Synchronize(true); Err)
+            return Err;
+        File.close();
+
+        header                      HeaderCopy;
+        std::vector<std::uint64_t>  TableCopy   ( Table.size() );
+        std::vector<std::uint8_t>   PayloadCopy ( Payload.size() );
+        const std::array            Views
+        { std::as_writable_bytes(std::span{ &HeaderCopy, 1 })
+        , std::as_writable_bytes(std::span{ TableCopy })
+        , std::as_writable_bytes(std::span{ PayloadCopy }).subspan(0, 1000)
+        , std::as_writable_bytes(std::span{ PayloadCopy }).subspan(1000)
+        };
+
+        if (auto Err = File.open(FileName, (std::string("r") + pMode).c_str()); Err)
+            return Err;
+
+        if (auto Err = File.ReadV(Views); Err && !Ignore(Err))
+            return Err;
+
+        if (auto Err = File.Synchronize(true); Err)
+            return Err;
+
+        assert(HeaderCopy.m_Magic == Header.m_Magic && HeaderCopy.m_nEntries == Header.m_nEntries);
+        assert(TableCopy == Table);
+        assert(PayloadCopy == Payload);
+
+        // One more byte is past the end
+        std::byte Extra;
+        const std::array More{ std::span{ &Extra, 1 } };
+        auto Err = File.ReadV(More);
+        if (!Err || Ignore(Err)) Err = File.Synchronize(true);
+        assert(Err && Err.getState<xfile::state>() == xfile::state::UNEXPECTED_EOF);
+        Err.clear();
+
+        File.close();
+        return {};
+    }
+
+    //-----------------------------------------------------------------------------------------
+
+    xerr positionalIOTest( std::wstring_view FileName, const char* pMode )
+    {
+        // Records cross the pages and the blocks of compressed files
+        constexpr std::size_t   record_v    = 4096 + 24;
+        constexpr std::size_t   count_v     = 400;
+        constexpr std::size_t   threads_v   = 4;
+
+        auto Fill = [](std::size_t i, std::span<std::byte> Record)
+        {
+            for (std::size_t j = 0; j < Record.size(); ++j) Record[j] = static_cast<std::byte>(i * 31 + j / 7);
+        };
+
+        // Runs Job(iThread) in threads_v threads and returns the first failure
+        auto Together = [&](auto&& Job) -> xerr
+        {
+            std::array<xerr, threads_v>         Errors;
+            std::vector<std::thread>            Threads;
+            for (std::size_t t = 0; t < threads_v; ++t) Threads.emplace_back([&, t] { Errors[t] = Job(t); });
+            for (auto& T : Threads) T.join();
+
+            xerr First;
+            for (auto& Err : Errors)
+            {
+                if (Err && !First) First = std::move(Err);
+                Err.clear();
+            }
+            return First;
+        };
+
+        const bool bCompressed = std::strchr(pMode, 'c') != nullptr;
+
+        xfile::stream File;
+        if (auto Err = File.open(FileName, (std::string("w") + pMode).c_str()); Err)
+            return Err;
+
+        if (bCompressed)
+        {
+            // Compressed files are written in order, WriteAt is not for them. Async
+            // writes hold on to the record until they are done.
+            std::array<std::byte, record_v> Record;
+            for (std::size_t i = 0; i < count_v; ++i)
+            {
+                Fill(i, Record);
+                if (auto Err = File.WriteSpan(std::span{ Record }); Err)
+                {
+                    if (Err.getState<xfile::state>() != xfile::state::INCOMPLETE) return Err;
+                    Err = File.Synchronize(true);
+                    if (Err) return Err;
+                }
+            }
+
+            auto Err = File.WriteAt(0, std::span{ Record });
+            assert(Err && Err.getState<xfile::state>() == xfile::state::NOT_SUPPORTED);
+            Err.clear();
+        }
+        else
+        {
+            // Each thread writes every threads_v record from the end, the file grows out of order
+            if (auto Err = Together([&](std::size_t t) -> xerr
+            {
+                std::array<std::byte, record_v> Record;
+                for (std::size_t i = count_v - 1 - t; i < count_v; i -= threads_v)
+                {
+                    Fill(i, Record);
+                    if (auto Err = File.WriteAt(i * record_v, std::span{ Record }); Err)
+                        return Err;
+                }
+                return {};
+            }); Err) return Err;
+
+            std::size_t Pos;
+            if (auto Err = File.Tell(Pos); Err)
+                return Err;
+            assert(Pos == 0);
+        }
+
+        if (auto Err = File.Synchronize(true); Err)
+            return Err;
+        File.close();
+
+        if (auto Err = File.open(FileName, (std::string("r") + pMode).c_str()); Err)
+            return Err;
+
+        // All the threads read all the records, each one in its own order
+        if (auto Err = Together([&](std::size_t t) -> xerr
+        {
+            std::array<std::byte, record_v> Record, Expected;
+            for (std::size_t n = 0; n < count_v; ++n)
+            {
+                const auto i = (n * (2 * t + 1) + t * 97) % count_v;
+                if (auto Err = File.ReadAt(i * record_v, std::span{ Record }); Err)
+                    return Err;
+
+                Fill(i, Expected);
+                assert(Record == Expected);
+            }
+            return {};
+        }); Err) return Err;
+
+        // The cursor did not move, the stream reads from the start
+        std::array<std::byte, record_v> Record, Expected;
+        if (auto Err = File.ReadSpan(std::span{ Record }); Err && Err.getState<xfile::state>() != xfile::state::INCOMPLETE)
+            return Err;
+        if (auto Err = File.Synchronize(true); Err)
+            return Err;
+
+        Fill(0, Expected);
+        assert(Record == Expected);
+
+        // A piece past the end of the file
+        auto Err = File.ReadAt((count_v - 1) * record_v + 8, std::span{ Record });
+        assert(Err && Err.getState<xfile::state>() == xfile::state::UNEXPECTED_EOF);
+        Err.clear();
+
+        File.close();
+        return {};
+    }
+
+    //-----------------------------------------------------------------------------------------
+
+    struct test_task
+    {
+        struct promise_type
+        {
+            test_task           get_return_object   ( void ) noexcept { return {}; }
+            std::suspend_never  initial_suspend     ( void ) noexcept { return {}; }
+            std::suspend_never  final_suspend       ( void ) noexcept { return {}; }
+            void                return_void         ( void ) noexcept {}
+            void                unhandled_exception ( void ) noexcept { assert(false); }
+        };
+    };
+
+    // Resumes the coroutines in the thread that runs it, like a job system would
+    struct test_executor : xfile::executor
+    {
+        void Post( std::coroutine_handle<> Handle ) noexcept override
+        {
+            std::lock_guard Lk(m_Lock);
+            m_Ready.push_back(Handle);
+            m_Signal.notify_one();
+        }
+
+        void Run( const std::atomic<bool>& bDone ) noexcept
+        {
+            std::unique_lock Lk(m_Lock);
+            while (bDone.load() == false)
+            {
+                if (m_Ready.empty())
+                {
+                    m_Signal.wait_for(Lk, std::chrono::milliseconds(10));
+                    continue;
+                }
+
+                auto Handle = m_Ready.front();
+                m_Ready.erase(m_Ready.begin());
+                Lk.unlock();
+                Handle.resume();
+                Lk.lock();
+            }
+        }
+
+        std::mutex                              m_Lock;
+        std::condition_variable                 m_Signal;
+        std::vector<std::coroutine_handle<>>    m_Ready;
+    };
+
+    xerr coroutineTest( std::wstring_view FileName, const char* pAsyncMode )
+    {
+        std::vector<std::uint32_t> Data( 64 * 1024 );
+        for (std::size_t i = 0; i < Data.size(); ++i) Data[i] = static_cast<std::uint32_t>(i * 7);
+        const auto Bytes = std::as_bytes(std::span{ Data });
+
+        std::vector<std::uint32_t>  Copy( Data.size() );
+        std::atomic<bool>           bDone = false;
+        xerr                        Error;
+        test_executor               Executor;
+        xfile::stream               File;
+        File.setExecutor(&Executor);
+
+        // The lambda must outlive the coroutine, it keeps the captures
+        auto Body = [&]() -> test_task
+        {
+            auto Finish = [&](xerr Err) { Error = std::move(Err); bDone = true; };
+
+            if (auto Err = co_await xfile::open_async(File, FileName, (std::string("w") + pAsyncMode).c_str()); Err)
+                co_return Finish(std::move(Err));
+
+            // The first half at the cursor, the second half at its offset
+            if (auto Err = co_await File.WriteAsync(Bytes.subspan(0, Bytes.size() / 2)); Err)
+                co_return Finish(std::move(Err));
+
+            if (auto Err = co_await File.WriteAsync(Bytes.subspan(Bytes.size() / 2), Bytes.size() / 2); Err)
+                co_return Finish(std::move(Err));
+
+            File.close();
+
+            if (auto Err = co_await xfile::open_async(File, FileName, (std::string("r") + pAsyncMode).c_str()); Err)
+                co_return Finish(std::move(Err));
+
+            const auto CopyBytes = std::as_writable_bytes(std::span{ Copy });
+            for (std::size_t i = 0; i < 4; ++i)
+            {
+                const auto Size = CopyBytes.size() / 4;
+                if (auto Err = co_await File.ReadAsync(CopyBytes.subspan(i * Size, Size)); Err)
+                    co_return Finish(std::move(Err));
+            }
+
+            std::array<std::byte, 8> Tail;
+            auto Err = co_await File.ReadAsync(Tail);
+            assert(Err && Err.getState<xfile::state>() == xfile::state::UNEXPECTED_EOF);
+            Err.clear();
+
+            File.close();
+            Finish({});
+        };
+
+        Body();
+        Executor.Run(bDone);
+        if (Error) return Error;
+
+        assert(Copy == Data);
+        return {};
+    }
+
+    //-----------------------------------------------------------------------------------------
+    // Device names in any case, unknown devices, and the cached working path
+    //-----------------------------------------------------------------------------------------
+
+    xerr pathResolutionTest( void )
+    {
+        for (auto Name : { L"TEMP:/resolve.dat", L"Temp:/resolve.dat", L"RAM:/resolve.dat", L"ram:/resolve.dat" })
+        {
+            xfile::stream File;
+            if (auto Err = File.open(Name, "w"); Err)
+                return Err;
+        }
+
+        {
+            xfile::stream File;
+            auto Err = File.open(L"nodevice:/resolve.dat", "w");
+            assert(Err && Err.getState<xfile::state>() == xfile::state::DEVICE_FAILURE);
+            Err.clear();
+        }
+
+        // Relative paths use the working path of when the cache was filled
+        std::error_code Ec;
+        const auto      Before = std::filesystem::current_path(Ec);
+        const auto      Temp   = std::filesystem::path(xfile::getTempPath());
+        (void)std::filesystem::remove(Temp / "resolve_relative.dat", Ec);
+
+        std::filesystem::current_path(Temp, Ec);
+        if (Ec) return xerr::create_f<xfile::state, "Fail to change the working path">();
+        xfile::invalidatePathCache();
+
+        xerr Error;
+        {
+            xfile::stream File;
+            Error = File.open(L"resolve_relative.dat", "w");
+        }
+
+        std::filesystem::current_path(Before, Ec);
+        xfile::invalidatePathCache();
+        if (Error) return Error;
+
+        assert(std::filesystem::exists(Temp / "resolve_relative.dat", Ec));
+        (void)std::filesystem::remove(Temp / "resolve_relative.dat", Ec);
+        return {};
+    }
+
+    //-----------------------------------------------------------------------------------------
+    // Read only files opened again and again reuse their OS handle
+    //-----------------------------------------------------------------------------------------
+
+    xerr handleCacheTest( std::wstring_view FileName )
+    {
+        auto pDevice = xfile::getDevice(FileName);
+        if (pDevice == nullptr)
+            return xerr::create_f<xfile::state, "The file does not have a device">();
+
+        auto Write = [&](std::uint32_t Seed) -> xerr
+        {
+            xfile::stream File;
+            if (auto Err = File.open(FileName, "w"); Err)
+                return Err;
+
+            std::array<std::uint32_t, 1024> Data;
+            for (std::size_t i = 0; i < Data.size(); ++i) Data[i] = Seed + static_cast<std::uint32_t>(i);
+            return File.WriteSpan(std::span{ Data });
+        };
+
+        // Reads from the start (the cursor of a reused handle is fresh) and leaves the cursor in the middle
+        auto Check = [&](std::uint32_t Seed) -> xerr
+        {
+            xfile::stream File;
+            if (auto Err = File.open(FileName, "r"); Err)
+                return Err;
+
+            std::array<std::uint32_t, 16> Data;
+            if (auto Err = File.ReadSpan(std::span{ Data }); Err)
+                return Err;
+
+            for (std::size_t i = 0; i < Data.size(); ++i) assert(Data[i] == Seed + i);
+            return File.SeekOrigin(1000);
+        };
+
+        if (auto Err = pDevice->setHandleCache(8); Err)
+            return Err;
+
+        if (auto Err = Write(100); Err)
+            return Err;
+
+        const auto Hits = pDevice->getHandleCacheHits();
+        for (int i = 0; i < 10; ++i)
+        {
+            if (auto Err = Check(100); Err)
+                return Err;
+        }
+        assert(pDevice->getHandleCacheHits() - Hits == 9);
+
+        // Writing the file drops its handles, the next open goes to the system
+        if (auto Err = Write(5000); Err)
+            return Err;
+
+        if (auto Err = Check(5000); Err)
+            return Err;
+        assert(pDevice->getHandleCacheHits() - Hits == 9);
+
+        // Devices without OS handles say so
+        auto Err = xfile::getDevice(L"ram:/")->setHandleCache(8);
+        assert(Err && Err.getState<xfile::state>() == xfile::state::NOT_SUPPORTED);
+        Err.clear();
+
+        return pDevice->setHandleCache(0);
+    }
+
+    //-----------------------------------------------------------------------------------------
+
+    xerr openBatchTest( std::wstring_view Path )
+    {
+        constexpr std::size_t count_v = 64;
+
+        auto getFileName = [&](std::size_t i) { return std::wstring(Path) + std::to_wstring(i) + L".dat"; };
+
+        for (std::size_t i = 0; i < count_v; ++i)
+        {
+            xfile::stream File;
+            if (auto Err = File.open(getFileName(i), "wb"); Err)
+                return Err;
+
+            if (auto Err = File.Write(static_cast<std::uint32_t>(i)); Err)
+                return Err;
+        }
+
+        // One more request for a file that does not exist
+        std::vector<xfile::stream>          Files( count_v + 1 );
+        std::vector<xfile::open_request>    Requests( count_v + 1 );
+        std::atomic<std::size_t>            nCallbacks = 0;
+        for (std::size_t i = 0; i < Requests.size(); ++i)
+        {
+            Requests[i].m_pStream   = &Files[i];
+            Requests[i].m_Path      = i < count_v ? getFileName(i) : std::wstring(Path) + L"missing.dat";
+            Requests[i].m_Mode      = "rb";
+            Requests[i].m_Callback  = [&](xfile::open_request& Request)
+            {
+                assert(Request.isDone() == false);
+                assert(Request.m_pStream->isOpen() == !Request.m_Error);
+                nCallbacks.fetch_add(1, std::memory_order_relaxed);
+            };
+        }
+
+        xfile::open_batch(Requests);
+
+        for (std::size_t i = 0; i < count_v; ++i)
+        {
+            if (auto Err = Requests[i].Wait(); Err)
+                return Err;
+
+            std::uint32_t Value;
+            if (auto Err = Files[i].Read(Value); Err)
+                return Err;
+            assert(Value == i);
+        }
+
+        auto Err = Requests.back().Wait();
+        assert(Err && Err.getState<xfile::state>() == xfile::state::OPENING_FILE);
+        assert(Files.back().isOpen() == false);
+        assert(nCallbacks == Requests.size());
+        Err.clear();
+
+        // A single file, the request can be used again once it is done
+        Files[0].close();
+        xfile::open_async(Files[0], getFileName(1), "rb", Requests[0]);
+        if (auto Err = Requests[0].Wait(); Err)
+            return Err;
+
+        std::uint32_t Value;
+        if (auto Err = Files[0].Read(Value); Err)
+            return Err;
+        assert(Value == 1);
+
+        Files.clear();
+        for (std::size_t i = 0; i < count_v; ++i)
+        {
+            if (auto Err = xfile::deleteFile(getFileName(i)); Err)
+                return Err;
+        }
+
+        return {};
+    }
+
+    //-----------------------------------------------------------------------------------------
+
+    xerr statsTest( std::wstring_view FileName, std::wstring_view TraceFileName )
+    {
+#if XFILE_STATS
+        using op = xfile::stats::op;
+
+        xfile::stats::snapshot Before;
+        if (auto Err = xfile::stats::getSnapshot(FileName, Before); Err)
+            return Err;
+
+        if (auto Err = xfile::stats::BeginTrace(); Err)
+            return Err;
+
+        // Records bigger than the buffer of the stream, each one is a call to the device
+        std::vector<std::uint32_t>  Data( 32 * 1024 );
+        xfile::stats::counters      Counters;
+        {
+            xfile::stream File;
+            File.setStats(&Counters);
+
+            if (auto Err = File.open(FileName, "wb"); Err)
+                return Err;
+
+            for (int i = 0; i < 8; ++i)
+            {
+                if (auto Err = File.WriteSpan(std::span{ Data }); Err)
+                    return Err;
+            }
+
+            // The counters go with the stream when it moves
+            xfile::stream Moved{ std::move(File) };
+
+            if (auto Err = Moved.SeekOrigin(0); Err)
+                return Err;
+
+            for (int i = 0; i < 8; ++i)
+            {
+                if (auto Err = Moved.ReadSpan(std::span{ Data }); Err)
+                    return Err;
+            }
+
+            Moved.Flush();
+        }
+
+        xfile::stats::snapshot Mine;
+        Counters.getSnapshot(Mine);
+
+        const auto Bytes = 8 * Data.size() * sizeof(std::uint32_t);
+        assert(Mine[op::OPEN].m_nOps  == 1 && Mine[op::CLOSE].m_nOps == 1);
+        assert(Mine[op::WRITE].m_nOps == 8 && Mine[op::WRITE].m_Bytes == Bytes);
+        assert(Mine[op::READ].m_nOps  == 8 && Mine[op::READ].m_Bytes  == Bytes);
+        assert(Mine[op::SEEK].m_nOps  == 1 && Mine[op::FLUSH].m_nOps == 1);
+
+        for (const auto& Op : Mine.m_Ops)
+        {
+            std::uint64_t Total = 0;
+            for (auto Count : Op.m_Histogram) Total += Count;
+            assert(Total == Op.m_nOps);
+            assert(Op.getPercentileNs(50) <= Op.getPercentileNs(100) && Op.getPercentileNs(100) <= Op.m_MaxNs);
+        }
+
+        // The device saw the same (and maybe more)
+        xfile::stats::snapshot After;
+        if (auto Err = xfile::stats::getSnapshot(FileName, After); Err)
+            return Err;
+        assert(After[op::WRITE].m_Bytes - Before[op::WRITE].m_Bytes >= Bytes);
+        assert(After[op::READ].m_nOps - Before[op::READ].m_nOps >= 8);
+
+        Counters.Reset();
+        Counters.getSnapshot(Mine);
+        assert(Mine[op::WRITE].m_nOps == 0 && Mine[op::WRITE].m_Histogram[0] == 0);
+
+        if (auto Err = xfile::stats::ExportTrace(TraceFileName); Err)
+            return Err;
+
+        xfile::buffer Trace;
+        if (auto Err = xfile::LoadAll(TraceFileName, Trace); Err)
+            return Err;
+
+        const std::string_view Json{ reinterpret_cast<const char*>(Trace.data()), Trace.size() };
+        assert(Json.starts_with("{\"displayTimeUnit\""));
+        assert(Json.find("\"name\":\"Write\"") != std::string_view::npos);
+        assert(Json.ends_with("]}\n"));
+
+        return xfile::deleteFile(TraceFileName);
+#else
+        // Compiled out, nothing is collected
+        xfile::stats::snapshot Snapshot;
+        xfile::stats::getSnapshot(Snapshot);
+        assert(Snapshot[xfile::stats::op::READ].m_nOps == 0);
+
+        auto Err = xfile::stats::BeginTrace();
+        assert(Err && Err.getState<xfile::state>() == xfile::state::NOT_SUPPORTED);
+        Err.clear();
+
+        Err = xfile::stats::ExportTrace(TraceFileName);
+        assert(Err && Err.getState<xfile::state>() == xfile::state::NOT_SUPPORTED);
+        Err.clear();
+
+        (void)FileName;
+        return {};
+#endif
+    }
+
+    //-----------------------------------------------------------------------------------------
+
+    xerr manyOpenFilesTest( std::wstring_view Path )
+    {
+        // Way more than what a single pool segment holds
+        std::vector<xfile::stream> Files( 1000 );
+        for (std::size_t i = 0; i < Files.size(); ++i)
+        {
+            if (auto Err = Files[i].open(std::wstring(Path) + std::to_wstring(i) + L".dat", "wb"); Err)
+                return Err;
+
+            if (auto Err = Files[i].Write(static_cast<std::uint32_t>(i)); Err)
+                return Err;
+        }
+
+        Files.clear();
+
+        for (std::size_t i = 0; i < 1000; ++i)
+        {
+            const auto FileName = std::wstring(Path) + std::to_wstring(i) + L".dat";
+            {
+                xfile::stream File;
+                if (auto Err = File.open(FileName, "rb"); Err)
+                    return Err;
+
+                std::uint32_t Value;
+                if (auto Err = File.Read(Value); Err)
+                    return Err;
+                assert(Value == i);
+            }
+
+            if (auto Err = xfile::deleteFile(FileName); Err)
+                return Err;
+        }
+
+        return {};
+    }
+
+    //-----------------------------------------------------------------------------------------
+    // Runs all the tests and returns how many of them failed
+    //-----------------------------------------------------------------------------------------
+
+    int Tests(void)
+    {
+        int nFailed = 0;
+        auto Check = [&]( xerr Err, const char* pName )
+        {
+            if (!Err) return;
+            const std::string Message{ Err.getMessage() };
+            std::printf("FAILED: %s (%s)\n", pName, Message.c_str());
+            Err.clear();
+            ++nFailed;
+        };
+
+        for (int i = 0; i < 2; ++i)
+        {
+           Check( syncModeTest( L"temp:/test.dat", i), "syncModeTest" );
+           Check( asyncModeTest( L"temp:/asyncMode.dat", i), "asyncModeTest" );
+        }
+
+        Check( asyncQueueDepthTest( L"temp:/asyncQueueDepth.dat" ), "asyncQueueDepthTest" );
+        Check( crossThreadAsyncTest( L"temp:/crossThread.dat" ), "crossThreadAsyncTest" );
+        Check( crossThreadAsyncTest( L"ram:/crossThread.dat" ), "crossThreadAsyncTest" );
+        Check( memoryMapTest( L"temp:/memoryMap.dat" ), "memoryMapTest" );
+
+#if !defined(_WIN32)
+        // Posix paths without a device name
+        {
+            const auto Path = (std::filesystem::temp_directory_path() / "xfile_posix_test.dat").wstring();
+            Check( syncModeTest( Path, true ), "syncModeTest" );
+            Check( asyncModeTest( Path, true ), "asyncModeTest" );
+        }
+#endif
+
+        Check( readViewTest( L"temp:/readView.dat" ), "readViewTest" );
+        Check( readViewTest( L"ram:/readView.dat" ), "readViewTest" );
+
         for (int i = 0; i < 2; ++i)
         {
-           (void)syncModeTest( L"temp:/test.dat", i);
-           (void)asyncModeTest( L"temp:/asyncMode.dat", i);
+            Check( syncModeTest( L"ram:/test.dat", i), "syncModeTest" );
+            Check( asyncModeTest( L"ram:/asyncMode.dat", i), "asyncModeTest" );
         }
 
-        (void)syncModeTest( L"ram:/test.dat", false);
-        (void)asyncModeTest( L"ram:/asyncMode.dat", false);
+        Check( ramFileSystemTest(), "ramFileSystemTest" );
+        Check( ramExtentTest(), "ramExtentTest" );
+        Check( bufferedStreamTest( L"temp:/buffered.dat" ), "bufferedStreamTest" );
+        Check( bufferedStreamTest( L"ram:/buffered.dat" ), "bufferedStreamTest" );
+        Check( textModeTest<char>( L"temp:/text.txt" ), "textModeTest<char>" );
+        Check( textModeTest<wchar_t>( L"temp:/wtext.txt" ), "textModeTest<wchar_t>" );
+        Check( printfTest( L"temp:/printf.txt" ), "printfTest" );
+        Check( fillTest( L"temp:/fill.dat" ), "fillTest" );
+        Check( fillTest( L"ram:/fill.dat" ), "fillTest" );
+        Check( toFileTest( L"temp:/copySrc.dat", "r",  L"temp:/copyDst.dat", "w"  ), "toFileTest" );
+        Check( toFileTest( L"temp:/copySrc.dat", "r",  L"ram:/copyDst.dat",  "w"  ), "toFileTest" );
+        Check( toFileTest( L"ram:/copySrc.dat",  "r",  L"temp:/copyDst.dat", "w"  ), "toFileTest" );
+        Check( toFileTest( L"temp:/copySrc.dat", "r@", L"temp:/copyDst.dat", "w"  ), "toFileTest" );
+        Check( toFileTest( L"temp:/copySrc.dat", "r",  L"temp:/copyDst.dat", "w@" ), "toFileTest" );
+        Check( toFileTest( L"ram:/copySrc.dat",  "r@", L"temp:/copyDst.dat", "w"  ), "toFileTest" );
+        Check( loadAllTest( L"temp:/loadAll.dat" ), "loadAllTest" );
+        Check( loadAllTest( L"ram:/loadAll.dat" ), "loadAllTest" );
+        Check( compressedFileTest( L"temp:/compressed.dat" ), "compressedFileTest" );
+        Check( compressedFileTest( L"ram:/compressed.dat" ), "compressedFileTest" );
+        Check( asyncTicketTest( L"temp:/asyncTicket.dat", "@" ), "asyncTicketTest" );
+        Check( asyncTicketTest( L"temp:/asyncTicket.dat", "" ), "asyncTicketTest" );
+        Check( asyncTicketTest( L"ram:/asyncTicket.dat", "@" ), "asyncTicketTest" );
+        Check( vectorIOTest( L"temp:/vectorIO.dat", "" ), "vectorIOTest" );
+        Check( vectorIOTest( L"temp:/vectorIO.dat", "@" ), "vectorIOTest" );
+        Check( vectorIOTest( L"ram:/vectorIO.dat", "" ), "vectorIOTest" );
+        Check( vectorIOTest( L"ram:/vectorIO.dat", "@" ), "vectorIOTest" );
+        Check( positionalIOTest( L"temp:/positionalIO.dat", "" ), "positionalIOTest" );
+        Check( positionalIOTest( L"temp:/positionalIO.dat", "@" ), "positionalIOTest" );
+        Check( positionalIOTest( L"ram:/positionalIO.dat", "" ), "positionalIOTest" );
+        Check( positionalIOTest( L"ram:/positionalIO.dat", "@" ), "positionalIOTest" );
+        Check( positionalIOTest( L"temp:/positionalIO.dat", "c" ), "positionalIOTest" );
+        Check( positionalIOTest( L"ram:/positionalIO.dat", "c@" ), "positionalIOTest" );
+        Check( asyncLayerTest( L"ram:/asyncLayer.dat", "@" ), "asyncLayerTest" );
+        Check( asyncLayerTest( L"temp:/asyncLayer.dat", "c@" ), "asyncLayerTest" );
+        Check( coroutineTest( L"temp:/coroutine.dat", "@" ), "coroutineTest" );
+        Check( coroutineTest( L"temp:/coroutine.dat", "" ), "coroutineTest" );
+        Check( coroutineTest( L"ram:/coroutine.dat", "@" ), "coroutineTest" );
+        Check( pathResolutionTest(), "pathResolutionTest" );
+        Check( handleCacheTest( L"temp:/handleCache.dat" ), "handleCacheTest" );
+        Check( openBatchTest( L"temp:/openBatch" ), "openBatchTest" );
+        Check( openBatchTest( L"ram:/openBatch" ), "openBatchTest" );
+        Check( statsTest( L"ram:/stats.dat", L"temp:/xfile_trace.json" ), "statsTest" );
+        Check( manyOpenFilesTest( L"ram:/many" ), "manyOpenFilesTest" );
+        Check( manyOpenFilesTest( L"temp:/xfile_many" ), "manyOpenFilesTest" );
 
-        int a = 22;
+        if (nFailed) std::printf("%d test(s) failed\n", nFailed);
+        return nFailed;
     }
 }
\ No newline at end of file
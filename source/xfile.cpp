@@ -1,27 +1,54 @@
 #include "xfile.h"
 #include <cassert>
 #include <filesystem>
+#include <format>
 #include <cwctype>
-
-
-#include "implementation/windows/xfile_device_window_files.h"
+#include <cwchar>
+#include <bit>
+#include <cstring>
+
+#include "implementation/xfile_instance_pool.h"
+#include "implementation/xfile_text_kernels.h"
+#include "implementation/xfile_thread_pool.h"
+#include "implementation/xfile_device_table.h"
+#include "implementation/xfile_handle_cache.h"
+#if XFILE_STATS
+    #include "implementation/xfile_stats_trace.h"
+#endif
+#if defined(_WIN32)
+    #include "implementation/windows/xfile_device_window_files.h"
+#else
+    #include "implementation/posix/xfile_device_posix_files.h"
+#endif
 #include "implementation/general/xfile_device_general_ram.h"
+#include "implementation/general/xfile_layer_general_compressed.h"
+#include "implementation/general/xfile_layer_general_async.h"
 
 
-static std::wstring TempPath;
-
 namespace xfile
 {
+#if !defined(_WIN32)
+    // Name used to find the device of '/' rooted paths (posix does not have drive letters)
+    constexpr static std::wstring_view root_device_name_v = L"/:";
+#endif
+
+    // Paths are resolved here, it keeps its memory so opening a file does not allocate
+    static thread_local std::wstring s_FinalPath;
+
     //------------------------------------------------------------------------------
 
-    const std::wstring_view getTempPath(void) noexcept
+    std::wstring getTempPath(void) noexcept
     {
-        if ( TempPath.empty() ) 
-        {
-            TempPath = std::filesystem::temp_directory_path();
-        }
+        std::wstring Path;
+        details::device_table::getInstance().AssignTempPath(Path);
+        return Path;
+    }
 
-        return TempPath;
+    //------------------------------------------------------------------------------
+
+    void invalidatePathCache(void) noexcept
+    {
+        details::device_table::getInstance().Invalidate();
     }
 
     //------------------------------------------------------------------------------
@@ -30,8 +57,8 @@ namespace xfile
     {
         if (Path.empty()) return {};
 
-        // Does it have a device?
-        for( std::size_t i = 0, end = Path.length(); (i < end); i++)
+        // Does it have a device? (a device name can not contain path separators)
+        for( std::size_t i = 0, end = Path.length(); (i < end) && Path[i] != L'/' && Path[i] != L'\\'; i++)
         {
             if (Path[i] == L':')
             {
@@ -39,70 +66,82 @@ namespace xfile
             }
         }
 
+#if !defined(_WIN32)
+        // Posix paths rooted with '/' belong to the root device, and so does the working path...
+        return root_device_name_v;
+#else
         // If it does not have a device assign in the path we will assume it is the working path...
-        return fromPathGetDeviceName( std::filesystem::current_path().c_str() );
+        // The view points to our own copy, the cached one may be replaced by invalidatePathCache
+        static thread_local std::wstring s_WorkingPath;
+        details::device_table::getInstance().AssignWorkingPath(s_WorkingPath);
+        return fromPathGetDeviceName( s_WorkingPath );
+#endif
     }
 
     //------------------------------------------------------------------------------
 
-    std::wstring to_lower(std::wstring_view input)
+    xerr registerAsyncBuffers( std::span<const std::span<std::byte>> Buffers ) noexcept
     {
-        std::wstring result;
-        result.reserve(input.size());
-
-        for (wchar_t ch : input) 
-        {
-            result.push_back(std::towlower(ch));
-        }
-
-        return result;
+#if !defined(_WIN32)
+        if (auto pRing = driver::posix::uring::getThreadRing(); pRing)
+            return pRing->RegisterBuffers(Buffers);
+#endif
+        return {};
     }
 
     //------------------------------------------------------------------------------
 
     static device::registration* SetTheFinalPathAndFindDevice( std::wstring& FinalPath, std::wstring_view Path) noexcept
     {
-        //
-        // Make sure to clear out current path
-        //
-        FinalPath.clear();
+        auto& Table = details::device_table::getInstance();
 
         //
-        // Set the final name and collect the device name is lower case
+        // Collect the device name
         //
-        std::wstring DeviceNameLower;
+        std::wstring_view DeviceName;
+        for (std::size_t i = 0, end = Path.length(); (i < end) && Path[i] != L'/' && Path[i] != L'\\'; i++)
         {
-            std::wstring_view DeviceName;
-            for (std::size_t i = 0, end = Path.length(); (i < end); i++)
-            {
-                if (Path[i] == L':')
-                {
-                    DeviceName = std::wstring_view{ Path.data(), i+1 };
-                    break;
-                }
-            }
-
-            if (DeviceName.empty() == false )
+            if (Path[i] == L':')
             {
-                DeviceNameLower = to_lower(DeviceName);
+                DeviceName = std::wstring_view{ Path.data(), i+1 };
+                break;
             }
+        }
 
+        //
+        // Set the final name, FinalPath keeps its memory between calls
+        //
+        if (DeviceName.empty())
+        {
             // If the user did not enter any device name we will assume it is using the current_path...
-            if (DeviceName.empty())
+#if !defined(_WIN32)
+            if (Path.empty() == false && Path[0] == L'/') 
             {
-                FinalPath = std::format(L"{}//{}", std::filesystem::current_path().c_str(), Path);
-                DeviceNameLower = to_lower(fromPathGetDeviceName(FinalPath));
-            }
-            // If the user is using the temp drive we must actually use the right path
-            else if (DeviceNameLower.length() == sizeof("temp") && std::wcsncmp(DeviceNameLower.data(), L"temp:", sizeof("temp:") - 1) == 0)
-            {
-                FinalPath = std::format(L"{}{}", getTempPath(), Path.substr(sizeof("temp:")));
-                DeviceNameLower = to_lower(fromPathGetDeviceName(FinalPath));
+                FinalPath.assign(Path);
             }
             else
             {
-                FinalPath = Path;
+                Table.AssignWorkingPath(FinalPath);
+                FinalPath.push_back(L'/');
+                FinalPath.append(Path);
             }
+#else
+            Table.AssignWorkingPath(FinalPath);
+            FinalPath.append(L"//");
+            FinalPath.append(Path);
+#endif
+            DeviceName = fromPathGetDeviceName(FinalPath);
+        }
+        else if (details::device_table::isSameName(DeviceName, L"temp:"))
+        {
+            // If the user is using the temp drive we must actually use the right path
+            Table.AssignTempPath(FinalPath);
+            FinalPath.append(Path.substr(std::min(Path.size(), sizeof("temp:"))));
+            DeviceName = fromPathGetDeviceName(FinalPath);
+        }
+        else
+        {
+            FinalPath.assign(Path);
         }
 
         //
@@ -110,42 +149,119 @@ namespace xfile
         //
         (void)FinalPath.c_str();
 
-
         //
         // At this point we should know which device we are dealing with...
         //
-        assert(DeviceNameLower.empty() == false);
+        assert(DeviceName.empty() == false);
+        return Table.Find(DeviceName);
+    }
 
-        for ( auto pDevice = device::registration::s_pHead; pDevice; pDevice = pDevice->m_pNext )
-        {
-            const char* pName = pDevice->m_pNames;
+    //------------------------------------------------------------------------------
 
-            for (std::size_t i = 0, end = DeviceNameLower.length(); (i != end) && *pName; i++, pName++)
-            {
-                if (DeviceNameLower[i] == ':' && *pName == ':')
-                    return pDevice;
+    device* getDevice( std::wstring_view Path ) noexcept
+    {
+        auto pDeviceReg = SetTheFinalPathAndFindDevice(s_FinalPath, Path);
+        return pDeviceReg ? pDeviceReg->m_pDevice : nullptr;
+    }
 
-                if ( *pName != DeviceNameLower[i] )
-                {
-                    // Skip character and see if it has more devices mapped
-                    while (*pName != ':' && *pName) pName++;
+    //------------------------------------------------------------------------------
 
-                    // Check to see if a has more devices
-                    if (*pName == ':')
-                    {
-                        if (pName[1])
-                        {
-                            i = -1;
-                            continue;
-                        }
-                        break;
-                    }
-                }
-            }
+    xerr deleteFile( std::wstring_view Path ) noexcept
+    {
+        auto pDeviceReg = SetTheFinalPathAndFindDevice(s_FinalPath, Path);
+
+        if (pDeviceReg == nullptr)
+            return xerr::create<state::DEVICE_FAILURE, "Unable to find requested device">();
+
+        return pDeviceReg->m_pDevice->deleteFile(s_FinalPath);
+    }
+
+    //------------------------------------------------------------------------------
+    // stats
+    //------------------------------------------------------------------------------
+
+#if XFILE_STATS
+    void details::TraceEvent( const device::registration* pDeviceReg, stats::op Op, std::chrono::steady_clock::time_point Start, std::uint64_t Ns, std::size_t Bytes ) noexcept
+    {
+        details::stats_trace::getInstance().Add(pDeviceReg, Op, Start, Ns, Bytes);
+    }
+#endif
+
+    //------------------------------------------------------------------------------
+
+    void stats::getSnapshot( snapshot& Snapshot ) noexcept
+    {
+        Snapshot = {};
+#if XFILE_STATS
+        for (auto pReg = device::registration::s_pHead; pReg; pReg = pReg->m_pNext)
+        {
+            snapshot Device;
+            pReg->m_Stats.getSnapshot(Device);
+            Snapshot += Device;
         }
+#endif
+    }
+
+    //------------------------------------------------------------------------------
+
+    xerr stats::getSnapshot( std::wstring_view Path, snapshot& Snapshot ) noexcept
+    {
+        Snapshot = {};
+#if XFILE_STATS
+        auto pDeviceReg = SetTheFinalPathAndFindDevice(s_FinalPath, Path);
+        if (pDeviceReg == nullptr)
+            return xerr::create<state::DEVICE_FAILURE, "Unable to find requested device">();
+
+        pDeviceReg->m_Stats.getSnapshot(Snapshot);
+        return {};
+#else
+        (void)Path;
+        return xerr::create<state::NOT_SUPPORTED, "Built without XFILE_STATS">();
+#endif
+    }
+
+    //------------------------------------------------------------------------------
+
+    void stats::Reset( void ) noexcept
+    {
+#if XFILE_STATS
+        for (auto pReg = device::registration::s_pHead; pReg; pReg = pReg->m_pNext)
+            pReg->m_Stats.Reset();
+#endif
+    }
 
-        // The device must not be implemented... or the user type the wrong device?
-        return nullptr;
+    //------------------------------------------------------------------------------
+
+    xerr stats::BeginTrace( std::size_t MaxEvents ) noexcept
+    {
+#if XFILE_STATS
+        details::stats_trace::getInstance().Begin(MaxEvents);
+        return {};
+#else
+        (void)MaxEvents;
+        return xerr::create<state::NOT_SUPPORTED, "Built without XFILE_STATS">();
+#endif
+    }
+
+    //------------------------------------------------------------------------------
+
+    void stats::EndTrace( void ) noexcept
+    {
+#if XFILE_STATS
+        details::stats_trace::getInstance().End();
+#endif
+    }
+
+    //------------------------------------------------------------------------------
+
+    xerr stats::ExportTrace( std::wstring_view Path ) noexcept
+    {
+#if XFILE_STATS
+        return details::stats_trace::getInstance().Export(Path);
+#else
+        (void)Path;
+        return xerr::create<state::NOT_SUPPORTED, "Built without XFILE_STATS">();
+#endif
     }
 
     //------------------------------------------------------------------------------
@@ -160,12 +276,14 @@ namespace xfile
         //
         // Get the registration device and set the FilePath
         //
-        m_pDeviceReg = SetTheFinalPathAndFindDevice(m_FilePath, Path);
+        m_pDeviceReg = SetTheFinalPathAndFindDevice(s_FinalPath, Path);
 
         // Make sure that we got a device
         if (m_pDeviceReg == nullptr) 
             return xerr::create<state::DEVICE_FAILURE, "Unable to find requested device">();
 
+        details::stats_probe Probe(*this, stats::op::OPEN);
+
         //
         // Okay now lets make sure that the mode is correct
         //
@@ -187,6 +305,7 @@ namespace xfile
             case 't':   m_AccessType.m_Text       = 1;                                                      break;
             case 'T':   m_AccessType.m_Text       = 2;                                                      break;
             case 'b':   m_AccessType.m_Text       = 0;                                                      break;
+            case 'm':   m_AccessType.m_bMemoryMap = true;                                                   break;
             default:
                 // "Don't understand this[%c] access mode while opening file (%s)", pMode[i], (const char*)Path)
                 assert(false);
@@ -210,13 +329,18 @@ namespace xfile
 
         // Ok let us create our instance from the device
         m_pInstance = m_pDeviceReg->m_pDevice->createInstance();
+        if (m_pInstance == nullptr)
+        {
+            --m_pDeviceReg->s_nInUse;
+            return xerr::create<state::OPENING_FILE, "Too many files open for this device">();
+        }
 
         // next thing is to open the file using the device
         // Note this hold initialization could be VERY WORNG as opening the file 
         // may the one of the slowest part of the file access as the DVD may need to seek
         // to it. This ideally should happen Async when an Async mode is requested.
         // May need to review this a bit more careful later.
-        if (auto Err = m_pInstance->open(m_FilePath, m_AccessType); Err)
+        if (auto Err = m_pInstance->open(s_FinalPath, m_AccessType); Err)
         {
             m_pDeviceReg->m_pDevice->destroyInstance(*m_pInstance);
             m_pInstance = nullptr;
@@ -224,6 +348,9 @@ namespace xfile
             return Err;
         }
 
+        // Kept by the stream (the scratch path is reused by the next open)
+        m_FilePath.assign(s_FinalPath);
+
         if( m_AccessType.m_bCreate == false )
         {
             if (bSeekToEnd)
@@ -238,225 +365,1045 @@ namespace xfile
             }
         }
 
+        //
+        // Compressed files get a layer on top of the device instance, read only files are detected by their header and footer.
+        // Detected files that the layer fails to load are read as they are, only "c" opens report the error.
+        //
+        m_pBaseInstance = m_pInstance;
+        if (m_AccessType.m_bCompress || (m_AccessType.m_bWrite == false && driver::compressed::layer::isCompressed(*m_pInstance, m_AccessType)))
+        {
+            auto* pLayer = driver::compressed::s_LayerPool.Alloc();
+            xerr  Err;
+
+            if (pLayer == nullptr)              Err = xerr::create<state::OPENING_FILE, "Too many compressed files open">();
+            else if (m_AccessType.m_bCreate)    Err = pLayer->Create(*m_pBaseInstance, m_AccessType);
+            else if (m_AccessType.m_bWrite)     Err = xerr::create<state::NOT_SUPPORTED, "Compressed files can not be modified, only created or read">();
+            else                                Err = pLayer->Load(*m_pBaseInstance, m_AccessType);
+
+            // A detected file the layer can not load is read as it is
+            if (Err && pLayer && m_AccessType.m_bCompress == false)
+            {
+                pLayer->clear();
+                driver::compressed::s_LayerPool.Free(*pLayer);
+                pLayer = nullptr;
+
+                Err.clear();
+                Err = m_pBaseInstance->Seek(device::SKM_ORIGIN, 0);
+            }
+
+            if (Err)
+            {
+                if (pLayer)
+                {
+                    pLayer->clear();
+                    driver::compressed::s_LayerPool.Free(*pLayer);
+                }
+                m_pBaseInstance->close();
+                m_pDeviceReg->m_pDevice->destroyInstance(*m_pBaseInstance);
+                m_pInstance = m_pBaseInstance = nullptr;
+                --m_pDeviceReg->s_nInUse;
+                return Err;
+            }
+
+            if (pLayer) m_pInstance = pLayer;
+        }
+
+        //
+        // Async files of devices (or layers) that can not overlap their requests get the async layer on top
+        //
+        if (m_AccessType.m_bASync && m_pInstance->isAsync() == false)
+        {
+            auto* pLayer = driver::async::s_LayerPool.Alloc();
+            xerr  Err;
+
+            if (pLayer == nullptr) Err = xerr::create<state::OPENING_FILE, "Too many async files open">();
+            else                   Err = pLayer->Create(*m_pInstance);
+
+            if (Err)
+            {
+                if (pLayer)
+                {
+                    pLayer->clear();
+                    driver::async::s_LayerPool.Free(*pLayer);
+                }
+                CloseLayers();
+                return Err;
+            }
+
+            m_pInstance   = pLayer;
+            m_bAsyncLayer = true;
+        }
+
+        // Async and mapped files talk to the device directly. Only once the file is open,
+        // a failed open leaves the stream ready for the next one with its buffer (close restores it)
+        if (m_AccessType.m_bASync || m_AccessType.m_bMemoryMap) m_BufferSize = 0;
+
         return {};
     }
 
+    //------------------------------------------------------------------------------
+    // Closes the layers from the top down and the instance of the device
+    //------------------------------------------------------------------------------
+
+    void stream::CloseLayers( void ) noexcept
+    {
+        auto* pInstance = m_pInstance;
+        pInstance->close();
+
+        if (m_bAsyncLayer)
+        {
+            auto& Layer = static_cast<driver::async::layer&>(*pInstance);
+            pInstance = &Layer.getBase();
+            Layer.clear();
+            driver::async::s_LayerPool.Free(Layer);
+            pInstance->close();
+        }
+
+        if (pInstance != m_pBaseInstance)
+        {
+            auto& Layer = static_cast<driver::compressed::layer&>(*pInstance);
+            Layer.clear();
+            driver::compressed::s_LayerPool.Free(Layer);
+            m_pBaseInstance->close();
+        }
+
+        --m_pDeviceReg->s_nInUse;
+        assert(m_pDeviceReg->s_nInUse >= 0);
+        m_pDeviceReg->m_pDevice->destroyInstance(*m_pBaseInstance);
+
+        m_pInstance     = nullptr;
+        m_pBaseInstance = nullptr;
+        m_bAsyncLayer   = false;
+    }
+
     //------------------------------------------------------------------------------
 
     void stream::close(void) noexcept
     {
         if (m_pInstance)
         {
-            m_pInstance->close();
-            --m_pDeviceReg->s_nInUse;
-            assert(m_pDeviceReg->s_nInUse >= 0);
-            m_pDeviceReg->m_pDevice->destroyInstance(*m_pInstance);
+            details::stats_probe Probe(*this, stats::op::CLOSE);
+
+            // Nobody is left to hear about a failure here, use Flush before closing to catch it
+            (void)FlushBuffer();
+
+            CloseLayers();
         }
 
         //
         // Done with the file
         //
-        m_pInstance  = nullptr;
-        m_pDeviceReg = nullptr;
+        m_pInstance     = nullptr;
+        m_pBaseInstance = nullptr;
+        m_pDeviceReg    = nullptr;
         m_AccessType.m_Value = 0;
         m_FilePath.clear();
+
+        // We keep the buffer memory around in case the stream is used again
+        m_BufferSize    = default_buffer_size_v;
+        m_BufferMode    = buffer_mode::NONE;
+        m_BufferOffset  = m_BufferPos = m_BufferEnd = 0;
+        m_CachedLength  = ~std::size_t{0};
     }
 
     //------------------------------------------------------------------------------
 
-    xerr stream::ReadRaw(std::span<std::byte> View) noexcept
+    xerr stream::setBufferSize( std::size_t Bytes ) noexcept
     {
         assert(m_pInstance);
-        assert(View.empty() == false);
 
-        // Read data if we have an error report it to the user
-        if (auto Err = m_pInstance->Read(View); Err )
+        if (Bytes && (m_AccessType.m_bASync || m_AccessType.m_bMemoryMap))
+            return xerr::create<state::NOT_SUPPORTED, "Async and memory mapped files can not be buffered">();
+
+        if (auto Err = FlushBuffer(); Err)
             return Err;
 
-        // If it is text mode try finding '\r\n' to remove the '\r'
-        if (m_AccessType.m_Text)
-        {
-            if (m_AccessType.m_Text==1)
-            {
-                char* pCharSrc = reinterpret_cast<char*>(View.data());
-                char* pCharDst = reinterpret_cast<char*>(View.data());
+        if (Bytes != m_BufferSize) m_Buffer = {};
+        m_BufferSize = Bytes;
+        return {};
+    }
 
-                for (std::size_t i = 0; i < View.size(); i++)
-                {
-                    *pCharDst = *pCharSrc;
-                    pCharSrc++;
-                    if (!(*pCharSrc == '\n' && *(pCharSrc - 1) == '\r'))
-                    {
-                        pCharDst++;
-                    }
-                }
+    //------------------------------------------------------------------------------
+    // Writes Count copies of C. Big runs of zeros are handed to the device so it can
+    // extend the file sparsely or punch holes instead of writing them.
+    //------------------------------------------------------------------------------
 
-                // Read any additional data that we may need
-                if (pCharSrc != pCharDst)
-                {
-                    const auto Delta = static_cast<std::size_t>(pCharSrc - pCharDst);
+    xerr stream::Fill( int C, std::size_t Count ) noexcept
+    {
+        assert(C >= 0 && C <= 0xff);
+        assert(m_pInstance);
 
-                    // Recurse
-                    return ReadRaw({ (std::byte*)&View[View.size() - Delta], Delta });
-                }
+        if (C == 0 && Count >= sparse_fill_threshold_v && m_AccessType.m_Text == 0 && m_AccessType.m_bASync == false)
+        {
+            if (auto Err = FlushBuffer(); Err)
+                return Err;
 
-                // Sugar a bad case here. We need to read one more character to know what to do.
-                if (*--pCharDst == '\r')
-                {
-                    char C;
+            details::stats_probe Probe(*this, stats::op::WRITE, Count);
+            if (auto Err = m_pInstance->WriteZero(Count); Err)
+                return Err;
 
-                    if ( auto Err = m_pInstance->Read( { (std::byte*)&C, 1 }); Err )
-                        return Err;
+            // The file may have grown
+            m_CachedLength = ~std::size_t{0};
+            return {};
+        }
 
-                    if (C == '\n')
-                    {
-                        *pCharDst = '\n';
-                    }
-                    else
-                    {
-                        // Upss the next character didnt match the sequence
-                        // lets rewind one
-                        if (auto Err = m_pInstance->Seek(device::SKM_CURENT, -1 ); Err )
-                            return Err;
-                    }
-                }
-            }
-            else if (m_AccessType.m_Text == 2)
-            {
-                if (( View.size()&1) == 0 )
-                {
-                    return xerr::create_f<state,"The text buffer you are trying to read is not multiple of 2... For wide character it needs to be multiple of 2">();
-                }
-                auto     wView    = std::span(reinterpret_cast<wchar_t*>(View.data()), View.size()/2);
-                wchar_t* pCharSrc = wView.data();
-                wchar_t* pCharDst = wView.data();
+        std::array<std::byte, 4096> Chunk;
+        std::memset(Chunk.data(), C, std::min(Count, Chunk.size()));
+        for (std::size_t i = 0; i < Count; i += Chunk.size())
+        {
+            if (auto Err = WriteRaw({ Chunk.data(), std::min(Count - i, Chunk.size()) }); Err)
+                return Err;
+        }
 
-                for (std::size_t i = 0; i < wView.size(); i++)
-                {
-                    *pCharDst = *pCharSrc;
-                    pCharSrc++;
-                    if (!(*pCharSrc == '\n' && *(pCharSrc - 1) == '\r'))
-                    {
-                        pCharDst++;
-                    }
-                }
+        return {};
+    }
 
-                // Read any additional data that we may need
-                if (pCharSrc != pCharDst)
-                {
-                    const auto Delta = static_cast<std::size_t>(pCharSrc - pCharDst);
+    //------------------------------------------------------------------------------
+    // Moves the cursor forward. When writing past the end of the file the gap is zero filled.
+    //------------------------------------------------------------------------------
 
-                    // Recurse
-                    return ReadRaw({ (std::byte*)&wView[wView.size() - Delta], Delta*2 });
-                }
+    xerr stream::Skip( std::size_t Count ) noexcept
+    {
+        assert(m_pInstance);
 
-                // Sugar a bad case here. We need to read one more character to know what to do.
-                if (*--pCharDst == L'\r')
-                {
-                    wchar_t C;
+        std::size_t Pos, Length;
+        if (auto Err = Tell(Pos); Err)
+            return Err;
 
-                    if (auto Err = m_pInstance->Read({ (std::byte*)&C, 2 }); Err)
-                        return Err;
+        if (auto Err = getFileLength(Length); Err)
+            return Err;
 
-                    if (C == L'\n')
-                    {
-                        *pCharDst = L'\n';
-                    }
-                    else
-                    {
-                        // Upss the next character didnt match the sequence
-                        // lets rewind one
-                        if (auto Err = m_pInstance->Seek(device::SKM_CURENT, -2); Err)
-                            return Err;
-                    }
-                }
-            }
+        if (m_AccessType.m_bWrite == false || Pos + Count <= Length)
+            return SeekCurrent(Count);
+
+        if (Pos < Length)
+        {
+            if (auto Err = SeekOrigin(Length); Err)
+                return Err;
         }
 
-        return {};
+        return Fill(0, Pos + Count - std::max(Pos, Length));
     }
 
+    //------------------------------------------------------------------------------
+    // Copies the whole file into another stream (at its cursor). Bytes are copied as they are
+    // in the file, text files are not translated. From fastest to slowest it tries:
+    //      1. The device copies by itself (copy_file_range, sendfile...)
+    //      2. The source lives in memory (ram, memory mapped) so it is written straight from there
+    //      3. Two big buffers, the write of one overlaps the read of the other
     //------------------------------------------------------------------------------
 
-    xerr stream::WriteRaw(std::span<const std::byte> View) noexcept
+    xerr stream::ToFile( stream& File, const progress_fn& Progress ) noexcept
     {
-        assert(m_pInstance);
-        assert(View.empty() == false);
+        assert(m_pInstance && File.m_pInstance);
+        assert(&File != this);
+
+        if (auto Err = SeekOrigin(0); Err)
+            return Err;
+
+        std::size_t Length;
+        if (auto Err = getFileLength(Length); Err)
+            return Err;
 
-        // If it is text mode try finding '\n' and add a '\r' in front so that it puts in the file '\r\n'
-        if (m_AccessType.m_Text)
+        const std::uint64_t Total = Length;
+        std::uint64_t       Done  = 0;
+
+        if (auto Err = FlushBuffer(); Err)
+            return Err;
+
+        if (auto Err = File.FlushBuffer(); Err)
+            return Err;
+
+        // Async files answer INCOMPLETE while the device still works with the view,
+        // the memory here is used (or reused) right after so we wait for it
+        static constexpr auto Settle = []( stream& Stream, xerr Err ) noexcept -> xerr
+        {
+            if (!Err || Stream.m_AccessType.m_bASync == false || Err.getState<state>() != state::INCOMPLETE) return Err;
+            Err.clear();
+            return Stream.m_pInstance->Synchronize(true);
+        };
+
+        //
+        // Let the devices talk to each other, we do it in slices to report the progress
+        //
+        if (m_AccessType.m_bASync == false && File.m_AccessType.m_bASync == false)
         {
-            if (m_AccessType.m_Text == 1)
+            constexpr std::uint64_t slice_v = 64 * 1024 * 1024;
+            while (Done < Total)
             {
-                auto* pFound = View.data();
-                std::uint64_t   iLast = 0;
-                std::uint64_t   i;
+                const auto Count = static_cast<std::size_t>(std::min(Total - Done, slice_v));
 
-                for (i = 0; i < View.size(); i++)
+                // A read of this file and a write of the other one
+                details::stats_probe ReadProbe(*this, stats::op::READ, Count);
+                details::stats_probe WriteProbe(File, stats::op::WRITE, Count);
+                if (auto Err = m_pInstance->CopyTo(*File.m_pInstance, Count); Err)
                 {
-                    if (pFound[i] == std::byte{ '\n' })
-                    {
-                        constexpr static std::uint16_t Data = (std::uint16_t{ '\n' } << 8) | (std::uint16_t{ '\r' } << 0);
+                    if (Done == 0 && Err.getState<state>() == state::NOT_SUPPORTED) break;
+                    return Err;
+                }
 
-                        if (auto Err = m_pInstance->Write({ &pFound[iLast], i - iLast }); Err ) 
-                            return Err;
+                Done                += Count;
+                File.m_CachedLength  = ~std::size_t{0};
+                if (Progress) Progress(Done, Total);
+            }
 
-                        if (auto Err = m_pInstance->Write({ reinterpret_cast<const std::byte*>(&Data), sizeof(Data)}); Err)
-                            return Err;
+            if (Done == Total) return {};
+        }
 
-                        // Update the base
-                        iLast = i + 1;
-                    }
-                }
+        //
+        // Sources in memory can be written directly
+        //
+        for (std::span<const std::byte> View; Done < Total; )
+        {
+            if (m_pInstance->MapView(View) || View.empty()) break;
+
+            View = View.first(static_cast<std::size_t>(std::min<std::uint64_t>(View.size(), Total - Done)));
+            if (auto Err = Settle(File, File.BufferedWrite(View)); Err)
+                return Err;
+
+            if (auto Err = m_pInstance->Seek(device::SKM_CURENT, View.size()); Err)
+                return Err;
+
+            Done += View.size();
+            if (Progress) Progress(Done, Total);
+        }
 
-                // Write the remainder 
-                if (iLast != i)
+        //
+        // Double buffered copy, the other stream writes in the background while we read the next chunk
+        //
+        if (Done < Total)
+        {
+            const auto                              ChunkSize = static_cast<std::size_t>(std::min<std::uint64_t>(copy_chunk_v, Total - Done));
+            std::array<std::vector<std::byte>, 2>   Buffers   { std::vector<std::byte>(ChunkSize), std::vector<std::byte>(ChunkSize) };
+
+            auto Count = static_cast<std::size_t>(std::min<std::uint64_t>(ChunkSize, Total - Done));
+            if (auto Err = Settle(*this, BufferedRead({ Buffers[0].data(), Count })); Err)
+                return Err;
+
+            // A write that goes to the IO threads. If none of them picked it up by the time we
+            // need it done we write it ourselves, so the copy never waits for a free IO thread.
+            struct background_write
+            {
+                enum : std::uint8_t
+                { QUEUED
+                , RUNNING
+                , DONE
+                };
+
+                bool TryRun( void ) noexcept
                 {
-                    if (auto Err = m_pInstance->Write({ &pFound[iLast], i - iLast }); Err ) 
-                        return Err;
+                    std::uint8_t Expected = QUEUED;
+                    if (m_State.compare_exchange_strong(Expected, RUNNING, std::memory_order_acquire) == false) return false;
+                    m_Error = Settle(*m_pFile, m_pFile->BufferedWrite(m_View));
+                    m_State.store(DONE, std::memory_order_release);
+                    m_State.notify_all();
+                    return true;
                 }
-            }
-            else if (m_AccessType.m_Text == 2)
-            {
-                auto            wView  = std::span(reinterpret_cast<const wchar_t*>(View.data()), View.size()/2);
-                auto*           pFound = wView.data();
-                std::uint64_t   iLast = 0;
-                std::uint64_t   i;
 
-                for (i = 0; i < wView.size(); i++)
+                xerr Wait( void ) noexcept
                 {
-                    if (pFound[i] == L'\n' )
+                    if (TryRun() == false)
                     {
-                        constexpr static std::uint32_t Data = (std::uint16_t{ L'\n' } << 16) | (std::uint16_t{ L'\r' } << 0);
+                        for (auto State = m_State.load(std::memory_order_acquire); State != DONE; State = m_State.load(std::memory_order_acquire))
+                            m_State.wait(State, std::memory_order_acquire);
+                    }
+                    return std::move(m_Error);
+                }
 
-                        if (auto Err = m_pInstance->Write({ reinterpret_cast<const std::byte*>(&pFound[iLast]), (i - iLast) * 2}); Err)
-                            return Err;
+                std::atomic<std::uint8_t>       m_State     { QUEUED };
+                stream*                         m_pFile     { nullptr };
+                std::span<const std::byte>      m_View      {};
+                xerr                            m_Error     {};
+            };
 
-                        if (auto Err = m_pInstance->Write({ reinterpret_cast<const std::byte*>(&Data), sizeof(Data) }); Err )
-                            return Err;
+            for (int i = 0; ; i ^= 1)
+            {
+                // Shared with the job, which may only get to run (and find nothing to do) after we are gone
+                auto Writing = std::make_shared<background_write>();
+                Writing->m_pFile = &File;
+                Writing->m_View  = { Buffers[i].data(), Count };
+                details::thread_pool::getIOInstance().Submit([Writing] { (void)Writing->TryRun(); });
 
-                        // Update the base
-                        iLast = i + 1;
-                    }
-                }
+                const auto Written = Count;
+                Count = static_cast<std::size_t>(std::min<std::uint64_t>(ChunkSize, Total - Done - Written));
 
-                // Write the remainder 
-                if (iLast != i)
-                {
-                    if (auto Err = m_pInstance->Write({ reinterpret_cast<const std::byte*>(&pFound[iLast]), (i - iLast)*2 }); Err )
-                        return Err;
+                xerr ReadErr;
+                if (Count) ReadErr = Settle(*this, BufferedRead({ Buffers[i ^ 1].data(), Count }));
+
+                if (auto Err = Writing->Wait(); Err)
+                    return Err;
+
+                Done += Written;
+                if (Progress) Progress(Done, Total);
+
+                if (ReadErr)   return ReadErr;
+                if (Count == 0) break;
+            }
+        }
+
+        return {};
+    }
+
+    //------------------------------------------------------------------------------
+    // Opening touches the disk (and the device tables) so it runs in the thread pool
+    //------------------------------------------------------------------------------
+
+    bool details::open_awaiter::await_suspend( std::coroutine_handle<> Handle ) noexcept
+    {
+        m_Handle = Handle;
+        if (m_pExecutor == nullptr) m_pExecutor = m_Stream.m_pExecutor;
+
+        // Opens block on the device so they go to the IO threads
+        details::thread_pool::getIOInstance().Submit([this]
+        {
+            m_Error = m_Stream.open(m_Path, m_Mode.c_str());
+            Arrive();
+        });
+
+        return m_bArrived.exchange(true, std::memory_order_acq_rel) == false;
+    }
+
+    //------------------------------------------------------------------------------
+
+    void open_async( stream& File, std::wstring_view Path, const char* pMode, open_request& Request ) noexcept
+    {
+        Request.m_pStream = &File;
+        Request.m_Path.assign(Path);
+        Request.m_Mode.assign(pMode);
+        open_batch({ &Request, 1 });
+    }
+
+    //------------------------------------------------------------------------------
+    // Each IO worker gets one job that takes the requests in order until there are
+    // none left, so a big batch does not flood the queue of the pool with jobs
+    //------------------------------------------------------------------------------
+
+    void open_batch( std::span<open_request> Requests ) noexcept
+    {
+        if (Requests.empty()) return;
+
+        for (auto& Request : Requests)
+        {
+            assert(Request.m_pStream && Request.m_pStream->isOpen() == false);
+            assert(Request.isDone());
+            Request.m_Error.clear();
+            Request.m_bDone.store(false, std::memory_order_relaxed);
+        }
+
+        struct batch
+        {
+            std::span<open_request>         m_Requests;
+            std::atomic<std::size_t>        m_iNext     { 0 };
+        };
+
+        auto&       Pool    = details::thread_pool::getIOInstance();
+        auto        pBatch  = std::make_shared<batch>();
+        pBatch->m_Requests  = Requests;
+        const auto  nJobs   = std::min(Requests.size(), Pool.getWorkerCount());
+
+        for (std::size_t i = 0; i < nJobs; ++i)
+        {
+            Pool.Submit([pBatch]
+            {
+                for (auto i = pBatch->m_iNext++; i < pBatch->m_Requests.size(); i = pBatch->m_iNext++)
+                {
+                    auto& Request = pBatch->m_Requests[i];
+                    Request.m_Error = Request.m_pStream->open(Request.m_Path, Request.m_Mode.c_str());
+                    if (Request.m_Callback) Request.m_Callback(Request);
+
+                    // After this the request may be gone, the waiters are woken through the done signal
+                    Request.m_bDone.store(true, std::memory_order_release);
+                    details::done_signal::Notify();
                 }
+            });
+        }
+    }
+
+    //------------------------------------------------------------------------------
+
+    xerr LoadAll( std::wstring_view Path, buffer& Buffer ) noexcept
+    {
+        stream File;
+        if (auto Err = File.open(Path, "r"); Err)
+            return Err;
+
+        // One read of the exact size, the stream buffer would only add a copy
+        (void)File.setBufferSize(0);
+        return File.LoadAll(Buffer);
+    }
+
+    //------------------------------------------------------------------------------
+    // Reads the whole file into Buffer and leaves the cursor at the end of the file.
+    // Memory the device can lend is copied directly, the rest is read in one go or,
+    // for big files, in one piece per thread (all of them with ReadAt on this instance).
+    //------------------------------------------------------------------------------
+
+    xerr stream::LoadAll( buffer& Buffer ) noexcept
+    {
+        assert(m_pInstance);
+
+        if (auto Err = FlushBuffer(); Err)
+            return Err;
+
+        std::size_t Length;
+        if (auto Err = getFileLength(Length); Err)
+            return Err;
+
+        if (auto Err = Buffer.Resize(Length); Err)
+            return Err;
+
+        if (auto Err = m_pInstance->Seek(device::SKM_ORIGIN, 0); Err)
+            return Err;
+
+        std::size_t Done = 0;
+        for (std::span<const std::byte> View; Done < Length; )
+        {
+            if (m_pInstance->MapView(View) || View.empty()) break;
+
+            View = View.first(std::min(View.size(), Length - Done));
+            std::memcpy(Buffer.data() + Done, View.data(), View.size());
+
+            if (auto Err = m_pInstance->Seek(device::SKM_CURENT, View.size()); Err)
+                return Err;
+
+            Done += View.size();
+        }
+
+        const auto nParts = std::min<std::size_t>( Length - Done < parallel_load_v ? 1 : (Length - Done) / (parallel_load_v / 2)
+                                                 , details::thread_pool::getInstance().getWorkerCount() + 1 );
+
+        if (nParts > 1 && m_AccessType.m_bASync == false)
+        {
+            const auto                  PartSize = details::Align((Length - Done + nParts - 1) / nParts, 4096);
+            std::vector<xerr>           Errors(nParts);
+
+            details::thread_pool::getInstance().ForEach(nParts, [&](std::size_t i)
+            {
+                const auto Offset = Done + i * PartSize;
+                if (Offset >= Length) return;
+
+                const auto           Count = std::min(PartSize, Length - Offset);
+                details::stats_probe Probe(*this, stats::op::READ, Count);
+                Errors[i] = m_pInstance->ReadAt(Offset, { Buffer.data() + Offset, Count });
+            });
+
+            bool bSupported = true;
+            for (auto& Err : Errors)
+            {
+                if (!Err) continue;
+                if (Err.getState<state>() != state::NOT_SUPPORTED) return Err;
+                Err.clear();
+                bSupported = false;
             }
+
+            // Devices without ReadAt get the single read below
+            if (bSupported) return m_pInstance->Seek(device::SKM_ORIGIN, Length);
         }
-        else
+
+        if (Done < Length)
+        {
+            details::stats_probe Probe(*this, stats::op::READ, Length - Done);
+            if (auto Err = m_pInstance->Read({ Buffer.data() + Done, Length - Done }); Err)
+            {
+                // Async files are still reading into the buffer, we wait for them below
+                if (m_AccessType.m_bASync == false || Err.getState<state>() != state::INCOMPLETE)
+                    return Err;
+                Err.clear();
+            }
+
+            if (m_AccessType.m_bASync)
+            {
+                if (auto Err = m_pInstance->Synchronize(true); Err)
+                    return Err;
+            }
+        }
+
+        return {};
+    }
+
+    //------------------------------------------------------------------------------
+    // Switches the buffer into READ or WRITE mode. Whatever the buffer had is flushed first
+    // so that the device cursor is the stream cursor.
+    //------------------------------------------------------------------------------
+
+    xerr stream::BeginBuffer( buffer_mode Mode ) noexcept
+    {
+        assert(Mode != buffer_mode::NONE);
+
+        if (auto Err = FlushBuffer(); Err)
+            return Err;
+
+        if (m_Buffer.size() != m_BufferSize) m_Buffer.resize(m_BufferSize);
+
+        if (auto Err = m_pInstance->Tell(m_BufferOffset); Err)
+            return Err;
+
+        m_BufferMode = Mode;
+        return {};
+    }
+
+    //------------------------------------------------------------------------------
+    // Sends the pending writes to the device, the buffer stays in WRITE mode
+    //------------------------------------------------------------------------------
+
+    xerr stream::WriteBuffer( void ) noexcept
+    {
+        assert(m_BufferMode == buffer_mode::WRITE);
+        if (m_BufferPos == 0) return {};
+
+        details::stats_probe Probe(*this, stats::op::WRITE, m_BufferPos);
+        if (auto Err = m_pInstance->Write({ m_Buffer.data(), m_BufferPos }); Err)
+            return Err;
+
+        m_BufferOffset += m_BufferPos;
+        m_BufferPos     = 0;
+        if (m_CachedLength != ~std::size_t{0}) m_CachedLength = std::max(m_CachedLength, m_BufferOffset);
+        return {};
+    }
+
+    //------------------------------------------------------------------------------
+    // Empties the buffer and leaves the device cursor where the stream cursor is
+    //------------------------------------------------------------------------------
+
+    xerr stream::FlushBuffer( void ) noexcept
+    {
+        switch (m_BufferMode)
+        {
+        case buffer_mode::NONE: 
+            return {};
+        case buffer_mode::WRITE:
+            if (auto Err = WriteBuffer(); Err)
+                return Err;
+            break;
+        case buffer_mode::READ:
+            // The device read ahead of us
+            if (m_BufferPos != m_BufferEnd)
+            {
+                details::stats_probe Probe(*this, stats::op::SEEK);
+                if (auto Err = m_pInstance->Seek(device::SKM_ORIGIN, m_BufferOffset + m_BufferPos); Err)
+                    return Err;
+            }
+            break;
+        }
+
+        m_BufferMode = buffer_mode::NONE;
+        m_BufferPos  = m_BufferEnd = 0;
+        return {};
+    }
+
+    //------------------------------------------------------------------------------
+
+    xerr stream::BufferedRead( std::span<std::byte> View ) noexcept
+    {
+        if (m_BufferSize == 0)
+        {
+            details::stats_probe Probe(*this, stats::op::READ, View.size());
+            return m_pInstance->Read(View);
+        }
+
+        if (m_BufferMode != buffer_mode::READ)
+        {
+            if (auto Err = BeginBuffer(buffer_mode::READ); Err)
+                return Err;
+        }
+
+        // Serve what we can from the buffer
+        const auto Available = std::min(View.size(), m_BufferEnd - m_BufferPos);
+        std::memcpy(View.data(), &m_Buffer[m_BufferPos], Available);
+        m_BufferPos += Available;
+        View         = View.subspan(Available);
+        if (View.empty()) return {};
+
+        // The buffer is empty, the device cursor is now at m_BufferOffset
+        m_BufferOffset += m_BufferEnd;
+        m_BufferPos     = m_BufferEnd = 0;
+
+        // Small reads refill the buffer with whatever is left in the file (up to the buffer size)
+        if (View.size() < m_BufferSize)
+        {
+            if (m_CachedLength == ~std::size_t{0} || m_CachedLength <= m_BufferOffset)
+            {
+                if (auto Err = m_pInstance->Length(m_CachedLength); Err)
+                    return Err;
+            }
+
+            if (m_CachedLength > m_BufferOffset)
+            {
+                const auto           Count = std::min(m_BufferSize, m_CachedLength - m_BufferOffset);
+                details::stats_probe Probe(*this, stats::op::READ, Count);
+                if (auto Err = m_pInstance->Read({ m_Buffer.data(), Count }); Err)
+                {
+                    (void)m_pInstance->Tell(m_BufferOffset);
+                    return Err;
+                }
+
+                m_BufferEnd = Count;
+                m_BufferPos = std::min(Count, View.size());
+                std::memcpy(View.data(), m_Buffer.data(), m_BufferPos);
+                View        = View.subspan(m_BufferPos);
+                if (View.empty()) return {};
+
+                // We got to the end of the file
+                m_BufferOffset += m_BufferEnd;
+                m_BufferPos     = m_BufferEnd = 0;
+            }
+        }
+
+        // Big reads (and reads past the end) go straight to the device so it reports things its own way
+        details::stats_probe Probe(*this, stats::op::READ, View.size());
+        if (auto Err = m_pInstance->Read(View); Err)
+        {
+            (void)m_pInstance->Tell(m_BufferOffset);
+            return Err;
+        }
+
+        m_BufferOffset += View.size();
+        return {};
+    }
+
+    //------------------------------------------------------------------------------
+
+    xerr stream::BufferedWrite( std::span<const std::byte> View ) noexcept
+    {
+        if (m_BufferSize == 0)
+        {
+            details::stats_probe Probe(*this, stats::op::WRITE, View.size());
+            return m_pInstance->Write(View);
+        }
+
+        if (m_BufferMode != buffer_mode::WRITE)
+        {
+            if (auto Err = BeginBuffer(buffer_mode::WRITE); Err)
+                return Err;
+        }
+
+        if (m_BufferPos + View.size() > m_BufferSize)
         {
-            if (auto Err = m_pInstance->Write(View); Err ) 
+            if (auto Err = WriteBuffer(); Err)
+                return Err;
+
+            // Too big for the buffer, no point on copying it
+            if (View.size() >= m_BufferSize)
+            {
+                details::stats_probe Probe(*this, stats::op::WRITE, View.size());
+                if (auto Err = m_pInstance->Write(View); Err)
+                {
+                    (void)m_pInstance->Tell(m_BufferOffset);
+                    return Err;
+                }
+
+                m_BufferOffset += View.size();
+                if (m_CachedLength != ~std::size_t{0}) m_CachedLength = std::max(m_CachedLength, m_BufferOffset);
+                return {};
+            }
+        }
+
+        std::memcpy(&m_Buffer[m_BufferPos], View.data(), View.size());
+        m_BufferPos += View.size();
+        return {};
+    }
+
+    //------------------------------------------------------------------------------
+    // Small records go in the buffer, the rest go to the device in a single call that
+    // starts with whatever the buffer had
+    //------------------------------------------------------------------------------
+
+    xerr stream::BufferedWriteV( std::span<const std::span<const std::byte>> Views ) noexcept
+    {
+        if (Views.size() == 1)  return BufferedWrite(Views[0]);
+
+        std::size_t Total = 0;
+        for (auto& View : Views) Total += View.size();
+
+        if (m_BufferSize == 0)
+        {
+            details::stats_probe Probe(*this, stats::op::WRITE, Total);
+            return m_pInstance->WriteV(Views);
+        }
+
+        if (m_BufferMode != buffer_mode::WRITE)
+        {
+            if (auto Err = BeginBuffer(buffer_mode::WRITE); Err)
+                return Err;
+        }
+
+        if (m_BufferPos + Total <= m_BufferSize)
+        {
+            for (auto& View : Views)
+            {
+                if (View.empty()) continue;
+                std::memcpy(&m_Buffer[m_BufferPos], View.data(), View.size());
+                m_BufferPos += View.size();
+            }
+            return {};
+        }
+
+        constexpr std::size_t                                   local_views_v = 16;
+        std::array<std::span<const std::byte>, local_views_v>   Local;
+        std::vector<std::span<const std::byte>>                 Heap;
+        std::span<std::span<const std::byte>>                   All;
+
+        if (Views.size() < local_views_v) All = { Local.data(), Views.size() + 1 };
+        else                              All = Heap = std::vector<std::span<const std::byte>>( Views.size() + 1 );
+
+        All[0] = { m_Buffer.data(), m_BufferPos };
+        std::ranges::copy(Views, All.begin() + 1);
+
+        details::stats_probe Probe(*this, stats::op::WRITE, m_BufferPos + Total);
+        if (auto Err = m_pInstance->WriteV(All); Err)
+        {
+            m_BufferPos = 0;
+            (void)m_pInstance->Tell(m_BufferOffset);
+            return Err;
+        }
+
+        m_BufferOffset += m_BufferPos + Total;
+        m_BufferPos     = 0;
+        if (m_CachedLength != ~std::size_t{0}) m_CachedLength = std::max(m_CachedLength, m_BufferOffset);
+        return {};
+    }
+
+    //------------------------------------------------------------------------------
+
+    xerr stream::BufferedSeek( device::seek_mode Mode, std::size_t Pos ) noexcept
+    {
+        if (m_BufferMode == buffer_mode::NONE)
+        {
+            details::stats_probe Probe(*this, stats::op::SEEK);
+            return m_pInstance->Seek(Mode, Pos);
+        }
+
+        // Relative seeks are relative to the stream cursor not the device one
+        if (Mode == device::SKM_CURENT)
+        {
+            Mode = device::SKM_ORIGIN;
+            Pos += m_BufferOffset + m_BufferPos;
+        }
+
+        // Seeking inside of what we read ahead is free
+        if (m_BufferMode == buffer_mode::READ && Mode == device::SKM_ORIGIN && Pos >= m_BufferOffset && Pos <= m_BufferOffset + m_BufferEnd)
+        {
+            m_BufferPos = Pos - m_BufferOffset;
+            return {};
+        }
+
+        if (m_BufferMode == buffer_mode::WRITE)
+        {
+            if (auto Err = WriteBuffer(); Err)
+                return Err;
+        }
+
+        m_BufferMode = buffer_mode::NONE;
+        m_BufferPos  = m_BufferEnd = 0;
+
+        details::stats_probe Probe(*this, stats::op::SEEK);
+        return m_pInstance->Seek(Mode, Pos);
+    }
+
+    //------------------------------------------------------------------------------
+
+    xerr stream::BufferedTell( std::size_t& Pos ) noexcept
+    {
+        if (m_BufferMode == buffer_mode::NONE)
+            return m_pInstance->Tell(Pos);
+
+        Pos = m_BufferOffset + m_BufferPos;
+        return {};
+    }
+
+    //------------------------------------------------------------------------------
+    // Text modes: reads characters removing the '\r' of every "\r\n"
+    //------------------------------------------------------------------------------
+
+    template< typename T_CHAR > static
+    xerr ReadText( stream& Stream, std::span<T_CHAR> View ) noexcept
+    {
+        std::size_t Filled = 0;
+        while (Filled < View.size())
+        {
+            if (auto Err = Stream.BufferedRead(std::as_writable_bytes(View.subspan(Filled))); Err)
+                return Err;
+
+            // A '\r' left at the end of the last round may pair with a '\n' we just read
+            const auto Start = (Filled && View[Filled - 1] == T_CHAR('\r')) ? Filled - 1 : Filled;
+            Filled = Start + details::text::CompactNewLines(&View[Start], View.size() - Start);
+        }
+
+        // If we end with a '\r' we need to look at the next character to know what to do
+        if (View.back() == T_CHAR('\r'))
+        {
+            T_CHAR C;
+            if (xerr Err = Stream.BufferedRead(std::as_writable_bytes(std::span{ &C, 1 })); Err)
+            {
+                // The file ends with a '\r', that is fine
+                if (Err.getState<state>() == state::UNEXPECTED_EOF) Err.clear();
+                return Err;
+            }
+
+            if (C == T_CHAR('\n')) View.back() = T_CHAR('\n');
+            else if (auto Err = Stream.BufferedSeek(device::SKM_CURENT, static_cast<std::size_t>(-static_cast<std::ptrdiff_t>(sizeof(T_CHAR)))); Err)
+                return Err;
+        }
+
+        return {};
+    }
+
+    //------------------------------------------------------------------------------
+    // Text modes: writes characters turning '\n' into "\r\n". The text is expanded into 
+    // a staging chunk so each chunk is a single write.
+    //------------------------------------------------------------------------------
+
+    template< typename T_CHAR > static
+    xerr WriteText( stream& Stream, std::span<const T_CHAR> View ) noexcept
+    {
+        constexpr std::size_t         chunk_v = 4096 / sizeof(T_CHAR);
+        std::array<T_CHAR, 2*chunk_v> Staging;
+
+        for (std::size_t i = 0; i < View.size(); i += chunk_v)
+        {
+            const auto Source = View.subspan(i, std::min(chunk_v, View.size() - i));
+            const auto Count  = details::text::ExpandNewLines(Source.data(), Source.size(), Staging.data());
+
+            if (auto Err = Stream.BufferedWrite(std::as_bytes(std::span{ Staging.data(), Count })); Err)
+                return Err;
+        }
+
+        return {};
+    }
+
+    //------------------------------------------------------------------------------
+
+    xerr stream::ReadRaw(std::span<std::byte> View) noexcept
+    {
+        assert(m_pInstance);
+        assert(View.empty() == false);
+
+        switch (m_AccessType.m_Text)
+        {
+        case 1:
+            return ReadText(*this, std::span{ reinterpret_cast<char*>(View.data()), View.size() });
+        case 2:
+            if (View.size() % sizeof(wchar_t))
+                return xerr::create_f<state, "The text buffer you are trying to read is not multiple of wchar_t">();
+            return ReadText(*this, std::span{ reinterpret_cast<wchar_t*>(View.data()), View.size() / sizeof(wchar_t) });
+        default:
+            return BufferedRead(View);
+        }
+    }
+
+    //------------------------------------------------------------------------------
+    // Reads Count bytes and returns a view to them. When the device can, the view points
+    // straight into the device memory (no copies), otherwise it points to our staging buffer.
+    // The view is valid until the next operation in the file.
+    //------------------------------------------------------------------------------
+
+    xerr stream::ReadView( std::span<const std::byte>& View, std::size_t Count ) noexcept
+    {
+        assert(m_pInstance);
+        assert(Count > 0);
+
+        //
+        // Binary files may be able to borrow the memory directly from the device (ram blocks, mapped pages, etc)
+        //
+        if (m_AccessType.m_Text == 0)
+        {
+            // We may already have it in our buffer
+            if (m_BufferMode == buffer_mode::READ && m_BufferEnd - m_BufferPos >= Count)
+            {
+                View         = { &m_Buffer[m_BufferPos], Count };
+                m_BufferPos += Count;
+                return {};
+            }
+
+            if (auto Err = FlushBuffer(); Err)
+                return Err;
+
+            auto Err = m_pInstance->ReadView(View, Count);
+            if (!Err || Err.getState<state>() != state::NOT_SUPPORTED) 
+                return Err;
+        }
+
+        //
+        // Otherwise we read it into our staging buffer
+        //
+        if (m_Staging.size() < Count) m_Staging.resize(std::bit_ceil(Count));
+
+        View = { m_Staging.data(), Count };
+        return ReadRaw({ m_Staging.data(), Count });
+    }
+
+    //------------------------------------------------------------------------------
+    // Reads into several buffers one after the other. Binary reads that the buffer can not
+    // serve go to the device in a single call.
+    //------------------------------------------------------------------------------
+
+    xerr stream::ReadV( std::span<const std::span<std::byte>> Views ) noexcept
+    {
+        assert(m_pInstance);
+
+        std::size_t Total = 0;
+        for (auto& View : Views) Total += View.size();
+        if (Total == 0) return {};
+
+        if (m_AccessType.m_Text || (m_BufferSize && Total < m_BufferSize))
+        {
+            for (auto& View : Views)
+            {
+                if (View.empty()) continue;
+                if (auto Err = ReadRaw(View); Err)
+                    return Err;
+            }
+            return {};
+        }
+
+        if (auto Err = FlushBuffer(); Err)
+            return Err;
+
+        details::stats_probe Probe(*this, stats::op::READ, Total);
+        return m_pInstance->ReadV(Views);
+    }
+
+    //------------------------------------------------------------------------------
+
+    xerr stream::WriteRaw(std::span<const std::byte> View) noexcept
+    {
+        assert(View.empty() == false);
+        return WriteV({ &View, 1 });
+    }
+
+    //------------------------------------------------------------------------------
+    // Writes several buffers one after the other, binary records cost one device call
+    //------------------------------------------------------------------------------
+
+    xerr stream::WriteV( std::span<const std::span<const std::byte>> Views ) noexcept
+    {
+        assert(m_pInstance);
+
+        switch (m_AccessType.m_Text)
+        {
+        case 1:
+            for (auto& View : Views)
+            {
+                if (auto Err = WriteText(*this, std::span{ reinterpret_cast<const char*>(View.data()), View.size() }); Err)
+                    return Err;
+            }
+            break;
+        case 2:
+            for (auto& View : Views)
+            {
+                if (auto Err = WriteText(*this, std::span{ reinterpret_cast<const wchar_t*>(View.data()), View.size() / sizeof(wchar_t) }); Err)
+                    return Err;
+            }
+            break;
+        default:
+            if (auto Err = BufferedWriteV(Views); Err ) 
                 return Err;
+            break;
         }
 
         if (m_AccessType.m_bForceFlush)
         {
-            m_pInstance->Flush();
+            Flush();
         }
 
         return {};
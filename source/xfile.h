@@ -3,12 +3,24 @@
 #pragma once
 
 #include <array>
+#include <cstddef>
+#include <atomic>
 #include <span>
 #include <string>
 #include <memory>
+#include <vector>
+#include <functional>
+#include <format>
+#include <coroutine>
+#include <mutex>
 
 #include "source/xerr.h"
 
+// Define XFILE_STATS to 1 to collect the I/O statistics (see xfile::stats), without it the probes compile to nothing
+#ifndef XFILE_STATS
+    #define XFILE_STATS 0
+#endif
+
 namespace xfile
 {
     //-----------------------------------------------------------------------------------------------------
@@ -34,13 +46,117 @@ namespace xfile
     , OPENING_FILE
     , UNEXPECTED_EOF
     , INCOMPLETE
+    , NOT_SUPPORTED                                     // The device (or the mode) does not support the requested feature
+    , CORRUPTED                                         // The content of the file is not valid (compressed files)
     };
 
     //------------------------------------------------------------------------------
     // general functions
     //------------------------------------------------------------------------------
-    const std::wstring_view getTempPath             ( void )                        noexcept;
-    std::wstring_view       fromPathGetDeviceName   ( std::wstring_view Path )      noexcept;
+    std::wstring            getTempPath             ( void )                        noexcept;   // A copy, invalidatePathCache may replace the cached one at any time
+    void                    invalidatePathCache     ( void )                        noexcept;   // The working/temp paths and the devices are read again (call it after chdir)
+    std::wstring_view       fromPathGetDeviceName   ( std::wstring_view Path )      noexcept;   // On windows paths without a device point to a per thread copy of the working path
+    xerr                    deleteFile              ( std::wstring_view Path )      noexcept;
+
+    struct buffer;
+    struct async_ticket;
+    struct stream;
+    struct device;
+
+    // Device that serves the path ("temp:", "ram:", "c:\\", ...), nullptr if there is none
+    device*                 getDevice               ( std::wstring_view Path )      noexcept;
+
+    // Loads the whole file into a new buffer (see stream::LoadAll)
+    xerr                    LoadAll                 ( std::wstring_view Path, buffer& Buffer ) noexcept;
+
+    // Registers buffers with the async engine of the calling thread (io_uring fixed buffers on linux).
+    // Async reads/writes that land inside these buffers skip the per-operation page pinning.
+    // Passing an empty span unregisters them. Does nothing on platforms without support.
+    xerr                    registerAsyncBuffers    ( std::span<const std::span<std::byte>> Buffers ) noexcept;
+
+    //------------------------------------------------------------------------------
+    // Description:
+    //      I/O statistics. Every operation a stream does on its device is timed and counted in
+    //      the device (and in the counters given to stream::setStats): opens, closes, reads and
+    //      writes (with the bytes requested), seeks, flushes and the time blocked waiting for
+    //      async requests (Synchronize(true) and Wait). The latencies go to log2 histograms.
+    //      Reads and writes are the ones that reach the device or its layers, the ones served
+    //      by the buffer of the stream are not counted. Counters use relaxed atomics so a
+    //      snapshot taken while files are in use is close but not exact.
+    //      BeginTrace/EndTrace also record each operation in a timeline that ExportTrace
+    //      writes as Chrome trace JSON (chrome://tracing or ui.perfetto.dev).
+    //      Everything is compiled out unless XFILE_STATS is 1, then the snapshots are empty
+    //      and the functions that need the stats report state::NOT_SUPPORTED.
+    //------------------------------------------------------------------------------
+    namespace stats
+    {
+        enum class op : std::uint8_t
+        { OPEN
+        , CLOSE
+        , READ
+        , WRITE
+        , SEEK
+        , FLUSH
+        , STALL                                         // Blocked waiting for async requests
+        , ENUM_COUNT
+        };
+
+        constexpr static std::size_t histogram_size_v = 40;     // Bucket i counts latencies below 2^i ns (and not in the one before), the last one the rest
+
+        struct op_snapshot
+        {
+            // Upper bound of the bucket where Percent (0 to 100) of the operations are done
+            inline          std::uint64_t           getPercentileNs ( double Percent )                                          const   noexcept;
+
+            std::uint64_t                                   m_nOps      { 0 };
+            std::uint64_t                                   m_Bytes     { 0 };
+            std::uint64_t                                   m_TotalNs   { 0 };
+            std::uint64_t                                   m_MaxNs     { 0 };
+            std::array<std::uint64_t, histogram_size_v>     m_Histogram {};
+        };
+
+        struct snapshot
+        {
+            inline          const op_snapshot&      operator []     ( op Op )                                                   const   noexcept { return m_Ops[static_cast<std::size_t>(Op)]; }
+            inline          snapshot&               operator +=     ( const snapshot& Other )                                           noexcept;
+
+            std::array<op_snapshot, static_cast<std::size_t>(op::ENUM_COUNT)>  m_Ops {};
+        };
+
+        struct counters
+        {
+            inline          void                    Record          ( op Op, std::size_t Bytes, std::uint64_t Ns )                      noexcept;
+            inline          void                    getSnapshot     ( snapshot& Snapshot )                                      const   noexcept;
+            inline          void                    Reset           ( void )                                                            noexcept;
+
+            struct op_counters
+            {
+                std::atomic<std::uint64_t>                              m_nOps      { 0 };
+                std::atomic<std::uint64_t>                              m_Bytes     { 0 };
+                std::atomic<std::uint64_t>                              m_TotalNs   { 0 };
+                std::atomic<std::uint64_t>                              m_MaxNs     { 0 };
+                std::array<std::atomic<std::uint64_t>, histogram_size_v> m_Histogram {};
+            };
+
+            std::array<op_counters, static_cast<std::size_t>(op::ENUM_COUNT)>  m_Ops {};
+        };
+
+        // Sum of every device, or the device that serves Path
+        void                getSnapshot             ( snapshot& Snapshot )                                  noexcept;
+        xerr                getSnapshot             ( std::wstring_view Path, snapshot& Snapshot )          noexcept;
+        void                Reset                   ( void )                                                noexcept;
+
+        // Keeps up to MaxEvents operations, the ones after that are dropped. Starting again forgets the last trace.
+        xerr                BeginTrace              ( std::size_t MaxEvents = 1024 * 1024 )                 noexcept;
+        void                EndTrace                ( void )                                                noexcept;
+        xerr                ExportTrace             ( std::wstring_view Path )                              noexcept;   // Ends the trace first
+
+        constexpr           const char*             getName         ( op Op )                                           noexcept
+        {
+            constexpr std::array<const char*, static_cast<std::size_t>(op::ENUM_COUNT)> Names{ "Open", "Close", "Read", "Write", "Seek", "Flush", "Stall" };
+            return Names[static_cast<std::size_t>(Op)];
+        }
+    }
 
     //------------------------------------------------------------------------------
     // Description:
@@ -70,6 +186,7 @@ namespace xfile
                             , m_bASync        : 1  // Async enable?
                             , m_bCompress     : 1  // Do compress files (been compress)
                             , m_bForceFlush   : 1  // Forces to flush constantly (good for debugging). Note that this is handle at the top layer.
+                            , m_bMemoryMap    : 1  // Map the file into memory (read only files). Devices that can not do it will ignore it
                             ;
             };
         };
@@ -87,6 +204,24 @@ namespace xfile
             virtual         bool                isEOF           (void)                                                      noexcept = 0;
             virtual         xerr                Synchronize     (bool bBlock)                                               noexcept = 0;
             virtual         void                AsyncAbort      (void)                                                      noexcept = 0;
+
+            // Optional features, devices that do not have them report state::NOT_SUPPORTED
+            inline virtual  xerr                MapView         (std::span<const std::byte>& View)                          noexcept;
+            inline virtual  xerr                ReadView        (std::span<const std::byte>& View, std::size_t Count)       noexcept;
+            inline virtual  xerr                WriteZero       (std::size_t Count)                                         noexcept;
+            inline virtual  xerr                CopyTo          (instance& Dest, std::size_t Count)                         noexcept;
+            inline virtual  xerr                ReadV           (std::span<const std::span<std::byte>> Views)               noexcept;   // Scatter/gather at the cursor,
+            inline virtual  xerr                WriteV          (std::span<const std::span<const std::byte>> Views)         noexcept;   // one Read/Write per view by default
+            inline virtual  xerr                ReadAt          (std::size_t Offset, std::span<std::byte> View)             noexcept;   // At their own offset without the cursor, safe
+            inline virtual  xerr                WriteAt         (std::size_t Offset, std::span<const std::byte> View)       noexcept;   // to call from several threads at once
+            inline virtual  bool                isAsync         (void)                                                      noexcept;   // Overlaps the requests of this async file by itself
+
+            // Requests with their own offset and ticket, they do not move the cursor. Devices that can not
+            // have several requests in flight do the work right away (see async_ticket)
+            inline virtual  xerr                ReadAsync       (async_ticket& Ticket, std::span<std::byte> View, std::size_t Offset)       noexcept;
+            inline virtual  xerr                WriteAsync      (async_ticket& Ticket, std::span<const std::byte> View, std::size_t Offset) noexcept;
+            inline virtual  xerr                Wait            (async_ticket& Ticket, bool bBlock)                         noexcept;
+            inline virtual  void                Cancel          (async_ticket& Ticket)                                      noexcept;
         };
 
         constexpr                       device          (void)                          noexcept = default;
@@ -95,6 +230,13 @@ namespace xfile
         virtual         void            Kill            (void)                          noexcept = 0;
         virtual         instance*       createInstance  (void)                          noexcept = 0;
         virtual         void            destroyInstance (instance& Instance )           noexcept = 0;
+        inline virtual  xerr            deleteFile      (std::wstring_view FileName)    noexcept;
+
+        // Keeps the OS handles of up to MaxHandles closed read only files so opening them again does not
+        // go to the system (0, the default, turns it off). Writing or deleting a file through xfile drops
+        // its handles, changes made by other processes are not seen: call it again to drop all of them.
+        inline virtual  xerr            setHandleCache  (std::size_t MaxHandles)        noexcept;
+        inline virtual  std::uint64_t   getHandleCacheHits(void)                        noexcept;
 
         // User must have a global instance of the class to register its device
         struct registration
@@ -112,10 +254,203 @@ namespace xfile
                             device*             m_pDevice   { nullptr };
                             std::atomic_int     s_nInUse    {0};
                             std::atomic_int     s_nHaveUsed {0};
+#if XFILE_STATS
+                            stats::counters     m_Stats     {};
+#endif
             inline static   registration*       s_pHead     { nullptr };
         };
     };
 
+    //------------------------------------------------------------------------------
+    // Description:
+    //      Memory that holds a whole file, returned by the LoadAll functions. The data
+    //      is aligned to alignment_v so it can be parsed with vector loads right away.
+    //------------------------------------------------------------------------------
+    struct buffer
+    {
+        constexpr static std::size_t alignment_v = 64;
+
+        constexpr                               buffer          ( void )                                                            noexcept = default;
+        inline                                  buffer          ( buffer&& Other )                                                  noexcept;
+        inline                                 ~buffer          ( void )                                                            noexcept;
+        inline          buffer&                 operator =      ( buffer&& Other )                                                  noexcept;
+        inline          xerr                    Resize          ( std::size_t Size )                                                noexcept;
+        inline          void                    clear           ( void )                                                            noexcept;
+        inline          std::byte*              data            ( void )                                                    const   noexcept { return m_pData; }
+        inline          std::size_t             size            ( void )                                                    const   noexcept { return m_Size;  }
+        inline          bool                    empty           ( void )                                                    const   noexcept { return m_Size == 0; }
+        inline          std::span<std::byte>    getView         ( void )                                                    const   noexcept { return { m_pData, m_Size }; }
+
+        std::byte*                      m_pData         { nullptr };
+        std::size_t                     m_Size          { 0 };
+    };
+
+    namespace details
+    {
+        //------------------------------------------------------------------------------
+        // Requests can be destroyed by their owner as soon as they are seen done, so the
+        // thread that finishes one can not touch it after that, not even to wake who waits
+        // on it. Waiters sleep on this counter instead, it moves every time a request is
+        // done (which may wake some of them for nothing, they just check again).
+        //------------------------------------------------------------------------------
+        struct done_signal
+        {
+            inline static   void                    Notify          ( void )                                                            noexcept;
+            template< typename T_IS_DONE >
+            static          void                    Wait            ( T_IS_DONE&& isDone )                                              noexcept;
+
+            inline static   std::atomic<std::uint32_t>  s_nDone     { 0 };
+        };
+    }
+
+    //------------------------------------------------------------------------------
+    // Description:
+    //      One request made with stream::ReadAsync/WriteAsync. Each request has its own ticket
+    //      so any number of them can be in flight on the same stream, at any offsets. The ticket
+    //      belongs to the user and it must not move or be destroyed until it is done.
+    //      The callback (optional) is called once the request is done by the thread that finds
+    //      out: the device's own completion thread, one that calls Wait/Poll/Synchronize, or the one
+    //      that made the request when the device does the work right away. The ticket is already done
+    //      when the callback is called so the callback can make a new request with it (or free it),
+    //      this also means Wait may return while the callback is still running on another thread.
+    //------------------------------------------------------------------------------
+    struct async_ticket
+    {
+        enum class status : std::uint8_t
+        { IDLE                                          // No request has been made
+        , PENDING                                       // The request is in flight
+        , COMPLETING                                    // The request is done but the callback has not been called yet
+        , DONE
+        };
+
+        enum class result : std::uint8_t
+        { OK
+        , UNEXPECTED_EOF                                // Less bytes than requested were transferred
+        , CANCELED
+        , FAILURE
+        };
+
+        using callback_fn = std::function<void(async_ticket& Ticket)>;
+
+        inline          bool                    isDone          ( void )                                                    const   noexcept { return m_Status.load(std::memory_order_acquire) == status::DONE; }
+        inline          xerr                    getError        ( void )                                                    const   noexcept;
+
+        // Used by the devices
+        inline          void                    Begin           ( device::instance& Instance, std::size_t Requested )               noexcept;
+        inline          bool                    Complete        ( result Result, std::size_t Transferred )                          noexcept;   // True when RunCallback must follow
+        inline          void                    RunCallback     ( void )                                                            noexcept;
+
+        callback_fn                         m_Callback      {};
+        void*                               m_pUserData     { nullptr };
+        std::atomic<status>                 m_Status        { status::IDLE };
+        result                              m_Result        { result::OK };
+        std::size_t                         m_Requested     { 0 };
+        std::size_t                         m_Transferred   { 0 };
+        device::instance*                   m_pInstance     { nullptr };            // Who is doing the request
+        alignas(std::max_align_t)
+        std::array<std::byte, 64>           m_DeviceData    {};                     // Per request state of the device (kernel requests, OVERLAPPED, etc)
+    };
+
+    //------------------------------------------------------------------------------
+    // Description:
+    //      Where the coroutines that co_await on xfile resume (see stream::setExecutor).
+    //      Without one they resume in the thread that finds the request done, which is usually
+    //      the completion thread of the device, so anything long should go to the job system.
+    //------------------------------------------------------------------------------
+    struct executor
+    {
+        virtual         void                    Post            ( std::coroutine_handle<> Handle )                                  noexcept = 0;
+    };
+
+    namespace details
+    {
+        //------------------------------------------------------------------------------
+        // The request and the suspension of the coroutine race each other, the last one
+        // to arrive resumes the coroutine. Requests that are done right away never suspend.
+        //------------------------------------------------------------------------------
+        struct awaiter
+        {
+            constexpr   bool                    await_ready     ( void )                                                    const   noexcept { return false; }
+            inline      void                    Arrive          ( void )                                                            noexcept;
+
+            executor*                       m_pExecutor     { nullptr };
+            std::coroutine_handle<>         m_Handle        {};
+            std::atomic<bool>               m_bArrived      { false };
+            xerr                            m_Error         {};
+        };
+
+        //------------------------------------------------------------------------------
+        // co_await File.ReadAsync(View) / File.WriteAsync(View)
+        //------------------------------------------------------------------------------
+        struct request_awaiter : awaiter
+        {
+            constexpr static std::size_t cursor_v = ~std::size_t{ 0 };    // Use the cursor of the stream, moves it by what was transferred
+
+            inline                                  request_awaiter ( stream& Stream, std::span<std::byte> View, std::size_t Offset, bool bWrite ) noexcept
+                                                    : m_Stream{ Stream }, m_View{ View }, m_Offset{ Offset }, m_bWrite{ bWrite } {}
+            inline      bool                    await_suspend   ( std::coroutine_handle<> Handle )                                  noexcept;
+            inline      xerr                    await_resume    ( void )                                                            noexcept;
+
+            stream&                         m_Stream;
+            std::span<std::byte>            m_View;
+            std::size_t                     m_Offset;
+            bool                            m_bWrite;
+            bool                            m_bCursor       { false };
+            async_ticket                    m_Ticket        {};
+        };
+
+        //------------------------------------------------------------------------------
+        // co_await xfile::open_async(File, Path, Mode), the open runs in the thread pool
+        //------------------------------------------------------------------------------
+        struct open_awaiter : awaiter
+        {
+            inline                                  open_awaiter    ( stream& Stream, std::wstring_view Path, const char* pMode, executor* pExecutor ) noexcept
+                                                    : m_Stream{ Stream }, m_Path{ Path }, m_Mode{ pMode } { m_pExecutor = pExecutor; }
+                        bool                    await_suspend   ( std::coroutine_handle<> Handle )                                  noexcept;
+            inline      xerr                    await_resume    ( void )                                                            noexcept { return std::move(m_Error); }
+
+            stream&                         m_Stream;
+            std::wstring                    m_Path;
+            std::string                     m_Mode;
+        };
+    }
+
+    // Opens the file without blocking the coroutine, the result is the error of stream::open
+    inline details::open_awaiter open_async( stream& File, std::wstring_view Path, const char* pMode, executor* pExecutor = nullptr ) noexcept
+    {
+        return { File, Path, pMode, pExecutor };
+    }
+
+    //------------------------------------------------------------------------------
+    // Description:
+    //      One file being opened in the IO threads by open_async/open_batch. Until the request
+    //      is done its stream is pending: it must not be used, moved or destroyed, and neither
+    //      can the request. The callback (optional) is called by the IO thread that opened the
+    //      file, before the request is done, so Wait returns after it.
+    //------------------------------------------------------------------------------
+    struct open_request
+    {
+        using callback_fn = std::function<void(open_request& Request)>;
+
+        inline          bool                    isDone          ( void )                                                    const   noexcept { return m_bDone.load(std::memory_order_acquire); }
+        inline          xerr                    Wait            ( void )                                                            noexcept;   // The error of stream::open
+
+        stream*                             m_pStream       { nullptr };
+        std::wstring                        m_Path          {};
+        std::string                         m_Mode          {};
+        callback_fn                         m_Callback      {};
+        void*                               m_pUserData     { nullptr };
+        std::atomic<bool>                   m_bDone         { true };
+        xerr                                m_Error         {};
+    };
+
+    // Opens the file in an IO thread, File is pending until the request is done
+    void                    open_async              ( stream& File, std::wstring_view Path, const char* pMode, open_request& Request ) noexcept;
+
+    // Opens the streams of all the requests (m_pStream, m_Path and m_Mode filled by the caller) at the
+    // same time in the IO threads. Each request is done as soon as its own file is open.
+    void                    open_batch              ( std::span<open_request> Requests )                                noexcept;
+
     //------------------------------------------------------------------------------
     // Description:
     //      The stream class is design to be a direct replacement to the fopen. The class
@@ -133,7 +468,9 @@ namespace xfile
     //         "a" or "a+"    Reading and Writing       - the file must exists, and it will do an automatic SeekEnd(0). 
     //  
     //         "@"            Asynchronous Mode         - Allows you to use async features.
-    //         "c"            Enable File Compression   - (No Supported) This must be use with 'w'. It will compress at file close.
+    //         "c"            Enable File Compression   - This must be use with 'w'. The file is compressed in independent blocks as it is written
+    //                                                      so reading it back (and seeking) only decompresses the blocks touched.
+    //                                                      Compressed files are written sequentially and can not be modified after.
     //  
     //         "b"            Binary files Mode         - This is the default so you don't need to put it really. 
     //         "t"            Text file Mode            - For writing or Reading text files. If you don't add this assumes you are doing binary files.             
@@ -141,17 +478,40 @@ namespace xfile
     //                                                      when reading it removes it when it finds '\\r\\n'
     //         "T"            WIDE Text file Mode       - Similar to "t" except it works for unicode...
     //
+    //         "m"            Memory Mapped Mode        - Only for read only files. The device maps the file in memory so reads are just copies
+    //                                                      and MapView gives direct access to the bytes. Devices that can't do it ignore it.
+    //
     //</TABLE>
     //
+    //      Synchronous files are buffered by the stream (default_buffer_size_v bytes) so small reads and writes
+    //      do not reach the device one by one. The buffer is flushed on seek, Flush and close. Use setBufferSize
+    //      to change its size or setBufferSize(0) to turn it off. Async ("@") and mapped ("m") files are never buffered.
+    //
+    //      ReadAsync/WriteAsync make requests at any offset without moving the cursor, each one with
+    //      its own async_ticket, so many reads can overlap on the same file. Use Wait/Poll/Cancel on the
+    //      tickets. The bytes go as they are (no text translation). For real overlap open with "@".
+    //      Coroutines can co_await ReadAsync(View)/WriteAsync(View) and open_async, they are resumed by
+    //      the completion of the request (no polling) in the executor given to setExecutor.
+    //
+    //      ReadAt/WriteAt do the work right away at their own offset, they do not use or move the cursor
+    //      and any number of threads can call them at once on the same stream. They go straight to the
+    //      device: bytes still in the buffer of the stream are not seen (Flush first) and there is no
+    //      text translation. Devices that can not do it return NOT_SUPPORTED.
+    //
+    //      To read a whole file use LoadAll, it sizes the buffer itself and files bigger than parallel_load_v
+    //      are read by several threads at once. The bytes are loaded as they are in the file (no text translation).
+    //
     //      To illustrate different possible combinations and their meaning we put together a table 
     //      to show a few examples.
     //<TABLE>
     //     Examples of Modes  Description
     //     =================  ----------------------------------------------------------------------------------------
     //          "r"           Good old fashion read a file. Note that you never need to do "rc" as the file system detects that automatically.
+    //          "rc"          Same as "r" but fails if the file is not compressed.
     //          "wc"          Means that we want to write a compress file       
     //          "wc@"         Means to create a compress file and we are going to access it asynchronous
     //          "r+@"         Means that we are going to read and write to an already exiting file asynchronously.
+    //          "rm"          Means that we are going to read a file that is mapped in memory, use MapView to parse it in place.
     //</TABLE>
     //
     //     Other key change added was the ability to have more type of devices beyond the standard set.
@@ -161,7 +521,8 @@ namespace xfile
     //     Known devices      Description
     //     =================  ----------------------------------------------------------------------------------------
     //          c:\ d:\ e:\    ...etc local devices such PC drives
-    //          ram:\          (No Supported) To use ram as a file device
+    //          /              (posix) Local file system, paths without a device name also go here
+    //          ram:\          To use ram as a file device. Files are kept (by name) until deleteFile or the app ends
     //          temp:\         To the temporary folder/drive for the machine
     //          (WIP) dvd:\          (No Supported) To use the dvd system of the console
     //          (WIP) net:\          (No Supported) To access across the network
@@ -173,7 +534,7 @@ namespace xfile
     //     Example of open strings:
     //<CODE>
     //     open( L"net:\\\\c:\\test.txt",        "r" );      // Reads a file across the network
-    //     open( L"ram:\\\\name doesnt matter",  "w" );      // Creates a ram file which you can read/write
+    //     open( L"ram:\\\\scratch.bin",         "w" );      // Creates a ram file which you can read/write and reopen by name
     //     open( L"c:\\dumpfile.bin",            "wc" );     // Creates a compress file in you c: drive
     //     open( L"UseDefaultPath.txt",          "r@" );     // No device specify so it reads the file from the default path
     //</CODE>
@@ -181,14 +542,41 @@ namespace xfile
     //------------------------------------------------------------------------------
     struct stream
     {
+        // How the user-space buffer of the stream is being used
+        enum class buffer_mode : std::uint8_t
+        { NONE                                          // Empty, the device cursor is the stream cursor
+        , READ                                          // Holds data read ahead from the device
+        , WRITE                                         // Holds data that has not reached the device yet
+        };
+
+        constexpr static std::size_t default_buffer_size_v   = 64 * 1024;
+        constexpr static std::size_t sparse_fill_threshold_v = 64 * 1024;      // Zero fills this big let the device do it (holes, sparse files...)
+        constexpr static std::size_t copy_chunk_v            = 4 * 1024 * 1024; // Size of each of the two buffers used by ToFile
+        constexpr static std::size_t parallel_load_v         = 8 * 1024 * 1024; // LoadAll splits files at least this big between threads
+
+        // Called by ToFile after each piece gets copied
+        using progress_fn = std::function<void(std::uint64_t Done, std::uint64_t Total)>;
+
         constexpr                               stream          ( void )                                                            noexcept = default;
         constexpr                               stream          ( stream&& )                                                        noexcept;
         inline                                 ~stream          ( void )                                                            noexcept;
                         xerr                    open            ( const std::wstring_view FileName, const char* pMode)              noexcept;
                         void                    close           ( void )                                                            noexcept;
-        inline          xerr                    ToFile          ( stream& File )                                                    noexcept;
+                        xerr                    ToFile          ( stream& File, const progress_fn& Progress = {} )                  noexcept;
         inline          xerr                    ToMemory        ( std::span<std::byte> View )                                       noexcept;
+                        xerr                    LoadAll         ( buffer& Buffer )                                                  noexcept;
         inline          xerr                    Synchronize     ( bool bBlock )                                                     noexcept;
+        inline          xerr                    ReadAsync       ( async_ticket& Ticket, std::span<std::byte> View, std::size_t Offset )       noexcept;
+        inline          xerr                    WriteAsync      ( async_ticket& Ticket, std::span<const std::byte> View, std::size_t Offset ) noexcept;
+        inline          xerr                    Wait            ( async_ticket& Ticket )                                            noexcept;
+        inline          xerr                    Poll            ( async_ticket& Ticket )                                            noexcept;
+        inline          void                    Cancel          ( async_ticket& Ticket )                                            noexcept;
+
+        // co_await versions, without an offset they use the cursor (and move it). They resume in the executor.
+        inline          details::request_awaiter ReadAsync      ( std::span<std::byte> View, std::size_t Offset = details::request_awaiter::cursor_v )       noexcept;
+        inline          details::request_awaiter WriteAsync     ( std::span<const std::byte> View, std::size_t Offset = details::request_awaiter::cursor_v ) noexcept;
+        inline          void                    setExecutor     ( executor* pExecutor )                                             noexcept { m_pExecutor = pExecutor; }
+        inline          void                    setStats        ( stats::counters* pStats )                                         noexcept { m_pStats = pStats; }       // Also counts here (with XFILE_STATS)
         inline          void                    AsyncAbort      ( void )                                                            noexcept;
         inline          void                    setForceFlush   ( bool bOnOff)                                                      noexcept;
         inline          void                    Flush           ( void)                                                             noexcept;
@@ -201,7 +589,16 @@ namespace xfile
         inline          xerr                    getC            ( int& C )                                                          noexcept;
         inline          xerr                    putC            ( int C, int Count = 1, bool bUpdatePos = true)                     noexcept;
         inline          xerr                    AlignPutC       ( int C, int Count = 0, int Aligment = 4, bool bUpdatePos = true)   noexcept;
+                        xerr                    Fill            ( int C, std::size_t Count )                                        noexcept;
+                        xerr                    Skip            ( std::size_t Count )                                               noexcept;
         inline          xerr                    getFileLength   ( std::size_t& Length )                                             noexcept;
+                        xerr                    setBufferSize   ( std::size_t Bytes )                                               noexcept;
+        inline          xerr                    MapView         ( std::span<const std::byte>& View )                                noexcept;
+                        xerr                    ReadView        ( std::span<const std::byte>& View, std::size_t Count )             noexcept;
+                        xerr                    ReadV           ( std::span<const std::span<std::byte>> Views )                     noexcept;
+                        xerr                    WriteV          ( std::span<const std::span<const std::byte>> Views )               noexcept;
+        inline          xerr                    ReadAt          ( std::size_t Offset, std::span<std::byte> View )                   noexcept;
+        inline          xerr                    WriteAt         ( std::size_t Offset, std::span<const std::byte> View )             noexcept;
 
 
         inline          xerr                    ReadString      ( std::wstring& Val)                                                noexcept;
@@ -231,20 +628,44 @@ namespace xfile
         inline          bool                    isReadMode      ( void )                                                    const   noexcept;
         inline          bool                    isWriteMode     ( void )                                                    const   noexcept;
 
+        // std::format syntax, the format string is checked at compile time
         template<typename... T_ARGS>
-        inline          xerr                    Printf          ( const char* pFormatStr, const T_ARGS& ... Args )                  noexcept;
+        inline          xerr                    Printf          ( std::format_string<T_ARGS...> FormatStr, T_ARGS&& ... Args )      noexcept;
 
         template<typename... T_ARGS>
-        inline          xerr                    wPrintf         ( const wchar_t* pFormatStr, const T_ARGS& ... Args )               noexcept;
+        inline          xerr                    wPrintf         ( std::wformat_string<T_ARGS...> FormatStr, T_ARGS&& ... Args )     noexcept;
 
         void                                    Clear           ( void )                                                            noexcept;
         xerr                                    ReadRaw         (std::span<std::byte> View)                                         noexcept;
         xerr                                    WriteRaw        (std::span<const std::byte> View)                                   noexcept;
 
-        device::instance*           m_pInstance     { nullptr };
-        device::registration*       m_pDeviceReg    { nullptr };
-        device::access_types        m_AccessType    {};
-        std::wstring                m_FilePath      {};
+        // Device access through the stream buffer (below the text translation)
+        xerr                                    BufferedRead    (std::span<std::byte> View)                                         noexcept;
+        xerr                                    BufferedWrite   (std::span<const std::byte> View)                                   noexcept;
+        xerr                                    BufferedWriteV  (std::span<const std::span<const std::byte>> Views)                 noexcept;
+        xerr                                    BufferedSeek    (device::seek_mode Mode, std::size_t Pos)                           noexcept;
+        xerr                                    BufferedTell    (std::size_t& Pos)                                                  noexcept;
+        xerr                                    BeginBuffer     (buffer_mode Mode)                                                  noexcept;
+        xerr                                    WriteBuffer     (void)                                                              noexcept;
+        xerr                                    FlushBuffer     (void)                                                              noexcept;
+        void                                    CloseLayers     (void)                                                              noexcept;
+
+        device::instance*               m_pInstance     { nullptr };                // Top of the layers, what the stream talks to
+        device::instance*               m_pBaseInstance { nullptr };                // Instance of the device, same as m_pInstance when there are no layers
+        device::registration*           m_pDeviceReg    { nullptr };
+        device::access_types            m_AccessType    {};
+        std::wstring                    m_FilePath      {};
+        std::vector<std::byte>          m_Staging       {};                         // Used by ReadView when the device can not lend its memory
+        std::vector<std::byte>          m_Buffer        {};                         // User-space buffer, allocated on first use
+        std::size_t                     m_BufferSize    { default_buffer_size_v };  // Zero when the stream is not buffered
+        std::size_t                     m_BufferOffset  { 0 };                      // File offset of the first byte of the buffer
+        std::size_t                     m_BufferPos     { 0 };                      // Stream cursor inside the buffer
+        std::size_t                     m_BufferEnd     { 0 };                      // Bytes read ahead into the buffer (READ mode)
+        std::size_t                     m_CachedLength  { ~std::size_t{0} };        // File length, ~0 until we ask the device
+        buffer_mode                     m_BufferMode    { buffer_mode::NONE };
+        bool                            m_bAsyncLayer   { false };                  // m_pInstance is the async layer (always the top one)
+        executor*                       m_pExecutor     { nullptr };                // Where the coroutines waiting on this stream resume
+        stats::counters*                m_pStats        { nullptr };                // Counters of the user for this stream, the device has its own
     };
 }
 